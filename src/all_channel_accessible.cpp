@@ -1,12 +1,16 @@
+#include <algorithm> // For std::stable_sort
 #include <cstring>   // For std::strlen, std::strcpy, std::strrchr
 #include <iostream>  // For std::cerr
 #include <cstdio>    // For std::snprintf
+#include <numeric>   // For std::iota
 #include <string>
 #include <vector>
 
 #include "argument_helper.hpp"
 #include "pdb_io.hpp"
 #include "utils.hpp"   // For custom utility functions
+#include "utils-bitgrid.hpp"
+#include "utils-label.hpp"
 #include "vossvolvox_cli_common.hpp"
 #include "xyzr_cli_helpers.hpp"
 
@@ -66,10 +70,12 @@ void getDirname(char path[], char dir[]) {
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   vossvolvox::OutputSettings outputs;
   vossvolvox::DebugSettings debug;
+  vossvolvox::EngineSettings engine_opts;
   double BIGPROBE = 9.0;
   double SMPROBE = 1.5;
   double TRIMPROBE = 4.0;
@@ -128,7 +134,9 @@ int main(int argc, char *argv[]) {
                     "<count>");
   vossvolvox::add_output_options(parser, outputs);
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
   vossvolvox::add_debug_option(parser, debug);
+  vossvolvox::add_engine_option(parser, engine_opts);
   parser.add_example(
       "./AllChannel.exe -i 3hdi.xyzr -b 9.0 -s 1.5 -g 0.5 -t 4.0 -v 5000 -p 0.01 -n 1");
 
@@ -142,6 +150,11 @@ int main(int argc, char *argv[]) {
   if (!vossvolvox::ensure_input_present(input_path, parser)) {
     return 1;
   }
+
+  ExcludeEngine engine = ExcludeEngine::Stamp;
+  if (!vossvolvox::resolve_exclude_engine(engine_opts, engine)) {
+    return 1;
+  }
   if (grid_override > 0.0f) {
     GRID = grid_override;
   }
@@ -190,10 +203,11 @@ int main(int argc, char *argv[]) {
       input_path,
       false);
   const int numatoms = grid_result.total_atoms;
+  const GridContext& ctx = grid_result.context;
 
   // Print header information
   std::cerr << "Probe Radius: " << BIGPROBE << endl;
-  std::cerr << "Grid Spacing: " << GRID << endl;
+  std::cerr << "Grid Spacing: " << ctx.spacing << endl;
   std::cerr << "Resolution: " << format_resolution(1000.0L) << " voxels per A^3" << endl;
   std::cerr << "Resolution: " << format_resolution(11494.0L) << " voxels per water molecule" << endl;
   std::cerr << "Input file: " << file << endl;
@@ -202,10 +216,10 @@ int main(int argc, char *argv[]) {
   // ****************************************************
   // STARTING LARGE PROBE
   // ****************************************************
-  auto biggrid = make_zeroed_grid();
+  auto biggrid = make_zeroed_grid(ctx);
   int bigvox;
   if (BIGPROBE > 0.0) {
-    bigvox = get_ExcludeGrid_fromArray(numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
+    bigvox = get_ExcludeGrid_fromArray(ctx, engine, numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
   } else {
     std::cerr << "BIGPROBE <= 0" << endl;
     return 1;
@@ -226,34 +240,38 @@ int main(int argc, char *argv[]) {
   // ****************************************************
   // TRIM LARGE PROBE SURFACE
   // ****************************************************
-  auto trimgrid = make_zeroed_grid();
-  copyGrid(biggrid.get(), trimgrid.get());
-  trun_ExcludeGrid(TRIMPROBE, biggrid.get(), trimgrid.get());
+  auto trimbytes = make_zeroed_grid(ctx);
+  copyGrid(ctx, biggrid.get(), trimbytes.get());
+  trun_ExcludeGrid(ctx, engine, TRIMPROBE, biggrid.get(), trimbytes.get());
   biggrid.reset();
+  // keep the trimmed shell bit-packed, it is held for the rest of the run
+  BitGrid trimgrid = make_zeroed_bitgrid(ctx);
+  copyGrid(ctx, trimbytes.get(), trimgrid);
+  trimbytes.reset();
 
   //cout << "bg_prb\tsm_prb\tgrid\texcvol\tsurf\taccvol\tfile" << endl;
 
   // ****************************************************
   // STARTING SMALL PROBE
   // ****************************************************
-  auto smgrid = make_zeroed_grid();
+  auto smgrid = make_zeroed_grid(ctx);
   int smvox;
-  smvox = fill_AccessGrid_fromArray(numatoms, SMPROBE, xyzr_buffer, smgrid.get());
+  smvox = fill_AccessGrid_fromArray(ctx, numatoms, SMPROBE, xyzr_buffer, smgrid.get());
 
   // ****************************************************
   // GETTING ACCESSIBLE CHANNELS
   // ****************************************************
-  auto solventACC = make_zeroed_grid();
-  copyGrid(trimgrid.get(), solventACC.get()); //copy trimgrid into solventACC
-  subt_Grids(solventACC.get(), smgrid.get()); //modify solventACC
+  auto solventACC = make_zeroed_grid(ctx);
+  copyGrid(trimgrid, solventACC.get()); //copy trimgrid into solventACC
+  subt_Grids(ctx, solventACC.get(), smgrid.get()); //modify solventACC
   smgrid.reset();
 
   // ***************************************************
   // CALCULATE TOTAL SOLVENT
   // ***************************************************
-  auto solventEXC = make_zeroed_grid();
-  grow_ExcludeGrid(SMPROBE, solventACC.get(), solventEXC.get());
-  intersect_Grids(solventEXC.get(), trimgrid.get()); //modifies solventEXC
+  auto solventEXC = make_zeroed_grid(ctx);
+  grow_ExcludeGrid(ctx, engine, SMPROBE, solventACC.get(), solventEXC.get());
+  intersect_Grids(solventEXC.get(), trimgrid); //modifies solventEXC
   //snprintf(mrcfile, sizeof(mrcfile), "allsolvent.mrc");
   //writeMRCFile(solventEXC, mrcfile);
   solventEXC.reset();
@@ -262,80 +280,34 @@ int main(int argc, char *argv[]) {
   // SELECT PARTICULAR CHANNEL
   // ***************************************************
 
-  // initialize channel volume
-  auto channelACC = make_zeroed_grid();
-
-  //main channel loop
-  int numchannels=0;
-  int allchannels=0;
-  int connected;
-  int maxvox=0, minvox=1000000, goodminvox=1000000;
-  int solventACCvol = countGrid(solventACC.get()); // initialize origSolventACC volume
+  // ***************************************************
+  // LABEL ALL CHANNELS IN ONE PASS
+  // ***************************************************
+  int solventACCvol = countGrid(ctx, solventACC.get()); // initialize origSolventACC volume
+  std::vector<int> labels, sizes;
+  const int allchannels = label_Components(ctx, solventACC.get(), labels, sizes);
+  solventACC.reset();
+  std::cerr << "Found " << allchannels << " connected channels" << endl;
+
+  // largest channels first; equal sizes stay in grid order
+  std::vector<int> order(allchannels);
+  std::iota(order.begin(), order.end(), 1);
+  std::stable_sort(order.begin(), order.end(),
+                   [&sizes](const int a, const int b) { return sizes[a] > sizes[b]; });
 
   if (numchan > 0) {
-    if (DEBUG > 0)
-      std::cerr << "#######" << endl << "Starting NumChan Area" << endl
-      << "#######" << endl;
-    auto tempSolventACC = make_zeroed_grid();
-
-    // set up a list
+    // set the minsize to be one less than the numchan-th largest channel
     std::vector<int> vollist(numchan + 2, 0);
-
-    copyGrid(solventACC.get(), tempSolventACC.get()); // initialize tempSolventACC volume
-
-    short int insert;
-    while ( countGrid(tempSolventACC.get()) > MINSIZE ) {
-      // get channel volume
-      zeroGrid(channelACC.get()); // initialize channelACC volume
-
-      // get first available filled point
-      int gp = get_GridPoint(tempSolventACC.get());  //modify gp
-
-      if (DEBUG > 0) {
-        int tempSolventACCvol = countGrid(tempSolventACC.get());
-        std::cerr << "Temp Solvent Volume ..." << tempSolventACCvol << endl;
-      }
-
-      // get all connected volume to point
-      if (DEBUG > 0)
-        std::cerr << "Time to crash..." << endl;
-      connected = get_Connected_Point (tempSolventACC.get(), channelACC.get(), gp); //modify channelACC
-      if (DEBUG > 0)
-        std::cerr << "Connected voxel volume: " << connected << endl;
-
-      // remove channel from total solvent
-      subt_Grids(tempSolventACC.get(), channelACC.get()); //modify solventACC
-
-      // get volume
-      int channelACCvol = countGrid(channelACC.get());
-
-      // skip volume if it is too small
-      if (channelACCvol <= MINSIZE) {
-        continue;
-      }
-
-      std::cerr << "Channel volume: " << int(channelACCvol*GRIDVOL) << " Angstroms^3" << endl;
-
-      insert = 0;
-      for (int i=0; i<numchan+2 && !insert; i++) {
-        if (channelACCvol > 0 && channelACCvol > vollist[i]) {
-          // shift elements over
-          for (int j=numchan+2; j>i; j--) {
-            vollist[j] = vollist[j-1];
-          }
-          // insert new guy
-          vollist[i] = channelACCvol;
-          insert = 1;
-        }
+    for (int i=0; i<numchan+2 && i<allchannels; i++) {
+      if (sizes[order[i]] > MINSIZE) {
+        vollist[i] = sizes[order[i]];
       }
     }
     for (int i=0; i<numchan+2; i++) {
       std::cerr << "Vollist[] " << i << "\t" << vollist[i] << endl;
     }
-    // set the minsize to be one less than a channel of
     MINSIZE = vollist[numchan-1] - 1;
 
-    tempSolventACC.reset();
     if (MINSIZE < 10) {
       std::cerr << endl << "#######" << endl << "NO CHANNELS WERE FOUND" << endl
       << "#######" << endl;
@@ -343,43 +315,22 @@ int main(int argc, char *argv[]) {
     }
     std::cerr << "Setting minimum volume size in voxels (MINSIZE) to: "
     << MINSIZE << endl;
-    if (DEBUG > 0)
-      std::cerr << "#######" << endl << "Ending NumChan Area" << endl
-      << "#######" << endl;
   }
 
-  auto channelEXC = make_zeroed_grid();
-
-  while ( countGrid(solventACC.get()) > MINSIZE ) {
-    if (DEBUG > 0)
-      std::cerr << endl << "Loop: Solvent Volume (" << countGrid(solventACC.get())
-      << ") greater than MINSIZE (" << MINSIZE << ")" << endl << endl;
-    allchannels++;
-
-    // get channel volume
-    zeroGrid(channelACC.get()); // initialize channelACC volume
-
-    // get first available filled point
-    int gp = get_GridPoint(solventACC.get());  //return gp
-
-    if (DEBUG > 0) {
-      std::cerr << "Solvent Volume ... " << countGrid(solventACC.get()) << endl;
-      std::cerr << "Channel Volume ... " << countGrid(channelACC.get()) << endl;
-    }
-
-    if (DEBUG > 0)
-      std::cerr << "Time to crash..." << endl;
+  // ***************************************************
+  // SELECT PARTICULAR CHANNEL
+  // ***************************************************
 
-    // get all connected volume to point
-    connected = get_Connected_Point(solventACC.get(), channelACC.get(), gp); //modify channelACC
-    if (DEBUG > 0)
-      std::cerr << "Connected voxel volume: " << connected << endl;
+  // initialize channel volume
+  auto channelACC = make_zeroed_grid(ctx);
+  auto channelEXC = make_zeroed_grid(ctx);
 
-    // remove channel from total solvent
-    subt_Grids(solventACC.get(), channelACC.get()); //modify solventACC
+  //main channel loop
+  int numchannels=0;
+  int maxvox=0, minvox=1000000, goodminvox=1000000;
 
-    // initialize volume for excluded surface
-    int channelACCvol = copyGrid(channelACC.get(), channelEXC.get()); // initialize channelEXC volume
+  for (int n = 0; n < allchannels; n++) {
+    const int channelACCvol = sizes[order[n]];
 
     // statistics
     if (channelACCvol > maxvox)
@@ -391,24 +342,27 @@ int main(int argc, char *argv[]) {
     if (channelACCvol <= MINSIZE) {
       // print message if it is worth it
       if (channelACCvol > 20) {
-        std::cerr << "Skipping channel " << allchannels << ": "
-        << int(channelACCvol*GRIDVOL) << " Angstroms^3" << endl;
+        std::cerr << "Skipping channel " << n + 1 << ": "
+        << int(channelACCvol*ctx.gridvol) << " Angstroms^3" << endl;
       }
       continue;
     }
 
-    std::cerr << "Channel volume: " << int(channelACCvol*GRIDVOL) << " Angstroms^3" << endl;
+    std::cerr << "Channel volume: " << int(channelACCvol*ctx.gridvol) << " Angstroms^3" << endl;
 
     // statistics
     if (channelACCvol < goodminvox)
       goodminvox = channelACCvol;
     numchannels++;
 
+    // get channel volume
+    extract_Component(ctx, labels, order[n], channelACC.get());
+
     // get excluded surface
-    grow_ExcludeGrid(SMPROBE, channelACC.get(), channelEXC.get());
+    grow_ExcludeGrid(ctx, engine, SMPROBE, channelACC.get(), channelEXC.get());
 
     //limit growth to inside trimgrid
-    int chanvox = intersect_Grids(channelEXC.get(), trimgrid.get()); //modifies channelEXC
+    int chanvox = intersect_Grids(channelEXC.get(), trimgrid); //modifies channelEXC
 
     // output results
     if (DEBUG > 0)
@@ -420,21 +374,21 @@ int main(int argc, char *argv[]) {
       std::cerr << "MRC: " << mrcfile << " -- DIR: " << dirname << endl;
     snprintf(mrcfile, sizeof(mrcfile), "%schannel-%03d.mrc", dirname, numchannels);
 
-    printVolCout(chanvox);
+    printVolCout(ctx, chanvox);
     std::cerr << endl;
-    writeSmallMRCFile(channelEXC.get(), mrcfile);
+    writeSmallMRCFile(ctx, channelEXC.get(), mrcfile);
     //cerr << "---------------------------------------------" << endl;
   }
 
   if (numchannels == 0)
     goodminvox = 0;
-  std::cerr << "Channel min size: " << int(minvox*GRIDVOL) << " A (all) " << int(goodminvox*GRIDVOL) << " A (good)" << endl;
-  std::cerr << "Channel max size: " << int(maxvox*GRIDVOL) << " A " << endl;
+  std::cerr << "Channel min size: " << int(minvox*ctx.gridvol) << " A (all) " << int(goodminvox*ctx.gridvol) << " A (good)" << endl;
+  std::cerr << "Channel max size: " << int(maxvox*ctx.gridvol) << " A " << endl;
   std::cerr << "Used " << numchannels << " of " << allchannels << " channels" << endl;
   if (allchannels > 0) {
-    std::cerr << "Mean size: " << solventACCvol/float(allchannels)*GRIDVOL << " A " << endl;
+    std::cerr << "Mean size: " << solventACCvol/float(allchannels)*ctx.gridvol << " A " << endl;
   }
-  std::cerr << "Cutoff size: " << MINSIZE << " voxels :: "<< MINSIZE*GRIDVOL << " Angstroms" << endl;
+  std::cerr << "Cutoff size: " << MINSIZE << " voxels :: "<< MINSIZE*ctx.gridvol << " Angstroms" << endl;
   std::cerr << endl << "Program Completed Sucessfully" << endl << endl;
   return 0;
 };
@@ -1,11 +1,15 @@
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
+#include <numeric>
 #include <string>
 #include <vector>
 
 #include "argument_helper.hpp"
 #include "pdb_io.hpp"
 #include "utils.hpp"
+#include "utils-bitgrid.hpp"
+#include "utils-label.hpp"
 #include "vossvolvox_cli_common.hpp"
 #include "xyzr_cli_helpers.hpp"
 
@@ -15,6 +19,7 @@ extern float GRID, GRIDVOL;
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   vossvolvox::OutputSettings outputs;
@@ -70,6 +75,7 @@ int main(int argc, char *argv[]) {
                     "<fraction>");
   vossvolvox::add_output_options(parser, outputs);
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
   vossvolvox::add_debug_option(parser, debug);
   parser.add_example(
       "./AllChannelExc.exe -i 3hdi.xyzr -b 9.0 -s 1.5 -g 0.5 -t 4.0 -v 5000 -p 0.01");
@@ -118,10 +124,11 @@ int main(int argc, char *argv[]) {
       input_path,
       false);
   const int numatoms = grid_result.total_atoms;
+  const GridContext& ctx = grid_result.context;
 
   //HEADER CHECK
   cerr << "Probe Radius: " << BIGPROBE << endl;
-  cerr << "Grid Spacing: " << GRID << endl;
+  cerr << "Grid Spacing: " << ctx.spacing << endl;
   cerr << "Resolution:      " << format_resolution(1000.0L) << " voxels per A^3" << endl;
   cerr << "Resolution:      " << format_resolution(11494.0L) << " voxels per water molecule" << endl;
   cerr << "Input file:   " << input_path << endl;
@@ -130,10 +137,10 @@ int main(int argc, char *argv[]) {
   // ****************************************************
   // STARTING LARGE PROBE
   // ****************************************************
-  auto biggrid = make_zeroed_grid();
+  auto biggrid = make_zeroed_grid(ctx);
   int bigvox;
   if(BIGPROBE > 0.0) {
-    bigvox = get_ExcludeGrid_fromArray(numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
+    bigvox = get_ExcludeGrid_fromArray(ctx, numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
   } else {
     cerr << "BIGPROBE <= 0" << endl;
     return 1;
@@ -149,67 +156,70 @@ int main(int argc, char *argv[]) {
   // ****************************************************
   // TRIM LARGE PROBE SURFACE
   // ****************************************************
-  auto trimgrid = make_zeroed_grid();
-  copyGrid(biggrid.get(), trimgrid.get());
-  trun_ExcludeGrid(TRIMPROBE, biggrid.get(), trimgrid.get());
+  auto trimbytes = make_zeroed_grid(ctx);
+  copyGrid(ctx, biggrid.get(), trimbytes.get());
+  trun_ExcludeGrid(ctx, TRIMPROBE, biggrid.get(), trimbytes.get());
   biggrid.reset();
+  // keep the trimmed shell bit-packed, it is held for the rest of the run
+  BitGrid trimgrid = make_zeroed_bitgrid(ctx);
+  copyGrid(ctx, trimbytes.get(), trimgrid);
+  trimbytes.reset();
 
   //cout << "bg_prb\tsm_prb\tgrid\texcvol\tsurf\taccvol\tfile" << endl;
 
   // ****************************************************
   // STARTING SMALL PROBE
   // ****************************************************
-  auto smgrid = make_zeroed_grid();
+  auto smgrid = make_zeroed_grid(ctx);
   int smvox;
-  smvox = fill_AccessGrid_fromArray(numatoms, SMPROBE, xyzr_buffer, smgrid.get());
+  smvox = fill_AccessGrid_fromArray(ctx, numatoms, SMPROBE, xyzr_buffer, smgrid.get());
 
   // ****************************************************
   // GETTING ACCESSIBLE CHANNELS
   // ****************************************************
-  auto solventACC = make_zeroed_grid();
-  copyGrid(trimgrid.get(), solventACC.get()); //copy trimgrid into solventACC
-  subt_Grids(solventACC.get(), smgrid.get()); //modify solventACC
+  auto solventACC = make_zeroed_grid(ctx);
+  copyGrid(trimgrid, solventACC.get()); //copy trimgrid into solventACC
+  subt_Grids(ctx, solventACC.get(), smgrid.get()); //modify solventACC
   smgrid.reset();
 
 
 // ***************************************************
 // CALCULATE TOTAL SOLVENT
 // ***************************************************
-  auto solventEXC = make_zeroed_grid();
-  grow_ExcludeGrid(SMPROBE, solventACC.get(), solventEXC.get());
-  intersect_Grids(solventEXC.get(), trimgrid.get()); //modifies solventEXC
+  auto solventEXC = make_zeroed_grid(ctx);
+  grow_ExcludeGrid(ctx, SMPROBE, solventACC.get(), solventEXC.get());
+  intersect_Grids(solventEXC.get(), trimgrid); //modifies solventEXC
   const std::string solvent_output = outputs.mrcFile.empty() ? "allsolvent.mrc" : outputs.mrcFile;
-  writeMRCFile(solventEXC.get(), const_cast<char*>(solvent_output.c_str()));
+  writeMRCFile(ctx, solventEXC.get(), const_cast<char*>(solvent_output.c_str()));
   solventACC.reset();
 
 // ***************************************************
 // SELECT PARTICULAR CHANNEL
 // ***************************************************
 
+  // label all channels in one pass, largest first; equal sizes stay in grid order
+  int solventEXCvol = countGrid(ctx, solventEXC.get());
+  std::vector<int> labels, sizes;
+  const int allchannels = label_Components(ctx, solventEXC.get(), labels, sizes);
+  solventEXC.reset();
+  std::vector<int> order(allchannels);
+  std::iota(order.begin(), order.end(), 1);
+  std::stable_sort(order.begin(), order.end(),
+                   [&sizes](const int a, const int b) { return sizes[a] > sizes[b]; });
+
   // initialize channel volume
-  auto channelEXC = make_zeroed_grid();
-  int solventEXCvol = countGrid(solventEXC.get());
+  auto channelEXC = make_zeroed_grid(ctx);
   //main channel loop
   int numchannels=0;
-  int allchannels=0;
-  int connected;
   int maxvox=0, minvox=1000000, goodminvox=1000000;
   cerr << "MIN SIZE: " << MINSIZE << " voxels" << endl;
-  cerr << "MIN SIZE: " << MINSIZE*GRIDVOL << " Angstroms" << endl;
-
-  while ( countGrid(solventEXC.get()) > MINSIZE ) {
-    allchannels++;
-
-    // get channel volume
-    zeroGrid(channelEXC.get()); // initialize channelEXC volume
-    int gp = get_GridPoint(solventEXC.get());  //modify x,y,z
-    connected = get_Connected_Point(solventEXC.get(), channelEXC.get(), gp); //modify channelEXC
-    subt_Grids(solventEXC.get(), channelEXC.get()); //modify solventEXC
+  cerr << "MIN SIZE: " << MINSIZE*ctx.gridvol << " Angstroms" << endl;
 
+  for (int n = 0; n < allchannels; n++) {
     // ***************************************************
     // GETTING CONTACT CHANNEL
     // ***************************************************
-    int chanEXC_voxels = countGrid(channelEXC.get()); // initialize channelEXC volume
+    int chanEXC_voxels = sizes[order[n]];
     if (chanEXC_voxels > maxvox)
       maxvox = chanEXC_voxels;
     if (chanEXC_voxels < minvox and chanEXC_voxels > 0)
@@ -223,29 +233,30 @@ int main(int argc, char *argv[]) {
       goodminvox = chanEXC_voxels;
 
     numchannels++;
+    extract_Component(ctx, labels, order[n], channelEXC.get());
 
     // ***************************************************
     // OUTPUT RESULTS
     // ***************************************************
-    cout << BIGPROBE << "\t" << SMPROBE << "\t" << GRID << "\t" << flush;
-    printVolCout(chanEXC_voxels);
-    long double surf = surface_area(channelEXC.get());
+    cout << BIGPROBE << "\t" << SMPROBE << "\t" << ctx.spacing << "\t" << flush;
+    printVolCout(ctx, chanEXC_voxels);
+    long double surf = surface_area(ctx, channelEXC.get());
     cout << "\t" << surf << "\t" << flush;
     cout << "\t#" << input_path << endl;
     char channel_file[64];
     std::snprintf(channel_file, sizeof(channel_file), "channel-%03d.mrc", numchannels);
-    writeSmallMRCFile(channelEXC.get(), channel_file);
+    writeSmallMRCFile(ctx, channelEXC.get(), channel_file);
     cerr << "---------------------------------------------" << endl;
   }
   if (numchannels == 0)
     goodminvox = 0;
-  cerr << "Channel min size: " << int(minvox*GRIDVOL) << " A (all) " << int(goodminvox*GRIDVOL) << " A (good)" << endl;
-  cerr << "Channel max size: " << int(maxvox*GRIDVOL) << " A " << endl;
+  cerr << "Channel min size: " << int(minvox*ctx.gridvol) << " A (all) " << int(goodminvox*ctx.gridvol) << " A (good)" << endl;
+  cerr << "Channel max size: " << int(maxvox*ctx.gridvol) << " A " << endl;
   cerr << "Used " << numchannels << " of " << allchannels << " channels" << endl;
   if (allchannels > 0) {
-    cerr << "Mean size: " << solventEXCvol/float(allchannels)*GRIDVOL << " A " << endl;
+    cerr << "Mean size: " << solventEXCvol/float(allchannels)*ctx.gridvol << " A " << endl;
   }
-  cerr << "Cutoff size: " << MINSIZE << " voxels :: "<< MINSIZE*GRIDVOL << " Angstroms" << endl;
+  cerr << "Cutoff size: " << MINSIZE << " voxels :: "<< MINSIZE*ctx.gridvol << " Angstroms" << endl;
   cerr << endl << "Program Completed Sucessfully" << endl << endl;
   return 0;
 };
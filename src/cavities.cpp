@@ -1,36 +1,110 @@
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <streambuf>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "argument_helper.hpp"
+#include "batch_scheduler.hpp"
 #include "pdb_io.hpp"
 #include "utils.hpp"
+#include "utils-bitgrid.hpp"
+#include "utils-checkpoint.hpp"
 #include "vossvolvox_cli_common.hpp"
 #include "xyzr_cli_helpers.hpp"
 
 // Globals
 extern float GRID;
 
-int getCavitiesBothMeth(const float probe,
+// Peak bytes per voxel of processStructure: the accessible shell (reused
+// as the inverse access map), the access map, and the grids of both
+// concurrent branches of getCavitiesBothMeth, each with its
+// distance-transform scratch
+const double CAVITIES_BYTES_PER_VOXEL = 15;
+
+// Voxel counts of the accessible method (cavities grown back from the
+// probe's accessible space), and where its channel search started
+struct AccessibleCavities {
+  int achanACC_voxels = 0;
+  int chanACC_voxels = 0;
+  int cavACC_voxels = 0;
+  int scavACC_voxels = 0;
+  int ecavACC_voxels = 0;
+  int firstpt = 0;
+  int lastpt = 0;
+};
+
+// Voxel counts and surface of the excluded method (cavities of the probe's
+// excluded surface), and where its channel search started
+struct ExcludedCavities {
+  int echanEXC_voxels = 0;
+  int chanEXC_voxels = 0;
+  int cavEXC_voxels = 0;
+  long double surfEXC = 0;
+  int firstpt = 0;
+  int lastpt = 0;
+};
+
+int getCavitiesBothMeth(const GridContext& ctx,
+                        const float probe,
                         gridpt shellACC[],
-                        gridpt shellEXC[],
+                        const BitGrid& shellEXC,
                         const int natoms,
                         const XYZRBuffer& xyzr_buffer,
                         const std::string& input_label,
-                        const vossvolvox::OutputSettings& outputs);
+                        const vossvolvox::OutputSettings& outputs,
+                        ExcludeEngine engine,
+                        const int frame);
+void run_branches(const std::function<void()>& first, const std::function<void()>& second);
+AccessibleCavities accessibleBranch(const GridContext& ctx,
+                                    const float probe,
+                                    gridpt cavACC[],
+                                    const BitGrid& shellEXC,
+                                    ExcludeEngine engine);
+ExcludedCavities excludedBranch(const GridContext& ctx,
+                                const float probe,
+                                std::unique_ptr<gridpt[]> access,
+                                const BitGrid& shellEXC,
+                                ExcludeEngine engine,
+                                const vossvolvox::OutputSettings& outputs);
+void processStructure(const GridContext& ctx,
+                      const XYZRBuffer& xyzr_buffer,
+                      const int numatoms,
+                      const double shell_rad,
+                      const double probe_rad,
+                      const std::string& input_label,
+                      const vossvolvox::OutputSettings& outputs,
+                      ExcludeEngine engine,
+                      const vossvolvox::CheckpointSettings& checkpoint,
+                      gridpt shellACC[],
+                      BitGrid& shellEXC,
+                      const int frame);
 
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   vossvolvox::OutputSettings outputs;
   vossvolvox::DebugSettings debug;
+  vossvolvox::EngineSettings engine_opts;
   double shell_rad = 10.0;
   double probe_rad = 3.0;
   double trim_rad = 3.0;
   float grid = GRID;
   vossvolvox::FilterSettings filters;
+  vossvolvox::CheckpointSettings checkpoint;
+  vossvolvox::FrameSettings frames;
+  vossvolvox::BatchSettings batch_settings;
 
   vossvolvox::ArgumentParser parser(
       argv[0],
@@ -62,8 +136,14 @@ int main(int argc, char *argv[]) {
                     "<grid spacing>");
   vossvolvox::add_output_options(parser, outputs);
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
   vossvolvox::add_debug_option(parser, debug);
+  vossvolvox::add_engine_option(parser, engine_opts);
+  vossvolvox::add_checkpoint_option(parser, checkpoint);
+  vossvolvox::add_frame_options(parser, frames);
+  vossvolvox::add_batch_options(parser, batch_settings);
   parser.add_example("./Cavities.exe -i 1a01.xyzr -b 10 -s 3 -t 3 -g 0.5 -o cavities.pdb");
+  parser.add_example("./Cavities.exe -i @structures.txt -b 10 -s 3 -t 3 -g 0.5 --jobs 0");
 
   const auto parse_result = parser.parse(argc, argv);
   if (parse_result == vossvolvox::ArgumentParser::ParseResult::HelpRequested) {
@@ -76,6 +156,11 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  ExcludeEngine engine = ExcludeEngine::Stamp;
+  if (!vossvolvox::resolve_exclude_engine(engine_opts, engine)) {
+    return 1;
+  }
+
   vossvolvox::enable_debug(debug);
   vossvolvox::debug_report_cli(input_path, &outputs);
 
@@ -87,183 +172,415 @@ int main(int argc, char *argv[]) {
   }
 
   const auto convert_options = vossvolvox::make_conversion_options(filters);
-  XYZRBuffer xyzr_buffer;
-  if (!vossvolvox::load_xyzr_or_exit(input_path, convert_options, xyzr_buffer)) {
+  vossvolvox::InputBatch batch;
+  if (!batch.open(input_path)) {
     return 1;
   }
-  const std::vector<const XYZRBuffer*> buffers = {&xyzr_buffer};
-  const auto grid_result = vossvolvox::prepare_grid_from_xyzr(
-      buffers,
-      grid,
-      static_cast<float>(shell_rad * 2),
-      input_path,
-      false);
-  const int numatoms = grid_result.total_atoms;
-
+  if (vossvolvox::frames_requested(frames)) {
+    if (batch.is_list()) {
+      cerr << "Error: --models and --trajectory take a single input, not a list" << endl;
+      return 1;
+    }
+    // Every frame runs on one union-bounds grid, reusing the shell grids
+    vossvolvox::FrameStream stream;
+    vossvolvox::GridPrepResult grid_result;
+    if (!stream.open(frames, input_path, convert_options) ||
+        !stream.prepare_grid(grid, static_cast<float>(shell_rad * 2), input_path, grid_result)) {
+      return 1;
+    }
+    const auto frame_outputs = vossvolvox::drop_grid_outputs(outputs, "frames");
+    auto shellACC = make_zeroed_grid(grid_result.context);
+    BitGrid shellEXC = make_zeroed_bitgrid(grid_result.context);
+    XYZRBuffer frame;
+    while (stream.next(frame)) {
+      processStructure(grid_result.context, frame, stream.atoms(), shell_rad, probe_rad,
+                       input_path, frame_outputs, engine, checkpoint, shellACC.get(), shellEXC,
+                       stream.frame());
+    }
+    if (stream.failed()) {
+      return 1;
+    }
+    cerr << endl << "Program Completed Sucessfully" << endl << endl;
+    return 0;
+  }
+  const auto batch_outputs =
+      batch.is_list() ? vossvolvox::drop_grid_outputs(outputs, "input lists") : outputs;
+
+  // Each process running inputs keeps one shell grid, reallocated only when
+  // the next structure's grid does not fit in it
+  GridBuffer shellACC;
+  vossvolvox::BatchScheduler scheduler(
+      batch.is_list() ? batch_settings : vossvolvox::BatchSettings(),
+      CAVITIES_BYTES_PER_VOXEL,
+      [&](const std::string& path, const XYZRBuffer& atoms,
+          const vossvolvox::GridPrepResult& prepared) {
 // ****************************************************
 // INITIALIZATION
 // ****************************************************
 //HEADER CHECK
-  cerr << "Grid Spacing: " << GRID << endl;
-  cerr << "Input file:   " << input_path << endl;
+        cerr << "Grid Spacing: " << prepared.context.spacing << endl;
+        cerr << "Input file:   " << path << endl;
 // ****************************************************
 // STARTING FILE READ-IN
 // ****************************************************
 
-  auto shellACC = make_zeroed_grid();
-  fill_AccessGrid_fromArray(numatoms, shell_rad, xyzr_buffer, shellACC.get());
-  fill_cavities(shellACC.get());
-
-  auto shellEXC = make_zeroed_grid();
-  trun_ExcludeGrid(shell_rad, shellACC.get(), shellEXC.get());
+        BitGrid shellEXC = make_zeroed_bitgrid(prepared.context);
+        processStructure(prepared.context, atoms, prepared.total_atoms, shell_rad, probe_rad,
+                         path, batch_outputs, engine, checkpoint,
+                         shellACC.zeroed(prepared.context), shellEXC, 0);
+      });
+  XYZRBuffer xyzr_buffer;
+  vossvolvox::GridPrepResult grid_result;
+  while (batch.next(convert_options, grid, static_cast<float>(shell_rad * 2), xyzr_buffer,
+                    grid_result)) {
+    scheduler.submit(batch.path(), xyzr_buffer, grid_result);
+  }
+  if (scheduler.finish() + batch.failures() > 0) {
+    return 1;
+  }
 
 // ****************************************************
-// STARTING MAIN PROGRAM
+// CLEAN UP AND QUIT
 // ****************************************************
 
-  getCavitiesBothMeth(probe_rad,
-                      shellACC.get(),
-                      shellEXC.get(),
-                      numatoms,
-                      xyzr_buffer,
-                      input_path,
-                      outputs);
+  cerr << endl << "Program Completed Sucessfully" << endl << endl;
+  return 0;
+};
+
+void processStructure(const GridContext& ctx,
+                      const XYZRBuffer& xyzr_buffer,
+                      const int numatoms,
+                      const double shell_rad,
+                      const double probe_rad,
+                      const std::string& input_label,
+                      const vossvolvox::OutputSettings& outputs,
+                      ExcludeEngine engine,
+                      const vossvolvox::CheckpointSettings& checkpoint,
+                      gridpt shellACC[],
+                      BitGrid& shellEXC,
+                      const int frame)
+{
+  // the shell depends only on the atoms, grid, and shell radius
+  const uint64_t shell_key = checkpoint_Key(ctx, xyzr_buffer, {shell_rad});
+  const std::string shellACC_path = vossvolvox::checkpoint_path(checkpoint, "shellACC", shell_key);
+  const std::string shellEXC_path = vossvolvox::checkpoint_path(checkpoint, "shellEXC", shell_key);
+
+  auto shellEXCbytes = make_zeroed_grid(ctx);
+  if (load_GridCheckpoint(ctx, shellACC_path, shell_key, shellACC) != 1 ||
+      load_GridCheckpoint(ctx, shellEXC_path, shell_key, shellEXCbytes.get()) != 1) {
+    zeroGrid(ctx, shellACC);
+    zeroGrid(ctx, shellEXCbytes.get());
+    fill_AccessGrid_fromArray(ctx, numatoms, shell_rad, xyzr_buffer, shellACC);
+    fill_cavities(ctx, shellACC);
+    trun_ExcludeGrid(ctx, engine, shell_rad, shellACC, shellEXCbytes.get());
+    save_GridCheckpoint(ctx, shellACC, shell_key, shellACC_path);
+    save_GridCheckpoint(ctx, shellEXCbytes.get(), shell_key, shellEXC_path);
+  }
+  // the shell is read-only from here on, so hold it bit-packed
+  copyGrid(ctx, shellEXCbytes.get(), shellEXC);
+  shellEXCbytes.reset();
 
 // ****************************************************
-// CLEAN UP AND QUIT
+// STARTING MAIN PROGRAM
 // ****************************************************
 
-  cerr << endl << "Program Completed Sucessfully" << endl << endl;
-  return 0;
+  getCavitiesBothMeth(ctx,
+                      probe_rad,
+                      shellACC,
+                      shellEXC,
+                      numatoms,
+                      xyzr_buffer,
+                      input_label,
+                      outputs,
+                      engine,
+                      frame);
 };
 
-int getCavitiesBothMeth(const float probe,
+int getCavitiesBothMeth(const GridContext& ctx,
+                        const float probe,
                         gridpt shellACC[],
-                        gridpt shellEXC[],
+                        const BitGrid& shellEXC,
                         const int natoms,
                         const XYZRBuffer& xyzr_buffer,
                         const std::string& input_label,
-                        const vossvolvox::OutputSettings& outputs)
+                        const vossvolvox::OutputSettings& outputs,
+                        ExcludeEngine engine,
+                        const int frame)
 {
 /* THIS USES THE ACCESSIBLE SHELL AS THE BIG SURFACE */
 /*******************************************************
-Accessible Process
+Stage graph: the probe access map is made once and both methods start
+from it; after that they only read the shell, so they run at once.
+
+  access --> cavACC --> accessible branch --+
+        \                                   +--> report
+         +--> excluded branch --------------+
 *******************************************************/
 
 //Create access map
-  auto access = make_zeroed_grid();
-  fill_AccessGrid_fromArray(natoms, probe, xyzr_buffer, access.get());
+  auto access = make_zeroed_grid(ctx);
+  fill_AccessGrid_fromArray(ctx, natoms, probe, xyzr_buffer, access.get());
 
-//Create inverse access map
-  auto cavACC = make_zeroed_grid();
-  copyGrid(shellACC, cavACC.get());
-  subt_Grids(cavACC.get(), access.get()); //modifies cavACC
-  access.reset();
-  int achanACC_voxels = countGrid(cavACC.get());
+//Create inverse access map in place; the shell is not needed after this
+  gridpt* cavACC = shellACC;
+  subt_Grids(ctx, cavACC, access.get()); //modifies cavACC
+
+  AccessibleCavities acc;
+  ExcludedCavities exc;
+  run_branches(
+      [&]() { acc = accessibleBranch(ctx, probe, cavACC, shellEXC, engine); },
+      [&]() { exc = excludedBranch(ctx, probe, std::move(access), shellEXC, engine, outputs); });
+
+  cerr << "FIRST POINT: " << acc.firstpt << endl;
+  cerr << "LAST  POINT: " << acc.lastpt << endl;
+  cerr << "FIRST POINT: " << exc.firstpt << endl;
+  cerr << "LAST  POINT: " << exc.lastpt << endl;
+  report_grid_metrics(ctx, std::cerr, exc.cavEXC_voxels, exc.surfEXC);
+
+  cerr << endl;
+  cerr << "achanACC_voxels = " << acc.achanACC_voxels << endl
+       << "chanACC_voxels  = " << acc.chanACC_voxels << endl
+       << "cavACC_voxels   = " << acc.cavACC_voxels << endl
+       << "scavACC_voxels  = " << acc.scavACC_voxels << endl
+       << "-------------------------------------" << endl
+       << "ecavACC_voxels  = " << acc.ecavACC_voxels << endl << endl;
+  cerr << "echanEXC_voxels = " << exc.echanEXC_voxels << endl
+       << "chanEXC_voxels  = " << exc.chanEXC_voxels << endl
+       << "-------------------------------------" << endl
+       << "cavEXC_voxels   = " << exc.cavEXC_voxels << endl << endl << endl;
+  // printVolCout leaves cout in fixed notation; restore it for the next frame
+  const auto cout_flags = cout.flags();
+  const auto cout_precision = cout.precision();
+  cout << probe << "\t" << ctx.spacing << "\t" ;
+  printVolCout(ctx, acc.ecavACC_voxels);
+  cout << "\t";
+  printVolCout(ctx, exc.cavEXC_voxels);
+  //cout << "\t\t";
+  //printVolCout(acc.scavACC_voxels);
+  //cout << "\t";
+  //printVolCout(acc.cavACC_voxels);
+  cout << "\t" << natoms;
+  if (frame > 0) {
+    cout << "\t" << frame << "\t" << input_label;
+    cout << "\tprobe,grid,cav_meth1,cav_meth2,num_atoms,frame,file";
+  } else {
+    cout << "\t" << input_label;
+    cout << "\tprobe,grid,cav_meth1,cav_meth2,num_atoms,file";
+  }
+  cout << endl;
+  cout.flags(cout_flags);
+  cout.precision(cout_precision);
+
+//  float perACC = 100*float(tunnACC_voxels) / float(chanACC_voxels);
+//  float perEXC = 100*float(tunnEXC_voxels) / float(chanEXC_voxels);
+
+  return acc.cavACC_voxels+acc.ecavACC_voxels;
+};
+
+static int available_threads()
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+static void set_threads(const int threads)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#else
+  (void)threads;
+#endif
+}
+
+// While the branches run, std::cerr goes through this buffer: what a branch
+// thread writes is kept in that branch's log, and anything else (another
+// thread's message) passes straight through to the original buffer.
+class BranchLogBuffer : public std::streambuf {
+ public:
+  explicit BranchLogBuffer(std::streambuf* target) : target_(target) {}
+
+  static thread_local std::string* log;
+
+ protected:
+  int_type overflow(int_type ch) override
+  {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+      return traits_type::not_eof(ch);
+    }
+    if (log != nullptr) {
+      log->push_back(traits_type::to_char_type(ch));
+      return ch;
+    }
+    return target_->sputc(traits_type::to_char_type(ch));
+  }
+
+  std::streamsize xsputn(const char* text, std::streamsize count) override
+  {
+    if (log != nullptr) {
+      log->append(text, static_cast<std::size_t>(count));
+      return count;
+    }
+    return target_->sputn(text, count);
+  }
+
+  int sync() override
+  {
+    return log != nullptr ? 0 : target_->pubsync();
+  }
+
+ private:
+  std::streambuf* target_;
+};
+
+thread_local std::string* BranchLogBuffer::log = nullptr;
+
+// Runs two stages that share only read-only inputs at the same time, each
+// with a share of the OpenMP threads, and returns when both are done. Their
+// progress messages are held back and printed after the join, the first
+// branch's before the second's, as if they had run one after the other.
+void run_branches(const std::function<void()>& first, const std::function<void()>& second)
+{
+  // Without a second core the branches would only take turns
+  if (std::thread::hardware_concurrency() < 2) {
+    first();
+    second();
+    return;
+  }
+  // Split this thread's OpenMP team between the branches
+  const int threads = available_threads();
+  const int first_threads = threads > 1 ? threads / 2 : 1;
+  const int second_threads = threads > 1 ? threads - first_threads : 1;
+  std::string first_log;
+  std::string second_log;
+  BranchLogBuffer branch_logs(std::cerr.rdbuf());
+  std::streambuf* saved = std::cerr.rdbuf(&branch_logs);
+  const auto print_logs = [&]() {
+    std::cerr.rdbuf(saved);
+    std::cerr << first_log << second_log << std::flush;
+  };
+  std::future<void> first_done;
+  try {
+    first_done = std::async(std::launch::async, [&]() {
+      BranchLogBuffer::log = &first_log;
+      set_threads(first_threads);
+      try {
+        first();
+      } catch (...) {
+        BranchLogBuffer::log = nullptr;
+        throw;
+      }
+      BranchLogBuffer::log = nullptr;
+    });
+  } catch (const std::system_error&) {
+    std::cerr.rdbuf(saved);
+    first();
+    second();
+    return;
+  }
+  set_threads(second_threads);
+  BranchLogBuffer::log = &second_log;
+  try {
+    second();
+  } catch (...) {
+    BranchLogBuffer::log = nullptr;
+    set_threads(threads);
+    first_done.wait();
+    print_logs();
+    throw;
+  }
+  BranchLogBuffer::log = nullptr;
+  set_threads(threads);
+  first_done.wait();
+  print_logs();
+  first_done.get();
+}
+
+AccessibleCavities accessibleBranch(const GridContext& ctx,
+                                    const float probe,
+                                    gridpt cavACC[],
+                                    const BitGrid& shellEXC,
+                                    ExcludeEngine engine)
+{
+/*******************************************************
+Accessible Process
+*******************************************************/
+  AccessibleCavities result;
+  result.achanACC_voxels = countGrid(ctx, cavACC);
 
 // EXTRA STEPS TO REMOVE SURFACE CAVITIES???
 
 //Get first point
-  int firstpt = first_filled_point(cavACC.get());
-  cerr << "FIRST POINT: " << firstpt << endl;
+  result.firstpt = first_filled_point(ctx, cavACC);
 //LAST POINT
-  int lastpt = last_filled_point(cavACC.get());
-  cerr << "LAST  POINT: " << lastpt << endl;
+  result.lastpt = last_filled_point(ctx, cavACC);
 //  get_Connected_Point(cavACC,chanACC,lastpt);
 
-
 //Pull channels out of inverse access map
-  auto chanACC = make_zeroed_grid();
-  cerr << "Getting Connected Next" << endl;
-  get_Connected_Point(cavACC.get(), chanACC.get(), firstpt); //modifies chanACC
-  get_Connected_Point(cavACC.get(), chanACC.get(), lastpt); //modifies chanACC
-  int chanACC_voxels = countGrid(chanACC.get());
+  auto chanACC = make_zeroed_grid(ctx);
+  get_Connected_Point(ctx, cavACC, chanACC.get(), result.firstpt); //modifies chanACC
+  get_Connected_Point(ctx, cavACC, chanACC.get(), result.lastpt); //modifies chanACC
+  result.chanACC_voxels = countGrid(ctx, chanACC.get());
 //Subtract channels from access map leaving cavities
-  subt_Grids(cavACC.get(), chanACC.get()); //modifies cavACC
+  subt_Grids(ctx, cavACC, chanACC.get()); //modifies cavACC
   chanACC.reset();
-  int cavACC_voxels = countGrid(cavACC.get());
+  result.cavACC_voxels = countGrid(ctx, cavACC);
 
 //Grow Access Cavs
-  auto ecavACC = make_zeroed_grid();
-  grow_ExcludeGrid(probe, cavACC.get(), ecavACC.get());
-  cavACC.reset();
+  auto ecavACC = make_zeroed_grid(ctx);
+  grow_ExcludeGrid(ctx, engine, probe, cavACC, ecavACC.get());
 
 //Intersect Grown Access Cavities with Shell
-  int scavACC_voxels = countGrid(ecavACC.get());
-  int ecavACC_voxels = intersect_Grids(ecavACC.get(), shellEXC); //modifies ecavACC
+  result.scavACC_voxels = countGrid(ctx, ecavACC.get());
+  result.ecavACC_voxels = intersect_Grids(ecavACC.get(), shellEXC); //modifies ecavACC
 
   //float surfEXC = surface_area(ecavACC);
-  ecavACC.reset();
-
+  return result;
+}
+
+ExcludedCavities excludedBranch(const GridContext& ctx,
+                                const float probe,
+                                std::unique_ptr<gridpt[]> access,
+                                const BitGrid& shellEXC,
+                                ExcludeEngine engine,
+                                const vossvolvox::OutputSettings& outputs)
+{
 /*******************************************************
 Excluded Process
 *******************************************************/
-
-//Create access map
-  auto access2 = make_zeroed_grid();
-  fill_AccessGrid_fromArray(natoms, probe, xyzr_buffer, access2.get());
+  ExcludedCavities result;
 
 //Create exclude map
-  auto exclude = make_zeroed_grid();
-  trun_ExcludeGrid(probe, access2.get(), exclude.get());
-  access2.reset();
+  auto exclude = make_zeroed_grid(ctx);
+  trun_ExcludeGrid(ctx, engine, probe, access.get(), exclude.get());
+  access.reset();
 
 //Create inverse exclude map
-  auto cavEXC = make_zeroed_grid();
+  auto cavEXC = make_zeroed_grid(ctx);
   copyGrid(shellEXC, cavEXC.get());
-  subt_Grids(cavEXC.get(), exclude.get()); //modifies cavEXC
+  subt_Grids(ctx, cavEXC.get(), exclude.get()); //modifies cavEXC
   exclude.reset();
-  int echanEXC_voxels = countGrid(cavEXC.get());
+  result.echanEXC_voxels = countGrid(ctx, cavEXC.get());
 
 //Get first point
-  firstpt = first_filled_point(cavEXC.get());
-  cerr << "FIRST POINT: " << firstpt << endl;
+  result.firstpt = first_filled_point(ctx, cavEXC.get());
 //LAST POINT
-  lastpt = last_filled_point(cavEXC.get());
-  cerr << "LAST  POINT: " << lastpt << endl;
+  result.lastpt = last_filled_point(ctx, cavEXC.get());
 
 //Pull channels out of inverse excluded map
-  auto chanEXC = make_zeroed_grid();
-  cerr << "Getting Connected Next" << endl;
-  get_Connected_Point(cavEXC.get(), chanEXC.get(), firstpt); //modifies chanEXC
-  get_Connected_Point(cavEXC.get(), chanEXC.get(), lastpt); //modifies chanEXC
-  int chanEXC_voxels = countGrid(chanEXC.get());
+  auto chanEXC = make_zeroed_grid(ctx);
+  get_Connected_Point(ctx, cavEXC.get(), chanEXC.get(), result.firstpt); //modifies chanEXC
+  get_Connected_Point(ctx, cavEXC.get(), chanEXC.get(), result.lastpt); //modifies chanEXC
+  result.chanEXC_voxels = countGrid(ctx, chanEXC.get());
 //Subtract channels from exclude map leaving cavities
-  subt_Grids(cavEXC.get(), chanEXC.get()); //modifies cavEXC
+  subt_Grids(ctx, cavEXC.get(), chanEXC.get()); //modifies cavEXC
   chanEXC.reset();
-  int cavEXC_voxels = countGrid(cavEXC.get());
+  result.cavEXC_voxels = countGrid(ctx, cavEXC.get());
 
 //Write out exclude cavities
-  long double surfEXC = surface_area(cavEXC.get());
-  report_grid_metrics(std::cerr, cavEXC_voxels, surfEXC);
-  write_output_files(cavEXC.get(), outputs);
-  cavEXC.reset();
-
-  cerr << endl;
-  cerr << "achanACC_voxels = " << achanACC_voxels << endl
-       << "chanACC_voxels  = " << chanACC_voxels << endl
-       << "cavACC_voxels   = " << cavACC_voxels << endl
-       << "scavACC_voxels  = " << scavACC_voxels << endl
-       << "-------------------------------------" << endl
-       << "ecavACC_voxels  = " << ecavACC_voxels << endl << endl;
-  cerr << "echanEXC_voxels = " << echanEXC_voxels << endl
-       << "chanEXC_voxels  = " << chanEXC_voxels << endl
-       << "-------------------------------------" << endl
-       << "cavEXC_voxels   = " << cavEXC_voxels << endl << endl << endl;
-  cout << probe << "\t" << GRID << "\t" ;
-  printVolCout(ecavACC_voxels);
-  cout << "\t";
-  printVolCout(cavEXC_voxels);
-  //cout << "\t\t";
-  //printVolCout(scavACC_voxels);
-  //cout << "\t";
-  //printVolCout(cavACC_voxels);
-  cout << "\t" << natoms << "\t" << input_label;
-  cout << "\tprobe,grid,cav_meth1,cav_meth2,num_atoms,file";
-  cout << endl;
-
-//  float perACC = 100*float(tunnACC_voxels) / float(chanACC_voxels);
-//  float perEXC = 100*float(tunnEXC_voxels) / float(chanEXC_voxels);
-
-  return cavACC_voxels+ecavACC_voxels;
-};
+  result.surfEXC = surface_area(ctx, cavEXC.get());
+  write_output_files(ctx, cavEXC.get(), outputs);
+  return result;
+}
@@ -2,9 +2,11 @@
 #include <string>
 #include <vector>
 
+#include "analysis_server.hpp"
 #include "argument_helper.hpp"
 #include "pdb_io.hpp"
 #include "utils.hpp"
+#include "utils-bitgrid.hpp"
 #include "vossvolvox_cli_common.hpp"
 #include "xyzr_cli_helpers.hpp"
 
@@ -12,9 +14,32 @@
 // Globals
 extern float GRID;
 
+// Channel volumes in voxels, and the excluded channel's surface area
+struct ChannelResult {
+  int exc_voxels = 0;
+  int acc_voxels = 0;
+  long double surf = 0;
+};
+
+bool processChannel(const GridContext& ctx,
+                    const XYZRBuffer& xyzr_buffer,
+                    const int numatoms,
+                    const double BIGPROBE,
+                    const double SMPROBE,
+                    const double TRIMPROBE,
+                    const double x,
+                    const double y,
+                    const double z,
+                    const vossvolvox::TrimMapSettings& trim,
+                    const vossvolvox::OutputSettings& outputs,
+                    const std::string& input_path,
+                    const bool print_header,
+                    ChannelResult& result);
+
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   vossvolvox::OutputSettings outputs;
@@ -27,6 +52,8 @@ int main(int argc, char *argv[]) {
   double z = 1000.0;
   float grid = GRID;
   vossvolvox::FilterSettings filters;
+  vossvolvox::TrimMapSettings trim;
+  vossvolvox::ServerSettings server;
 
   vossvolvox::ArgumentParser parser(
       argv[0],
@@ -77,7 +104,10 @@ int main(int argc, char *argv[]) {
   outputs.use_small_mrc = true;
   vossvolvox::add_output_options(parser, outputs);
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
+  vossvolvox::add_trim_map_options(parser, trim);
   vossvolvox::add_debug_option(parser, debug);
+  vossvolvox::add_server_option(parser, server);
   parser.add_example(
       "./Channel.exe -i 3hdi.xyzr -b 9.0 -s 1.5 -t 4.0 -x -10 -y 5 -z 0 -o channel.pdb");
 
@@ -88,7 +118,12 @@ int main(int argc, char *argv[]) {
   if (parse_result == vossvolvox::ArgumentParser::ParseResult::Error) {
     return 1;
   }
-  if (!vossvolvox::ensure_input_present(input_path, parser)) {
+  if (server.socket_path.empty() && !vossvolvox::ensure_input_present(input_path, parser)) {
+    return 1;
+  }
+  // A saved shell only fits the grid of the structure it was made for
+  if (!server.socket_path.empty() && (!trim.load_path.empty() || !trim.save_path.empty())) {
+    std::cerr << "Error: --trim-map and --save-trim-map cannot be used with --serve\n";
     return 1;
   }
 
@@ -103,6 +138,44 @@ int main(int argc, char *argv[]) {
   }
 
   const auto convert_options = vossvolvox::make_conversion_options(filters);
+  if (!server.socket_path.empty()) {
+    // The command-line probes, seed, and grid are the request defaults
+    vossvolvox::AnalysisServer analysis(convert_options);
+    analysis.add_tool("channel", [&](const vossvolvox::ServerRequest& request,
+                                     const XYZRBuffer& atoms,
+                                     const std::string& label,
+                                     vossvolvox::ServerReply& reply) {
+      const double big = request.number("big_probe", BIGPROBE);
+      const double small = request.number("small_probe", SMPROBE);
+      const double trim_probe = request.number("trim_probe", TRIMPROBE);
+      const float spacing = static_cast<float>(request.number("grid", grid));
+      if (spacing <= 0) {
+        reply.fail("\"grid\" must be positive");
+        return false;
+      }
+      const std::vector<const XYZRBuffer*> buffers = {&atoms};
+      const auto prepared = vossvolvox::prepare_grid_from_xyzr(
+          buffers, spacing, static_cast<float>(big), label, false);
+      reply.progress("grid");
+      ChannelResult result;
+      if (!processChannel(prepared.context, atoms, prepared.total_atoms, big, small, trim_probe,
+                          request.number("x", x), request.number("y", y), request.number("z", z),
+                          vossvolvox::TrimMapSettings(), request.outputs(outputs), label,
+                          false, result)) {
+        reply.fail("unable to build the trimmed shell");
+        return false;
+      }
+      const long double gridvol = prepared.context.gridvol;
+      reply.field("big_probe", big);
+      reply.field("small_probe", small);
+      reply.field("grid", prepared.context.spacing);
+      reply.field("excvol", static_cast<double>(result.exc_voxels * gridvol));
+      reply.field("surf_area", static_cast<double>(result.surf));
+      reply.field("accvol", static_cast<double>(result.acc_voxels * gridvol));
+      return true;
+    });
+    return analysis.run(server.socket_path);
+  }
   XYZRBuffer xyzr_buffer;
   if (!vossvolvox::load_xyzr_or_exit(input_path, convert_options, xyzr_buffer)) {
     return 1;
@@ -118,84 +191,128 @@ int main(int argc, char *argv[]) {
 
 //HEADER CHECK
   cerr << "Probe Radius: " << BIGPROBE << endl;
-  cerr << "Grid Spacing: " << GRID << endl;
+  cerr << "Grid Spacing: " << grid_result.context.spacing << endl;
   cerr << "Input file:   " << input_path << endl;
 
+  ChannelResult result;
+  if (!processChannel(grid_result.context, xyzr_buffer, numatoms, BIGPROBE, SMPROBE, TRIMPROBE,
+                      x, y, z, trim, outputs, input_path, true, result)) {
+    return 1;
+  }
+
+  cerr << endl << "Program Completed Sucessfully" << endl << endl;
+  return 0;
+};
+
+// Extract the channel at (x, y, z) on ctx's grid, print its result
+// row, and write the grid outputs. Returns false when the shell cannot be made.
+bool processChannel(const GridContext& ctx,
+                    const XYZRBuffer& xyzr_buffer,
+                    const int numatoms,
+                    const double BIGPROBE,
+                    const double SMPROBE,
+                    const double TRIMPROBE,
+                    const double x,
+                    const double y,
+                    const double z,
+                    const vossvolvox::TrimMapSettings& trim,
+                    const vossvolvox::OutputSettings& outputs,
+                    const std::string& input_path,
+                    const bool print_header,
+                    ChannelResult& result) {
 // ****************************************************
 // STARTING LARGE PROBE
 // ****************************************************
-  auto biggrid = make_zeroed_grid();
-  int bigvox;
-  if (BIGPROBE > 0.0) {
-    bigvox = get_ExcludeGrid_fromArray(numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
-  } else {
+  if (BIGPROBE <= 0.0) {
     cerr << "BIGPROBE <= 0" << endl;
-    return 1;
+    return false;
   }
+  auto trimbytes = make_zeroed_grid(ctx);
+  if (!trim.load_path.empty()) {
+    // shell saved by an earlier run with --save-trim-map
+    if (readMRCFileOnGrid(ctx, trim.load_path.c_str(), trim.threshold, trimbytes.get()) < 0) {
+      return false;
+    }
+  } else {
+    auto biggrid = make_zeroed_grid(ctx);
+    get_ExcludeGrid_fromArray(ctx, numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
 
 // ****************************************************
 // TRIM LARGE PROBE SURFACE
 // ****************************************************
-  auto trimgrid = make_zeroed_grid();
-  copyGrid(biggrid.get(), trimgrid.get());
-  trun_ExcludeGrid(TRIMPROBE, biggrid.get(), trimgrid.get());
-  biggrid.reset();
+    copyGrid(ctx, biggrid.get(), trimbytes.get());
+    trun_ExcludeGrid(ctx, TRIMPROBE, biggrid.get(), trimbytes.get());
+  }
+  if (!trim.save_path.empty()
+      && writeMRCFile(ctx, trimbytes.get(), trim.save_path.c_str()) != 1) {
+    std::cerr << "Error: --save-trim-map " << trim.save_path
+              << " was not written (empty shell or write error)" << std::endl;
+    return false;
+  }
+  // keep the trimmed shell bit-packed, it is held for the rest of the run
+  BitGrid trimgrid = make_zeroed_bitgrid(ctx);
+  copyGrid(ctx, trimbytes.get(), trimgrid);
+  trimbytes.reset();
 
-  cout << "bg_prb\tsm_prb\tgrid\texcvol\tsurf\taccvol\tfile" << endl;
+  if (print_header) {
+    cout << "bg_prb\tsm_prb\tgrid\texcvol\tsurf\taccvol\tfile" << endl;
+  }
 
 // ****************************************************
 // STARTING SMALL PROBE
 // ****************************************************
-    auto smgrid = make_zeroed_grid();
+    auto smgrid = make_zeroed_grid(ctx);
     int smvox;
-    smvox = fill_AccessGrid_fromArray(numatoms, SMPROBE, xyzr_buffer, smgrid.get());
+    smvox = fill_AccessGrid_fromArray(ctx, numatoms, SMPROBE, xyzr_buffer, smgrid.get());
 
 // ****************************************************
 // GETTING ACCESSIBLE CHANNELS
 // ****************************************************
-    auto solventACC = make_zeroed_grid();
-    copyGrid(trimgrid.get(), solventACC.get()); //copy trimgrid into solventACC
-    subt_Grids(solventACC.get(), smgrid.get()); //modify solventACC
+    auto solventACC = make_zeroed_grid(ctx);
+    copyGrid(trimgrid, solventACC.get()); //copy trimgrid into solventACC
+    subt_Grids(ctx, solventACC.get(), smgrid.get()); //modify solventACC
     smgrid.reset();
 
 
 // ***************************************************
 // SELECT PARTICULAR CHANNEL
 // ***************************************************
-    auto channelACC = make_zeroed_grid();
+    auto channelACC = make_zeroed_grid(ctx);
 
 //main channel
-    get_Connected(solventACC.get(), channelACC.get(), x, y, z);
+    get_Connected(ctx, solventACC.get(), channelACC.get(), x, y, z);
     solventACC.reset();
 
 // ***************************************************
 // GETTING CONTACT CHANNEL
 // ***************************************************
-    auto channelEXC = make_zeroed_grid();
-    int channelACCvol = copyGrid(channelACC.get(), channelEXC.get());
+    auto channelEXC = make_zeroed_grid(ctx);
+    int channelACCvol = copyGrid(ctx, channelACC.get(), channelEXC.get());
     cerr << "Accessible Channel Volume  ";
-    printVol(channelACCvol);
-    grow_ExcludeGrid(SMPROBE, channelACC.get(), channelEXC.get());
+    printVol(ctx, channelACCvol);
+    grow_ExcludeGrid(ctx, SMPROBE, channelACC.get(), channelEXC.get());
     channelACC.reset();
 
 //limit growth to inside trimgrid
-    intersect_Grids(channelEXC.get(), trimgrid.get()); //modifies channelEXC
+    intersect_Grids(channelEXC.get(), trimgrid); //modifies channelEXC
 
 // ***************************************************
 // OUTPUT RESULTS
 // ***************************************************
-    cout << BIGPROBE << "\t" << SMPROBE << "\t" << GRID << "\t" << flush;
-    int chanEXC_voxels = countGrid(channelEXC.get());
-    printVolCout(chanEXC_voxels);
-    long double surf = surface_area(channelEXC.get());
+    cout << BIGPROBE << "\t" << SMPROBE << "\t" << ctx.spacing << "\t" << flush;
+    int chanEXC_voxels = countGrid(ctx, channelEXC.get());
+    printVolCout(ctx, chanEXC_voxels);
+    long double surf = surface_area(ctx, channelEXC.get());
     cout << "\t" << surf << "\t" << flush;
-    printVolCout(channelACCvol);
+    printVolCout(ctx, channelACCvol);
     cout << "\t#" << input_path << endl;
-    report_grid_metrics(std::cerr, chanEXC_voxels, surf);
-    write_output_files(channelEXC.get(), outputs);
+    report_grid_metrics(ctx, std::cerr, chanEXC_voxels, surf);
+    write_output_files(ctx, channelEXC.get(), outputs);
 
     cerr << endl;
 
-  cerr << endl << "Program Completed Sucessfully" << endl << endl;
-  return 0;
-};
+  result.exc_voxels = chanEXC_voxels;
+  result.acc_voxels = channelACCvol;
+  result.surf = surf;
+  return true;
+}
@@ -15,6 +15,7 @@ extern float GRID;
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   double probe = 10.0;
@@ -53,6 +54,7 @@ int main(int argc, char *argv[]) {
                     "Number of grid steps between g1 and g2.",
                     "<steps>");
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
   vossvolvox::add_debug_option(parser, debug);
   parser.add_example("./FracDim.exe -i sample.xyzr -p 1.5 -g1 0.4 -g2 0.8 -gn 8");
 
@@ -14,14 +14,17 @@ extern float GRID, GRIDVOL;
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   double BIGPROBE = 10.0;
   double PROBESTEP = 0.1;
   double TRIMPROBE = 1.5;
   float grid = GRID;
+  bool sweep = false;
   vossvolvox::FilterSettings filters;
   vossvolvox::DebugSettings debug;
+  vossvolvox::EngineSettings engine_opts;
 
   vossvolvox::ArgumentParser parser(
       argv[0],
@@ -51,9 +54,17 @@ int main(int argc, char *argv[]) {
                     GRID,
                     "Grid spacing in Angstroms.",
                     "<grid>");
+  parser.add_flag("",
+                  "--sweep",
+                  sweep,
+                  false,
+                  "Compute atom surface distances once and threshold them per probe.");
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
   vossvolvox::add_debug_option(parser, debug);
+  vossvolvox::add_engine_option(parser, engine_opts);
   parser.add_example("./FsvCalc.exe -i sample.xyzr -b 10 -s 0.25 -t 1.5 -g 0.8");
+  parser.add_example("./FsvCalc.exe -i sample.xyzr -b 10 -s 0.1 --sweep");
 
   const auto parse_result = parser.parse(argc, argv);
   if (parse_result == vossvolvox::ArgumentParser::ParseResult::HelpRequested) {
@@ -66,6 +77,11 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  ExcludeEngine engine = ExcludeEngine::Stamp;
+  if (!vossvolvox::resolve_exclude_engine(engine_opts, engine)) {
+    return 1;
+  }
+
   vossvolvox::enable_debug(debug);
   vossvolvox::debug_report_cli(input_path, nullptr);
 
@@ -103,7 +119,7 @@ int main(int argc, char *argv[]) {
 
 //GET SHELL
   auto shell = make_zeroed_grid();
-  int shellvol = get_ExcludeGrid_fromArray(numatoms, BIGPROBE, xyzr_buffer, shell.get());
+  int shellvol = get_ExcludeGrid_fromArray(engine, numatoms, BIGPROBE, xyzr_buffer, shell.get());
 
 //INIT NEW smShellACC GRID
   cerr << "Trimming Radius: " << TRIMPROBE << endl;
@@ -112,7 +128,7 @@ int main(int argc, char *argv[]) {
 //COPY AND TRUNCATE (IF NECESSARY)
   copyGrid(shell.get(), smShell.get());
   if(TRIMPROBE > 0) {
-    trun_ExcludeGrid(TRIMPROBE, shell.get(), smShell.get());
+    trun_ExcludeGrid(engine, TRIMPROBE, shell.get(), smShell.get());
   }
   shell.reset();
 
@@ -122,22 +138,33 @@ int main(int argc, char *argv[]) {
 
   cout << "probe\tshell_vol\tsolvent_vol\tfsv\tfile" << endl;
 
+//SWEEP MODE: ONE DISTANCE FIELD, THRESHOLDED PER PROBE
+  std::vector<float> surfdist;
+  if (sweep) {
+    surfdist.resize(grid_result.context.numbins);
+    fill_SurfaceDistance_fromArray(numatoms, BIGPROBE, xyzr_buffer, surfdist.data());
+  }
+
+//WORK GRIDS ARE FULLY OVERWRITTEN EACH STEP
+  auto solventACC = make_zeroed_grid();
+  auto probeACC = make_zeroed_grid();
+  auto solventEXC = make_zeroed_grid();
+
   for (double SMPROBE=0.0; SMPROBE<BIGPROBE; SMPROBE+=PROBESTEP) {
 	//COPY SMSHELL INTO CHANACC
-	  auto solventACC = make_zeroed_grid();
 	  int smshellvol = copyGrid(smShell.get(), solventACC.get());
 
 	//SUBTRACT PROBE_ACC FROM SHELL TO GET ACC CHANNELS
-	  auto probeACC = make_zeroed_grid();
-	  fill_AccessGrid_fromArray(numatoms, SMPROBE, xyzr_buffer, probeACC.get());
+	  if (sweep) {
+	    threshold_AccessGrid(surfdist.data(), SMPROBE, probeACC.get());
+	  } else {
+	    fill_AccessGrid_fromArray(numatoms, SMPROBE, xyzr_buffer, probeACC.get());
+	  }
 	  subt_Grids(solventACC.get(), probeACC.get());
 
-	//INIT NEW solventEXC GRID
-	  auto solventEXC = make_zeroed_grid();
-
 	//GROW EXCLUDED SURFACE FROM ACCESSIBLE
 	  //copyGrid(solventACC,solventEXC);
-	  grow_ExcludeGrid(SMPROBE, solventACC.get(), solventEXC.get());
+	  grow_ExcludeGrid(engine, SMPROBE, solventACC.get(), solventEXC.get());
 
 	//INTERSECT
 	  intersect_Grids(solventEXC.get(), smShell.get()); //modifies solventEXC
@@ -0,0 +1,697 @@
+#include "analysis_server.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "xyzr_cli_helpers.hpp"
+
+namespace vossvolvox {
+
+namespace {
+
+// Converted structures kept in memory, least recently used dropped first.
+const std::size_t SERVER_CACHE_ENTRIES = 64;
+// A request line longer than this (inline atoms included) closes the client.
+const std::size_t SERVER_MAX_LINE = std::size_t(256) << 20;
+
+volatile std::sig_atomic_t g_server_signal = 0;
+
+void on_server_signal(int) {
+  g_server_signal = 1;
+}
+
+std::string json_string(const std::string& text) {
+  std::string out = "\"";
+  for (const char c : text) {
+    switch (c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escaped[8];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+          out += escaped;
+        } else {
+          out += c;
+        }
+    }
+  }
+  return out + "\"";
+}
+
+std::string json_number(const double value) {
+  if (!std::isfinite(value)) {
+    return "null";
+  }
+  // The shortest text that reads back as the same value. Values that came
+  // from a float (grid spacings, areas) only need to read back as that
+  // float, so 0.8f is 0.8 rather than 0.800000011920929.
+  const bool from_float = double(float(value)) == value;
+  const int max_digits = from_float ? std::numeric_limits<float>::max_digits10
+                                    : std::numeric_limits<double>::max_digits10;
+  char text[32];
+  for (int digits = 6; digits <= max_digits; digits++) {
+    std::snprintf(text, sizeof(text), "%.*g", digits, value);
+    const double back = std::strtod(text, nullptr);
+    if (from_float ? float(back) == float(value) : back == value) {
+      break;
+    }
+  }
+  return text;
+}
+
+bool send_text(int fd, const std::string& text) {
+  std::size_t done = 0;
+  while (done < text.size()) {
+    const ssize_t sent = ::send(fd, text.data() + done, text.size() - done, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    done += static_cast<std::size_t>(sent);
+  }
+  return true;
+}
+
+void append_utf8(std::string& out, unsigned long code) {
+  if (code < 0x80) {
+    out += static_cast<char>(code);
+  } else if (code < 0x800) {
+    out += static_cast<char>(0xC0 | (code >> 6));
+    out += static_cast<char>(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    out += static_cast<char>(0xE0 | (code >> 12));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (code & 0x3F));
+  } else {
+    out += static_cast<char>(0xF0 | (code >> 18));
+    out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+    out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+    out += static_cast<char>(0x80 | (code & 0x3F));
+  }
+}
+
+// Tokens of one JSON text; structure is checked by ServerRequest::parse.
+class JsonReader {
+ public:
+  explicit JsonReader(const std::string& text) : text_(text) {}
+
+  char peek() {
+    while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+      pos_++;
+    }
+    return pos_ < text_.size() ? text_[pos_] : '\0';
+  }
+
+  bool consume(const char c) {
+    if (peek() != c) {
+      return false;
+    }
+    pos_++;
+    return true;
+  }
+
+  bool at_end() { return peek() == '\0' && pos_ >= text_.size(); }
+
+  bool word(const char* literal) {
+    const std::size_t length = std::strlen(literal);
+    peek();
+    if (text_.compare(pos_, length, literal) != 0) {
+      return false;
+    }
+    pos_ += length;
+    return true;
+  }
+
+  bool string(std::string& out) {
+    if (!consume('"')) {
+      return false;
+    }
+    out.clear();
+    while (pos_ < text_.size()) {
+      const char c = text_[pos_++];
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        out += c;
+        continue;
+      }
+      if (pos_ >= text_.size()) {
+        return false;
+      }
+      const char escape = text_[pos_++];
+      switch (escape) {
+        case '"': case '\\': case '/': out += escape; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+          unsigned long code = 0;
+          if (!hex4(code)) {
+            return false;
+          }
+          // a high surrogate followed by its low half
+          if (code >= 0xD800 && code < 0xDC00 && text_.compare(pos_, 2, "\\u") == 0) {
+            pos_ += 2;
+            unsigned long low = 0;
+            if (!hex4(low)) {
+              return false;
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          }
+          append_utf8(out, code);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  // A JSON number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?. strtod
+  // alone would also take inf, nan, hex, and a leading + or 0.
+  bool number(std::string& token) {
+    peek();
+    std::size_t end = pos_;
+    if (end < text_.size() && text_[end] == '-') {
+      end++;
+    }
+    if (end < text_.size() && text_[end] == '0') {
+      end++;
+    } else if (!digits(end)) {
+      return false;
+    }
+    if (end < text_.size() && text_[end] == '.') {
+      end++;
+      if (!digits(end)) {
+        return false;
+      }
+    }
+    if (end < text_.size() && (text_[end] == 'e' || text_[end] == 'E')) {
+      end++;
+      if (end < text_.size() && (text_[end] == '+' || text_[end] == '-')) {
+        end++;
+      }
+      if (!digits(end)) {
+        return false;
+      }
+    }
+    token = text_.substr(pos_, end - pos_);
+    pos_ = end;
+    return true;
+  }
+
+ private:
+  // Moves end past a run of decimal digits; false when there is none.
+  bool digits(std::size_t& end) const {
+    const std::size_t start = end;
+    while (end < text_.size() && std::isdigit(static_cast<unsigned char>(text_[end]))) {
+      end++;
+    }
+    return end > start;
+  }
+
+  bool hex4(unsigned long& code) {
+    if (pos_ + 4 > text_.size()) {
+      return false;
+    }
+    char digits[5] = {0};
+    std::memcpy(digits, text_.data() + pos_, 4);
+    char* end = nullptr;
+    code = std::strtoul(digits, &end, 16);
+    pos_ += 4;
+    return end == digits + 4;
+  }
+
+  const std::string& text_;
+  std::size_t pos_ = 0;
+};
+
+}  // namespace
+
+/*********************************************/
+bool ServerRequest::parse(const std::string& line, std::string& error) {
+  values_.clear();
+  xyzr_.clear();
+  has_xyzr_ = false;
+  id_json_ = "null";
+  JsonReader reader(line);
+
+  // Numbers of "xyzr", flat or in nested arrays.
+  std::function<bool()> read_numbers = [&]() -> bool {
+    if (!reader.consume('[')) {
+      return false;
+    }
+    if (reader.consume(']')) {
+      return true;
+    }
+    do {
+      std::string token;
+      if (reader.peek() == '[') {
+        if (!read_numbers()) {
+          return false;
+        }
+      } else if (reader.number(token)) {
+        xyzr_.push_back(std::strtof(token.c_str(), nullptr));
+      } else {
+        return false;
+      }
+    } while (reader.consume(','));
+    return reader.consume(']');
+  };
+
+  std::function<bool(const std::string&, int)> read_object;
+  auto read_value = [&](const std::string& key, int depth) -> bool {
+    const char next = reader.peek();
+    std::string value;
+    if (next == '"') {
+      if (!reader.string(value)) {
+        error = "bad string for \"" + key + "\"";
+        return false;
+      }
+      values_[key] = value;
+      if (key == "id") {
+        id_json_ = json_string(value);
+      }
+      return true;
+    }
+    if (next == '{') {
+      if (depth > 0) {
+        error = "\"" + key + "\" is nested too deeply";
+        return false;
+      }
+      return read_object(key + ".", depth + 1);
+    }
+    if (next == '[') {
+      if (key != "xyzr") {
+        error = "\"" + key + "\" may not be an array";
+        return false;
+      }
+      has_xyzr_ = true;
+      if (!read_numbers()) {
+        error = "\"xyzr\" must hold only numbers";
+        return false;
+      }
+      return true;
+    }
+    if (reader.word("true") || reader.word("false")) {
+      values_[key] = next == 't' ? "true" : "false";
+      return true;
+    }
+    if (reader.word("null")) {
+      return true;
+    }
+    if (!reader.number(value)) {
+      error = "bad value for \"" + key + "\"";
+      return false;
+    }
+    values_[key] = value;
+    if (key == "id") {
+      id_json_ = value;
+    }
+    return true;
+  };
+
+  read_object = [&](const std::string& prefix, int depth) -> bool {
+    if (!reader.consume('{')) {
+      error = "expected a JSON object";
+      return false;
+    }
+    if (reader.consume('}')) {
+      return true;
+    }
+    do {
+      std::string key;
+      if (!reader.string(key) || !reader.consume(':')) {
+        error = "expected \"key\": value";
+        return false;
+      }
+      if (!read_value(prefix + key, depth)) {
+        return false;
+      }
+    } while (reader.consume(','));
+    if (!reader.consume('}')) {
+      error = "expected , or }";
+      return false;
+    }
+    return true;
+  };
+
+  if (!read_object("", 0)) {
+    return false;
+  }
+  if (!reader.at_end()) {
+    error = "unexpected text after the request object";
+    return false;
+  }
+  return true;
+}
+
+std::string ServerRequest::text(const std::string& key, const std::string& fallback) const {
+  const auto it = values_.find(key);
+  return it == values_.end() ? fallback : it->second;
+}
+
+double ServerRequest::number(const std::string& key, double fallback) const {
+  const auto it = values_.find(key);
+  if (it == values_.end()) {
+    return fallback;
+  }
+  if (it->second == "true" || it->second == "false") {
+    return it->second == "true" ? 1.0 : 0.0;
+  }
+  char* end = nullptr;
+  const double value = std::strtod(it->second.c_str(), &end);
+  if (it->second.empty() || *end != '\0') {
+    throw std::runtime_error("\"" + key + "\" is not a number");
+  }
+  return value;
+}
+
+bool ServerRequest::flag(const std::string& key, bool fallback) const {
+  return number(key, fallback ? 1.0 : 0.0) != 0.0;
+}
+
+OutputSettings ServerRequest::outputs(const OutputSettings& base) const {
+  OutputSettings outputs = base;
+  outputs.pdbFile = text("outputs.pdb");
+  outputs.ezdFile = text("outputs.ezd");
+  outputs.mrcFile = text("outputs.mrc");
+  outputs.ccp4File = text("outputs.ccp4");
+  outputs.map_4bit = flag("outputs.map_4bit", base.map_4bit);
+  outputs.map_gzip = flag("outputs.map_gzip", base.map_gzip);
+  return outputs;
+}
+
+/*********************************************/
+ServerReply::ServerReply(int fd, std::string id_json)
+    : fd_(fd), id_json_(std::move(id_json)), start_(std::chrono::steady_clock::now()) {}
+
+double ServerReply::elapsed_ms() const {
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start_;
+  return elapsed.count();
+}
+
+bool ServerReply::send_event(const std::string& event, const std::string& fields) {
+  const std::string line =
+      "{\"id\":" + id_json_ + ",\"event\":" + json_string(event) + fields + "}\n";
+  if (!lost_ && !send_text(fd_, line)) {
+    lost_ = true;
+  }
+  return !lost_;
+}
+
+void ServerReply::progress(const std::string& stage) {
+  send_event("progress", ",\"stage\":" + json_string(stage) + ",\"ms\":" +
+                             json_number(elapsed_ms()));
+}
+
+void ServerReply::field(const std::string& key, double value) {
+  fields_ += "," + json_string(key) + ":" + json_number(value);
+}
+
+void ServerReply::field(const std::string& key, const std::string& value) {
+  fields_ += "," + json_string(key) + ":" + json_string(value);
+}
+
+void ServerReply::fail(const std::string& message) {
+  failed_ = true;
+  error_ = message;
+}
+
+/*********************************************/
+AnalysisServer::AnalysisServer(const pdbio::ConversionOptions& options) : options_(options) {}
+
+void AnalysisServer::add_tool(const std::string& name, Handler handler) {
+  tools_[name] = std::move(handler);
+}
+
+const XYZRBuffer* AnalysisServer::load_structure(const std::string& path, bool& cached) {
+  cached = false;
+  struct stat info;
+  if (::stat(path.c_str(), &info) != 0) {
+    return nullptr;
+  }
+  const std::int64_t mtime_ns =
+      std::int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+  auto it = structures_.find(path);
+  if (it != structures_.end() && it->second.size == info.st_size &&
+      it->second.mtime_ns == mtime_ns) {
+    it->second.last_use = ++use_counter_;
+    cached = true;
+    return &it->second.atoms;
+  }
+  if (it == structures_.end() && structures_.size() >= SERVER_CACHE_ENTRIES) {
+    auto oldest = structures_.begin();
+    for (auto entry = structures_.begin(); entry != structures_.end(); ++entry) {
+      if (entry->second.last_use < oldest->second.last_use) {
+        oldest = entry;
+      }
+    }
+    structures_.erase(oldest);
+  }
+  CachedStructure& entry = structures_[path];
+  if (!load_xyzr_or_exit(path, options_, entry.atoms)) {
+    structures_.erase(path);
+    return nullptr;
+  }
+  entry.size = info.st_size;
+  entry.mtime_ns = mtime_ns;
+  entry.last_use = ++use_counter_;
+  return &entry.atoms;
+}
+
+bool AnalysisServer::handle_line(int fd, const std::string& line) {
+  if (line.find_first_not_of(" \t\r") == std::string::npos) {
+    return true;
+  }
+  ServerRequest request;
+  std::string error;
+  if (!request.parse(line, error)) {
+    return ServerReply(fd, request.id_json())
+        .send_event("error", ",\"message\":" + json_string(error));
+  }
+  ServerReply reply(fd, request.id_json());
+  const std::string tool = request.text("tool");
+  if (tool == "ping" || tool == "shutdown") {
+    std::string names;
+    for (const auto& entry : tools_) {
+      names += (names.empty() ? "" : ",") + entry.first;
+    }
+    reply.field("tools", names);
+    stop_ = tool == "shutdown";
+    return reply.send_event("result", ",\"tool\":" + json_string(tool) + reply.fields_);
+  }
+  const auto handler = tools_.find(tool);
+  if (handler == tools_.end()) {
+    return reply.send_event("error", ",\"message\":" + json_string("unknown tool '" + tool + "'"));
+  }
+
+  // Atoms: inline, or a structure file converted once and then cached
+  XYZRBuffer inline_atoms;
+  const XYZRBuffer* atoms = &inline_atoms;
+  std::string label;
+  bool cached = false;
+  if (request.has_atoms()) {
+    const auto& values = request.xyzr();
+    if (values.size() % 4 != 0) {
+      return reply.send_event("error", ",\"message\":" +
+                                           json_string("\"xyzr\" must hold 4 numbers per atom"));
+    }
+    for (std::size_t n = 0; n < values.size(); n += 4) {
+      inline_atoms.atoms.push_back(
+          XYZRAtom{values[n], values[n + 1], values[n + 2], values[n + 3]});
+    }
+    label = request.text("label", "<inline>");
+  } else if (request.has("input")) {
+    label = request.text("input");
+    atoms = load_structure(label, cached);
+    if (atoms == nullptr) {
+      return reply.send_event("error",
+                              ",\"message\":" + json_string("unable to load '" + label + "'"));
+    }
+  } else {
+    return reply.send_event("error", ",\"message\":" +
+                                         json_string("request needs \"input\" or \"xyzr\""));
+  }
+  // read_NumAtoms_from_array throws on fewer than 3 atoms; say why up front
+  int valid = 0;
+  for (const auto& atom : atoms->atoms) {
+    valid += (atom.r > 0 && atom.r < 100) ? 1 : 0;
+  }
+  if (valid < 3) {
+    return reply.send_event(
+        "error", ",\"message\":" + json_string("not enough atoms in '" + label + "'"));
+  }
+  reply.send_event("progress", ",\"stage\":\"loaded\",\"ms\":" + json_number(reply.elapsed_ms()) +
+                                   ",\"atoms\":" + std::to_string(valid) +
+                                   ",\"cached\":" + (cached ? "true" : "false"));
+
+  // The tool writes its usual row to std::cout; it becomes the "row" field
+  std::ostringstream rows;
+  const auto cout_flags = std::cout.flags();
+  const auto cout_precision = std::cout.precision();
+  std::streambuf* saved = std::cout.rdbuf(rows.rdbuf());
+  bool ok = false;
+  try {
+    ok = handler->second(request, *atoms, label, reply);
+  } catch (const std::exception& failure) {
+    reply.fail(failure.what());
+  }
+  std::cout.rdbuf(saved);
+  std::cout.flags(cout_flags);
+  std::cout.precision(cout_precision);
+  if (!ok || reply.failed()) {
+    const std::string message = reply.error_.empty() ? tool + " failed" : reply.error_;
+    return reply.send_event("error", ",\"message\":" + json_string(message));
+  }
+  std::string row = rows.str();
+  while (!row.empty() && row.back() == '\n') {
+    row.pop_back();
+  }
+  const double ms = reply.elapsed_ms();
+  std::cerr << "Server: " << tool << " " << label << " in " << ms << " ms" << std::endl;
+  return reply.send_event("result", ",\"tool\":" + json_string(tool) + ",\"ms\":" +
+                                        json_number(ms) + reply.fields_ + ",\"row\":" +
+                                        json_string(row));
+}
+
+int AnalysisServer::run(const std::string& socket_path) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Error: socket path '" << socket_path << "' is empty or too long\n";
+    return 1;
+  }
+  std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+  const int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    std::cerr << "Error: unable to create a socket\n";
+    return 1;
+  }
+  // A socket left by an earlier server is replaced; any other file is not
+  struct stat info;
+  if (::lstat(socket_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+    ::unlink(socket_path.c_str());
+  }
+  if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+      ::listen(listen_fd, 16) != 0) {
+    std::cerr << "Error: unable to listen on '" << socket_path << "': " << std::strerror(errno)
+              << "\n";
+    ::close(listen_fd);
+    return 1;
+  }
+
+  // No SA_RESTART, so a signal wakes poll()
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = on_server_signal;
+  sigemptyset(&action.sa_mask);
+  ::sigaction(SIGINT, &action, nullptr);
+  ::sigaction(SIGTERM, &action, nullptr);
+
+  std::string names;
+  for (const auto& entry : tools_) {
+    names += (names.empty() ? "" : ", ") + entry.first;
+  }
+  std::cerr << "Server: listening on " << socket_path << " (tools: " << names << ")" << std::endl;
+
+  struct Client {
+    int fd;
+    std::string pending;
+    bool open;
+  };
+  std::vector<Client> clients;
+  std::vector<char> chunk(1 << 16);
+  while (!stop_ && !g_server_signal) {
+    std::vector<pollfd> polls;
+    polls.push_back(pollfd{listen_fd, POLLIN, 0});
+    for (const auto& client : clients) {
+      polls.push_back(pollfd{client.fd, POLLIN, 0});
+    }
+    if (::poll(polls.data(), polls.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (std::size_t n = 1; n < polls.size() && !stop_; n++) {
+      if (polls[n].revents == 0) {
+        continue;
+      }
+      Client& client = clients[n - 1];
+      const ssize_t got = ::recv(client.fd, chunk.data(), chunk.size(), 0);
+      if (got <= 0) {
+        client.open = false;
+        continue;
+      }
+      client.pending.append(chunk.data(), static_cast<std::size_t>(got));
+      std::size_t start = 0;
+      std::size_t newline;
+      while (client.open && !stop_ &&
+             (newline = client.pending.find('\n', start)) != std::string::npos) {
+        client.open = handle_line(client.fd, client.pending.substr(start, newline - start));
+        start = newline + 1;
+      }
+      client.pending.erase(0, start);
+      if (client.pending.size() > SERVER_MAX_LINE) {
+        ServerReply(client.fd, "null")
+            .send_event("error", ",\"message\":\"request line too long\"");
+        client.open = false;
+      }
+    }
+    for (auto& client : clients) {
+      if (!client.open) {
+        ::close(client.fd);
+      }
+    }
+    clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                 [](const Client& client) { return !client.open; }),
+                  clients.end());
+    if (polls[0].revents & POLLIN) {
+      const int fd = ::accept(listen_fd, nullptr, nullptr);
+      if (fd >= 0) {
+        clients.push_back(Client{fd, std::string(), true});
+      }
+    }
+  }
+
+  for (const auto& client : clients) {
+    ::close(client.fd);
+  }
+  ::close(listen_fd);
+  ::unlink(socket_path.c_str());
+  std::cerr << "Server: stopped" << std::endl;
+  return 0;
+}
+
+}  // namespace vossvolvox
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "pdb_io.hpp"
+#include "utils.hpp"
+#include "vossvolvox_cli_common.hpp"
+
+namespace vossvolvox {
+
+// One JSON-lines request. Top-level scalars are kept by key, members of the
+// "outputs" object as "outputs.<name>", and the numbers of the "xyzr" array
+// (flat, or one [x, y, z, r] array per atom) as inline atoms. Other arrays
+// and nesting are rejected.
+class ServerRequest {
+ public:
+  bool parse(const std::string& line, std::string& error);
+
+  bool has(const std::string& key) const { return values_.count(key) > 0; }
+  std::string text(const std::string& key, const std::string& fallback = std::string()) const;
+  // Throws std::runtime_error when the value is not a number or boolean.
+  double number(const std::string& key, double fallback) const;
+  bool flag(const std::string& key, bool fallback) const;
+
+  // "id" as it was sent (string or number), or "null".
+  const std::string& id_json() const { return id_json_; }
+  bool has_atoms() const { return has_xyzr_; }
+  const std::vector<float>& xyzr() const { return xyzr_; }
+
+  // Grid output files named by "outputs" ({"pdb", "ezd", "mrc", "ccp4",
+  // "map_4bit", "map_gzip"}); names given on the server command line are
+  // not used, since every request would overwrite them.
+  OutputSettings outputs(const OutputSettings& base) const;
+
+ private:
+  std::map<std::string, std::string> values_;
+  std::string id_json_ = "null";
+  std::vector<float> xyzr_;
+  bool has_xyzr_ = false;
+};
+
+// Events of one request, written to its client as they happen.
+class ServerReply {
+ public:
+  ServerReply(int fd, std::string id_json);
+
+  // {"id":...,"event":"progress","stage":...,"ms":...}
+  void progress(const std::string& stage);
+  // Fields of the final result event.
+  void field(const std::string& key, double value);
+  void field(const std::string& key, const std::string& value);
+  // Ends the request with an error event instead of a result.
+  void fail(const std::string& message);
+
+  bool failed() const { return failed_; }
+  double elapsed_ms() const;
+
+ private:
+  friend class AnalysisServer;
+  // False once an event could not be sent, i.e. the client has gone.
+  bool send_event(const std::string& event, const std::string& fields);
+
+  int fd_;
+  std::string id_json_;
+  std::chrono::steady_clock::time_point start_;
+  std::string fields_;
+  bool failed_ = false;
+  bool lost_ = false;
+  std::string error_;
+};
+
+// Long-running analysis over a Unix domain socket. Each line a client sends
+// is one JSON request naming a tool registered with add_tool; the server
+// answers with progress events and then one result or error event, each a
+// JSON line. Requests are run one at a time in arrival order, and each gets
+// every OpenMP thread for its grid loops. Converted structures are
+// cached by path (and checked against the file's size and modification time),
+// so a repeated input is not parsed again, and the tools keep their grid
+// buffers between requests.
+class AnalysisServer {
+ public:
+  // Runs one request on its atoms: grids them, analyzes, writes the usual
+  // result row to std::cout (returned as "row"), and adds result fields.
+  using Handler = std::function<bool(const ServerRequest& request,
+                                     const XYZRBuffer& atoms,
+                                     const std::string& label,
+                                     ServerReply& reply)>;
+
+  explicit AnalysisServer(const pdbio::ConversionOptions& options);
+
+  void add_tool(const std::string& name, Handler handler);
+
+  // Serves until SIGINT, SIGTERM, or a {"tool":"shutdown"} request. Returns
+  // the process exit status.
+  int run(const std::string& socket_path);
+
+ private:
+  struct CachedStructure {
+    XYZRBuffer atoms;
+    std::int64_t size = 0;
+    std::int64_t mtime_ns = 0;
+    std::uint64_t last_use = 0;
+  };
+
+  // Returns false when the client should be dropped: a reply to it could not
+  // be sent.
+  bool handle_line(int fd, const std::string& line);
+  const XYZRBuffer* load_structure(const std::string& path, bool& cached);
+
+  pdbio::ConversionOptions options_;
+  std::map<std::string, Handler> tools_;
+  std::map<std::string, CachedStructure> structures_;
+  std::uint64_t use_counter_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace vossvolvox
@@ -0,0 +1,375 @@
+#include "batch_scheduler.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace vossvolvox {
+
+namespace {
+
+// Structures with at least this many voxels (about 320^3) run alone with
+// every thread; below it a grid loop finishes before a full team pays off.
+const double BATCH_LARGE_NUMBINS = 32.0 * 1024 * 1024;
+
+bool send_all(int fd, const void* data, std::size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return false;
+    }
+    bytes += sent;
+    size -= static_cast<std::size_t>(sent);
+  }
+  return true;
+}
+
+bool recv_all(int fd, void* data, std::size_t size) {
+  char* bytes = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t got = ::recv(fd, bytes, size, 0);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    bytes += got;
+    size -= static_cast<std::size_t>(got);
+  }
+  return true;
+}
+
+bool send_string(int fd, const std::string& text) {
+  const uint64_t length = text.size();
+  return send_all(fd, &length, sizeof(length)) && send_all(fd, text.data(), text.size());
+}
+
+bool recv_string(int fd, std::string& text) {
+  uint64_t length = 0;
+  if (!recv_all(fd, &length, sizeof(length))) {
+    return false;
+  }
+  text.resize(length);
+  return recv_all(fd, &text[0], text.size());
+}
+
+// The grid goes to the worker as raw bytes, so it must stay plain data
+static_assert(std::is_trivially_copyable<GridContext>::value, "GridContext is sent as bytes");
+
+bool send_grid(int fd, const GridPrepResult& grid) {
+  const int32_t total_atoms = grid.total_atoms;
+  const uint64_t inputs = grid.per_input.size();
+  return send_all(fd, &grid.context, sizeof(grid.context)) &&
+         send_all(fd, &total_atoms, sizeof(total_atoms)) &&
+         send_all(fd, &inputs, sizeof(inputs)) &&
+         send_all(fd, grid.per_input.data(), inputs * sizeof(int));
+}
+
+bool recv_grid(int fd, GridPrepResult& grid) {
+  int32_t total_atoms = 0;
+  uint64_t inputs = 0;
+  if (!recv_all(fd, &grid.context, sizeof(grid.context)) ||
+      !recv_all(fd, &total_atoms, sizeof(total_atoms)) ||
+      !recv_all(fd, &inputs, sizeof(inputs))) {
+    return false;
+  }
+  grid.total_atoms = total_atoms;
+  grid.per_input.resize(inputs);
+  return recv_all(fd, grid.per_input.data(), inputs * sizeof(int));
+}
+
+int available_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+void set_threads(int threads) {
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#else
+  (void)threads;
+#endif
+}
+
+double physical_memory() {
+  const long pages = ::sysconf(_SC_PHYS_PAGES);
+  const long page_size = ::sysconf(_SC_PAGESIZE);
+  return pages > 0 && page_size > 0 ? double(pages) * double(page_size) : 0;
+}
+
+}  // namespace
+
+BatchScheduler::BatchScheduler(const BatchSettings& settings, double bytes_per_voxel, Task task)
+    : task_(std::move(task)), bytes_per_voxel_(bytes_per_voxel) {
+  jobs_ = settings.jobs;
+  if (jobs_ <= 0) {
+    jobs_ = std::max(1, static_cast<int>(::sysconf(_SC_NPROCESSORS_ONLN)));
+  }
+  budget_bytes_ = settings.memory_mb > 0 ? settings.memory_mb * 1024 * 1024
+                                         : physical_memory() / 2;
+  total_threads_ = available_threads();
+  job_threads_ = std::max(1, total_threads_ / jobs_);
+  if (jobs_ <= 1) {
+    return;
+  }
+
+  // Anything still buffered would be written again by every worker
+  std::cout.flush();
+  std::cerr.flush();
+  std::fflush(nullptr);
+  for (int w = 0; w < jobs_; w++) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+      break;
+    }
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+      ::close(fds[0]);
+      ::close(fds[1]);
+      break;
+    }
+    if (pid == 0) {
+      // A worker holding another worker's socket would keep it from seeing
+      // the end of its jobs
+      ::close(fds[0]);
+      for (const auto& other : workers_) {
+        ::close(other.fd);
+      }
+      run_worker(fds[1]);
+    }
+    ::close(fds[1]);
+    Worker worker;
+    worker.pid = pid;
+    worker.fd = fds[0];
+    workers_.push_back(worker);
+  }
+  if (workers_.empty()) {
+    std::cerr << "Warning: unable to start batch workers; inputs run one at a time\n";
+    return;
+  }
+  std::cerr << "Batch: " << workers_.size() << " workers, " << job_threads_
+            << " thread(s) each, " << static_cast<long>(budget_bytes_ / (1024 * 1024))
+            << " MB grid budget\n";
+}
+
+BatchScheduler::~BatchScheduler() {
+  finish();
+}
+
+void BatchScheduler::run_worker(int fd) {
+  std::string path;
+  int32_t threads = 1;
+  uint64_t count = 0;
+  XYZRBuffer atoms;
+  GridPrepResult grid;
+  while (recv_string(fd, path) && recv_all(fd, &threads, sizeof(threads)) &&
+         recv_grid(fd, grid) && recv_all(fd, &count, sizeof(count))) {
+    atoms.atoms.resize(count);
+    if (!recv_all(fd, atoms.atoms.data(), count * sizeof(XYZRAtom))) {
+      break;
+    }
+    set_threads(threads);
+    std::ostringstream rows;
+    std::ostringstream log;
+    std::streambuf* saved_out = std::cout.rdbuf(rows.rdbuf());
+    std::streambuf* saved_err = std::cerr.rdbuf(log.rdbuf());
+    int32_t status = 0;
+    try {
+      task_(path, atoms, grid);
+    } catch (const std::exception& error) {
+      std::cerr << "Error: " << error.what() << " while analyzing '" << path << "'\n";
+      status = 1;
+    }
+    std::cout.rdbuf(saved_out);
+    std::cerr.rdbuf(saved_err);
+    if (!send_all(fd, &status, sizeof(status)) || !send_string(fd, rows.str()) ||
+        !send_string(fd, log.str())) {
+      break;
+    }
+  }
+  ::close(fd);
+  std::cerr.flush();
+  ::_exit(0);
+}
+
+int BatchScheduler::busy_workers() const {
+  int busy = 0;
+  for (const auto& worker : workers_) {
+    busy += (worker.fd >= 0 && worker.job >= 0) ? 1 : 0;
+  }
+  return busy;
+}
+
+int BatchScheduler::live_workers() const {
+  int live = 0;
+  for (const auto& worker : workers_) {
+    live += worker.fd >= 0 ? 1 : 0;
+  }
+  return live;
+}
+
+BatchScheduler::Worker* BatchScheduler::idle_worker() {
+  for (auto& worker : workers_) {
+    if (worker.fd >= 0 && worker.job < 0) {
+      return &worker;
+    }
+  }
+  return nullptr;
+}
+
+void BatchScheduler::submit(const std::string& path,
+                            const XYZRBuffer& atoms,
+                            const GridPrepResult& grid) {
+  const double bytes = double(grid.context.numbins) * bytes_per_voxel_;
+  const bool large = grid.context.numbins >= BATCH_LARGE_NUMBINS;
+  const bool alone = large || bytes > budget_bytes_;
+  while (live_workers() > 0) {
+    // A job that runs alone waits for an empty pool, and nothing joins it;
+    // others wait for a free worker and room in the budget
+    Worker* worker = idle_worker();
+    const int busy = busy_workers();
+    const bool fits = running_alone_ == 0 &&
+                      (alone ? busy == 0 : running_bytes_ + bytes <= budget_bytes_);
+    if (worker == nullptr || !fits) {
+      wait_for_result();
+      continue;
+    }
+    if (bytes > budget_bytes_) {
+      std::cerr << "Note: '" << path << "' needs about "
+                << static_cast<long>(bytes / (1024 * 1024))
+                << " MB, over the memory budget; running it alone\n";
+    }
+    const int32_t threads = large ? total_threads_ : job_threads_;
+    const uint64_t count = atoms.atoms.size();
+    if (!send_string(worker->fd, path) || !send_all(worker->fd, &threads, sizeof(threads)) ||
+        !send_grid(worker->fd, grid) || !send_all(worker->fd, &count, sizeof(count)) ||
+        !send_all(worker->fd, atoms.atoms.data(), count * sizeof(XYZRAtom))) {
+      stop_worker(*worker);
+      continue;
+    }
+    if (debug_enabled()) {
+      std::cerr << "Debug: batch_job=" << path << " running=" << busy << std::endl;
+    }
+    Job job;
+    job.path = path;
+    job.bytes = bytes;
+    job.alone = alone;
+    queue_.push_back(job);
+    worker->job = static_cast<int>(queue_.size()) - 1;
+    running_bytes_ += bytes;
+    running_alone_ += alone ? 1 : 0;
+    return;
+  }
+
+  // One job, or every worker has stopped: run here, after the rows before
+  // it, and count a throwing task as a worker's failed job is counted
+  print_ready();
+  try {
+    task_(path, atoms, grid);
+  } catch (const std::exception& error) {
+    std::cerr << "Error: " << error.what() << " while analyzing '" << path << "'\n";
+    failures_++;
+  }
+}
+
+void BatchScheduler::wait_for_result() {
+  std::vector<pollfd> polls;
+  std::vector<Worker*> owners;
+  for (auto& worker : workers_) {
+    if (worker.fd >= 0 && worker.job >= 0) {
+      polls.push_back(pollfd{worker.fd, POLLIN, 0});
+      owners.push_back(&worker);
+    }
+  }
+  if (polls.empty()) {
+    return;
+  }
+  if (::poll(polls.data(), polls.size(), -1) < 0) {
+    return;
+  }
+  for (std::size_t n = 0; n < polls.size(); n++) {
+    if (polls[n].revents == 0) {
+      continue;
+    }
+    Worker& worker = *owners[n];
+    Job& job = queue_[worker.job];
+    int32_t status = 0;
+    if (recv_all(worker.fd, &status, sizeof(status)) && recv_string(worker.fd, job.rows) &&
+        recv_string(worker.fd, job.log)) {
+      job.failed = status != 0;
+      worker.job = -1;
+    } else {
+      std::cerr << "Error: batch worker stopped while analyzing '" << job.path << "'\n";
+      job.failed = true;
+      stop_worker(worker);
+    }
+    job.done = true;
+    running_bytes_ -= job.bytes;
+    running_alone_ -= job.alone ? 1 : 0;
+    failures_ += job.failed ? 1 : 0;
+  }
+  print_ready();
+}
+
+void BatchScheduler::stop_worker(Worker& worker) {
+  ::close(worker.fd);
+  ::waitpid(worker.pid, nullptr, 0);
+  worker.fd = -1;
+  worker.pid = -1;
+  worker.job = -1;
+}
+
+void BatchScheduler::print_ready() {
+  while (printed_ < queue_.size() && queue_[printed_].done) {
+    std::cerr << queue_[printed_].log;
+    if (!queue_[printed_].failed) {
+      std::cout << queue_[printed_].rows;
+    }
+    queue_[printed_].rows.clear();
+    queue_[printed_].log.clear();
+    printed_++;
+  }
+  std::cerr.flush();
+  std::cout.flush();
+}
+
+int BatchScheduler::finish() {
+  if (finished_) {
+    return failures_;
+  }
+  finished_ = true;
+  while (busy_workers() > 0) {
+    wait_for_result();
+  }
+  print_ready();
+  for (auto& worker : workers_) {
+    if (worker.fd >= 0) {
+      stop_worker(worker);
+    }
+  }
+  return failures_;
+}
+
+}  // namespace vossvolvox
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "utils.hpp"
+#include "vossvolvox_cli_common.hpp"
+#include "xyzr_cli_helpers.hpp"
+
+namespace vossvolvox {
+
+// Runs the structures of a batch. With one job every input is analyzed in
+// this process, in order. With more, worker processes analyze several small
+// structures at once, each with a share of the OpenMP threads, while a
+// structure whose estimated grid is large, or over the whole budget, runs
+// alone: it waits for the running jobs and nothing starts until it is done.
+// Concurrent grids are admitted only while their estimated memory fits the
+// budget, and result rows are printed in input order either way. A task that
+// throws counts as a failed input whether it ran here or in a worker.
+//
+// Workers are forked by the constructor, before this process runs any
+// OpenMP region (libgomp does not survive a fork after its thread pool
+// starts), so construct the scheduler before loading the first input. Each
+// worker is sent the atoms with the GridPrepResult the caller prepared and
+// runs the task with std::cout and std::cerr captured; the messages of a job
+// are printed with its row, so those of concurrent jobs never interleave.
+class BatchScheduler {
+ public:
+  // Analyzes one structure on its prepared grid and writes its row to
+  // std::cout.
+  using Task = std::function<void(const std::string& path,
+                                  const XYZRBuffer& atoms,
+                                  const GridPrepResult& grid)>;
+
+  // bytes_per_voxel is the task's peak memory per grid voxel, used to
+  // estimate each structure's footprint from its NUMBINS.
+  BatchScheduler(const BatchSettings& settings, double bytes_per_voxel, Task task);
+  ~BatchScheduler();
+
+  BatchScheduler(const BatchScheduler&) = delete;
+  BatchScheduler& operator=(const BatchScheduler&) = delete;
+
+  // Queues one input prepared by InputBatch::next; waits for a worker and
+  // for memory when none is free.
+  void submit(const std::string& path, const XYZRBuffer& atoms, const GridPrepResult& grid);
+
+  // Waits for every queued input, prints the remaining rows, and stops the
+  // workers. Returns the number of inputs whose analysis failed.
+  int finish();
+
+ private:
+  struct Worker {
+    pid_t pid = -1;
+    int fd = -1;                      // socket to the worker, -1 once it has stopped
+    int job = -1;                     // index of the running job, -1 when idle
+  };
+  struct Job {
+    std::string path;
+    double bytes = 0;
+    bool alone = false;               // large or over budget: runs by itself
+    bool done = false;
+    bool failed = false;
+    std::string rows;
+    std::string log;                  // the job's std::cerr output
+  };
+
+  void run_worker(int fd);
+  int busy_workers() const;
+  int live_workers() const;
+  Worker* idle_worker();
+  void wait_for_result();
+  void stop_worker(Worker& worker);
+  void print_ready();
+
+  Task task_;
+  double bytes_per_voxel_;
+  double budget_bytes_ = 0;
+  int jobs_ = 1;
+  int total_threads_ = 1;
+  int job_threads_ = 1;
+  std::vector<Worker> workers_;
+  std::vector<Job> queue_;
+  std::size_t printed_ = 0;
+  double running_bytes_ = 0;
+  int running_alone_ = 0;             // running jobs that must run by themselves
+  int failures_ = 0;
+  bool finished_ = false;
+};
+
+}  // namespace vossvolvox
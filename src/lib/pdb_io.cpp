@@ -2,19 +2,35 @@
 
 #include <algorithm>
 #include <cctype>
+#include <condition_variable>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <initializer_list>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <regex>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
 #include "atmtypenumbers_data.hpp"
 
 #if VOSS_HAVE_GEMMI
@@ -26,28 +42,40 @@
 namespace vossvolvox::pdbio {
 namespace {
 
-std::string trim(std::string_view view) {
+std::string_view trim(std::string_view view) {
     const auto first = view.find_first_not_of(' ');
     if (first == std::string_view::npos) {
         return {};
     }
     const auto last = view.find_last_not_of(' ');
-    return std::string(view.substr(first, last - first + 1));
+    return view.substr(first, last - first + 1);
 }
 
-std::string to_upper(std::string value) {
+std::string to_upper(std::string_view view) {
+    std::string value(view);
     std::transform(value.begin(), value.end(), value.begin(), [](char c) {
         return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
     });
     return value;
 }
 
-std::string get_field(const std::string& line, std::size_t start, std::size_t length) {
+bool equals_upper(std::string_view view, std::string_view upper) {
+    if (view.size() != upper.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < view.size(); ++i) {
+        if (std::toupper(static_cast<unsigned char>(view[i])) != upper[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string_view get_field(std::string_view line, std::size_t start, std::size_t length) {
     if (line.size() <= start) {
         return {};
     }
-    const auto real_length = std::min(length, line.size() - start);
-    return line.substr(start, real_length);
+    return line.substr(start, std::min(length, line.size() - start));
 }
 
 std::string format_coordinate(double value) {
@@ -57,40 +85,237 @@ std::string format_coordinate(double value) {
     return oss.str();
 }
 
+// Parses a leading number the way std::strtod does: leading whitespace and a
+// '+' sign are skipped. On success sets end past the number; returns false
+// when no number starts there.
+bool parse_number(const char* begin, const char* limit, double& value, const char*& end) {
+    while (begin < limit && std::isspace(static_cast<unsigned char>(*begin))) {
+        ++begin;
+    }
+    if (begin < limit && *begin == '+' && begin + 1 < limit && begin[1] != '-') {
+        ++begin;
+    }
+    const auto result = std::from_chars(begin, limit, value);
+    if (result.ec != std::errc()) {
+        return false;
+    }
+    end = result.ptr;
+    return true;
+}
+
+double parse_float(std::string_view text) {
+    double value = 0.0;
+    const char* end = nullptr;
+    if (!parse_number(text.data(), text.data() + text.size(), value, end)) {
+        return 0.0;
+    }
+    return value;
+}
+
+// Calls visit(line) for every '\n'-terminated line of text, plus a final
+// unterminated one. Terminators are not included, as with std::getline.
+template <typename Visitor>
+void for_each_line(std::string_view text, Visitor&& visit) {
+    std::size_t start = 0;
+    while (start < text.size()) {
+        const auto newline = text.find('\n', start);
+        if (newline == std::string_view::npos) {
+            visit(text.substr(start));
+            return;
+        }
+        visit(text.substr(start, newline - start));
+        start = newline + 1;
+    }
+}
+
+// Read-only view of a whole file, memory-mapped when possible and read into
+// memory otherwise (pipes, empty or special files, mmap failures).
+class MappedFile {
+   public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        if (mapped_ != nullptr) {
+            munmap(mapped_, size_);
+        }
+    }
+
+    bool open(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* mapped = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ,
+                                MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                mapped_ = mapped;
+                size_ = static_cast<std::size_t>(info.st_size);
+                ::close(fd);
+                return true;
+            }
+        }
+        ::close(fd);
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream) {
+            return false;
+        }
+        copy_.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    std::string_view text() const {
+        if (mapped_ != nullptr) {
+            return std::string_view(static_cast<const char*>(mapped_), size_);
+        }
+        return copy_;
+    }
+
+   private:
+    void* mapped_ = nullptr;
+    std::size_t size_ = 0;
+    std::string copy_;
+};
+
+// Owns strings that do not exist in the input text (Gemmi fields, atom names
+// with embedded blanks) so AtomRecord can hold string_views to them.
+class StringArena {
+   public:
+    std::string_view keep(std::string value) {
+        strings_.push_back(std::move(value));
+        return strings_.back();
+    }
+
+   private:
+    std::deque<std::string> strings_;
+};
+
 struct RadiusEntry {
     std::string explicit_text{"0.01"};
     std::string united_text{"0.01"};
+    double explicit_radius = 0.01;
+    double united_radius = 0.01;
+
+    const std::string& text(bool use_united) const {
+        return use_united ? united_text : explicit_text;
+    }
+    double radius(bool use_united) const { return use_united ? united_radius : explicit_radius; }
+};
+
+// Matches one field of an atmtypenumbers line. Most fields are plain names or
+// '|' lists of names, which are compared directly instead of through the
+// regex engine. The comparison keeps the anchored-ERE meaning of "^a|b|c$":
+// the first name is a prefix, the last a suffix, and any middle name may
+// appear anywhere.
+class FieldMatcher {
+   public:
+    explicit FieldMatcher(const std::string& pattern) {
+        using namespace std::regex_constants;
+        if (pattern == ".*") {
+            kind_ = Kind::Any;
+            return;
+        }
+        if (pattern.find_first_of("[](){}.*+?^$\\") != std::string::npos) {
+            kind_ = Kind::Regex;
+            regex_ = std::regex("^" + pattern + "$", extended);
+            return;
+        }
+        kind_ = Kind::Names;
+        std::size_t start = 0;
+        while (true) {
+            const auto bar = pattern.find('|', start);
+            names_.push_back(pattern.substr(start, bar == std::string::npos ? bar : bar - start));
+            if (bar == std::string::npos) {
+                break;
+            }
+            start = bar + 1;
+        }
+    }
+
+    bool matches(const std::string& value) const {
+        switch (kind_) {
+            case Kind::Any:
+                return true;
+            case Kind::Regex:
+                return std::regex_search(value, regex_);
+            case Kind::Names:
+                break;
+        }
+        if (names_.size() == 1) {
+            return value == names_.front();
+        }
+        const std::string& first = names_.front();
+        const std::string& last = names_.back();
+        if (value.compare(0, first.size(), first) == 0) {
+            return true;
+        }
+        if (value.size() >= last.size() &&
+            value.compare(value.size() - last.size(), last.size(), last) == 0) {
+            return true;
+        }
+        for (std::size_t n = 1; n + 1 < names_.size(); ++n) {
+            if (value.find(names_[n]) != std::string::npos) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+   private:
+    enum class Kind { Any, Names, Regex };
+    Kind kind_ = Kind::Any;
+    std::vector<std::string> names_;
+    std::regex regex_;
 };
 
 struct PatternEntry {
-    std::regex residue;
-    std::regex atom;
-    std::string key;
+    FieldMatcher residue;
+    FieldMatcher atom;
+    const RadiusEntry* entry;
 };
 
 class AtomTypeLibrary {
    public:
     AtomTypeLibrary() { load(); }
 
-    std::pair<bool, std::string> radius_for(const std::string& residue,
-                                            const std::string& atom,
-                                            bool use_united) const {
-        for (const auto& entry : patterns_) {
-            if (std::regex_search(residue, entry.residue) &&
-                std::regex_search(atom, entry.atom)) {
-                const auto it = radii_.find(entry.key);
-                if (it != radii_.end()) {
-                    return {true, use_united ? it->second.united_text
-                                             : it->second.explicit_text};
-                }
+    // Radius entry of the first pattern matching (residue, atom). When none
+    // matches, found is false and entry is the 0.01 placeholder. Answers are
+    // cached per (residue, atom), so the pattern scan runs once per distinct
+    // pair; lookups are safe from several threads.
+    struct Match {
+        bool found;
+        const RadiusEntry* entry;
+    };
+
+    Match radius_for(std::string_view residue, std::string_view atom) const {
+        std::string key;
+        key.reserve(residue.size() + atom.size() + 1);
+        key.append(residue).append(1, '\t').append(atom);
+        {
+            std::shared_lock<std::shared_mutex> lock(cache_mutex_);
+            const auto it = cache_.find(key);
+            if (it != cache_.end()) {
+                return it->second;
+            }
+        }
+        const std::string residue_name(residue);
+        const std::string atom_name(atom);
+        Match match{false, &missing_};
+        for (const auto& pattern : patterns_) {
+            if (pattern.residue.matches(residue_name) && pattern.atom.matches(atom_name)) {
+                match = Match{true, pattern.entry};
+                break;
             }
         }
-        return {false, std::string("0.01")};
+        std::unique_lock<std::shared_mutex> lock(cache_mutex_);
+        cache_.emplace(std::move(key), match);
+        return match;
     }
 
    private:
     void load() {
-        using namespace std::regex_constants;
         std::istringstream input(vossvolvox::kAtmTypeNumbers);
         std::string line;
         while (std::getline(input, line)) {
@@ -135,7 +360,8 @@ class AtomTypeLibrary {
                         united_text = explicit_text;
                     }
                 }
-                radii_[key] = RadiusEntry{explicit_text, united_text};
+                radii_[key] = RadiusEntry{explicit_text, united_text,
+                                          parse_float(explicit_text), parse_float(united_text)};
                 continue;
             }
 
@@ -145,8 +371,6 @@ class AtomTypeLibrary {
             std::string residue_pattern = tokens[0] == "*" ? ".*" : tokens[0];
             std::string atom_pattern = tokens[1];
             std::replace(atom_pattern.begin(), atom_pattern.end(), '_', ' ');
-            residue_pattern = "^" + residue_pattern + "$";
-            atom_pattern = "^" + atom_pattern + "$";
 
             const std::string key = tokens[2];
             if (!radii_.count(key)) {
@@ -156,9 +380,9 @@ class AtomTypeLibrary {
             }
 
             try {
-                patterns_.push_back(PatternEntry{std::regex(residue_pattern, extended),
-                                                 std::regex(atom_pattern, extended),
-                                                 key});
+                patterns_.push_back(PatternEntry{FieldMatcher(residue_pattern),
+                                                 FieldMatcher(atom_pattern),
+                                                 &radii_[key]});
             } catch (const std::regex_error& err) {
                 std::cerr << "pdb_io: warning: invalid regex on line '" << line
                           << "': " << err.what() << "\n";
@@ -167,19 +391,25 @@ class AtomTypeLibrary {
     }
 
     std::vector<PatternEntry> patterns_;
+    // Node-based, so entry pointers held by patterns_ stay valid.
     std::unordered_map<std::string, RadiusEntry> radii_;
+    const RadiusEntry missing_{};
+    mutable std::shared_mutex cache_mutex_;
+    mutable std::unordered_map<std::string, Match> cache_;
 };
 
+// Fields of one ATOM/HETATM record. The views point into the mapped input
+// (or into a StringArena) and are only valid while that storage lives.
 struct AtomRecord {
-    std::string x;
-    std::string y;
-    std::string z;
-    std::string residue;
-    std::string atom;
-    std::string resnum;
-    std::string chain;
-    std::string element;
-    std::string record;
+    std::string_view x;
+    std::string_view y;
+    std::string_view z;
+    std::string_view residue;
+    std::string_view atom;
+    std::string_view resnum;
+    std::string_view chain;
+    std::string_view element;
+    std::string_view record;
 };
 
 struct ResidueInfo {
@@ -215,20 +445,13 @@ const std::unordered_set<std::string> kIonElements = {
     "HG", "CD", "SR", "CS", "BA", "YB", "MO", "RU", "OS", "IR", "AU", "AG", "PT", "TI",
     "AL", "GA", "V",  "W"};
 
-std::string normalize_atom_name(std::string raw) {
-    std::string padded = raw;
-    if (padded.size() < 2) {
-        padded.resize(2, ' ');
-    } else {
-        padded.resize(2);
-    }
-
+std::string_view normalize_atom_name(std::string_view raw, StringArena& arena) {
     const auto to_upper_local = [](char c) {
         return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
     };
 
-    const char c0 = padded[0];
-    const char c1 = padded[1];
+    const char c0 = raw.size() > 0 ? raw[0] : ' ';
+    const char c1 = raw.size() > 1 ? raw[1] : ' ';
     const bool first_blank_digit = (c0 == ' ' || std::isdigit(static_cast<unsigned char>(c0)) != 0);
     const bool second_h_like = (to_upper_local(c1) == 'H' || to_upper_local(c1) == 'D');
     if (first_blank_digit && second_h_like) {
@@ -240,15 +463,19 @@ std::string normalize_atom_name(std::string raw) {
         return "H";
     }
 
-    auto trimmed = trim(raw);
-    trimmed.erase(std::remove(trimmed.begin(), trimmed.end(), ' '), trimmed.end());
-    return trimmed;
+    const auto trimmed = trim(raw);
+    if (trimmed.find(' ') == std::string_view::npos) {
+        return trimmed;
+    }
+    std::string packed(trimmed);
+    packed.erase(std::remove(packed.begin(), packed.end(), ' '), packed.end());
+    return arena.keep(std::move(packed));
 }
 
 std::string make_residue_key(const AtomRecord& atom) {
-    std::ostringstream oss;
-    oss << to_upper(atom.chain) << '|' << atom.resnum << '|' << to_upper(atom.residue);
-    return oss.str();
+    std::string key = to_upper(atom.chain);
+    key.append(1, '|').append(atom.resnum).append(1, '|').append(to_upper(atom.residue));
+    return key;
 }
 
 bool looks_like_nucleic(const std::string& name) {
@@ -299,29 +526,113 @@ bool is_ion(const ResidueInfo& info) {
     return false;
 }
 
-std::unordered_map<std::string, ResidueInfo> classify_residues(const std::vector<AtomRecord>& atoms) {
-    std::unordered_map<std::string, ResidueInfo> residues;
-    for (const auto& atom : atoms) {
-        const std::string key = make_residue_key(atom);
-        auto& info = residues[key];
-        if (info.atom_count == 0) {
-            info.name = atom.residue;
-            info.chain = atom.chain;
-            info.resnum = atom.resnum;
+// Bytes of input text per parse chunk. Chunks end at line boundaries and
+// depend only on the text, so the output does not depend on the thread count.
+const std::size_t PARSE_CHUNK = std::size_t(1) << 20;
+
+// Splits text into pieces of about PARSE_CHUNK bytes, each ending just after
+// a '\n' (or at the end of the text).
+std::vector<std::string_view> split_into_chunks(std::string_view text) {
+    std::vector<std::string_view> chunks;
+    std::size_t start = 0;
+    while (start < text.size()) {
+        std::size_t stop = start + PARSE_CHUNK;
+        if (stop >= text.size()) {
+            stop = text.size();
+        } else {
+            const auto newline = text.find('\n', stop);
+            stop = newline == std::string_view::npos ? text.size() : newline + 1;
         }
+        chunks.push_back(text.substr(start, stop - start));
+        start = stop;
+    }
+    return chunks;
+}
+
+// Atoms parsed from one chunk, with the residues they belong to in
+// first-seen order. residue_of[n] indexes residues for atoms[n].
+struct AtomChunk {
+    std::vector<AtomRecord> atoms;
+    std::vector<int> residue_of;
+    std::vector<std::string> keys;
+    std::vector<ResidueInfo> residues;
+    StringArena arena;
+};
+
+// Accumulates per-residue counts and flags for one chunk. Consecutive atoms
+// of the same residue reuse its slot without building the key again.
+void classify_chunk(AtomChunk& chunk) {
+    std::unordered_map<std::string, int> index;
+    chunk.residue_of.resize(chunk.atoms.size());
+    const AtomRecord* previous = nullptr;
+    int slot = -1;
+    for (std::size_t n = 0; n < chunk.atoms.size(); ++n) {
+        const AtomRecord& atom = chunk.atoms[n];
+        if (previous == nullptr || atom.chain != previous->chain ||
+            atom.resnum != previous->resnum || atom.residue != previous->residue) {
+            std::string key = make_residue_key(atom);
+            const auto found = index.find(key);
+            if (found != index.end()) {
+                slot = found->second;
+            } else {
+                slot = static_cast<int>(chunk.residues.size());
+                index.emplace(key, slot);
+                chunk.keys.push_back(std::move(key));
+                chunk.residues.emplace_back();
+                auto& info = chunk.residues.back();
+                info.name = std::string(atom.residue);
+                info.chain = std::string(atom.chain);
+                info.resnum = std::string(atom.resnum);
+            }
+        }
+        previous = &atom;
+        chunk.residue_of[n] = slot;
+        auto& info = chunk.residues[slot];
         ++info.atom_count;
         if (!atom.element.empty()) {
             info.elements.insert(to_upper(atom.element));
         }
-        if (to_upper(atom.record) == "ATOM") {
+        if (equals_upper(atom.record, "ATOM")) {
             info.polymer_flag = true;
         }
-        if (to_upper(atom.record) != "HETATM") {
+        if (!equals_upper(atom.record, "HETATM")) {
             info.hetatm_only = false;
         }
     }
-    for (auto& entry : residues) {
-        auto& info = entry.second;
+}
+
+// Merges the chunk residues in chunk order (so names come from the first
+// occurrence, as in a single pass), classifies each residue once, and
+// points every chunk slot at its merged entry.
+std::vector<ResidueInfo> merge_residues(std::deque<AtomChunk>& chunks,
+                                        std::vector<std::vector<const ResidueInfo*>>& lookup) {
+    std::vector<ResidueInfo> residues;
+    std::unordered_map<std::string, int> index;
+    std::vector<std::vector<int>> global(chunks.size());
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+        auto& chunk = chunks[c];
+        global[c].resize(chunk.residues.size());
+        for (std::size_t r = 0; r < chunk.residues.size(); ++r) {
+            auto& local = chunk.residues[r];
+            const auto found = index.find(chunk.keys[r]);
+            if (found == index.end()) {
+                global[c][r] = static_cast<int>(residues.size());
+                index.emplace(std::move(chunk.keys[r]), global[c][r]);
+                residues.push_back(std::move(local));
+                continue;
+            }
+            global[c][r] = found->second;
+            auto& info = residues[found->second];
+            info.atom_count += local.atom_count;
+            info.elements.insert(local.elements.begin(), local.elements.end());
+            info.polymer_flag = info.polymer_flag || local.polymer_flag;
+            info.hetatm_only = info.hetatm_only && local.hetatm_only;
+        }
+    }
+    const int count = static_cast<int>(residues.size());
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (int r = 0; r < count; ++r) {
+        auto& info = residues[r];
         if (is_amino(info.name) || is_nucleic(info.name)) {
             info.polymer_flag = true;
         }
@@ -331,6 +642,13 @@ std::unordered_map<std::string, ResidueInfo> classify_residues(const std::vector
         info.is_ion = is_ion(info);
         info.is_ligand = !info.polymer_flag && !info.is_water && !info.is_ion;
     }
+    lookup.assign(chunks.size(), {});
+    for (std::size_t c = 0; c < chunks.size(); ++c) {
+        lookup[c].reserve(global[c].size());
+        for (const int r : global[c]) {
+            lookup[c].push_back(&residues[r]);
+        }
+    }
     return residues;
 }
 
@@ -356,72 +674,127 @@ bool should_filter(const ResidueInfo& info, const Filters& filters) {
     return false;
 }
 
-double parse_float(const std::string& text) {
-    try {
-        return std::stod(text);
-    } catch (...) {
-        return 0.0;
+// Radius lookups of one chunk, keyed by views into the chunk's own storage.
+// A chunk repeats a few dozen (residue, atom) pairs thousands of times, so
+// only the first sight of each pair builds a key and takes the library lock.
+class ChunkRadii {
+   public:
+    explicit ChunkRadii(const AtomTypeLibrary& library) : library_(library) {}
+
+    AtomTypeLibrary::Match lookup(std::string_view residue, std::string_view atom) {
+        const Key key{residue, atom};
+        const auto it = memo_.find(key);
+        if (it != memo_.end()) {
+            return it->second;
+        }
+        const auto match = library_.radius_for(residue, atom);
+        memo_.emplace(key, match);
+        return match;
     }
-}
 
-void emit_atoms(const std::vector<AtomRecord>& atoms,
+   private:
+    using Key = std::pair<std::string_view, std::string_view>;
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const {
+            const std::size_t h = std::hash<std::string_view>()(key.first);
+            return h ^ (std::hash<std::string_view>()(key.second) + 0x9e3779b9 + (h << 6) + (h >> 2));
+        }
+    };
+
+    const AtomTypeLibrary& library_;
+    std::unordered_map<Key, AtomTypeLibrary::Match, KeyHash> memo_;
+};
+
+// Converted output of one chunk, buffered so chunks can run in parallel and
+// still be written in input order.
+struct ChunkOutput {
+    std::string text;
+    std::string warnings;
+    std::vector<XyzrAtom> atoms;
+};
+
+void emit_atoms(std::deque<AtomChunk>& chunks,
                 const std::string& label,
                 const AtomTypeLibrary& library,
                 const ConversionOptions& options,
                 std::ostream* output,
-                std::vector<XyzrAtom>* sink) {
-    if (atoms.empty()) {
+                XyzrSink* sink) {
+    const int nchunks = static_cast<int>(chunks.size());
+    std::size_t total = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:total)
+    for (int c = 0; c < nchunks; ++c) {
+        classify_chunk(chunks[c]);
+        total += chunks[c].atoms.size();
+    }
+    if (total == 0) {
         return;
     }
-    const auto residues = classify_residues(atoms);
-    for (const auto& atom : atoms) {
-        const auto key = make_residue_key(atom);
-        const auto residue_it = residues.find(key);
-        const ResidueInfo* info = residue_it != residues.end() ? &residue_it->second : nullptr;
-        if (info && should_filter(*info, options.filters)) {
-            continue;
+    std::vector<std::vector<const ResidueInfo*>> lookup;
+    const auto residues = merge_residues(chunks, lookup);
+
+    std::vector<ChunkOutput> results(chunks.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < nchunks; ++c) {
+        const AtomChunk& chunk = chunks[c];
+        ChunkOutput& result = results[c];
+        ChunkRadii radii(library);
+        for (std::size_t n = 0; n < chunk.atoms.size(); ++n) {
+            const AtomRecord& atom = chunk.atoms[n];
+            if (should_filter(*lookup[c][chunk.residue_of[n]], options.filters)) {
+                continue;
+            }
+            const auto match = radii.lookup(atom.residue, atom.atom);
+            if (!match.found) {
+                result.warnings.append("pdb_to_xyzr: error, file ").append(label)
+                    .append(" residue ").append(atom.resnum)
+                    .append(" atom pattern ").append(atom.residue).append(1, ' ').append(atom.atom)
+                    .append(" was not found in embedded atmtypenumbers\n");
+            }
+            if (output) {
+                result.text.append(atom.x).append(1, ' ').append(atom.y).append(1, ' ')
+                    .append(atom.z).append(1, ' ')
+                    .append(match.entry->text(options.use_united)).append(1, '\n');
+            }
+            if (sink) {
+                result.atoms.push_back(XyzrAtom{parse_float(atom.x), parse_float(atom.y),
+                                                parse_float(atom.z),
+                                                match.entry->radius(options.use_united)});
+            }
         }
-        const auto result = library.radius_for(atom.residue, atom.atom, options.use_united);
-        if (!result.first) {
-            std::cerr << "pdb_to_xyzr: error, file " << label << " residue " << atom.resnum
-                      << " atom pattern " << atom.residue << ' ' << atom.atom
-                      << " was not found in embedded atmtypenumbers" << std::endl;
+    }
+
+    if (sink) {
+        sink->reserve(total);
+    }
+    for (const auto& result : results) {
+        if (!result.warnings.empty()) {
+            std::cerr << result.warnings << std::flush;
         }
         if (output) {
-            *output << atom.x << ' ' << atom.y << ' ' << atom.z << ' ' << result.second << '\n';
+            output->write(result.text.data(), static_cast<std::streamsize>(result.text.size()));
         }
         if (sink) {
-            sink->push_back(
-                XyzrAtom{parse_float(atom.x), parse_float(atom.y), parse_float(atom.z),
-                         parse_float(result.second)});
+            for (const auto& atom : result.atoms) {
+                sink->add(atom.x, atom.y, atom.z, atom.radius);
+            }
         }
     }
 }
 
-bool convert_stream_impl(const AtomTypeLibrary& library,
-                         std::istream& input,
-                         const std::string& label,
-                         const ConversionOptions& options,
-                         std::ostream* output,
-                         std::vector<XyzrAtom>* sink) {
-    std::string line;
-    std::vector<AtomRecord> atoms;
-    while (std::getline(input, line)) {
+void parse_pdb_chunk(std::string_view text, AtomChunk& chunk) {
+    for_each_line(text, [&](std::string_view line) {
         if (line.size() < 6) {
-            continue;
-        }
-        auto record = trim(line.substr(0, 6));
-        std::transform(record.begin(), record.end(), record.begin(), [](char c) {
-            return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
-        });
-        if (record != "ATOM" && record != "HETATM") {
-            continue;
-        }
-        const std::string raw_x = get_field(line, 30, 8);
-        const std::string raw_y = get_field(line, 38, 8);
-        const std::string raw_z = get_field(line, 46, 8);
+            return;
+        }
+        const auto record = trim(line.substr(0, 6));
+        if (!equals_upper(record, "ATOM") && !equals_upper(record, "HETATM")) {
+            return;
+        }
+        const auto raw_x = get_field(line, 30, 8);
+        const auto raw_y = get_field(line, 38, 8);
+        const auto raw_z = get_field(line, 46, 8);
         if (trim(raw_x).empty() || trim(raw_y).empty() || trim(raw_z).empty()) {
-            continue;
+            return;
         }
         AtomRecord atom;
         atom.record = record;
@@ -429,50 +802,328 @@ bool convert_stream_impl(const AtomTypeLibrary& library,
         atom.y = raw_y;
         atom.z = raw_z;
         atom.residue = trim(get_field(line, 17, 3));
-        atom.atom = normalize_atom_name(get_field(line, 12, 4));
+        atom.atom = normalize_atom_name(get_field(line, 12, 4), chunk.arena);
         atom.resnum = trim(get_field(line, 22, 4));
         atom.chain = trim(get_field(line, 21, 1));
         atom.element = trim(get_field(line, 76, 2));
         if (atom.element.empty() && !atom.atom.empty()) {
-            atom.element = to_upper(atom.atom.substr(0, 1));
+            atom.element = chunk.arena.keep(to_upper(atom.atom.substr(0, 1)));
         }
-        atoms.push_back(std::move(atom));
+        chunk.atoms.push_back(atom);
+    });
+}
+
+bool convert_text_impl(const AtomTypeLibrary& library,
+                       std::string_view text,
+                       const std::string& label,
+                       const ConversionOptions& options,
+                       std::ostream* output,
+                       XyzrSink* sink) {
+    const auto pieces = split_into_chunks(text);
+    const int npieces = static_cast<int>(pieces.size());
+    std::deque<AtomChunk> chunks(pieces.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < npieces; ++c) {
+        parse_pdb_chunk(pieces[c], chunks[c]);
     }
-    emit_atoms(atoms, label, library, options, output, sink);
+    emit_atoms(chunks, label, library, options, output, sink);
     return true;
 }
 
+// Plain XYZR text: four numbers per line, other lines are skipped.
+void parse_xyzr_chunk(std::string_view text, std::vector<XyzrAtom>& atoms) {
+    for_each_line(text, [&](std::string_view line) {
+        const char* cursor = line.data();
+        const char* limit = line.data() + line.size();
+        double values[4];
+        for (double& value : values) {
+            if (!parse_number(cursor, limit, value, cursor)) {
+                return;
+            }
+        }
+        atoms.push_back(XyzrAtom{values[0], values[1], values[2], values[3]});
+    });
+}
+
+template <typename Chunks>
+void feed_xyzr_chunks(const Chunks& parsed, XyzrSink& sink) {
+    std::size_t total = 0;
+    for (const auto& atoms : parsed) {
+        total += atoms.size();
+    }
+    sink.reserve(total);
+    for (const auto& atoms : parsed) {
+        for (const auto& atom : atoms) {
+            sink.add(atom.x, atom.y, atom.z, atom.radius);
+        }
+    }
+}
+
+void parse_xyzr_text(std::string_view text, XyzrSink& sink) {
+    const auto pieces = split_into_chunks(text);
+    const int npieces = static_cast<int>(pieces.size());
+    std::vector<std::vector<XyzrAtom>> parsed(pieces.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < npieces; ++c) {
+        parse_xyzr_chunk(pieces[c], parsed[c]);
+    }
+    feed_xyzr_chunks(parsed, sink);
+}
+
+bool is_gzip_file(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    unsigned char magic[2] = {0, 0};
+    input.read(reinterpret_cast<char*>(magic), 2);
+    return input.gcount() == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+// Inflates a gzip file on a background thread into blocks of about
+// PARSE_CHUNK bytes that end at line boundaries, so the parser can work on
+// one batch of blocks while the next is being decompressed. At most
+// kMaxPending blocks wait in the queue, which bounds memory use.
+class GzipBlockReader {
+   public:
+    explicit GzipBlockReader(const std::string& path) : path_(path) {
+        file_ = gzopen(path.c_str(), "rb");
+        if (file_ == nullptr) {
+            failed_ = true;
+            done_ = true;
+            return;
+        }
+        gzbuffer(file_, 1 << 17);
+        worker_ = std::thread([this]() { inflate_all(); });
+    }
+
+    ~GzipBlockReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        space_.notify_all();
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+        if (file_ != nullptr) {
+            gzclose(file_);
+        }
+    }
+
+    // Moves every ready block to the end of blocks, waiting for at least one.
+    // Returns the number moved; 0 means the end of the input.
+    std::size_t next_batch(std::deque<std::string>& blocks) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return !pending_.empty() || done_; });
+        const std::size_t count = pending_.size();
+        for (auto& block : pending_) {
+            blocks.push_back(std::move(block));
+        }
+        pending_.clear();
+        lock.unlock();
+        space_.notify_all();
+        return count;
+    }
+
+    bool failed() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return failed_;
+    }
+
+    const std::string& error() const { return error_; }
+
+   private:
+    static const std::size_t kMaxPending = 16;
+
+    void push(std::string block) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_.wait(lock, [this]() { return pending_.size() < kMaxPending || stop_; });
+        pending_.push_back(std::move(block));
+        lock.unlock();
+        ready_.notify_one();
+    }
+
+    void finish(bool failed, std::string error) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            failed_ = failed;
+            error_ = std::move(error);
+            done_ = true;
+        }
+        ready_.notify_all();
+    }
+
+    void inflate_all() {
+        std::string carry;
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stop_) {
+                    break;
+                }
+            }
+            const std::size_t start = carry.size();
+            carry.resize(start + PARSE_CHUNK);
+            const int got = gzread(file_, &carry[start], static_cast<unsigned>(PARSE_CHUNK));
+            if (got < 0) {
+                int code = 0;
+                const char* message = gzerror(file_, &code);
+                finish(true, message != nullptr ? message : "read error");
+                return;
+            }
+            carry.resize(start + static_cast<std::size_t>(got));
+            if (got == 0) {
+                // A truncated stream ends like a complete one; zlib flags it here.
+                int code = Z_OK;
+                const char* message = gzerror(file_, &code);
+                if (code != Z_OK) {
+                    finish(true, message != nullptr ? message : "read error");
+                    return;
+                }
+                break;
+            }
+            const auto newline = carry.rfind('\n');
+            if (newline == std::string::npos) {
+                continue;
+            }
+            std::string rest = carry.substr(newline + 1);
+            carry.resize(newline + 1);
+            push(std::move(carry));
+            carry = std::move(rest);
+        }
+        if (!carry.empty()) {
+            push(std::move(carry));
+        }
+        finish(false, std::string());
+    }
+
+    std::string path_;
+    gzFile file_ = nullptr;
+    std::thread worker_;
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable space_;
+    std::deque<std::string> pending_;
+    bool done_ = false;
+    bool stop_ = false;
+    bool failed_ = false;
+    std::string error_;
+};
+
+bool report_gzip_failure(const GzipBlockReader& reader, const std::string& path) {
+    if (!reader.failed()) {
+        return false;
+    }
+    // zlib messages already start with the file name.
+    if (reader.error().empty()) {
+        std::cerr << "pdb_io: unable to decompress '" << path << "'" << std::endl;
+    } else {
+        std::cerr << "pdb_io: unable to decompress " << reader.error() << std::endl;
+    }
+    return true;
+}
+
+// PDB conversion of a gzip file. Each batch of inflated blocks is parsed in
+// parallel while the reader thread inflates the next one.
+bool convert_gzip_impl(const AtomTypeLibrary& library,
+                       const std::string& path,
+                       const ConversionOptions& options,
+                       std::ostream* output,
+                       XyzrSink* sink) {
+    GzipBlockReader reader(path);
+    std::deque<std::string> blocks;
+    std::deque<AtomChunk> chunks;
+    while (true) {
+        const std::size_t first = blocks.size();
+        const std::size_t count = reader.next_batch(blocks);
+        if (count == 0) {
+            break;
+        }
+        chunks.resize(blocks.size());
+        const int n = static_cast<int>(count);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int b = 0; b < n; ++b) {
+            parse_pdb_chunk(blocks[first + b], chunks[first + b]);
+        }
+    }
+    if (report_gzip_failure(reader, path)) {
+        return false;
+    }
+    emit_atoms(chunks, path, library, options, output, sink);
+    return true;
+}
+
+bool parse_xyzr_gzip(const std::string& path, XyzrSink& sink) {
+    GzipBlockReader reader(path);
+    std::deque<std::string> blocks;
+    std::deque<std::vector<XyzrAtom>> parsed;
+    while (true) {
+        const std::size_t first = blocks.size();
+        const std::size_t count = reader.next_batch(blocks);
+        if (count == 0) {
+            break;
+        }
+        parsed.resize(blocks.size());
+        const int n = static_cast<int>(count);
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int b = 0; b < n; ++b) {
+            parse_xyzr_chunk(blocks[first + b], parsed[first + b]);
+        }
+        // Parsed text is no longer needed; XYZR atoms hold no views into it.
+        for (std::size_t b = first; b < blocks.size(); ++b) {
+            std::string().swap(blocks[b]);
+        }
+    }
+    if (report_gzip_failure(reader, path)) {
+        return false;
+    }
+    feed_xyzr_chunks(parsed, sink);
+    return true;
+}
+
+class VectorSink : public XyzrSink {
+   public:
+    explicit VectorSink(std::vector<XyzrAtom>& atoms) : atoms_(atoms) {}
+    void reserve(std::size_t count) override { atoms_.reserve(atoms_.size() + count); }
+    void add(double x, double y, double z, double radius) override {
+        atoms_.push_back(XyzrAtom{x, y, z, radius});
+    }
+
+   private:
+    std::vector<XyzrAtom>& atoms_;
+};
+
 #if VOSS_HAVE_GEMMI
 bool convert_with_gemmi_impl(const AtomTypeLibrary& library,
                              const std::string& path,
                              const ConversionOptions& options,
                              std::ostream* output,
-                             std::vector<XyzrAtom>* sink) {
+                             XyzrSink* sink) {
     try {
         gemmi::Structure structure = gemmi::read_structure(path);
-        std::vector<AtomRecord> atoms;
+        std::deque<AtomChunk> chunks(1);
+        auto& atoms = chunks[0].atoms;
+        auto& arena = chunks[0].arena;
         for (const auto& model : structure.models) {
             for (const auto& chain : model.chains) {
                 for (const auto& residue : chain.residues) {
-                    const std::string residue_name = trim(residue.name);
-                    const std::string resnum = trim(residue.seqid.str());
+                    const std::string_view residue_name = trim(residue.name);
+                    const std::string_view resnum = trim(arena.keep(residue.seqid.str()));
                     for (const auto& atom : residue.atoms) {
                         AtomRecord record;
-                        record.x = format_coordinate(atom.pos.x);
-                        record.y = format_coordinate(atom.pos.y);
-                        record.z = format_coordinate(atom.pos.z);
+                        record.x = arena.keep(format_coordinate(atom.pos.x));
+                        record.y = arena.keep(format_coordinate(atom.pos.y));
+                        record.z = arena.keep(format_coordinate(atom.pos.z));
                         record.residue = residue_name;
-                        record.atom = normalize_atom_name(atom.name);
+                        record.atom = normalize_atom_name(atom.name, arena);
                         record.resnum = resnum;
                         record.chain = chain.name;
-                        record.element = to_upper(atom.element.name());
+                        record.element = arena.keep(to_upper(atom.element.name()));
                         record.record = atom.het_flag == 'H' ? "HETATM" : "ATOM";
-                        atoms.push_back(std::move(record));
+                        atoms.push_back(record);
                     }
                 }
             }
         }
-        emit_atoms(atoms, path, library, options, output, sink);
+        emit_atoms(chunks, path, library, options, output, sink);
         return true;
     } catch (const std::exception& ex) {
         std::cerr << "pdb_to_xyzr: Gemmi failed to read '" << path << "': " << ex.what()
@@ -502,6 +1153,280 @@ bool has_extension(std::string path, std::initializer_list<const char*> exts) {
     return false;
 }
 
+const char kBinaryXyzrMagic[8] = {'V', 'V', 'X', 'Y', 'Z', 'R', 'B', '\0'};
+const std::uint32_t kBinaryXyzrVersion = 1;
+
+// Conversion settings packed into the binary header and cache key.
+std::uint32_t settings_bits(const ConversionOptions& options) {
+    const Filters& f = options.filters;
+    return (options.use_united ? 1u : 0u) | (f.exclude_ions ? 2u : 0u) |
+           (f.exclude_ligands ? 4u : 0u) | (f.exclude_hetatm ? 8u : 0u) |
+           (f.exclude_water ? 16u : 0u) | (f.exclude_nucleic_acids ? 32u : 0u) |
+           (f.exclude_amino_acids ? 64u : 0u);
+}
+
+// 64-bit FNV-style hash of the file content, eight bytes per step.
+std::uint64_t hash_text(std::string_view text) {
+    std::uint64_t hash = 0xcbf29ce484222325ull ^ text.size();
+    std::size_t pos = 0;
+    for (; pos + 8 <= text.size(); pos += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, text.data() + pos, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+    for (; pos < text.size(); ++pos) {
+        hash = (hash ^ static_cast<unsigned char>(text[pos])) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Atoms held as the float32 columns of a binary XYZR file.
+struct FloatColumns {
+    std::vector<float> x, y, z, r;
+};
+
+class FloatColumnsSink : public XyzrSink {
+   public:
+    explicit FloatColumnsSink(FloatColumns& columns) : columns_(columns) {}
+    void reserve(std::size_t count) override {
+        columns_.x.reserve(count);
+        columns_.y.reserve(count);
+        columns_.z.reserve(count);
+        columns_.r.reserve(count);
+    }
+    void add(double x, double y, double z, double radius) override {
+        columns_.x.push_back(static_cast<float>(x));
+        columns_.y.push_back(static_cast<float>(y));
+        columns_.z.push_back(static_cast<float>(z));
+        columns_.r.push_back(static_cast<float>(radius));
+    }
+
+   private:
+    FloatColumns& columns_;
+};
+
+// Writes to a temporary name and renames it into place, so readers never
+// see a partial file when several tools fill one cache directory.
+bool write_binary_xyzr(const std::string& path,
+                       const FloatColumns& columns,
+                       std::uint32_t settings,
+                       std::uint64_t source_hash) {
+    BinaryXyzrHeader header{};
+    std::memcpy(header.magic, kBinaryXyzrMagic, sizeof(header.magic));
+    header.version = kBinaryXyzrVersion;
+    header.settings = settings;
+    header.count = columns.x.size();
+    header.source_hash = source_hash;
+    for (int axis = 0; axis < 3; ++axis) {
+        const auto& values = axis == 0 ? columns.x : axis == 1 ? columns.y : columns.z;
+        const auto bounds = std::minmax_element(values.begin(), values.end());
+        header.min[axis] = values.empty() ? 0.0f : *bounds.first;
+        header.max[axis] = values.empty() ? 0.0f : *bounds.second;
+    }
+
+    const std::string temp = path + ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream output(temp, std::ios::binary);
+        if (!output) {
+            return false;
+        }
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto* values : {&columns.x, &columns.y, &columns.z, &columns.r}) {
+            output.write(reinterpret_cast<const char*>(values->data()),
+                         static_cast<std::streamsize>(values->size() * sizeof(float)));
+        }
+        if (!output) {
+            output.close();
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Returns the header of a well-formed binary XYZR image, or nullptr.
+const BinaryXyzrHeader* binary_xyzr_header(std::string_view text) {
+    if (text.size() < sizeof(BinaryXyzrHeader)) {
+        return nullptr;
+    }
+    const auto* header = reinterpret_cast<const BinaryXyzrHeader*>(text.data());
+    if (std::memcmp(header->magic, kBinaryXyzrMagic, sizeof(header->magic)) != 0 ||
+        header->version != kBinaryXyzrVersion ||
+        header->count > (text.size() - sizeof(BinaryXyzrHeader)) / (4 * sizeof(float))) {
+        return nullptr;
+    }
+    return header;
+}
+
+void feed_binary_xyzr(std::string_view text, const BinaryXyzrHeader& header, XyzrSink& sink) {
+    const std::size_t count = static_cast<std::size_t>(header.count);
+    const char* columns = text.data() + sizeof(BinaryXyzrHeader);
+    sink.reserve(count);
+    for (std::size_t n = 0; n < count; ++n) {
+        float values[4];
+        for (int c = 0; c < 4; ++c) {
+            std::memcpy(&values[c], columns + (c * count + n) * sizeof(float), sizeof(float));
+        }
+        sink.add(values[0], values[1], values[2], values[3]);
+    }
+}
+
+std::uint32_t swap_bytes(std::uint32_t value) {
+    return (value >> 24) | ((value >> 8) & 0xff00u) | ((value << 8) & 0xff0000u) | (value << 24);
+}
+
+// DCD trajectory (CHARMM, NAMD, LAMMPS): Fortran records framed by 4-byte
+// length markers, in either byte order. Each frame is an optional unit-cell
+// record, then X, Y and Z records of float32, then an optional fourth
+// dimension record.
+class DcdFile {
+   public:
+    DcdFile() = default;
+    DcdFile(const DcdFile&) = delete;
+    DcdFile& operator=(const DcdFile&) = delete;
+    ~DcdFile() {
+        if (file_ != nullptr) {
+            std::fclose(file_);
+        }
+    }
+
+    bool open(const std::string& path) {
+        file_ = std::fopen(path.c_str(), "rb");
+        if (file_ == nullptr) {
+            return fail(path, "unable to open");
+        }
+        std::vector<char> record;
+        if (read_record(record, true) != 1 || record.size() != 84 ||
+            std::memcmp(record.data(), "CORD", 4) != 0) {
+            return fail(path, "not a DCD trajectory");
+        }
+        std::uint32_t icntrl[20];
+        std::memcpy(icntrl, record.data() + 4, sizeof(icntrl));
+        for (auto& value : icntrl) {
+            value = swap_ ? swap_bytes(value) : value;
+        }
+        if (icntrl[8] != 0) {
+            return fail(path, "fixed atoms are not supported");
+        }
+        const bool charmm = icntrl[19] != 0;
+        has_cell_ = charmm && icntrl[10] != 0;
+        has_4d_ = charmm && icntrl[11] != 0;
+        std::uint32_t count = 0;
+        if (read_record(record, false) != 1 || read_record(record, false) != 1 ||
+            record.size() != sizeof(count)) {
+            return fail(path, "truncated header");
+        }
+        std::memcpy(&count, record.data(), sizeof(count));
+        atoms_ = swap_ ? swap_bytes(count) : count;
+        first_frame_ = std::ftell(file_);
+        return true;
+    }
+
+    std::size_t atoms() const { return atoms_; }
+
+    // Reads the next frame's coordinates. Returns 1, 0 at the end of the
+    // file, or -1 for a short or malformed frame.
+    int next(std::vector<float>& x, std::vector<float>& y, std::vector<float>& z) {
+        std::vector<char> record;
+        const std::size_t bytes = atoms_ * sizeof(float);
+        int status = 1;
+        if (has_cell_) {
+            status = read_record(record, false);
+            if (status != 1) {
+                return status;
+            }
+        }
+        std::vector<float>* axes[3] = {&x, &y, &z};
+        for (int axis = 0; axis < 3; ++axis) {
+            status = read_record(record, false);
+            if (status == 0 && axis == 0 && !has_cell_) {
+                return 0;
+            }
+            if (status != 1 || record.size() != bytes) {
+                return -1;
+            }
+            axes[axis]->resize(atoms_);
+            std::memcpy(axes[axis]->data(), record.data(), bytes);
+            if (swap_) {
+                for (float& value : *axes[axis]) {
+                    std::uint32_t raw;
+                    std::memcpy(&raw, &value, sizeof(raw));
+                    raw = swap_bytes(raw);
+                    std::memcpy(&value, &raw, sizeof(raw));
+                }
+            }
+        }
+        if (has_4d_ && read_record(record, false) != 1) {
+            return -1;
+        }
+        return 1;
+    }
+
+    bool rewind() { return std::fseek(file_, first_frame_, SEEK_SET) == 0; }
+
+   private:
+    bool fail(const std::string& path, const char* reason) {
+        std::cerr << "pdb_io: " << reason << ": '" << path << "'" << std::endl;
+        return false;
+    }
+
+    // Returns 1, 0 at a clean end of file, or -1. The first record of a file
+    // is 84 bytes long, which also tells the byte order.
+    int read_record(std::vector<char>& record, bool first) {
+        std::uint32_t length = 0;
+        if (std::fread(&length, sizeof(length), 1, file_) != 1) {
+            return 0;
+        }
+        if (first) {
+            swap_ = length != 84 && swap_bytes(length) == 84;
+        }
+        length = swap_ ? swap_bytes(length) : length;
+        if (length > (1u << 30)) {
+            return -1;
+        }
+        record.resize(length);
+        std::uint32_t trailer = 0;
+        if (std::fread(record.data(), 1, length, file_) != length ||
+            std::fread(&trailer, sizeof(trailer), 1, file_) != 1 ||
+            (swap_ ? swap_bytes(trailer) : trailer) != length) {
+            return -1;
+        }
+        return 1;
+    }
+
+    std::FILE* file_ = nullptr;
+    bool swap_ = false;
+    bool has_cell_ = false;
+    bool has_4d_ = false;
+    std::size_t atoms_ = 0;
+    long first_frame_ = 0;
+};
+
+// Offset of the first line at or after from that starts with ENDMDL, or npos.
+std::size_t find_endmdl(std::string_view text, std::size_t from) {
+    while (true) {
+        const auto found = text.find("ENDMDL", from);
+        if (found == std::string_view::npos || found == 0 || text[found - 1] == '\n') {
+            return found;
+        }
+        from = found + 1;
+    }
+}
+
+bool has_atom_records(std::string_view text) {
+    bool found = false;
+    for_each_line(text, [&](std::string_view line) {
+        const auto record = trim(line.substr(0, std::min<std::size_t>(6, line.size())));
+        found = found || equals_upper(record, "ATOM") || equals_upper(record, "HETATM");
+    });
+    return found;
+}
+
 }  // namespace
 
 struct PdbToXyzrConverter::Impl {
@@ -515,17 +1440,21 @@ bool PdbToXyzrConverter::ConvertStream(std::istream& input,
                                        const std::string& label,
                                        const ConversionOptions& options,
                                        std::ostream& output) const {
-    return convert_stream_impl(impl_->library, input, label, options, &output, nullptr);
+    const std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    return convert_text_impl(impl_->library, text, label, options, &output, nullptr);
 }
 
 bool PdbToXyzrConverter::ConvertFile(const std::string& path,
                                      const ConversionOptions& options,
                                      std::ostream& output) const {
-    std::ifstream stream(path);
-    if (!stream) {
+    if (is_gzip_file(path)) {
+        return convert_gzip_impl(impl_->library, path, options, &output, nullptr);
+    }
+    MappedFile file;
+    if (!file.open(path)) {
         return false;
     }
-    return ConvertStream(stream, path, options, output);
+    return convert_text_impl(impl_->library, file.text(), path, options, &output, nullptr);
 }
 
 bool PdbToXyzrConverter::ConvertStreamToAtoms(std::istream& input,
@@ -533,17 +1462,30 @@ bool PdbToXyzrConverter::ConvertStreamToAtoms(std::istream& input,
                                               const ConversionOptions& options,
                                               std::vector<XyzrAtom>& atoms) const {
     atoms.clear();
-    return convert_stream_impl(impl_->library, input, label, options, nullptr, &atoms);
+    const std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    VectorSink sink(atoms);
+    return convert_text_impl(impl_->library, text, label, options, nullptr, &sink);
 }
 
 bool PdbToXyzrConverter::ConvertFileToAtoms(const std::string& path,
                                             const ConversionOptions& options,
                                             std::vector<XyzrAtom>& atoms) const {
-    std::ifstream stream(path);
-    if (!stream) {
+    atoms.clear();
+    VectorSink sink(atoms);
+    return ConvertFileToSink(path, options, sink);
+}
+
+bool PdbToXyzrConverter::ConvertFileToSink(const std::string& path,
+                                           const ConversionOptions& options,
+                                           XyzrSink& sink) const {
+    if (is_gzip_file(path)) {
+        return convert_gzip_impl(impl_->library, path, options, nullptr, &sink);
+    }
+    MappedFile file;
+    if (!file.open(path)) {
         return false;
     }
-    return ConvertStreamToAtoms(stream, path, options, atoms);
+    return convert_text_impl(impl_->library, file.text(), path, options, nullptr, &sink);
 }
 
 #if VOSS_HAVE_GEMMI
@@ -557,7 +1499,14 @@ bool PdbToXyzrConverter::ConvertWithGemmiToAtoms(const std::string& path,
                                                  const ConversionOptions& options,
                                                  std::vector<XyzrAtom>& atoms) const {
     atoms.clear();
-    return convert_with_gemmi_impl(impl_->library, path, options, nullptr, &atoms);
+    VectorSink sink(atoms);
+    return convert_with_gemmi_impl(impl_->library, path, options, nullptr, &sink);
+}
+
+bool PdbToXyzrConverter::ConvertWithGemmiToSink(const std::string& path,
+                                                const ConversionOptions& options,
+                                                XyzrSink& sink) const {
+    return convert_with_gemmi_impl(impl_->library, path, options, nullptr, &sink);
 }
 #endif
 
@@ -573,33 +1522,27 @@ bool IsXyzrFile(const std::string& path) {
     return has_extension(path, {".xyzr", ".xyz"});
 }
 
-bool LoadStructureAsXyzr(const std::string& path,
-                         const ConversionOptions& options,
-                         std::vector<XyzrAtom>& atoms) {
-    atoms.clear();
-    PdbToXyzrConverter converter;
-    if (IsXyzrFile(path)) {
-        std::ifstream input(path);
-        if (!input) {
-            return false;
-        }
-        std::string line;
-        while (std::getline(input, line)) {
-            if (line.empty()) {
-                continue;
-            }
-            std::istringstream iss(line);
-            double x, y, z, r;
-            if (!(iss >> x >> y >> z >> r)) {
-                continue;
-            }
-            atoms.push_back(XyzrAtom{x, y, z, r});
-        }
-        return true;
-    }
+bool IsBinaryXyzrFile(const std::string& path) {
+    return has_extension(path, {".xyzrb"});
+}
+
+bool IsDcdFile(const std::string& path) {
+    return has_extension(path, {".dcd"});
+}
+
+namespace {
 
+// One converter per process: building the atom-type library compiles every
+// radius pattern, which costs more than converting a small structure.
+const PdbToXyzrConverter& shared_converter() {
+    static const PdbToXyzrConverter converter;
+    return converter;
+}
+
+bool load_uncached(const std::string& path, const ConversionOptions& options, XyzrSink& sink) {
+    const PdbToXyzrConverter& converter = shared_converter();
 #if VOSS_HAVE_GEMMI
-    if (converter.ConvertWithGemmiToAtoms(path, options, atoms)) {
+    if (converter.ConvertWithGemmiToSink(path, options, sink)) {
         return true;
     }
     if (IsMmcifFile(path) || IsPdbmlFile(path)) {
@@ -612,7 +1555,95 @@ bool LoadStructureAsXyzr(const std::string& path,
         return false;
     }
 #endif
-    return converter.ConvertFileToAtoms(path, options, atoms);
+    return converter.ConvertFileToSink(path, options, sink);
+}
+
+// Serves a structure from options.cache_dir, converting and storing it on a
+// miss. The entry name combines the content hash and the settings, and the
+// header repeats both, so a renamed or edited source never reuses stale atoms.
+bool load_through_cache(const std::string& path, const ConversionOptions& options, XyzrSink& sink) {
+    std::uint64_t source_hash = 0;
+    {
+        MappedFile source;
+        if (!source.open(path)) {
+            return false;
+        }
+        source_hash = hash_text(source.text());
+    }
+    const std::uint32_t settings = settings_bits(options);
+    char name[64];
+    std::snprintf(name, sizeof(name), "%016llx-%02x.xyzrb",
+                  static_cast<unsigned long long>(source_hash), settings);
+    const std::string cache_path = options.cache_dir + "/" + name;
+
+    MappedFile cached;
+    if (cached.open(cache_path)) {
+        const BinaryXyzrHeader* header = binary_xyzr_header(cached.text());
+        if (header && header->source_hash == source_hash && header->settings == settings) {
+            feed_binary_xyzr(cached.text(), *header, sink);
+            return true;
+        }
+    }
+
+    FloatColumns columns;
+    FloatColumnsSink collect(columns);
+    if (!load_uncached(path, options, collect)) {
+        return false;
+    }
+    ::mkdir(options.cache_dir.c_str(), 0777);
+    if (!write_binary_xyzr(cache_path, columns, settings, source_hash)) {
+        std::cerr << "pdb_io: warning, unable to write cache file '" << cache_path << "'"
+                  << std::endl;
+    }
+    // Hand out the float values so a miss and a later hit give the same atoms.
+    sink.reserve(columns.x.size());
+    for (std::size_t n = 0; n < columns.x.size(); ++n) {
+        sink.add(columns.x[n], columns.y[n], columns.z[n], columns.r[n]);
+    }
+    return true;
+}
+
+}  // namespace
+
+bool LoadStructureAsXyzr(const std::string& path,
+                         const ConversionOptions& options,
+                         XyzrSink& sink) {
+    if (IsXyzrFile(path)) {
+        if (is_gzip_file(path)) {
+            return parse_xyzr_gzip(path, sink);
+        }
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        parse_xyzr_text(file.text(), sink);
+        return true;
+    }
+    if (IsBinaryXyzrFile(path)) {
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        const BinaryXyzrHeader* header = binary_xyzr_header(file.text());
+        if (!header) {
+            std::cerr << "pdb_io: '" << path << "' is not a valid binary XYZR file" << std::endl;
+            return false;
+        }
+        feed_binary_xyzr(file.text(), *header, sink);
+        return true;
+    }
+    if (!options.cache_dir.empty()) {
+        return load_through_cache(path, options, sink);
+    }
+    return load_uncached(path, options, sink);
+}
+
+bool LoadStructureAsXyzr(const std::string& path,
+                         const ConversionOptions& options,
+                         std::vector<XyzrAtom>& atoms) {
+    atoms.clear();
+    VectorSink sink(atoms);
+    return LoadStructureAsXyzr(path, options, sink);
 }
 
 bool ReadFileToXyzr(const std::string& path,
@@ -643,4 +1674,183 @@ void WriteXyzrToStream(std::ostream& output, const XyzrData& data) {
     output.precision(old_precision);
 }
 
+bool WriteBinaryXyzrToFile(const std::string& path,
+                           const XyzrData& data,
+                           const ConversionOptions& options,
+                           std::uint64_t source_hash) {
+    FloatColumns columns;
+    FloatColumnsSink collect(columns);
+    collect.reserve(data.atoms.size());
+    for (const auto& atom : data.atoms) {
+        collect.add(atom.x, atom.y, atom.z, atom.radius);
+    }
+    return write_binary_xyzr(path, columns, settings_bits(options), source_hash);
+}
+
+struct FrameReader::Impl {
+    AtomTypeLibrary library;
+    ConversionOptions options;
+    std::string path;
+    bool failed = false;
+    std::size_t frames = 0;
+
+    // PDB models: text read but not yet handed out, and how far it has
+    // already been searched for ENDMDL.
+    gzFile pdb = nullptr;
+    std::string text;
+    std::size_t searched = 0;
+    bool at_end = false;
+
+    // DCD frames, with radii from the topology.
+    std::unique_ptr<DcdFile> dcd;
+    std::vector<XyzrAtom> topology;
+    std::vector<float> x, y, z;
+
+    ~Impl() {
+        if (pdb != nullptr) {
+            gzclose(pdb);
+        }
+    }
+
+    // Appends the next block of the PDB file; false once it is exhausted.
+    bool read_more() {
+        const std::size_t start = text.size();
+        text.resize(start + PARSE_CHUNK);
+        const int got = gzread(pdb, &text[start], static_cast<unsigned>(PARSE_CHUNK));
+        text.resize(start + static_cast<std::size_t>(got > 0 ? got : 0));
+        int code = Z_OK;
+        const char* message = gzerror(pdb, &code);
+        if (got < 0 || (got == 0 && code != Z_OK)) {
+            std::cerr << "pdb_io: unable to read " << (message != nullptr ? message : path.c_str())
+                      << std::endl;
+            failed = true;
+        }
+        if (got <= 0) {
+            at_end = true;
+        }
+        return got > 0;
+    }
+
+    bool next_model(XyzrSink& sink) {
+        while (!failed) {
+            const std::size_t found = find_endmdl(text, searched);
+            if (found != std::string::npos) {
+                const std::size_t newline = text.find('\n', found);
+                if (newline == std::string::npos && !at_end && read_more()) {
+                    continue;
+                }
+                convert_text_impl(library, std::string_view(text).substr(0, found), path, options,
+                                  nullptr, &sink);
+                text.erase(0, newline == std::string::npos ? text.size() : newline + 1);
+                searched = 0;
+                return true;
+            }
+            // ENDMDL may straddle the end of the text read so far.
+            searched = text.size() > 6 ? text.size() - 6 : 0;
+            if (!at_end && read_more()) {
+                continue;
+            }
+            if (failed) {
+                break;
+            }
+            // Whatever follows the last ENDMDL is a frame only if it has atoms,
+            // or if the file had no MODEL blocks at all.
+            const bool last = frames == 0 || has_atom_records(text);
+            if (last) {
+                convert_text_impl(library, text, path, options, nullptr, &sink);
+            }
+            text.clear();
+            searched = 0;
+            return last;
+        }
+        return false;
+    }
+
+    bool next_dcd(XyzrSink& sink) {
+        const int status = dcd->next(x, y, z);
+        if (status < 0) {
+            std::cerr << "pdb_io: trajectory frame " << frames + 1 << " is truncated: '" << path
+                      << "'" << std::endl;
+            failed = true;
+        }
+        if (status != 1) {
+            return false;
+        }
+        sink.reserve(topology.size());
+        for (std::size_t n = 0; n < topology.size(); ++n) {
+            sink.add(x[n], y[n], z[n], topology[n].radius);
+        }
+        return true;
+    }
+};
+
+FrameReader::FrameReader() : impl_(new Impl) {}
+FrameReader::~FrameReader() = default;
+
+bool FrameReader::Open(const std::string& path,
+                       const std::string& topology,
+                       const ConversionOptions& options) {
+    impl_.reset(new Impl);
+    impl_->options = options;
+    impl_->path = path;
+    if (!topology.empty()) {
+        if (!IsDcdFile(path)) {
+            std::cerr << "pdb_io: trajectories must be DCD files: '" << path << "'" << std::endl;
+            return false;
+        }
+        if (!LoadStructureAsXyzr(topology, options, impl_->topology)) {
+            return false;
+        }
+        impl_->dcd.reset(new DcdFile);
+        if (!impl_->dcd->open(path)) {
+            return false;
+        }
+        if (impl_->dcd->atoms() != impl_->topology.size()) {
+            std::cerr << "pdb_io: '" << path << "' has " << impl_->dcd->atoms()
+                      << " atoms per frame but topology '" << topology << "' converts to "
+                      << impl_->topology.size() << std::endl;
+            return false;
+        }
+        return true;
+    }
+    if (IsMmcifFile(path) || IsPdbmlFile(path) || IsXyzrFile(path) || IsBinaryXyzrFile(path)) {
+        std::cerr << "pdb_io: models are read from PDB files only: '" << path << "'" << std::endl;
+        return false;
+    }
+    impl_->pdb = gzopen(path.c_str(), "rb");
+    if (impl_->pdb == nullptr) {
+        std::cerr << "pdb_io: unable to open '" << path << "'" << std::endl;
+        return false;
+    }
+    gzbuffer(impl_->pdb, 1 << 17);
+    return true;
+}
+
+bool FrameReader::Next(XyzrSink& sink) {
+    if (impl_->failed || (impl_->pdb == nullptr && !impl_->dcd)) {
+        return false;
+    }
+    const bool read = impl_->dcd ? impl_->next_dcd(sink) : impl_->next_model(sink);
+    if (read) {
+        impl_->frames++;
+    }
+    return read;
+}
+
+bool FrameReader::Rewind() {
+    impl_->frames = 0;
+    impl_->failed = false;
+    if (impl_->dcd) {
+        return impl_->dcd->rewind();
+    }
+    impl_->text.clear();
+    impl_->searched = 0;
+    impl_->at_end = false;
+    return impl_->pdb != nullptr && gzrewind(impl_->pdb) == 0;
+}
+
+bool FrameReader::failed() const {
+    return impl_->failed;
+}
+
 }  // namespace vossvolvox::pdbio
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <iosfwd>
 #include <memory>
 #include <ostream>
@@ -28,6 +30,9 @@ struct Filters {
 struct ConversionOptions {
     bool use_united = true;
     Filters filters;
+    // When set, LoadStructureAsXyzr keeps converted structures here as binary
+    // XYZR files keyed by file content and the settings above.
+    std::string cache_dir;
 };
 
 struct XyzrAtom {
@@ -41,6 +46,15 @@ struct XyzrData {
     std::vector<XyzrAtom> atoms;
 };
 
+// Receives converted atoms in file order, so callers can fill their own
+// buffers directly instead of going through an XyzrData copy.
+class XyzrSink {
+   public:
+    virtual ~XyzrSink() = default;
+    virtual void reserve(std::size_t count) { (void)count; }
+    virtual void add(double x, double y, double z, double radius) = 0;
+};
+
 class PdbToXyzrConverter {
    public:
     PdbToXyzrConverter();
@@ -64,6 +78,11 @@ class PdbToXyzrConverter {
                             const ConversionOptions& options,
                             std::vector<XyzrAtom>& atoms) const;
 
+    // Parses a memory-mapped PDB file straight into sink.
+    bool ConvertFileToSink(const std::string& path,
+                           const ConversionOptions& options,
+                           XyzrSink& sink) const;
+
 #if VOSS_HAVE_GEMMI
     bool ConvertWithGemmi(const std::string& path,
                           const ConversionOptions& options,
@@ -72,6 +91,10 @@ class PdbToXyzrConverter {
     bool ConvertWithGemmiToAtoms(const std::string& path,
                                  const ConversionOptions& options,
                                  std::vector<XyzrAtom>& atoms) const;
+
+    bool ConvertWithGemmiToSink(const std::string& path,
+                                const ConversionOptions& options,
+                                XyzrSink& sink) const;
 #endif
 
    private:
@@ -82,11 +105,48 @@ class PdbToXyzrConverter {
 bool IsMmcifFile(const std::string& path);
 bool IsPdbmlFile(const std::string& path);
 bool IsXyzrFile(const std::string& path);
+bool IsBinaryXyzrFile(const std::string& path);
+bool IsDcdFile(const std::string& path);
+
+// Reads a structure one frame at a time, so trajectories never have to be
+// held in memory. Frames are the MODEL/ENDMDL blocks of a PDB file, plain or
+// gzip (a file without ENDMDL records is a single frame), or the frames of a
+// DCD trajectory. A DCD holds coordinates only; radii come from a topology
+// structure whose converted atoms match the trajectory atom for atom.
+class FrameReader {
+   public:
+    FrameReader();
+    ~FrameReader();
+
+    // path is a PDB file, or a DCD file when topology is not empty.
+    bool Open(const std::string& path,
+              const std::string& topology,
+              const ConversionOptions& options);
+
+    // Delivers the next frame to sink. Returns false after the last frame
+    // and on a read error; failed() tells the two apart.
+    bool Next(XyzrSink& sink);
+
+    // Goes back to the first frame.
+    bool Rewind();
+
+    bool failed() const;
+
+   private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
 
 bool LoadStructureAsXyzr(const std::string& path,
                          const ConversionOptions& options,
                          std::vector<XyzrAtom>& atoms);
 
+// Same as above, delivering atoms to sink. PDB and XYZR files are
+// memory-mapped and parsed in place.
+bool LoadStructureAsXyzr(const std::string& path,
+                         const ConversionOptions& options,
+                         XyzrSink& sink);
+
 bool ReadFileToXyzr(const std::string& path,
                     const ConversionOptions& options,
                     XyzrData& data);
@@ -94,4 +154,24 @@ bool ReadFileToXyzr(const std::string& path,
 bool WriteXyzrToFile(const std::string& path, const XyzrData& data);
 void WriteXyzrToStream(std::ostream& output, const XyzrData& data);
 
+// Binary XYZR (.xyzrb): a fixed header (atom count, center bounds, the
+// conversion settings used and a hash of the source file) followed by
+// packed float32 x, y, z and radius arrays. Values are stored at float
+// precision, which is what the grid tools read.
+struct BinaryXyzrHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t settings;
+    std::uint64_t count;
+    std::uint64_t source_hash;
+    float min[3];
+    float max[3];
+    std::uint64_t reserved;
+};
+
+bool WriteBinaryXyzrToFile(const std::string& path,
+                           const XyzrData& data,
+                           const ConversionOptions& options,
+                           std::uint64_t source_hash = 0);
+
 }  // namespace vossvolvox::pdbio
@@ -0,0 +1,284 @@
+/*
+** utils-bitgrid.cpp
+** Word-at-a-time grid operations for the bit-packed BitGrid type.
+** Every function mirrors the byte-grid version in utils-main.cpp, including
+** the meaning of the returned voxel count, so callers can switch a grid
+** between the two representations without changing their bookkeeping.
+*/
+
+#include <cstdint>                    // for uint64_t
+#include <iostream>                   // for cerr, endl, flush
+#include <stdexcept>                  // for invalid_argument
+#include <string>                     // for string, to_string
+
+#include "utils-bitgrid.hpp"
+
+namespace {
+
+inline int popcount64(uint64_t word) {
+  return __builtin_popcountll(word);
+}
+
+// Number of grid points covered by word w of a grid with numbins voxels.
+inline unsigned int word_span(std::size_t w, std::size_t numbins) {
+  const std::size_t start = w * 64;
+  return static_cast<unsigned int>(numbins - start < 64 ? numbins - start : 64);
+}
+
+// Pack the (up to) 64 byte voxels starting at pt into one word.
+inline uint64_t pack_word(const gridpt grid[], std::size_t pt, unsigned int span) {
+  uint64_t word = 0;
+  for (unsigned int b = 0; b < span; ++b) {
+    word |= uint64_t(grid[pt + b] ? 1 : 0) << b;
+  }
+  return word;
+}
+
+inline void check_sizes(const BitGrid& a, const BitGrid& b, const char* op) {
+  if (a.size() != b.size()) {
+    throw std::invalid_argument(std::string(op) + " on bit grids of different sizes (" +
+                                std::to_string(a.size()) + " vs " + std::to_string(b.size()) +
+                                ")");
+  }
+}
+
+}  // namespace
+
+/*********************************************/
+BitGrid make_zeroed_bitgrid(const GridContext& ctx) {
+  return BitGrid(ctx.numbins);
+}
+
+/*********************************************/
+BitGrid make_zeroed_bitgrid() {
+  return make_zeroed_bitgrid(current_grid_context());
+}
+
+/*********************************************/
+int countGrid (const BitGrid& grid) {
+  if (DEBUG > 0)
+    std::cerr << "Counting up Voxels in Bit Grid for Volume...  " << std::flush;
+  const uint64_t* words = grid.words();
+  const long long nwords = static_cast<long long>(grid.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    voxels += popcount64(words[w]);
+  }
+  if (DEBUG > 0)
+    std::cerr << "done [ " << voxels << " voxels ]" << std::endl << std::endl;
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+void zeroGrid (BitGrid& grid) {
+  uint64_t* words = grid.words();
+  const long long nwords = static_cast<long long>(grid.num_words());
+  #pragma omp parallel for
+  for (long long w = 0; w < nwords; w++) {
+    words[w] = 0;
+  }
+}
+
+/*********************************************/
+int copyGrid (const BitGrid& oldgrid, BitGrid& newgrid) {
+  if (newgrid.size() != oldgrid.size()) {
+    newgrid = BitGrid(oldgrid.size());
+  }
+  const uint64_t* src = oldgrid.words();
+  uint64_t* dst = newgrid.words();
+  const long long nwords = static_cast<long long>(oldgrid.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    dst[w] = src[w];
+    voxels += popcount64(src[w]);
+  }
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+void inverseGrid (BitGrid& grid) {
+  uint64_t* words = grid.words();
+  const long long nwords = static_cast<long long>(grid.num_words());
+  if (nwords == 0) {
+    return;
+  }
+  #pragma omp parallel for
+  for (long long w = 0; w < nwords; w++) {
+    words[w] = ~words[w];
+  }
+  // Keep the padding bits past size() clear so counts stay exact.
+  words[nwords - 1] &= grid.tail_mask();
+}
+
+/*********************************************/
+int subt_Grids (BitGrid& biggrid, const BitGrid& smgrid) {
+  // B AND !S; returns the number of voxels removed from biggrid.
+  check_sizes(biggrid, smgrid, "subt_Grids");
+  uint64_t* big = biggrid.words();
+  const uint64_t* sm = smgrid.words();
+  const long long nwords = static_cast<long long>(biggrid.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    voxels += popcount64(big[w] & sm[w]);
+    big[w] &= ~sm[w];
+  }
+  if (DEBUG > 0)
+    std::cerr << "Subtracting Bit Grids...  done [ " << voxels
+              << " vox changed ]" << std::endl << std::endl;
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+int intersect_Grids (BitGrid& grid1, const BitGrid& grid2) {
+  // G1 AND G2; returns the number of voxels left in grid1.
+  check_sizes(grid1, grid2, "intersect_Grids");
+  uint64_t* g1 = grid1.words();
+  const uint64_t* g2 = grid2.words();
+  const long long nwords = static_cast<long long>(grid1.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    g1[w] &= g2[w];
+    voxels += popcount64(g1[w]);
+  }
+  if (DEBUG > 0)
+    std::cerr << "Intersecting Bit Grids...  done [ " << voxels
+              << " vox overlap ]" << std::endl << std::endl;
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+int merge_Grids (BitGrid& grid1, const BitGrid& grid2) {
+  // G1 OR G2; like the byte version, returns the pre-merge overlap count.
+  check_sizes(grid1, grid2, "merge_Grids");
+  uint64_t* g1 = grid1.words();
+  const uint64_t* g2 = grid2.words();
+  const long long nwords = static_cast<long long>(grid1.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    voxels += popcount64(g1[w] & g2[w]);
+    g1[w] |= g2[w];
+  }
+  if (DEBUG > 0)
+    std::cerr << "Merging Bit Grids...  done [ " << voxels
+              << " vox overlap ]" << std::endl << std::endl;
+  return static_cast<int>(voxels);
+}
+
+/*********************************************
+**********************************************
+       BYTE GRID <-> BIT GRID CONVERSION
+**********************************************
+*********************************************/
+
+/*********************************************/
+int copyGrid(const GridContext& ctx, const gridpt oldgrid[], BitGrid& newgrid) {
+  // Pack a ctx.numbins byte grid into newgrid; returns the voxel count.
+  if (newgrid.size() != ctx.numbins) {
+    newgrid = BitGrid(ctx.numbins);
+  }
+  uint64_t* dst = newgrid.words();
+  const std::size_t numbins = newgrid.size();
+  const long long nwords = static_cast<long long>(newgrid.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    const uint64_t word = pack_word(oldgrid, std::size_t(w) * 64,
+                                    word_span(std::size_t(w), numbins));
+    dst[w] = word;
+    voxels += popcount64(word);
+  }
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+int copyGrid (const gridpt oldgrid[], BitGrid& newgrid) {
+  return copyGrid(current_grid_context(), oldgrid, newgrid);
+}
+
+/*********************************************/
+int copyGrid (const BitGrid& oldgrid, gridpt newgrid[]) {
+  // Expand a bit grid into an oldgrid.size() byte grid; returns the voxel count.
+  const uint64_t* src = oldgrid.words();
+  const std::size_t numbins = oldgrid.size();
+  const long long nwords = static_cast<long long>(oldgrid.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    const uint64_t word = src[w];
+    const std::size_t base = std::size_t(w) * 64;
+    const unsigned int span = word_span(std::size_t(w), numbins);
+    for (unsigned int b = 0; b < span; ++b) {
+      newgrid[base + b] = (word >> b) & 1u;
+    }
+    voxels += popcount64(word);
+  }
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+int subt_Grids (gridpt biggrid[], const BitGrid& smgrid) {
+  const uint64_t* sm = smgrid.words();
+  const std::size_t numbins = smgrid.size();
+  const long long nwords = static_cast<long long>(smgrid.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    uint64_t mask = sm[w];
+    if (mask == 0) {
+      continue;
+    }
+    const std::size_t base = std::size_t(w) * 64;
+    const uint64_t hit = mask & pack_word(biggrid, base, word_span(std::size_t(w), numbins));
+    voxels += popcount64(hit);
+    for (uint64_t bits = hit; bits; bits &= bits - 1) {
+      biggrid[base + __builtin_ctzll(bits)] = 0;
+    }
+  }
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+int intersect_Grids (gridpt grid1[], const BitGrid& grid2) {
+  const uint64_t* g2 = grid2.words();
+  const std::size_t numbins = grid2.size();
+  const long long nwords = static_cast<long long>(grid2.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    const std::size_t base = std::size_t(w) * 64;
+    const uint64_t word = pack_word(grid1, base, word_span(std::size_t(w), numbins));
+    const uint64_t drop = word & ~g2[w];
+    for (uint64_t bits = drop; bits; bits &= bits - 1) {
+      grid1[base + __builtin_ctzll(bits)] = 0;
+    }
+    voxels += popcount64(word & g2[w]);
+  }
+  return static_cast<int>(voxels);
+}
+
+/*********************************************/
+int merge_Grids (gridpt grid1[], const BitGrid& grid2) {
+  const uint64_t* g2 = grid2.words();
+  const std::size_t numbins = grid2.size();
+  const long long nwords = static_cast<long long>(grid2.num_words());
+  long long voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (long long w = 0; w < nwords; w++) {
+    const uint64_t mask = g2[w];
+    if (mask == 0) {
+      continue;
+    }
+    const std::size_t base = std::size_t(w) * 64;
+    const uint64_t word = pack_word(grid1, base, word_span(std::size_t(w), numbins));
+    voxels += popcount64(word & mask);
+    for (uint64_t bits = mask & ~word; bits; bits &= bits - 1) {
+      grid1[base + __builtin_ctzll(bits)] = 1;
+    }
+  }
+  return static_cast<int>(voxels);
+}
@@ -0,0 +1,75 @@
+/*
+** utils-bitgrid.hpp
+** Bit-packed voxel grid (one bit per voxel, 64 voxels per word) plus
+** word-at-a-time versions of the grid set operations from utils-main.cpp.
+** Byte grids (gridpt[]) remain the working format for rasterization and
+** flood fills; BitGrid is meant for masks that are held for a long time
+** (trim grids, shells) where the 8x memory saving matters.
+*/
+#ifndef UTILS_BITGRID_H
+#define UTILS_BITGRID_H
+
+#include <cstddef>                    // for size_t
+#include <cstdint>                    // for uint64_t
+#include <vector>                     // for vector
+
+#include "utils.hpp"                  // for GridContext, gridpt
+
+class BitGrid {
+ public:
+  BitGrid() = default;
+  explicit BitGrid(std::size_t numbins)
+      : numbins_(numbins), words_((numbins + 63) / 64, 0) {}
+
+  inline std::size_t size() const { return numbins_; }
+  inline std::size_t num_words() const { return words_.size(); }
+  inline bool empty() const { return words_.empty(); }
+
+  inline bool test(std::size_t pt) const {
+    return (words_[pt >> 6] >> (pt & 63)) & 1u;
+  }
+  inline void set(std::size_t pt) {
+    words_[pt >> 6] |= (uint64_t(1) << (pt & 63));
+  }
+  inline void reset(std::size_t pt) {
+    words_[pt >> 6] &= ~(uint64_t(1) << (pt & 63));
+  }
+  inline bool operator[](std::size_t pt) const { return test(pt); }
+
+  inline uint64_t* words() { return words_.data(); }
+  inline const uint64_t* words() const { return words_.data(); }
+
+  // Mask of the valid bits in the final word; bits past size() stay zero.
+  inline uint64_t tail_mask() const {
+    const unsigned int rem = static_cast<unsigned int>(numbins_ & 63);
+    return rem == 0 ? ~uint64_t(0) : ((uint64_t(1) << rem) - 1);
+  }
+
+ private:
+  std::size_t numbins_ = 0;
+  std::vector<uint64_t> words_;
+};
+
+BitGrid make_zeroed_bitgrid(const GridContext& ctx);
+BitGrid make_zeroed_bitgrid();
+
+//grid util functions (bit-packed)
+int countGrid (const BitGrid& grid);
+void zeroGrid (BitGrid& grid);
+int copyGrid (const BitGrid& oldgrid, BitGrid& newgrid);
+void inverseGrid (BitGrid& grid);
+int subt_Grids (BitGrid& biggrid, const BitGrid& smgrid); //Modifies biggrid; returns difference
+int intersect_Grids (BitGrid& grid1, const BitGrid& grid2); //Modifies grid1; returns final vox num
+int merge_Grids (BitGrid& grid1, const BitGrid& grid2); //Modifies grid1; returns overlap
+
+//conversion between byte and bit grids
+int copyGrid(const GridContext& ctx, const gridpt oldgrid[], BitGrid& newgrid); //pack
+int copyGrid (const gridpt oldgrid[], BitGrid& newgrid); //pack
+int copyGrid (const BitGrid& oldgrid, gridpt newgrid[]); //unpack
+
+//mixed operations: byte grid modified by a bit-packed mask
+int subt_Grids (gridpt biggrid[], const BitGrid& smgrid);
+int intersect_Grids (gridpt grid1[], const BitGrid& grid2);
+int merge_Grids (gridpt grid1[], const BitGrid& grid2);
+
+#endif // UTILS_BITGRID_H
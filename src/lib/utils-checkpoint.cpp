@@ -0,0 +1,219 @@
+/*
+** utils-checkpoint.cpp
+** Grid checkpoint save and load. Chunks of CHECKPOINT_PLANES z-planes are
+** bit-packed and deflated by one thread each; the file is written and read
+** with a few large sequential calls.
+*/
+
+#include <cstdio>                     // for fopen, fread, fseek, fwrite, rename, remove
+#include <cstring>                    // for memcmp, memcpy
+#include <iostream>                   // for cerr, endl
+#include <vector>                     // for vector
+
+#include <unistd.h>                   // for getpid
+#include <zlib.h>                     // for compress2, uncompress, compressBound
+
+#include "utils-checkpoint.hpp"
+
+namespace {
+
+const char CHECKPOINT_MAGIC[8] = {'V', 'V', 'G', 'R', 'I', 'D', '1', '\0'};
+const uint32_t CHECKPOINT_VERSION = 1;
+// 16 planes of a 500x500 grid pack to about 500 KB before deflate.
+const int CHECKPOINT_PLANES = 16;
+
+static_assert(sizeof(GridCheckpointHeader) == 72, "checkpoint header must be 72 bytes");
+
+// FNV-1a over raw bytes.
+inline uint64_t hash_bytes(uint64_t hash, const void* data, const size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t n = 0; n < size; n++) {
+    hash = (hash ^ bytes[n]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Voxel range [lo, hi) of chunk c.
+inline void chunk_range(const GridContext& ctx, const uint32_t num_chunks, const uint32_t c,
+                        size_t& lo, size_t& hi) {
+  const size_t span = size_t(CHECKPOINT_PLANES) * ctx.dxy;
+  lo = c * span;
+  hi = c + 1 < num_chunks ? lo + span : size_t(ctx.numbins);
+}
+
+uint32_t count_chunks(const GridContext& ctx) {
+  const uint32_t planes = (ctx.dz + CHECKPOINT_PLANES - 1) / CHECKPOINT_PLANES;
+  return planes > 0 ? planes : 1;
+}
+
+bool header_matches(const GridCheckpointHeader& header, const GridContext& ctx, const uint64_t key) {
+  return std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 &&
+         header.version == CHECKPOINT_VERSION &&
+         header.chunk_planes == uint32_t(CHECKPOINT_PLANES) &&
+         header.key == key &&
+         header.xmin == ctx.xmin && header.ymin == ctx.ymin && header.zmin == ctx.zmin &&
+         header.spacing == ctx.spacing &&
+         header.dx == ctx.dx && header.dy == ctx.dy && header.dz == ctx.dz &&
+         header.numbins == ctx.numbins &&
+         header.num_chunks == count_chunks(ctx);
+}
+
+}  // namespace
+
+/*********************************************/
+uint64_t checkpoint_Key(const GridContext& ctx, const XYZRBuffer& atoms,
+                        std::initializer_list<double> params) {
+  uint64_t hash = 14695981039346656037ULL;
+  const float bounds[4] = {ctx.xmin, ctx.ymin, ctx.zmin, ctx.spacing};
+  const int dims[3] = {ctx.dx, ctx.dy, ctx.dz};
+  hash = hash_bytes(hash, bounds, sizeof(bounds));
+  hash = hash_bytes(hash, dims, sizeof(dims));
+  hash = hash_bytes(hash, atoms.atoms.data(), atoms.atoms.size() * sizeof(XYZRAtom));
+  for (const double param : params) {
+    hash = hash_bytes(hash, &param, sizeof(param));
+  }
+  return hash;
+}
+
+/*********************************************/
+int save_GridCheckpoint(const GridContext& ctx, const gridpt grid[],
+                        const uint64_t key, const std::string& path) {
+  if (path.empty()) {
+    return 0;
+  }
+  GridCheckpointHeader header{};
+  std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_VERSION;
+  header.chunk_planes = CHECKPOINT_PLANES;
+  header.key = key;
+  header.xmin = ctx.xmin;  header.ymin = ctx.ymin;  header.zmin = ctx.zmin;
+  header.spacing = ctx.spacing;
+  header.dx = ctx.dx;  header.dy = ctx.dy;  header.dz = ctx.dz;
+  header.numbins = ctx.numbins;
+  header.num_chunks = count_chunks(ctx);
+
+  // Pack and deflate every chunk.
+  const int num_chunks = header.num_chunks;
+  std::vector<std::vector<unsigned char> > packed(num_chunks);
+  std::vector<uint64_t> sizes(num_chunks);
+  uint64_t voxels = 0;
+  bool ok = true;
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:voxels) reduction(&&:ok)
+  for (int c = 0; c < num_chunks; c++) {
+    size_t lo, hi;
+    chunk_range(ctx, num_chunks, c, lo, hi);
+    std::vector<unsigned char> bits((hi - lo + 7) / 8, 0);
+    for (size_t pt = lo; pt < hi; pt++) {
+      if (grid[pt]) {
+        bits[(pt - lo) >> 3] |= (unsigned char)(1u << ((pt - lo) & 7));
+        voxels++;
+      }
+    }
+    uLongf length = compressBound(bits.size());
+    packed[c].resize(length);
+    if (compress2(packed[c].data(), &length, bits.data(), bits.size(), Z_BEST_SPEED) != Z_OK) {
+      ok = false;
+    }
+    packed[c].resize(length);
+    sizes[c] = length;
+  }
+  header.voxels = voxels;
+  if (!ok) {
+    std::cerr << "checkpoint: unable to compress grid for " << path << std::endl;
+    return -1;
+  }
+
+  const std::string temp = path + ".tmp" + std::to_string(::getpid());
+  FILE* fp = std::fopen(temp.c_str(), "wb");
+  if (fp == NULL) {
+    std::cerr << "checkpoint: unable to write " << path << std::endl;
+    return -1;
+  }
+  ok = std::fwrite(&header, sizeof(header), 1, fp) == 1 &&
+       std::fwrite(sizes.data(), sizeof(uint64_t), num_chunks, fp) == size_t(num_chunks);
+  for (int c = 0; ok && c < num_chunks; c++) {
+    ok = std::fwrite(packed[c].data(), 1, packed[c].size(), fp) == packed[c].size();
+  }
+  ok = std::fclose(fp) == 0 && ok;
+  if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+    std::remove(temp.c_str());
+    std::cerr << "checkpoint: unable to write " << path << std::endl;
+    return -1;
+  }
+  std::cerr << "checkpoint: saved " << voxels << " voxels to " << path << std::endl;
+  return 1;
+}
+
+/*********************************************/
+int load_GridCheckpoint(const GridContext& ctx, const std::string& path,
+                        const uint64_t key, gridpt grid[]) {
+  if (path.empty()) {
+    return 0;
+  }
+  FILE* fp = std::fopen(path.c_str(), "rb");
+  if (fp == NULL) {
+    return 0;
+  }
+  long file_size = -1;
+  if (std::fseek(fp, 0, SEEK_END) == 0) {
+    file_size = std::ftell(fp);
+  }
+  std::rewind(fp);
+  GridCheckpointHeader header;
+  std::vector<uint64_t> sizes;
+  std::vector<unsigned char> payload;
+  bool ok = file_size >= 0 &&
+            std::fread(&header, sizeof(header), 1, fp) == 1 && header_matches(header, ctx, key);
+  if (ok) {
+    sizes.resize(header.num_chunks);
+    ok = std::fread(sizes.data(), sizeof(uint64_t), sizes.size(), fp) == sizes.size();
+  }
+  // Check the size table before allocating: no chunk can deflate to more
+  // than compressBound, and the chunks must fit in what is left of the file.
+  const uint64_t available = uint64_t(file_size) - sizeof(header) - sizes.size() * sizeof(uint64_t);
+  std::vector<size_t> offsets(sizes.size() + 1, 0);
+  for (size_t c = 0; ok && c < sizes.size(); c++) {
+    size_t lo, hi;
+    chunk_range(ctx, sizes.size(), c, lo, hi);
+    ok = sizes[c] <= compressBound((hi - lo + 7) / 8) && sizes[c] <= available - offsets[c];
+    offsets[c + 1] = offsets[c] + sizes[c];
+  }
+  if (ok) {
+    payload.resize(offsets.back());
+    ok = std::fread(payload.data(), 1, payload.size(), fp) == payload.size();
+  }
+  std::fclose(fp);
+  if (!ok) {
+    zeroGrid(ctx, grid);
+    std::cerr << "checkpoint: ignoring " << path
+              << " (unreadable, or made for another grid or stage)" << std::endl;
+    return -1;
+  }
+
+  // Inflate and unpack every chunk.
+  const int num_chunks = header.num_chunks;
+  uint64_t voxels = 0;
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:voxels) reduction(&&:ok)
+  for (int c = 0; c < num_chunks; c++) {
+    size_t lo, hi;
+    chunk_range(ctx, num_chunks, c, lo, hi);
+    std::vector<unsigned char> bits((hi - lo + 7) / 8);
+    uLongf length = bits.size();
+    if (uncompress(bits.data(), &length, payload.data() + offsets[c], sizes[c]) != Z_OK ||
+        length != bits.size()) {
+      ok = false;
+      continue;
+    }
+    for (size_t pt = lo; pt < hi; pt++) {
+      grid[pt] = (bits[(pt - lo) >> 3] >> ((pt - lo) & 7)) & 1;
+      voxels += grid[pt] ? 1 : 0;
+    }
+  }
+  if (!ok || voxels != header.voxels) {
+    zeroGrid(ctx, grid);
+    std::cerr << "checkpoint: ignoring " << path << " (corrupt payload)" << std::endl;
+    return -1;
+  }
+  std::cerr << "checkpoint: loaded " << voxels << " voxels from " << path << std::endl;
+  return 1;
+}
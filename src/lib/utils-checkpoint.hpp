@@ -0,0 +1,48 @@
+/*
+** utils-checkpoint.hpp
+** Native grid checkpoints for resuming multi-stage tools. A checkpoint
+** holds the grid context and the grid bit-packed in chunks of z-planes,
+** each chunk deflated on its own so chunks are packed and unpacked in
+** parallel.
+*/
+#ifndef UTILS_CHECKPOINT_H
+#define UTILS_CHECKPOINT_H
+
+#include <cstdint>                    // for uint32_t, uint64_t
+#include <initializer_list>           // for initializer_list
+#include <string>                     // for string
+
+#include "utils.hpp"                  // for GridContext, gridpt, XYZRBuffer
+
+// On-disk header (72 bytes). A table of num_chunks compressed sizes
+// (uint64_t) follows, then the chunks in order. Chunk c holds bits for
+// voxels [c*chunk_planes*DXY, ...), the last one running to NUMBINS.
+struct GridCheckpointHeader {
+  char magic[8];                      // "VVGRID1\0"
+  uint32_t version;
+  uint32_t chunk_planes;
+  uint64_t key;                       // stage key, see checkpoint_Key
+  float xmin, ymin, zmin, spacing;
+  int32_t dx, dy, dz;
+  uint32_t numbins;
+  uint64_t voxels;
+  uint32_t num_chunks;
+  uint32_t reserved;
+};
+
+// Key for one pipeline stage: the atoms, the grid, and the stage parameters.
+uint64_t checkpoint_Key(const GridContext& ctx, const XYZRBuffer& atoms,
+                        std::initializer_list<double> params);
+
+// Write grid to path (through a temporary file, then rename). An empty path
+// does nothing. Returns 1 when written, 0 for an empty path, -1 on error.
+int save_GridCheckpoint(const GridContext& ctx, const gridpt grid[],
+                        const uint64_t key, const std::string& path);
+
+// Fill grid from path. Returns 1 when loaded, 0 when the path is empty or
+// the file does not exist, and -1 when the file is unreadable or was made
+// for another grid or key. The grid is untouched on 0 and zeroed on -1.
+int load_GridCheckpoint(const GridContext& ctx, const std::string& path,
+                        const uint64_t key, gridpt grid[]);
+
+#endif // UTILS_CHECKPOINT_H
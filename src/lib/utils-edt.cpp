@@ -0,0 +1,244 @@
+/*
+** utils-edt.cpp
+** Separable exact distance transform and the excluded-volume engines built
+** on it. A voxel is cleared (trun) or filled (grow) exactly when some seed
+** lies within the probe radius, using the same integer-vs-float test as the
+** sphere stencils, so both engines produce identical grids.
+*/
+
+#include <algorithm>                  // for copy
+#include <cstdint>                    // for int64_t, uint32_t, uint64_t
+#include <cstdlib>                    // for malloc
+#include <iostream>                   // for cerr, endl
+#include <new>                        // for bad_alloc
+#include <vector>                     // for vector
+
+#include "utils-edt.hpp"
+
+namespace {
+
+// One-dimensional squared distance transform of f (length n, stride 1) into d.
+// v, zn and zd are scratch arrays of length n, n+1 and n+1. Parabola
+// intersections are kept as exact fractions zn/zd (zd > 0) so the lower
+// envelope needs no floating-point division.
+void edt_1d(const uint32_t* f, const int n, uint32_t* d, int* v, int64_t* zn, int64_t* zd) {
+  int k = -1;
+  for (int q = 0; q < n; q++) {
+    if (f[q] == EDT_INFINITY) {
+      continue;
+    }
+    const int64_t fq = int64_t(f[q]) + int64_t(q) * q;
+    if (k < 0) {
+      k = 0;
+      v[0] = q;
+      zn[0] = -1;  zd[0] = 0;   // -infinity
+      zn[1] = 1;   zd[1] = 0;   // +infinity
+      continue;
+    }
+    // Intersection s = sn/sd of the parabola rooted at q with the rightmost
+    // one kept; pop parabolas it hides (s <= z[k]).
+    int64_t sn, sd;
+    while (true) {
+      const int p = v[k];
+      sn = fq - (int64_t(f[p]) + int64_t(p) * p);
+      sd = 2 * int64_t(q - p);
+      const bool hidden = zd[k] == 0 ? zn[k] > 0 : sn * zd[k] <= zn[k] * sd;
+      if (hidden) {
+        k--;
+      } else {
+        break;
+      }
+    }
+    k++;
+    v[k] = q;
+    zn[k] = sn;  zd[k] = sd;
+    zn[k + 1] = 1;  zd[k + 1] = 0;
+  }
+  if (k < 0) {
+    for (int q = 0; q < n; q++) {
+      d[q] = EDT_INFINITY;
+    }
+    return;
+  }
+  k = 0;
+  for (int q = 0; q < n; q++) {
+    // advance while z[k+1] < q
+    while (zd[k + 1] != 0 && zn[k + 1] < int64_t(q) * zd[k + 1]) {
+      k++;
+    }
+    const uint64_t dq = uint64_t(q - v[k]) * uint64_t(q - v[k]) + f[v[k]];
+    d[q] = dq >= EDT_INFINITY ? EDT_INFINITY - 1 : uint32_t(dq);
+  }
+}
+
+// First pass: 1D distance to the nearest seed along each x row, squared.
+// A forward and a backward sweep are enough for binary input.
+void edt_rows(const GridContext& ctx, const gridpt seeds[], std::vector<uint32_t>& dist2) {
+  const int n = ctx.dx;
+  const int rows = ctx.dy * ctx.dz;
+  #pragma omp parallel for
+  for (int row = 0; row < rows; row++) {
+    const gridpt* in = seeds + size_t(row) * n;
+    uint32_t* out = dist2.data() + size_t(row) * n;
+    int last = -1;
+    for (int q = 0; q < n; q++) {
+      if (in[q]) {
+        last = q;
+      }
+      out[q] = last < 0 ? EDT_INFINITY : uint32_t(q - last);
+    }
+    last = -1;
+    for (int q = n - 1; q >= 0; q--) {
+      if (in[q]) {
+        last = q;
+      }
+      if (last >= 0 && uint32_t(last - q) < out[q]) {
+        out[q] = uint32_t(last - q);
+      }
+      if (out[q] != EDT_INFINITY) {
+        out[q] *= out[q];
+      }
+    }
+  }
+}
+
+// Transform lines of n voxels spaced stride apart. Lines start at
+// a + b*strideb for a in [0,na) (adjacent in memory) and b in [0,nb).
+// EDT_TILE neighboring lines are gathered together so every cache line
+// fetched from the strided axis is used in full.
+const int EDT_TILE = 16;
+
+void edt_columns(std::vector<uint32_t>& dist2, const int n, const int stride,
+                 const int na, const int nb, const int strideb) {
+  #pragma omp parallel
+  {
+    std::vector<uint32_t> tile(size_t(n) * EDT_TILE), out(n);
+    std::vector<int> v(n);
+    std::vector<int64_t> zn(n + 1), zd(n + 1);
+    #pragma omp for
+    for (int b = 0; b < nb; b++) {
+      for (int a0 = 0; a0 < na; a0 += EDT_TILE) {
+        const int width = a0 + EDT_TILE <= na ? EDT_TILE : na - a0;
+        uint32_t* base = dist2.data() + size_t(b) * strideb + a0;
+        for (int q = 0; q < n; q++) {
+          const uint32_t* src = base + size_t(q) * stride;
+          for (int t = 0; t < width; t++) {
+            tile[size_t(t) * n + q] = src[t];
+          }
+        }
+        for (int t = 0; t < width; t++) {
+          uint32_t* line = tile.data() + size_t(t) * n;
+          edt_1d(line, n, out.data(), v.data(), zn.data(), zd.data());
+          std::copy(out.begin(), out.end(), line);
+        }
+        for (int q = 0; q < n; q++) {
+          uint32_t* dst = base + size_t(q) * stride;
+          for (int t = 0; t < width; t++) {
+            dst[t] = tile[size_t(t) * n + q];
+          }
+        }
+      }
+    }
+  }
+}
+
+gridpt* alloc_seed_grid(const GridContext& ctx) {
+  gridpt* seeds = (gridpt*) std::malloc(ctx.numbins);
+  if (seeds == NULL) {
+    throw std::bad_alloc();
+  }
+  zeroGrid(ctx, seeds);
+  return seeds;
+}
+
+}  // namespace
+
+/*********************************************/
+void squared_distance_transform(const GridContext& ctx, const gridpt seeds[],
+                                std::vector<uint32_t>& dist2) {
+  dist2.resize(size_t(ctx.dxyz));
+  // x rows, then y columns (per z plane), then z pillars (per y row).
+  edt_rows(ctx, seeds, dist2);
+  edt_columns(dist2, ctx.dy, ctx.dx, ctx.dx, ctx.dz, ctx.dxy);
+  edt_columns(dist2, ctx.dz, ctx.dxy, ctx.dx, ctx.dy, ctx.dx);
+}
+
+/*********************************************/
+void mark_trun_seeds(const GridContext& ctx, const gridpt ACCgrid[], gridpt seeds[]) {
+  // Same scan range and neighbor test as trun_ExcludeGrid.
+  #pragma omp parallel for
+  for (int k = 1; k < ctx.dz; k++) {
+    for (int j = 1; j < ctx.dy; j++) {
+      for (int i = 1; i < ctx.dx; i++) {
+        const int pt = i + j * ctx.dx + k * ctx.dxy;
+        if (!ACCgrid[pt] && hasFilledNeighbor(ctx, pt, ACCgrid)) {
+          seeds[pt] = 1;
+        }
+      }
+    }
+  }
+}
+
+/*********************************************/
+void mark_grow_seeds(const GridContext& ctx, const gridpt ACCgrid[], gridpt seeds[]) {
+  // Same scan range and neighbor test as grow_ExcludeGrid.
+  #pragma omp parallel for
+  for (int k = 1; k < ctx.dz; k++) {
+    for (int j = 1; j < ctx.dy; j++) {
+      for (int i = 1; i < ctx.dx; i++) {
+        const int pt = i + j * ctx.dx + k * ctx.dxy;
+        if (ACCgrid[pt] && hasEmptyNeighbor(ctx, pt, ACCgrid)) {
+          seeds[pt] = 1;
+        }
+      }
+    }
+  }
+}
+
+/*********************************************/
+void trun_ExcludeGrid_edt(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  std::cerr << "Truncating Excluded Grid from Accessible Grid by Probe " << probe
+            << " (distance transform)..." << std::endl;
+  copyGridFromTo(ctx, ACCgrid, EXCgrid);
+
+  gridpt* seeds = alloc_seed_grid(ctx);
+  mark_trun_seeds(ctx, ACCgrid, seeds);
+  std::vector<uint32_t> dist2;
+  squared_distance_transform(ctx, seeds, dist2);
+  std::free(seeds);
+
+  const float R = probe / ctx.spacing;
+  const float cutoff = R * R;
+  const long long total = ctx.dxyz;
+  #pragma omp parallel for
+  for (long long pt = 0; pt < total; pt++) {
+    if (EXCgrid[pt] && float(dist2[pt]) < cutoff) {
+      EXCgrid[pt] = 0;
+    }
+  }
+  std::cerr << "done" << std::endl << std::endl;
+}
+
+/*********************************************/
+void grow_ExcludeGrid_edt(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  std::cerr << std::endl << "Growing Excluded Grid from Accessible Grid by Probe "
+            << probe << " (distance transform)..." << std::endl;
+  copyGrid(ctx, ACCgrid, EXCgrid);
+
+  gridpt* seeds = alloc_seed_grid(ctx);
+  mark_grow_seeds(ctx, ACCgrid, seeds);
+  std::vector<uint32_t> dist2;
+  squared_distance_transform(ctx, seeds, dist2);
+  std::free(seeds);
+
+  const float R = probe / ctx.spacing;
+  const float cutoff = R * R;
+  const long long total = ctx.dxyz;
+  #pragma omp parallel for
+  for (long long pt = 0; pt < total; pt++) {
+    if (!EXCgrid[pt] && float(dist2[pt]) < cutoff) {
+      EXCgrid[pt] = 1;
+    }
+  }
+  std::cerr << "done" << std::endl << std::endl;
+}
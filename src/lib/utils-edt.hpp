@@ -0,0 +1,30 @@
+/*
+** utils-edt.hpp
+** Exact squared Euclidean distance transform on the voxel grid
+** (Felzenszwalb & Huttenlocher lower-envelope algorithm, one separable
+** pass per axis). Run time is linear in the number of voxels and does
+** not depend on the probe radius, unlike stamping a sphere per voxel.
+*/
+#ifndef UTILS_EDT_H
+#define UTILS_EDT_H
+
+#include <cstdint>                    // for uint32_t
+#include <vector>                     // for vector
+
+#include "utils.hpp"                  // for GridContext, gridpt
+
+// Sentinel for voxels with no seed anywhere in the grid.
+const uint32_t EDT_INFINITY = 0xFFFFFFFFu;
+
+// dist2[pt] = squared distance in voxels from (i,j,k) to the nearest voxel
+// with seeds[pt] set, for every pt in [0, DXYZ). dist2 is resized to DXYZ.
+void squared_distance_transform(const GridContext& ctx, const gridpt seeds[],
+                                std::vector<uint32_t>& dist2);
+
+// Seeds used by the excluded-volume engines, chosen exactly like the
+// sphere-stamping loops: empty voxels touching ACCgrid (for truncation) or
+// filled ACCgrid voxels touching empty space (for growth).
+void mark_trun_seeds(const GridContext& ctx, const gridpt ACCgrid[], gridpt seeds[]);
+void mark_grow_seeds(const GridContext& ctx, const gridpt ACCgrid[], gridpt seeds[]);
+
+#endif // UTILS_EDT_H
@@ -0,0 +1,165 @@
+/*
+** utils-label.cpp
+** Slab-parallel union-find labeling. Each z-slab is joined by one thread,
+** the seams between slabs are joined serially, and every tree is rooted at
+** its smallest voxel index, so component numbering is fixed by the grid
+** alone.
+*/
+
+#include <vector>                     // for vector
+
+#include "utils-label.hpp"
+
+namespace {
+
+// Planes per slab. Seam work is about 1/LABEL_SLAB of the total.
+const int LABEL_SLAB = 16;
+
+// Root of x with path halving. Parents never point forward in the grid.
+inline int find_root(std::vector<int>& parent, int x) {
+  while (parent[x] != x) {
+    parent[x] = parent[parent[x]];
+    x = parent[x];
+  }
+  return x;
+}
+
+// Join the trees of a and b under the smaller root index.
+inline void join(std::vector<int>& parent, int a, int b) {
+  a = find_root(parent, a);
+  b = find_root(parent, b);
+  if (a < b) {
+    parent[b] = a;
+  } else if (b < a) {
+    parent[a] = b;
+  }
+}
+
+// The 13 of the 26 neighbor offsets that point backward in the grid. Like
+// get_Connected_Point, offsets are linear, so there is no edge clipping.
+int backward_offsets(const GridContext& ctx, int offsets[13]) {
+  int n = 0;
+  for (int dk = -1; dk <= 1; dk++) {
+    for (int dj = -1; dj <= 1; dj++) {
+      for (int di = -1; di <= 1; di++) {
+        const int off = di + dj * ctx.dx + dk * ctx.dxy;
+        if (off < 0) {
+          offsets[n++] = off;
+        }
+      }
+    }
+  }
+  return n;
+}
+
+}  // namespace
+
+/*********************************************/
+int label_Components(const GridContext& ctx, const gridpt grid[],
+                     std::vector<int>& labels, std::vector<int>& sizes) {
+  const int total = ctx.dxyz;
+  const int nslabs = (ctx.dz + LABEL_SLAB - 1) / LABEL_SLAB;
+  int offsets[13];
+  const int noffsets = backward_offsets(ctx, offsets);
+
+  std::vector<int> parent(total);
+  std::vector<std::vector<int> > slab_roots(nslabs);
+
+  // Join within each slab, then point every voxel at its slab-local root.
+  #pragma omp parallel for schedule(dynamic,1)
+  for (int slab = 0; slab < nslabs; slab++) {
+    const int lo = slab * LABEL_SLAB * ctx.dxy;
+    const int hi = (slab + 1) * LABEL_SLAB < ctx.dz ? (slab + 1) * LABEL_SLAB * ctx.dxy : total;
+    for (int pt = lo; pt < hi; pt++) {
+      if (!grid[pt]) {
+        continue;
+      }
+      parent[pt] = pt;
+      for (int n = 0; n < noffsets; n++) {
+        const int q = pt + offsets[n];
+        if (q >= lo && grid[q]) {
+          join(parent, pt, q);
+        }
+      }
+    }
+    for (int pt = lo; pt < hi; pt++) {
+      if (grid[pt]) {
+        parent[pt] = parent[parent[pt]];
+        if (parent[pt] == pt) {
+          slab_roots[slab].push_back(pt);
+        }
+      }
+    }
+  }
+
+  // Join across the seams. Only slab-local roots are touched from here on.
+  const int reach = ctx.dxy + ctx.dx + 1;
+  for (int slab = 1; slab < nslabs; slab++) {
+    const int lo = slab * LABEL_SLAB * ctx.dxy;
+    const int hi = lo + reach < total ? lo + reach : total;
+    for (int pt = lo; pt < hi; pt++) {
+      if (!grid[pt]) {
+        continue;
+      }
+      for (int n = 0; n < noffsets; n++) {
+        const int q = pt + offsets[n];
+        if (q < lo && q >= 0 && grid[q]) {
+          join(parent, parent[pt], parent[q]);
+        }
+      }
+    }
+  }
+
+  // Number the global roots in grid order. A root's parent always comes
+  // earlier, so one ascending pass resolves every slab-local root.
+  labels.assign(total, 0);
+  int count = 0;
+  for (int slab = 0; slab < nslabs; slab++) {
+    for (const int root : slab_roots[slab]) {
+      parent[root] = parent[parent[root]];
+      if (parent[root] == root) {
+        labels[root] = ++count;
+      }
+    }
+  }
+
+  // Label the remaining voxels and count component sizes.
+  sizes.assign(count + 1, 0);
+  #pragma omp parallel
+  {
+    std::vector<int> local(count + 1, 0);
+    #pragma omp for schedule(dynamic,1)
+    for (int slab = 0; slab < nslabs; slab++) {
+      const int lo = slab * LABEL_SLAB * ctx.dxy;
+      const int hi = (slab + 1) * LABEL_SLAB < ctx.dz ? (slab + 1) * LABEL_SLAB * ctx.dxy : total;
+      for (int pt = lo; pt < hi; pt++) {
+        if (grid[pt]) {
+          const int root = parent[parent[pt]];
+          if (root != pt) {
+            labels[pt] = labels[root];
+          }
+          local[labels[root]]++;
+        }
+      }
+    }
+    #pragma omp critical (label_sizes)
+    for (int c = 1; c <= count; c++) {
+      sizes[c] += local[c];
+    }
+  }
+  return count;
+}
+
+/*********************************************/
+int extract_Component(const GridContext& ctx, const std::vector<int>& labels,
+                      const int label, gridpt grid[]) {
+  const int total = ctx.dxyz;
+  const int numbins = ctx.numbins;
+  int voxels = 0;
+  #pragma omp parallel for reduction(+:voxels)
+  for (int pt = 0; pt < numbins; pt++) {
+    grid[pt] = pt < total && labels[pt] == label;
+    voxels += grid[pt] ? 1 : 0;
+  }
+  return voxels;
+}
@@ -0,0 +1,27 @@
+/*
+** utils-label.hpp
+** One-pass connected-component labeling of a voxel grid (26-connectivity,
+** same neighbor offsets as get_Connected_Point). Replaces the repeated
+** get_GridPoint / get_Connected_Point / subt_Grids extraction loop, which
+** sweeps the whole grid once per component.
+*/
+#ifndef UTILS_LABEL_H
+#define UTILS_LABEL_H
+
+#include <vector>                     // for vector
+
+#include "utils.hpp"                  // for GridContext, gridpt
+
+// labels[pt] = component number of filled voxel pt (0 for empty voxels), for
+// every pt in [0, DXYZ). Components are numbered 1..N in the order of their
+// first voxel in grid order, which is the order get_GridPoint would find
+// them. sizes[c] is the voxel count of component c (sizes[0] = 0). Returns N.
+// The result does not depend on the number of threads.
+int label_Components(const GridContext& ctx, const gridpt grid[],
+                     std::vector<int>& labels, std::vector<int>& sizes);
+
+// grid = (labels == label); returns the number of voxels set.
+int extract_Component(const GridContext& ctx, const std::vector<int>& labels,
+                      const int label, gridpt grid[]);
+
+#endif // UTILS_LABEL_H
@@ -18,6 +18,9 @@
 // Mathematical helpers (ceil, pow, sqrt).
 #include <cmath>
 
+// FLT_MAX marks voxels out of reach in surface distance fields.
+#include <cfloat>
+
 // File stream helpers for legacy XYZR files.
 #include <fstream>
 
@@ -25,15 +28,30 @@
 #include <iostream>
 #include <iomanip>
 
+// Failures are thrown: std::bad_alloc for grids, length_error for a grid
+// too large to index, runtime_error otherwise.
+#include <new>
+#include <stdexcept>
+
+// 64-bit voxel counts for the MAXBINS check and its message.
+#include <cstdint>
+#include <sstream>
+
 // Project-specific definitions such as gridpt and DEBUG.
 #include "utils.hpp"
 
+// Cached row-span sphere stencils for voxel-centered spheres.
+#include "utils-stencil.hpp"
+
 // Enables assert-based invariants when debugging.
 #include <cassert>
 
 // Dynamic arrays used for neighbor offsets.
 #include <vector>
 
+// Fixed-size lookup tables.
+#include <array>
+
 // Minimum bounds derived from the input atoms plus padding.
 float XMIN, YMIN, ZMIN;
 
@@ -63,6 +81,58 @@ float CUTOFF=10000;
 // Memory-stable buffer holding the source XYZR filename.
 char XYZRFILE[256];
 
+// Sphere rasterizer restricted to a range of z-planes (defined below).
+static int fill_AccessGrid_planes(const GridContext& ctx, const float x, const float y,
+	const float z, const float R, const int kbegin, const int kend, gridpt grid[]);
+
+/*********************************************
+**********************************************
+         GRID CONTEXT
+**********************************************
+*********************************************/
+
+/*********************************************/
+// Snapshot of the process-wide globals as a GridContext.
+GridContext current_grid_context() {
+  GridContext ctx;
+  ctx.xmin = XMIN;  ctx.ymin = YMIN;  ctx.zmin = ZMIN;
+  ctx.xmax = XMAX;  ctx.ymax = YMAX;  ctx.zmax = ZMAX;
+  ctx.dx = DX;  ctx.dy = DY;  ctx.dz = DZ;
+  ctx.dxy = DXY;  ctx.dxyz = DXYZ;
+  ctx.numbins = NUMBINS;
+  ctx.spacing = GRID;
+  ctx.gridvol = GRIDVOL;
+  ctx.maxprobe = MAXPROBE;
+  ctx.water_res = WATER_RES;
+  ctx.cutoff = CUTOFF;
+  return ctx;
+}
+
+/*********************************************/
+// Publish a context through the legacy globals (compatibility shim only).
+void set_grid_context(const GridContext& ctx) {
+  XMIN = ctx.xmin;  YMIN = ctx.ymin;  ZMIN = ctx.zmin;
+  XMAX = ctx.xmax;  YMAX = ctx.ymax;  ZMAX = ctx.zmax;
+  DX = ctx.dx;  DY = ctx.dy;  DZ = ctx.dz;
+  DXY = ctx.dxy;  DXYZ = ctx.dxyz;
+  NUMBINS = ctx.numbins;
+  GRID = ctx.spacing;
+  GRIDVOL = ctx.gridvol;
+  MAXPROBE = ctx.maxprobe;
+  WATER_RES = ctx.water_res;
+  CUTOFF = ctx.cutoff;
+}
+
+/*********************************************/
+// Fresh context for the given spacing; bounds still have to be read in
+// (read_NumAtoms_from_array) and finalized (assignLimits).
+GridContext make_grid_context(float spacing, float maxprobe) {
+  GridContext ctx;
+  ctx.spacing = spacing;
+  initGridState(ctx, maxprobe);
+  return ctx;
+}
+
 /*********************************************
 **********************************************
          INITIALIZE FUNCTIONS
@@ -71,26 +141,23 @@ char XYZRFILE[256];
 
 //init functions
 /*********************************************/
-void initGridState(float maxprobe) {
+void initGridState(GridContext& ctx, float maxprobe) {
   // Recompute per-voxel volume in case GRID changed.
-  GRIDVOL=GRID*GRID*GRID;
+  ctx.gridvol=ctx.spacing*ctx.spacing*ctx.spacing;
 
   // Convert legacy constant into voxel units.
-  WATER_RES=14137.2/GRIDVOL;
+  ctx.water_res=14137.2/ctx.gridvol;
 
   // Cache the runtime probe radius limit requested by caller.
-  MAXPROBE = maxprobe;
-
-  // Reset logging metadata so new inputs appear fresh.
-  XYZRFILE[0]='\0';
+  ctx.maxprobe = maxprobe;
 
   // Prepare minima/maxima for scanning (start with wide range)
-  XMIN=1000;
-  YMIN=1000;
-  ZMIN=1000;
-  XMAX=-1000;
-  YMAX=-1000;
-  ZMAX=-1000;
+  ctx.xmin=1000;
+  ctx.ymin=1000;
+  ctx.zmin=1000;
+  ctx.xmax=-1000;
+  ctx.ymax=-1000;
+  ctx.zmax=-1000;
 };
 
 // Deprecated name kept for compatibility with existing tools.
@@ -99,7 +166,7 @@ void finalGridDims(float maxprobe) {
 }
 
 /*********************************************/
-float getIdealGrid () {
+float getIdealGrid(const GridContext& ctx) {
 
   // Track the search interval bounds while we find the best spacing.
   double idealgrid, maxgrid=1, mingrid=-1;
@@ -114,7 +181,7 @@ float getIdealGrid () {
   double third = 1/3.;
 
   // Estimate spacing so that the bounding box fits within the legacy cap.
-  idealgrid = pow((XMAX-XMIN)*(YMAX-YMIN)*(ZMAX-ZMIN)/maxvoxels, third);
+  idealgrid = pow((ctx.xmax-ctx.xmin)*(ctx.ymax-ctx.ymin)*(ctx.zmax-ctx.zmin)/maxvoxels, third);
 
   // Search step size for fine-tuning the spacing.
   double increment = 0.001;
@@ -126,9 +193,9 @@ float getIdealGrid () {
   while(maxgrid - mingrid > 2*increment) {
     //cerr << "xx ideal grid: " << idealgrid << std::endl;
     // Align dimensions to multiples of four for the historical grid layout.
-    dx=int((XMAX-XMIN)/idealgrid/4.0+1)*4;
-    dy=int((YMAX-YMIN)/idealgrid/4.0+1)*4;
-    dz=int((ZMAX-ZMIN)/idealgrid/4.0+1)*4;
+    dx=int((ctx.xmax-ctx.xmin)/idealgrid/4.0+1)*4;
+    dy=int((ctx.ymax-ctx.ymin)/idealgrid/4.0+1)*4;
+    dz=int((ctx.zmax-ctx.zmin)/idealgrid/4.0+1)*4;
 
     // Calculate the voxel count for this spacing.
     voxels = dx*dy*dz;
@@ -198,56 +265,71 @@ float OLDgetIdealGrid () {
 // A helper function for clarity and reuse
 // NOTE: The +1 preserves the historical padding that prevented boundary points
 // from mapping just outside the allocated grid (fixes ijk2pt out-of-bounds).
-unsigned int calculateDimension(float min, float max, float grid) {
+// The count is left in a double so assignLimits can reject a spacing whose
+// grid would not fit (or is infinite) before converting it.
+double calculateDimension(float min, float max, float grid) {
   // Convert coordinate extent to voxel count while enforcing multiples of four.
-  return static_cast<unsigned int>(std::ceil((max - min) / grid / 4.0 + 1.0)) * 4;
+  return std::ceil((max - min) / grid / 4.0 + 1.0) * 4;
 }
 
-void assignLimits() {
+void assignLimits(GridContext& ctx) {
   // Determine number of safety buffer cells around the bounding box.
-  const int safety_cells = static_cast<int>(std::ceil(MAXPROBE / GRID)) + 2;
+  // (kept in a float: a tiny spacing would overflow an int here)
+  const float safety_cells = std::ceil(ctx.maxprobe / ctx.spacing) + 2;
   if (safety_cells > 0) {
     // Convert buffer count to Angstrom padding.
-    const float padding = safety_cells * GRID;
+    const float padding = safety_cells * ctx.spacing;
 
     // Expand every axis to guarantee the probe can traverse beyond atoms.
-    XMIN -= padding;
-    YMIN -= padding;
-    ZMIN -= padding;
-    XMAX += padding;
-    YMAX += padding;
-    ZMAX += padding;
+    ctx.xmin -= padding;
+    ctx.ymin -= padding;
+    ctx.zmin -= padding;
+    ctx.xmax += padding;
+    ctx.ymax += padding;
+    ctx.zmax += padding;
   }
 
   // Convert padded bounds into voxel counts along each axis.
-  DX = calculateDimension(XMIN, XMAX, GRID);
-  DY = calculateDimension(YMIN, YMAX, GRID);
-  DZ = calculateDimension(ZMIN, ZMAX, GRID);
+  const double dims[3] = {calculateDimension(ctx.xmin, ctx.xmax, ctx.spacing),
+                          calculateDimension(ctx.ymin, ctx.ymax, ctx.spacing),
+                          calculateDimension(ctx.zmin, ctx.zmax, ctx.spacing)};
+
+  // Count the voxels in 64 bits, stopping once past MAXBINS so nothing
+  // overflows; every index into the grid must fit in an int.
+  int64_t numbins = -1;
+  if (dims[0] <= MAXBINS && dims[1] <= MAXBINS && dims[2] <= MAXBINS) {
+    const int64_t dx = static_cast<int64_t>(dims[0]);
+    const int64_t dxy = dx * static_cast<int64_t>(dims[1]);
+    if (dxy <= MAXBINS) {
+      numbins = dxy * static_cast<int64_t>(dims[2]) + dxy + dx + 1;
+    }
+  }
+  if (numbins < 0 || numbins > MAXBINS) {
+    std::ostringstream message;
+    message << "grid spacing " << ctx.spacing << " with probe " << ctx.maxprobe
+            << " needs more than " << MAXBINS << " voxels; try a spacing of "
+            << getIdealGrid(ctx) << " or more";
+    throw std::length_error(message.str());
+  }
 
   // Precompute strides for fast linear indexing.
-  DXY = DY * DX;
-  DXYZ = DZ * DXY;
+  ctx.dx = static_cast<int>(dims[0]);
+  ctx.dy = static_cast<int>(dims[1]);
+  ctx.dz = static_cast<int>(dims[2]);
+  ctx.dxy = ctx.dy * ctx.dx;
+  ctx.dxyz = ctx.dz * ctx.dxy;
 
   // Add padding voxels, matching legacy ijk2pt expectations.
-  NUMBINS = DXYZ + DXY + DX + 1;
+  ctx.numbins = static_cast<unsigned int>(numbins);
 
   // Emit a quick sanity check about grid usage.
   std::cerr << "Percent filled NUMBINS/2^31: "
-            << (NUMBINS * 1000.0 / MAXBINS) / 10.0 << "%" << std::endl;
+            << (ctx.numbins * 1000.0 / MAXBINS) / 10.0 << "%" << std::endl;
 
   // Hint at an alternate grid spacing that satisfies the voxel cap.
-  float idealGrid = getIdealGrid();
+  float idealGrid = getIdealGrid(ctx);
   std::cerr << "Ideal Grid: " << idealGrid << std::endl;
 
-  // Improved debug message for when NUMBINS exceeds MAXBINS
-  /*if(NUMBINS > MAXBINS) {
-    std::cerr << "MAXPROBE " << MAXPROBE << ", grid " << GRID
-              << " is too large; consider using " << idealGrid
-              << " for " << XYZRFILE // Assuming XYZRFILE is defined and used elsewhere
-              << std::endl << "###### grid is too large ######" << std::endl << std::endl;
-    exit(1); // Consider throwing an exception instead of calling exit for better error handling
-  }*/
-
   std::cerr << std::endl;                     // Leave a blank line to separate log bundles.
 }
 
@@ -255,26 +337,26 @@ void assignLimits() {
 // Dumps the configured grid limits and a couple of reference values so that
 // downstream callers can sanity check the derived constants.  Nothing here
 // mutates state; it simply reports existing globals.
-void testLimits (gridpt grid[]) {
+void testLimits(const GridContext& ctx, gridpt grid[]) {
   std::cerr << "int(1.2) is " << int(1.2) << std::endl;
   std::cerr << "int(-1.2) is " << int(-1.2) << std::endl;
 
-  std::cerr << "XMIN: " << XMIN << std::endl;
-  std::cerr << "YMIN: " << YMIN << std::endl;
-  std::cerr << "ZMIN: " << ZMIN << std::endl;
+  std::cerr << "XMIN: " << ctx.xmin << std::endl;
+  std::cerr << "YMIN: " << ctx.ymin << std::endl;
+  std::cerr << "ZMIN: " << ctx.zmin << std::endl;
 
-  std::cerr << "DX: " << DX << std::endl;
-  std::cerr << "DY: " << DY << std::endl;
-  std::cerr << "DZ: " << DZ << std::endl;
-  std::cerr << "DXY: " << DXY << std::endl;
-  std::cerr << "DXYZ: " << DXYZ << std::endl;
-  std::cerr << "NUMBINS: " << NUMBINS << std::endl;
+  std::cerr << "DX: " << ctx.dx << std::endl;
+  std::cerr << "DY: " << ctx.dy << std::endl;
+  std::cerr << "DZ: " << ctx.dz << std::endl;
+  std::cerr << "DXY: " << ctx.dxy << std::endl;
+  std::cerr << "DXYZ: " << ctx.dxyz << std::endl;
+  std::cerr << "NUMBINS: " << ctx.numbins << std::endl;
 
   unsigned int i;
   std::cerr << "First filled spot: ";
-  for(i=0; i<NUMBINS && !grid[i]; i++) { }
+  for(i=0; i<ctx.numbins && !grid[i]; i++) { }
   std::cerr << i << std::endl << "Last filled spot: ";
-  for(i=NUMBINS-1; i>=0 && !grid[i]; i--) { }
+  for(i=ctx.numbins-1; i>=0 && !grid[i]; i--) { }
   std::cerr << i << std::endl;
   std::cerr << std::endl;
 };
@@ -286,7 +368,7 @@ void testLimits (gridpt grid[]) {
 *********************************************/
 
 /*********************************************/
-int countGrid (const gridpt grid[]) {
+int countGrid(const GridContext& ctx, const gridpt grid[]) {
   // Reset the voxel counter before starting.
   int voxels=0;
 
@@ -295,7 +377,7 @@ int countGrid (const gridpt grid[]) {
     std::cerr << "Counting up Voxels in Grid for Volume...  " << std::flush;
 
   // Iterate every voxel to measure occupancy.
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     if(grid[pt]) {
       voxels++;
     }
@@ -309,12 +391,12 @@ int countGrid (const gridpt grid[]) {
 };
 
 /*********************************************/
-void zeroGrid (gridpt grid[]) {
+void zeroGrid(const GridContext& ctx, gridpt grid[]) {
   // Allocate working buffer if the caller has not provided one.
   if (grid==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    grid = (gridpt*) std::malloc (NUMBINS);
-    if (grid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
+    grid = (gridpt*) std::malloc (ctx.numbins);
+    if (grid==NULL) { throw std::bad_alloc(); }
   }
 
   // Log the zeroing start when debugging.
@@ -323,7 +405,7 @@ void zeroGrid (gridpt grid[]) {
 
   // Parallel loop to reset every voxel to an empty state.
   #pragma omp parallel for
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     grid[pt] = 0;
   }
 
@@ -334,26 +416,36 @@ void zeroGrid (gridpt grid[]) {
 };
 
 /*********************************************/
-int copyGridFromTo (const gridpt oldgrid[], gridpt newgrid[]) {
+int copyGridFromTo(const GridContext& ctx, const gridpt oldgrid[], gridpt newgrid[]) {
   // Thin wrapper to satisfy legacy callers that use the old name.
-  return copyGrid(oldgrid, newgrid);
+  return copyGrid(ctx, oldgrid, newgrid);
 }
 
-std::unique_ptr<gridpt[]> make_zeroed_grid() {
-  auto grid = std::make_unique<gridpt[]>(NUMBINS);
-  zeroGrid(grid.get());
+std::unique_ptr<gridpt[]> make_zeroed_grid(const GridContext& ctx) {
+  auto grid = std::make_unique<gridpt[]>(ctx.numbins);
+  zeroGrid(ctx, grid.get());
   return grid;
 }
 
-std::unique_ptr<gridpt[]> make_grid() {
-  return std::unique_ptr<gridpt[]>(new gridpt[NUMBINS]);
+std::unique_ptr<gridpt[]> make_grid(const GridContext& ctx) {
+  return std::unique_ptr<gridpt[]>(new gridpt[ctx.numbins]);
 }
 
-int first_filled_point(const gridpt grid[]) {
+gridpt* GridBuffer::zeroed(const GridContext& ctx) {
+  if (!data_ || ctx.numbins > capacity_) {
+    data_.reset();
+    data_ = make_grid(ctx);
+    capacity_ = ctx.numbins;
+  }
+  zeroGrid(ctx, data_.get());
+  return data_.get();
+}
+
+int first_filled_point(const GridContext& ctx, const gridpt grid[]) {
   if (!grid) {
     return 0;
   }
-  for (unsigned int pt = 1; pt < NUMBINS; ++pt) {
+  for (unsigned int pt = 1; pt < ctx.numbins; ++pt) {
     if (grid[pt]) {
       return static_cast<int>(pt);
     }
@@ -361,28 +453,28 @@ int first_filled_point(const gridpt grid[]) {
   return 0;
 }
 
-int last_filled_point(const gridpt grid[]) {
+int last_filled_point(const GridContext& ctx, const gridpt grid[]) {
   if (!grid) {
-    return static_cast<int>(NUMBINS - 1);
+    return static_cast<int>(ctx.numbins - 1);
   }
-  for (unsigned int pt = NUMBINS - 1; pt > 0; --pt) {
+  for (unsigned int pt = ctx.numbins - 1; pt > 0; --pt) {
     if (grid[pt]) {
       return static_cast<int>(pt);
     }
   }
-  return static_cast<int>(NUMBINS - 1);
+  return static_cast<int>(ctx.numbins - 1);
 }
 
 /*********************************************/
-int copyGrid (const gridpt oldgrid[], gridpt newgrid[]) {
+int copyGrid(const GridContext& ctx, const gridpt oldgrid[], gridpt newgrid[]) {
   // Zeroing the destination is unnecessary because every element will be overwritten.
   int voxels=0;
 
   // Allocate destination if so requested.
   if (newgrid==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    newgrid = (gridpt*) std::malloc (NUMBINS);
-    if (newgrid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
+    newgrid = (gridpt*) std::malloc (ctx.numbins);
+    if (newgrid==NULL) { throw std::bad_alloc(); }
   }
 
   // Emit progress when debugging.
@@ -391,7 +483,7 @@ int copyGrid (const gridpt oldgrid[], gridpt newgrid[]) {
 
   // Parallel copy loop that counts occupancy at the same time.
   #pragma omp parallel for
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     if(oldgrid[pt]) {
       #pragma omp atomic
       voxels++;
@@ -408,12 +500,12 @@ int copyGrid (const gridpt oldgrid[], gridpt newgrid[]) {
 };
 
 /*********************************************/
-void inverseGrid (gridpt grid[]) {
+void inverseGrid(const GridContext& ctx, gridpt grid[]) {
   // Ensure a target grid exists before mutating.
   if (grid==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    grid = (gridpt*) std::malloc (NUMBINS);
-    if (grid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
+    grid = (gridpt*) std::malloc (ctx.numbins);
+    if (grid==NULL) { throw std::bad_alloc(); }
   }
 
   if (DEBUG > 0)
@@ -421,7 +513,7 @@ void inverseGrid (gridpt grid[]) {
 
   // Flip every voxel in parallel so the accessible/inaccessible regions swap.
   #pragma omp parallel for
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     if(grid[pt]) {
       grid[pt] = 0;
     } else {
@@ -442,7 +534,7 @@ void inverseGrid (gridpt grid[]) {
 *********************************************/
 
 /*********************************************/
-int read_NumAtoms (char file[]) {
+int read_NumAtoms(GridContext& ctx, char file[]) {
   // Prepare the text reader and command-line helpers before parsing.
   ifstream infile;
   int count = 0;
@@ -450,7 +542,6 @@ int read_NumAtoms (char file[]) {
   float minmax[6];
   minmax[0] = 100;  minmax[1] = 100;  minmax[2] = 100;
   minmax[3] = -100;  minmax[4] = -100;  minmax[5] = -100;
-  std::strcpy(XYZRFILE,file);
 
   // Announce the file being inspected and begin reading lines.
   std::cerr << "Reading file for Min/Max: " << file << std::endl;
@@ -479,28 +570,27 @@ int read_NumAtoms (char file[]) {
   }
   std::cerr << std::endl << " [ read " << count << " atoms ]" << std::endl << std::endl;
   if (count < 3) {
-    std::cerr << std::endl << " not enough atoms were found" << std::endl << std::endl;
-    exit(1);
+    throw std::runtime_error("not enough atoms were found");
   }
 
   // Increase bounds so spheres and rounding do not clip at the edges.
-  float FACT = MAXVDW + MAXPROBE + 2*GRID;
+  float FACT = MAXVDW + ctx.maxprobe + 2*ctx.spacing;
   for(int i=0;i<=2;i++) {
     minmax[i] -= FACT;
-    minmax[i] = int(minmax[i]/(4*GRID)-1)*4*GRID;
+    minmax[i] = int(minmax[i]/(4*ctx.spacing)-1)*4*ctx.spacing;
   }
   for(int i=3;i<=5;i++) {
     minmax[i] += FACT;
-    minmax[i] = int(minmax[i]/(4*GRID)+1)*4*GRID;
+    minmax[i] = int(minmax[i]/(4*ctx.spacing)+1)*4*ctx.spacing;
   }
 
   // Store the adjusted extents in the global min/max trackers.
-  if(minmax[0] < XMIN) { XMIN = minmax[0]; }
-  if(minmax[1] < YMIN) { YMIN = minmax[1]; }
-  if(minmax[2] < ZMIN) { ZMIN = minmax[2]; }
-  if(minmax[3] > XMAX) { XMAX = minmax[3]; }
-  if(minmax[4] > YMAX) { YMAX = minmax[4]; }
-  if(minmax[5] > ZMAX) { ZMAX = minmax[5]; }
+  if(minmax[0] < ctx.xmin) { ctx.xmin = minmax[0]; }
+  if(minmax[1] < ctx.ymin) { ctx.ymin = minmax[1]; }
+  if(minmax[2] < ctx.zmin) { ctx.zmin = minmax[2]; }
+  if(minmax[3] > ctx.xmax) { ctx.xmax = minmax[3]; }
+  if(minmax[4] > ctx.ymax) { ctx.ymax = minmax[4]; }
+  if(minmax[5] > ctx.zmax) { ctx.zmax = minmax[5]; }
 
   // Prompt caller to compute derived grid dimensions now that bounds exist.
   std::cerr << "Now Run AssignLimits() to Get NUMBINS Variable" << std::endl << std::endl;
@@ -509,17 +599,11 @@ int read_NumAtoms (char file[]) {
 };
 
 /*********************************************/
-int read_NumAtoms_from_array (const XYZRBuffer& buffer) {
+int read_NumAtoms_from_array(GridContext& ctx, const XYZRBuffer& buffer) {
   const int total = buffer.size();
   // Guard against empty buffers which would produce meaningless bounds.
   if (total <= 0) {
-    std::cerr << "read_NumAtoms_from_array: buffer is empty" << std::endl;
-    exit(1);
-  }
-  // Populate filename placeholder when the caller only provides memory data.
-  if(!XYZRFILE[0]) {
-    std::strncpy(XYZRFILE, "<memory>", sizeof(XYZRFILE));
-    XYZRFILE[sizeof(XYZRFILE) - 1] = '\0';
+    throw std::runtime_error("read_NumAtoms_from_array: buffer is empty");
   }
   int count = 0;
   float minmax[6];
@@ -550,27 +634,26 @@ int read_NumAtoms_from_array (const XYZRBuffer& buffer) {
   }
   std::cerr << std::endl << " [ processed " << count << " atoms ]" << std::endl << std::endl;
   if (count < 3) {
-    std::cerr << std::endl << " not enough atoms were found" << std::endl << std::endl;
-    exit(1);
+    throw std::runtime_error("not enough atoms were found");
   }
 
-  float FACT = MAXVDW + MAXPROBE + 2*GRID;
+  float FACT = MAXVDW + ctx.maxprobe + 2*ctx.spacing;
   for(int i=0;i<=2;i++) {
     // Shrink bounds on the lower axes to ensure integer multiples of 4*GRID.
     minmax[i] -= FACT;
-    minmax[i] = int(minmax[i]/(4*GRID)-1)*4*GRID;
+    minmax[i] = int(minmax[i]/(4*ctx.spacing)-1)*4*ctx.spacing;
   }
   for(int i=3;i<=5;i++) {
     // Expand the upper axes similarly to keep XMAX/YMAX/ZMAX aligned.
     minmax[i] += FACT;
-    minmax[i] = int(minmax[i]/(4*GRID)+1)*4*GRID;
+    minmax[i] = int(minmax[i]/(4*ctx.spacing)+1)*4*ctx.spacing;
   }
-  if(minmax[0] < XMIN) { XMIN = minmax[0]; }
-  if(minmax[1] < YMIN) { YMIN = minmax[1]; }
-  if(minmax[2] < ZMIN) { ZMIN = minmax[2]; }
-  if(minmax[3] > XMAX) { XMAX = minmax[3]; }
-  if(minmax[4] > YMAX) { YMAX = minmax[4]; }
-  if(minmax[5] > ZMAX) { ZMAX = minmax[5]; }
+  if(minmax[0] < ctx.xmin) { ctx.xmin = minmax[0]; }
+  if(minmax[1] < ctx.ymin) { ctx.ymin = minmax[1]; }
+  if(minmax[2] < ctx.zmin) { ctx.zmin = minmax[2]; }
+  if(minmax[3] > ctx.xmax) { ctx.xmax = minmax[3]; }
+  if(minmax[4] > ctx.ymax) { ctx.ymax = minmax[4]; }
+  if(minmax[5] > ctx.zmax) { ctx.zmax = minmax[5]; }
 
   std::cerr << "Now Run AssignLimits() to Get NUMBINS Variable" << std::endl << std::endl;
 
@@ -578,20 +661,19 @@ int read_NumAtoms_from_array (const XYZRBuffer& buffer) {
 };
 
 /*********************************************/
-int fill_AccessGrid_fromFile (int numatoms, const float probe, char file[],
+int fill_AccessGrid_fromFile(const GridContext& ctx, int numatoms, const float probe, char file[],
 	gridpt grid[]) {
 
   // Ensure a working grid exists before zeroing it out.
   if (grid==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    grid = (gridpt*) std::malloc (NUMBINS);
-    if (grid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
+    grid = (gridpt*) std::malloc (ctx.numbins);
+    if (grid==NULL) { throw std::bad_alloc(); }
   }
-  zeroGrid(grid);
+  zeroGrid(ctx, grid);
 
   ifstream infile;
   char line[256];
-  if(!XYZRFILE[0]) { std::strcpy(XYZRFILE,file); }
 
   // Warm-up counters used for showing progress to the user.
   float count = 0;
@@ -613,7 +695,7 @@ int fill_AccessGrid_fromFile (int numatoms, const float probe, char file[],
     }
     sscanf(line," %f %f %f %f",&x,&y,&z,&r);
     // parallelized function
-    filled += fill_AccessGrid(x,y,z,r+probe,grid);
+    filled += fill_AccessGrid(ctx, x,y,z,r+probe,grid);
   }
   infile.close();
   std::cerr << std::endl << "[ read " << count << " atoms ]" << std::endl;
@@ -621,30 +703,62 @@ int fill_AccessGrid_fromFile (int numatoms, const float probe, char file[],
   //OUTPUT INFO
   std::cerr << std::endl << "Access volume for probe " << probe << std::flush;
   std::cerr << "   voxels " << filled << std::flush;
-  std::cerr << " x gridvol " << GRIDVOL << std::endl;
+  std::cerr << " x gridvol " << ctx.gridvol << std::endl;
   std::cerr << "  ACCESS VOL:  ";
-  printVol(filled);
+  printVol(ctx, filled);
   std::cerr << std::endl;
 
   return filled;
 };
 
 /*********************************************/
-int fill_AccessGrid_fromArray (int numatoms, const float probe,
+// Sort atoms into z-slabs of FILL_SLAB planes by the planes their sphere
+// (radius r + probe) touches. Atoms of slab s are
+// slab_atoms[slab_start[s] .. slab_start[s+1]), in input order.
+static const int FILL_SLAB = 8;
+
+static int bin_atoms_by_slab(const GridContext& ctx, const int numatoms, const float probe,
+	const XYZRBuffer& buffer, std::vector<int>& slab_start, std::vector<int>& slab_atoms) {
+  const int nslabs = (ctx.dz + FILL_SLAB - 1) / FILL_SLAB;
+  slab_start.assign(nslabs + 1, 0);
+  std::vector<int> atom_klo(numatoms), atom_khi(numatoms);
+  for(int idx = 0; idx < numatoms; ++idx) {
+    const auto& atom = buffer.atoms[idx];
+    const float R = atom.r + probe;
+    int klo = int((atom.z - ctx.zmin - R)/ctx.spacing - 1.0) / FILL_SLAB;
+    int khi = int((atom.z - ctx.zmin + R)/ctx.spacing + 1.0) / FILL_SLAB;
+    if (klo < 0) { klo = 0; }
+    if (khi > nslabs - 1) { khi = nslabs - 1; }
+    atom_klo[idx] = klo;
+    atom_khi[idx] = khi;
+    for(int slab = klo; slab <= khi; ++slab) {
+      slab_start[slab + 1]++;
+    }
+  }
+  for(int slab = 0; slab < nslabs; ++slab) {
+    slab_start[slab + 1] += slab_start[slab];
+  }
+  slab_atoms.assign(slab_start[nslabs], 0);
+  std::vector<int> slab_fill(slab_start.begin(), slab_start.end() - 1);
+  for(int idx = 0; idx < numatoms; ++idx) {
+    for(int slab = atom_klo[idx]; slab <= atom_khi[idx]; ++slab) {
+      slab_atoms[slab_fill[slab]++] = idx;
+    }
+  }
+  return nslabs;
+}
+
+/*********************************************/
+int fill_AccessGrid_fromArray(const GridContext& ctx, int numatoms, const float probe,
 	const XYZRBuffer& buffer, gridpt grid[]) {
 
   // Prepare the output grid the same way as the file-based helper.
   if (grid==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    grid = (gridpt*) std::malloc (NUMBINS);
-    if (grid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
-  }
-  zeroGrid(grid);
-
-  if(!XYZRFILE[0]) {
-    std::strncpy(XYZRFILE, "<memory>", sizeof(XYZRFILE));
-    XYZRFILE[sizeof(XYZRFILE) - 1] = '\0';
+    grid = (gridpt*) std::malloc (ctx.numbins);
+    if (grid==NULL) { throw std::bad_alloc(); }
   }
+  zeroGrid(ctx, grid);
 
   // Clamp the requested atom count to the buffer length.
   const int total = buffer.size();
@@ -652,98 +766,202 @@ int fill_AccessGrid_fromArray (int numatoms, const float probe,
     numatoms = total;
   }
 
-  // Progress counters similar to the file-based variant.
-  float count = 0;
-  const float cat = numatoms > 0 ? float(numatoms)/60.0f : 1.0f;
-  float cut = cat;
-
   std::cerr << "Filling in-memory atoms into Grid (probe " << probe << ")..." << std::endl;
   printBar();
 
+  // Bin atoms into z-slabs of FILL_SLAB planes. Each slab is rasterized by
+  // one thread, so no two threads write the same plane and the grid does not
+  // depend on the thread count or schedule.
+  std::vector<int> slab_start, slab_atoms;
+  const int nslabs = bin_atoms_by_slab(ctx, numatoms, probe, buffer, slab_start, slab_atoms);
+
+  // Progress is reported per slab, scaled to the usual 60-character bar.
+  const float slabcat = nslabs > 0 ? float(nslabs)/60.0f : 1.0f;
+  float slabcut = slabcat;
+  float slabsdone = 0;
   int filled=0;
-  // Iterate through every atom we intend to rasterize.
-  for(int idx = 0; idx < numatoms; ++idx) {
-    const auto& atom = buffer.atoms[idx];
-    count++;
-    if(count > cut) {
-      std::cerr << "^" << std::flush;
-      cut += cat;
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:filled)
+  for(int slab = 0; slab < nslabs; ++slab) {
+    const int kbegin = slab * FILL_SLAB;
+    const int kend = kbegin + FILL_SLAB < ctx.dz ? kbegin + FILL_SLAB : ctx.dz;
+    for(int n = slab_start[slab]; n < slab_start[slab + 1]; ++n) {
+      const auto& atom = buffer.atoms[slab_atoms[n]];
+      filled += fill_AccessGrid_planes(ctx, atom.x, atom.y, atom.z, atom.r + probe,
+        kbegin, kend, grid);
+    }
+    #pragma omp critical (fill_progress)
+    {
+      slabsdone++;
+      while(slabsdone > slabcut) {
+        std::cerr << "^" << std::flush;
+        slabcut += slabcat;
+      }
     }
-    filled += fill_AccessGrid(atom.x, atom.y, atom.z, atom.r + probe, grid);
   }
-  std::cerr << std::endl << "[ processed " << count << " atoms ]" << std::endl;
+  std::cerr << std::endl << "[ processed " << numatoms << " atoms ]" << std::endl;
 
   std::cerr << std::endl << "Access volume for probe " << probe << std::flush;
   std::cerr << "   voxels " << filled << std::flush;
-  std::cerr << " x gridvol " << GRIDVOL << std::endl;
+  std::cerr << " x gridvol " << ctx.gridvol << std::endl;
   std::cerr << "  ACCESS VOL:  ";
-  printVol(filled);
+  printVol(ctx, filled);
   std::cerr << std::endl;
 
   return filled;
 };
 
 /*********************************************/
-int get_ExcludeGrid_fromFile (int numatoms, const float probe,
+// Distance field for probe sweeps: field[pt] = min over atoms of
+// (distance to the atom center - atom radius) in Angstroms, for voxels within
+// maxprobe of some atom surface, and FLT_MAX elsewhere. Thresholding the field
+// at a probe radius reproduces the accessible grid for that probe.
+int fill_SurfaceDistance_fromArray(const GridContext& ctx, int numatoms, const float maxprobe,
+	const XYZRBuffer& buffer, float field[]) {
+  const long long total = ctx.numbins;
+  #pragma omp parallel for
+  for(long long pt = 0; pt < total; pt++) {
+    field[pt] = FLT_MAX;
+  }
+
+  const int natoms = buffer.size();
+  if (numatoms <= 0 || numatoms > natoms) {
+    numatoms = natoms;
+  }
+  std::cerr << "Filling atom surface distances into Grid (up to probe " << maxprobe
+            << ")..." << std::endl;
+
+  std::vector<int> slab_start, slab_atoms;
+  const int nslabs = bin_atoms_by_slab(ctx, numatoms, maxprobe, buffer, slab_start, slab_atoms);
+  int reached = 0;
+  #pragma omp parallel for schedule(dynamic,1) reduction(+:reached)
+  for(int slab = 0; slab < nslabs; ++slab) {
+    const int kbegin = slab * FILL_SLAB;
+    const int kend = kbegin + FILL_SLAB < ctx.dz ? kbegin + FILL_SLAB : ctx.dz;
+    for(int n = slab_start[slab]; n < slab_start[slab + 1]; ++n) {
+      const auto& atom = buffer.atoms[slab_atoms[n]];
+      const float R = atom.r + maxprobe;
+      const float cutoff = (R / ctx.spacing)*(R / ctx.spacing);
+      const int imin = int((atom.x - ctx.xmin - R)/ctx.spacing - 1.0);
+      const int jmin = int((atom.y - ctx.ymin - R)/ctx.spacing - 1.0);
+      const int kmin = int((atom.z - ctx.zmin - R)/ctx.spacing - 1.0);
+      const int imax = int((atom.x - ctx.xmin + R)/ctx.spacing + 1.0);
+      const int jmax = int((atom.y - ctx.ymin + R)/ctx.spacing + 1.0);
+      const int kmax = int((atom.z - ctx.zmin + R)/ctx.spacing + 1.0);
+      const float xk = (atom.x - ctx.xmin)/ctx.spacing;
+      const float yk = (atom.y - ctx.ymin)/ctx.spacing;
+      const float zk = (atom.z - ctx.zmin)/ctx.spacing;
+      const int klo = kmin > kbegin ? kmin : kbegin;
+      const int khi = kmax < kend - 1 ? kmax : kend - 1;
+      for(int dk=klo; dk<=khi; dk++) {
+      for(int dj=jmin; dj<=jmax; dj++) {
+        float* row = field + dj*ctx.dx + dk*ctx.dxy;
+        const float yz = (yk-dj)*(yk-dj) + (zk-dk)*(zk-dk);
+        if (yz >= cutoff) {
+          continue;
+        }
+        for(int di=imin; di<=imax; di++) {
+          const float distsq = (xk-di)*(xk-di) + yz;
+          if (distsq < cutoff) {
+            const float dist = std::sqrt(distsq)*ctx.spacing - atom.r;
+            if (dist < row[di]) {
+              reached += row[di] == FLT_MAX ? 1 : 0;
+              row[di] = dist;
+            }
+          }
+        }
+      }}
+    }
+  }
+  std::cerr << "[ processed " << numatoms << " atoms, " << reached
+            << " voxels within probe reach ]" << std::endl;
+  return reached;
+}
+
+/*********************************************/
+// Accessible grid for one probe radius from a fill_SurfaceDistance field.
+int threshold_AccessGrid(const GridContext& ctx, const float field[], const float probe,
+	gridpt grid[]) {
+  const long long total = ctx.numbins;
+  long long filled = 0;
+  #pragma omp parallel for reduction(+:filled)
+  for(long long pt = 0; pt < total; pt++) {
+    grid[pt] = field[pt] < probe;
+    filled += grid[pt] ? 1 : 0;
+  }
+  return int(filled);
+}
+
+/*********************************************/
+int get_ExcludeGrid_fromFile(const GridContext& ctx, int numatoms, const float probe,
 	char file[], gridpt EXCgrid[]) {
   // Read the molecule and rasterize accessible space first.
   gridpt *ACCgrid;
   std::cerr << "Allocating Grid..." << std::endl;
-  ACCgrid = (gridpt*) std::malloc (NUMBINS);
-  if (ACCgrid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
-  fill_AccessGrid_fromFile(numatoms,probe,file,ACCgrid);
+  ACCgrid = (gridpt*) std::malloc (ctx.numbins);
+  if (ACCgrid==NULL) { throw std::bad_alloc(); }
+  fill_AccessGrid_fromFile(ctx, numatoms,probe,file,ACCgrid);
 
   // Shrink the accessible map into the excluded volume.
   //trun_ExcludeGrid(probe, ACCgrid, EXCgrid);
-  trun_ExcludeGrid_fast(probe, ACCgrid, EXCgrid);
+  trun_ExcludeGrid_fast(ctx, probe, ACCgrid, EXCgrid);
 
   // Release the intermediate buffer.
   std::free (ACCgrid);
 
   // Report the excluded volume summary.
-  int voxels = countGrid(EXCgrid);
+  int voxels = countGrid(ctx, EXCgrid);
   std::cerr << std::endl << "******************************************" << std::endl;
   std::cerr << "Excluded Volume for Probe " << probe << std::flush;
   std::cerr << "   voxels " << voxels << std::flush;
-  std::cerr << " x gridvol " << GRIDVOL << std::endl;
+  std::cerr << " x gridvol " << ctx.gridvol << std::endl;
   std::cerr << "  EXCLUDED VOL:  ";
-  printVol(voxels);
+  printVol(ctx, voxels);
   std::cerr << std::endl << "******************************************" << std::endl;
 
   return voxels;
 };
 
 /*********************************************/
-int get_ExcludeGrid_fromArray (int numatoms, const float probe,
-	const XYZRBuffer& buffer, gridpt EXCgrid[]) {
+int get_ExcludeGrid_fromArray(const GridContext& ctx, ExcludeEngine engine, int numatoms,
+	const float probe, const XYZRBuffer& buffer, gridpt EXCgrid[]) {
   // Build the accessible grid from the in-memory atom buffer.
   gridpt *ACCgrid;
   std::cerr << "Allocating Grid..." << std::endl;
-  ACCgrid = (gridpt*) std::malloc (NUMBINS);
-  if (ACCgrid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
-  fill_AccessGrid_fromArray(numatoms,probe,buffer,ACCgrid);
+  ACCgrid = (gridpt*) std::malloc (ctx.numbins);
+  if (ACCgrid==NULL) { throw std::bad_alloc(); }
+  fill_AccessGrid_fromArray(ctx, numatoms,probe,buffer,ACCgrid);
 
-  int voxels_acc = countGrid(ACCgrid);
+  int voxels_acc = countGrid(ctx, ACCgrid);
   std::cerr << "Accessible voxels: " << voxels_acc << std::endl;
 
   // Contract that accessible map into the excluded volume.
-  trun_ExcludeGrid_fast(probe, ACCgrid, EXCgrid);
+  if (engine == ExcludeEngine::DistanceTransform) {
+    trun_ExcludeGrid_edt(ctx, probe, ACCgrid, EXCgrid);
+  } else {
+    trun_ExcludeGrid_fast(ctx, probe, ACCgrid, EXCgrid);
+  }
 
   // Free the scratch grid before final reporting.
   std::free (ACCgrid);
 
-  int voxels = countGrid(EXCgrid);
+  int voxels = countGrid(ctx, EXCgrid);
   std::cerr << std::endl << "******************************************" << std::endl;
   std::cerr << "Excluded Volume for Probe " << probe << std::flush;
   std::cerr << "   voxels " << voxels << std::flush;
-  std::cerr << " x gridvol " << GRIDVOL << std::endl;
+  std::cerr << " x gridvol " << ctx.gridvol << std::endl;
   std::cerr << "  EXCLUDED VOL:  ";
-  printVol(voxels);
+  printVol(ctx, voxels);
   std::cerr << std::endl << "******************************************" << std::endl;
 
   return voxels;
 };
 
+/*********************************************/
+int get_ExcludeGrid_fromArray(const GridContext& ctx, int numatoms, const float probe,
+	const XYZRBuffer& buffer, gridpt EXCgrid[]) {
+  return get_ExcludeGrid_fromArray(ctx, ExcludeEngine::Stamp, numatoms, probe, buffer, EXCgrid);
+}
+
 
 /*********************************************
 **********************************************
@@ -775,34 +993,33 @@ int get_ExcludeGrid_fromArray (int numatoms, const float probe,
  *   - This function is a significant time-limiting factor and is optimized to reduce unnecessary checks.
  *
  *********************************************/
-void trun_ExcludeGrid(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) { // contract
+void trun_ExcludeGrid(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) { // contract
 
   // Define grid boundaries for limiting the search region.
   // These constants define the start and end indices for each axis.
   const int imin = 1;      // Minimum i index
-  const int jmin = DX;     // Minimum j index (step size = DX)
-  const int kmin = DXY;    // Minimum k index (step size = DXY)
-  const int imax = DX;     // Maximum i index
-  const int jmax = DXY;    // Maximum j index
-  const int kmax = DXYZ;   // Maximum k index
+  const int jmin = ctx.dx;     // Minimum j index (step size = DX)
+  const int kmin = ctx.dxy;    // Minimum k index (step size = DXY)
+  const int imax = ctx.dx;     // Maximum i index
+  const int jmax = ctx.dxy;    // Maximum j index
+  const int kmax = ctx.dxyz;   // Maximum k index
 
   // Progress tracking variables for displaying the progress bar.
   float count = 0;                     // Counter for processed slices.
-  const float cat = ((kmax - kmin) / DXY) / 60.0; // Calculate progress increment.
+  const float cat = ((kmax - kmin) / ctx.dxy) / 60.0; // Calculate progress increment.
   float cut = cat;                     // Progress cutoff for printing.
 
   // Allocate memory for `EXCgrid` if it is NULL.
   if (EXCgrid == NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    EXCgrid = (gridpt*) std::malloc(NUMBINS);
+    EXCgrid = (gridpt*) std::malloc(ctx.numbins);
     if (EXCgrid == NULL) {
-      std::cerr << "GRID IS NULL" << std::endl;
-      exit(1);
+      throw std::bad_alloc();
     }
   }
 
   // Copy the `ACCgrid` into `EXCgrid` as the starting point for modification.
-  copyGridFromTo(ACCgrid, EXCgrid);
+  copyGridFromTo(ctx, ACCgrid, EXCgrid);
 
   // Inform the user about the operation being performed.
   std::cerr << "Truncating Excluded Grid from Accessible"
@@ -810,7 +1027,7 @@ void trun_ExcludeGrid(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[
   printBar(); // Print a progress bar to show the operation's progress.
 
   // Loop over the k-dimension in large steps (DXY) to limit the search range.
-  for (int bigk = kmin; bigk < kmax; bigk += DXY) {
+  for (int bigk = kmin; bigk < kmax; bigk += ctx.dxy) {
     count++; // Increment the slice counter.
     if (count > cut) {
       std::cerr << "^" << std::flush; // Print progress marker.
@@ -819,19 +1036,19 @@ void trun_ExcludeGrid(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[
 
     // Enable parallelization for processing the grid in the j-dimension.
     #pragma omp parallel for
-    for (int bigj = jmin; bigj < jmax; bigj += DX) {
+    for (int bigj = jmin; bigj < jmax; bigj += ctx.dx) {
       // Loop over the i-dimension with unit step size.
       for (int i = imin; i < imax; i++) {
         const int pt = i + bigj + bigk;
         // Check if the current grid point is unoccupied in the accessible grid.
         if (!ACCgrid[i + bigj + bigk]) {
           // Check if the grid point has any filled neighbors in the accessible grid.
-          if (hasFilledNeighbor(pt, ACCgrid)) {
+          if (hasFilledNeighbor(ctx, pt, ACCgrid)) {
             // Convert `bigj` and `bigk` to smaller indices for the actual 3D grid.
-            const int j = bigj / DX;      // Convert bigj to small j index.
-            const int k = bigk / DXY;     // Convert bigk to small k index.
+            const int j = bigj / ctx.dx;      // Convert bigj to small j index.
+            const int k = bigk / ctx.dxy;     // Convert bigk to small k index.
             // Mark the grid point as excluded using the emptying function.
-            empty_ExcludeGrid(i, j, k, probe, EXCgrid);
+            empty_ExcludeGrid(ctx, i, j, k, probe, EXCgrid);
           }
         }
       }
@@ -844,7 +1061,7 @@ void trun_ExcludeGrid(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[
 }
 
 
-std::vector<int> computeOffsets(const float radius_units) {
+std::vector<int> computeOffsets(const GridContext& ctx, const float radius_units) {
   std::vector<int> offsets;
   if (radius_units <= 0.0f) {
     return offsets;
@@ -857,7 +1074,7 @@ std::vector<int> computeOffsets(const float radius_units) {
       for (int dk = -max_radius; dk <= max_radius; dk++) {
         const float dist2 = static_cast<float>(di * di + dj * dj + dk * dk);
         if (dist2 < cutoff) {
-          offsets.push_back(di + dj * DX + dk * DXY);
+          offsets.push_back(di + dj * ctx.dx + dk * ctx.dxy);
         }
       }
     }
@@ -865,35 +1082,33 @@ std::vector<int> computeOffsets(const float radius_units) {
   return offsets;
 }
 
-void trun_ExcludeGrid_fast(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
-  const int imin = 1, jmin = DX, kmin = DXY;
-  const int imax = DX, jmax = DXY, kmax = DXYZ;
+void trun_ExcludeGrid_fast(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  const int imin = 1, jmin = ctx.dx, kmin = ctx.dxy;
+  const int imax = ctx.dx, jmax = ctx.dxy, kmax = ctx.dxyz;
 
   float count = 0;
-  const float cat = ((kmax - kmin) / DXY) / 60.0;
+  const float cat = ((kmax - kmin) / ctx.dxy) / 60.0;
   float cut = cat;
 
   // Allocate memory for EXCgrid if NULL
   if (EXCgrid == NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    EXCgrid = (gridpt *)std::malloc(NUMBINS);
+    EXCgrid = (gridpt *)std::malloc(ctx.numbins);
     if (EXCgrid == NULL) {
-      std::cerr << "GRID IS NULL" << std::endl;
-      exit(1);
+      throw std::bad_alloc();
     }
   }
 
   // Copy ACCgrid to EXCgrid
-  copyGridFromTo(ACCgrid, EXCgrid);
+  copyGridFromTo(ctx, ACCgrid, EXCgrid);
 
-  // Precompute offsets for the given probe radius
-  const float radius_units = probe / GRID;
-  std::vector<int> offsets = computeOffsets(radius_units);
+  // Look up the row-span stencil for the given probe radius once
+  const SphereStencil& stencil = sphere_stencil(probe / ctx.spacing);
 
   std::cerr << "Truncating Excluded Grid from Accessible Grid by Probe " << probe << "..." << std::endl;
   printBar();
 
-  for (int bigk = kmin; bigk < kmax; bigk += DXY) {
+  for (int bigk = kmin; bigk < kmax; bigk += ctx.dxy) {
     count++;
     if (count > cut) {
       std::cerr << "^" << std::flush;
@@ -901,15 +1116,15 @@ void trun_ExcludeGrid_fast(const float probe, const gridpt ACCgrid[], gridpt EXC
     }
 
     #pragma omp parallel for
-    for (int bigj = jmin; bigj < jmax; bigj += DX) {
+    for (int bigj = jmin; bigj < jmax; bigj += ctx.dx) {
       for (int i = imin; i < imax; i++) {
         const int pt = i + bigj + bigk;
 
         // Skip empty grid points
         if (!ACCgrid[pt]) {
           // If the point has filled neighbors, exclude it
-          if (hasFilledNeighbor(pt, ACCgrid)) {
-            empty_ExcludeGrid_fast(pt, offsets, EXCgrid);
+          if (hasFilledNeighbor(ctx, pt, ACCgrid)) {
+            stamp_Stencil(ctx, stencil, i, bigj / ctx.dx, bigk / ctx.dxy, 0, EXCgrid);
           }
         }
       }
@@ -922,26 +1137,26 @@ void trun_ExcludeGrid_fast(const float probe, const gridpt ACCgrid[], gridpt EXC
 
 /*********************************************/
 // Expands the excluded grid outward by filling neighbors around occupied voxels.
-void grow_ExcludeGrid (const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+void grow_ExcludeGrid(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
   // Limit search to the main interior of the grid to avoid borders.
   const int imin = 1;
-  const int jmin = DX;
-  const int kmin = DXY;
-  const int imax = DX;
-  const int jmax = DXY;
-  const int kmax = DXYZ;
+  const int jmin = ctx.dx;
+  const int kmin = ctx.dxy;
+  const int imax = ctx.dx;
+  const int jmax = ctx.dxy;
+  const int kmax = ctx.dxyz;
 
   // Allocate or reuse the exclusion grid and seed it from the accessible grid.
   if (EXCgrid==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    EXCgrid = (gridpt*) std::malloc (NUMBINS);
-    if (EXCgrid==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
+    EXCgrid = (gridpt*) std::malloc (ctx.numbins);
+    if (EXCgrid==NULL) { throw std::bad_alloc(); }
   }
-  copyGrid(ACCgrid,EXCgrid);
+  copyGrid(ctx, ACCgrid,EXCgrid);
 
   // Progress tracking to keep the user informed.
   float count = 0;
-  const float cat = ((kmax-kmin)/DXY)/60.0;
+  const float cat = ((kmax-kmin)/ctx.dxy)/60.0;
   float cut = cat;
 
   std::cerr << std::endl << "Growing Excluded Grid from Accessible "
@@ -949,21 +1164,21 @@ void grow_ExcludeGrid (const float probe, const gridpt ACCgrid[], gridpt EXCgrid
   printBar();
 
   // Sweep through the volume slice by slice, parallelizing the inner loops.
-  for(int k=kmin; k<kmax; k+=DXY) {
+  for(int k=kmin; k<kmax; k+=ctx.dxy) {
     count++;
     if(count > cut) {
       std::cerr << "^" << std::flush;
       cut += cat;
     }
     #pragma omp parallel for
-    for(int j=jmin; j<jmax; j+=DX) {
+    for(int j=jmin; j<jmax; j+=ctx.dx) {
       for(int i=imin; i<imax; i++) {
         const int pt = i+j+k;
         if(ACCgrid[pt]) {
-          if(hasEmptyNeighbor(pt,ACCgrid)) {
-            const int k2 = k/DXY;
-            const int j2 = j/DX;
-            fill_ExcludeGrid(i,j2,k2,probe,EXCgrid);
+          if(hasEmptyNeighbor(ctx, pt,ACCgrid)) {
+            const int k2 = k/ctx.dxy;
+            const int j2 = j/ctx.dx;
+            fill_ExcludeGrid(ctx, i,j2,k2,probe,EXCgrid);
           }
         }
       }
@@ -975,22 +1190,42 @@ void grow_ExcludeGrid (const float probe, const gridpt ACCgrid[], gridpt EXCgrid
 };
 
 /*********************************************/
-float *get_Point (gridpt grid[]) {
+// Engine-selecting front ends used by the tools' --exclude-engine option.
+void trun_ExcludeGrid(const GridContext& ctx, ExcludeEngine engine, const float probe,
+	const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  if (engine == ExcludeEngine::DistanceTransform) {
+    trun_ExcludeGrid_edt(ctx, probe, ACCgrid, EXCgrid);
+  } else {
+    trun_ExcludeGrid(ctx, probe, ACCgrid, EXCgrid);
+  }
+}
+
+void grow_ExcludeGrid(const GridContext& ctx, ExcludeEngine engine, const float probe,
+	const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  if (engine == ExcludeEngine::DistanceTransform) {
+    grow_ExcludeGrid_edt(ctx, probe, ACCgrid, EXCgrid);
+  } else {
+    grow_ExcludeGrid(ctx, probe, ACCgrid, EXCgrid);
+  }
+}
+
+/*********************************************/
+float *get_Point(const GridContext& ctx, gridpt grid[]) {
   // Search the entire grid for an occupied voxel and return its coordinates.
   int gp;
   int i,j,k;
   float *xyz = (float*) std::malloc ( sizeof(float)*3 );
 
-  for(k=0; k<DZ; k++) {
-    for(j=0; j<DY; j++) {
-      for(i=0; i<DX; i++) {
-        gp = ijk2pt(i,j,k);
+  for(k=0; k<ctx.dz; k++) {
+    for(j=0; j<ctx.dy; j++) {
+      for(i=0; i<ctx.dx; i++) {
+        gp = ijk2pt(ctx, i,j,k);
         if(grid[gp] == 1) {
           std::cerr << std::endl << "grid point: " << gp << " value: " << grid[gp] << std::endl;
           std::cerr << std::endl << "i:" << i << " j:" << j << " k:" << k << std::endl;
-          xyz[0] = float(i-0.5)*GRID + XMIN;
-          xyz[1] = float(j-0.5)*GRID + YMIN;
-          xyz[2] = float(k-0.5)*GRID + ZMIN;
+          xyz[0] = float(i-0.5)*ctx.spacing + ctx.xmin;
+          xyz[1] = float(j-0.5)*ctx.spacing + ctx.ymin;
+          xyz[2] = float(k-0.5)*ctx.spacing + ctx.zmin;
           std::cerr << std::endl << "x:" << xyz[0] << " y:" << xyz[1] << " z:" << xyz[2] << std::endl;
           return xyz;
         }
@@ -1001,15 +1236,15 @@ float *get_Point (gridpt grid[]) {
 };
 
 /*********************************************/
-int get_GridPoint (gridpt grid[]) {
+int get_GridPoint(const GridContext& ctx, gridpt grid[]) {
   // Find and return the first occupied voxel index.
   int gp;
   if (DEBUG > 0)
     std::cerr << "searching for first filled grid point... " << std::endl;
-  for(gp=0; gp<DXYZ; gp++) {
+  for(gp=0; gp<ctx.dxyz; gp++) {
     if(grid[gp] == 1) {
       if (DEBUG > 0)
-        cerr << "grid point: " << gp << " of " << DXYZ
+        cerr << "grid point: " << gp << " of " << ctx.dxyz
               << "; value: " << grid[gp] << std::endl;
       return gp;
     }
@@ -1018,36 +1253,99 @@ int get_GridPoint (gridpt grid[]) {
 };
 
 /*********************************************/
-int get_Connected (gridpt grid[], gridpt connect[], const float x, const float y, const float z) {
+// Breadth-first flood fill of the 26-connected region of grid around gp into
+// connect (gp itself must already be set in connect). The frontier grows as
+// needed, so no voxel is dropped however large the region. Levels with more
+// than FLOOD_PARALLEL_MIN points are expanded in parallel; each voxel is
+// claimed with an atomic exchange, so the filled set and the count do not
+// depend on the thread count. Adds the newly filled voxels to connected and
+// returns the number of frontier points expanded.
+static const int FLOOD_PARALLEL_MIN = 4096;
+
+static int flood_Connected(const GridContext& ctx, const gridpt grid[], gridpt connect[],
+	const int gp, int& connected) {
+  int offsets[26];
+  int noffsets = 0;
+  for(int i=-1; i<=1; i++) {
+  for(int j=-ctx.dx; j<=ctx.dx; j+=ctx.dx) {
+  for(int k=-ctx.dxy; k<=ctx.dxy; k+=ctx.dxy) {
+    if(i + j + k != 0) {
+      offsets[noffsets++] = i + j + k;
+    }
+  }}}
+
+  int steps = 0;
+  int added = 0;
+  std::vector<int> frontier(1, gp), next;
+  while(!frontier.empty()) {
+    const int last = frontier.size();
+    steps += last;
+    next.clear();
+    #pragma omp parallel if(last > FLOOD_PARALLEL_MIN) reduction(+:added)
+    {
+      std::vector<int> local;
+      #pragma omp for schedule(static) nowait
+      for(int n=0; n<last; n++) {
+        const int p = frontier[n];
+        for(int o=0; o<noffsets; o++) {
+          const int pt = p + offsets[o];
+          if(!grid[pt]) {
+            continue;
+          }
+          gridpt seen;
+          #pragma omp atomic read
+          seen = connect[pt];
+          if(seen) {
+            continue;
+          }
+          #pragma omp atomic capture
+          { seen = connect[pt]; connect[pt] = 1; }
+          if(!seen) {
+            local.push_back(pt);
+            added++;
+          }
+        }
+      }
+      #pragma omp critical (flood_frontier)
+      next.insert(next.end(), local.begin(), local.end());
+    }
+    frontier.swap(next);
+  }
+  connected += added;
+  return steps;
+}
+
+/*********************************************/
+int get_Connected(const GridContext& ctx, gridpt grid[], gridpt connect[], const float x, const float y, const float z) {
   // Log the query point in physical space then convert to voxel index.
   std::cerr << std::endl << "x:" << x << " y:" << y << " z:" << z << std::endl;
-  const int gp = xyz2pt(x,y,z);
+  const int gp = xyz2pt(ctx, x,y,z);
   if (DEBUG > 0)
     std::cerr << "gp: " << gp << " grid value: " << grid[gp] << std::endl;
 
   // Allocate the connectivity mask if the caller did not supply one.
   if (connect==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    connect = (gridpt*) std::malloc (NUMBINS);
-    if (connect==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
-    zeroGrid(connect);
+    connect = (gridpt*) std::malloc (ctx.numbins);
+    if (connect==NULL) { throw std::bad_alloc(); }
+    zeroGrid(ctx, connect);
   }
 
   if (grid[gp] == 0) {
     std::cerr << "GetConnected: Point is NOT FILLED" << std::endl;
     int pt;
-    const int delta = int(3.0/GRID);
+    const int delta = int(3.0/ctx.spacing);
     bool stop=0;
-    int ip = int((x-XMIN)/GRID+0.5);
-    int jp = int((y-YMIN)/GRID+0.5);
-    int kp = int((z-ZMIN)/GRID+0.5);
+    int ip = int((x-ctx.xmin)/ctx.spacing+0.5);
+    int jp = int((y-ctx.ymin)/ctx.spacing+0.5);
+    int kp = int((z-ctx.zmin)/ctx.spacing+0.5);
     for(int id=-delta; !stop && id<=delta; id++) {
     for(int jd=-delta; !stop && jd<=delta; jd++) {
     for(int kd=-delta; !stop && kd<=delta; kd++) {
-      pt = ijk2pt(ip+id,jp+jd,kp+kd);
+      pt = ijk2pt(ctx, ip+id,jp+jd,kp+kd);
       if(grid[pt]) {
         float xn,yn,zn;
-        pt2xyz(pt, xn, yn, zn);
+        pt2xyz(ctx, pt, xn, yn, zn);
 	     std::cerr << "nearest filled pt: " << xn << " " << yn << " " << zn << std::endl;
         stop=1;
       }
@@ -1055,53 +1353,14 @@ int get_Connected (gridpt grid[], gridpt connect[], const float x, const float y
   }
 
   // Traverse neighbors from the starting point to mark connected voxels.
-  const int max = NUMBINS;
+  const int max = ctx.numbins;
   int steps=0;
   int connected=0;
   if(gp >= 0 && gp <= max && grid[gp]) {
     connect[gp] = 1;
     if (DEBUG > 0)
       std::cerr << "GetConnected..." << std::flush;
-// defined in utils.h
-//    #define MAXLIST 1048576 //2^20
-//    #define MAXLIST 32768 //2^15
-//    #define MAXLIST 8192  //2^13
-    int LIST[MAXLIST];
-    int last = 1;
-    LIST[0] = gp;
-    LIST[1] = 0;
-
-    // Breadth-first expansion loop.
-    while(last != 0) {
-    //cerr << "." << std::flush;
-      int newlast = 0;
-      int NEWLIST[MAXLIST];
-      // Try every point collected in the current frontier.
-      for(int n=0; n<last; n++) {
-        steps++;
-        int p = LIST[n];
-        for(int i=-1; i<=1; i++) {
-        for(int j=-DX; j<=DX; j+=DX) {
-        for(int k=-DXY; k<=DXY; k+=DXY) {
-          int pt = p + i + j + k;
-          if(grid[pt] && !connect[pt]) {  //isClose2Tunnel???
-            connect[pt] = 1;
-            connected++;
-            if(newlast < MAXLIST-10) {
-              NEWLIST[newlast] = pt;
-              newlast++;
-            }
-          }
-        }}}
-      }
-      // Copy new frontier back into the working list in parallel.
-      #pragma omp parallel for
-      for(int n=0; n<newlast; n++) {
-        LIST[n] = NEWLIST[n];
-      }
-      last=newlast;
-      LIST[last]=0;
-    }
+    steps = flood_Connected(ctx, grid, connect, gp, connected);
     //cerr << std::endl;
     if(steps > 1) {
       if (DEBUG > 0)
@@ -1121,29 +1380,29 @@ int get_Connected (gridpt grid[], gridpt connect[], const float x, const float y
 };
 
 /*********************************************/
-int get_ConnectedRange (gridpt grid[], gridpt connect[], const float x, const float y, const float z) {
+int get_ConnectedRange(const GridContext& ctx, gridpt grid[], gridpt connect[], const float x, const float y, const float z) {
   // Locate a filled voxel near the user-specified coordinate and flood-fill it.
-  int gp = xyz2pt(x,y,z);
+  int gp = xyz2pt(ctx, x,y,z);
   int ip,jp,kp;
-  ip = int((x-XMIN)/GRID+0.5);
-  jp = int((y-YMIN)/GRID+0.5);
-  kp = int((z-ZMIN)/GRID+0.5);
+  ip = int((x-ctx.xmin)/ctx.spacing+0.5);
+  jp = int((y-ctx.ymin)/ctx.spacing+0.5);
+  kp = int((z-ctx.zmin)/ctx.spacing+0.5);
   if (connect==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    connect = (gridpt*) std::malloc (NUMBINS);
-    if (connect==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
-    zeroGrid(connect);
+    connect = (gridpt*) std::malloc (ctx.numbins);
+    if (connect==NULL) { throw std::bad_alloc(); }
+    zeroGrid(ctx, connect);
   }
 
 //Oops selected point isn't open! Better get new one
   if(!grid[gp]) {
-    const int delta = int(1.50/GRID);
+    const int delta = int(1.50/ctx.spacing);
     bool stop=0;
     int gd=gp;
     for(int id=-delta; !stop && id<=delta; id++) {
     for(int jd=-delta; !stop && jd<=delta; jd++) {
     for(int kd=-delta; !stop && kd<=delta; kd++) {
-      gd = ijk2pt(ip+id,jp+jd,kp+kd);
+      gd = ijk2pt(ctx, ip+id,jp+jd,kp+kd);
       if(grid[gd]) {
         stop=1;
         gp=gd;
@@ -1151,7 +1410,7 @@ int get_ConnectedRange (gridpt grid[], gridpt connect[], const float x, const fl
     }}}
   }
 
-  const int max = NUMBINS;
+  const int max = ctx.numbins;
   int steps=0;
   int connected=0;
   if(gp >= 0 && gp <= max && grid[gp]) {
@@ -1159,42 +1418,7 @@ int get_ConnectedRange (gridpt grid[], gridpt connect[], const float x, const fl
     if (DEBUG > 0)
       std::cerr << "GetConnected..." << std::flush;
 
-//    #define MAXLIST 1048576 //2^20
-//    #define MAXLIST 32768 //2^15
-//    #define MAXLIST 8192  //2^13
-    int LIST[MAXLIST];
-    int last = 1;
-    LIST[0] = gp;
-    LIST[1] = 0;
-
-    while(last != 0) {
-    //cerr << "." << std::flush;
-      int newlast = 0;
-      int NEWLIST[MAXLIST];
-      for(int n=0; n<last; n++) {
-        steps++;
-        int p = LIST[n];
-        for(int i=-1; i<=1; i++) {
-        for(int j=-DX; j<=DX; j+=DX) {
-        for(int k=-DXY; k<=DXY; k+=DXY) {
-          int pt = p + i + j + k;
-          if(grid[pt] && !connect[pt]) {  //isClose2Tunnel???
-            connect[pt] = 1;
-            connected++;
-            if(newlast < MAXLIST-10) {
-              NEWLIST[newlast] = pt;
-              newlast++;
-            }
-          }
-        }}}
-      }
-      #pragma omp parallel for
-      for(int n=0; n<newlast; n++) {
-        LIST[n] = NEWLIST[n];
-      }
-      last=newlast;
-      LIST[last]=0;
-    }
+    steps = flood_Connected(ctx, grid, connect, gp, connected);
     //cerr << std::endl;
     if(steps > 1) {
       if (DEBUG > 0)
@@ -1214,16 +1438,16 @@ int get_ConnectedRange (gridpt grid[], gridpt connect[], const float x, const fl
 };
 
 /*********************************************/
-int get_Connected_Point (gridpt grid[], gridpt connect[], const int gp) {
+int get_Connected_Point(const GridContext& ctx, gridpt grid[], gridpt connect[], const int gp) {
   if (DEBUG > 0)
     std::cerr << "Initialize Get Connected Point..." << std::endl;
   if (connect==NULL) {
     std::cerr << "Allocating Grid..." << std::endl;
-    connect = (gridpt*) std::malloc (NUMBINS);
-    if (connect==NULL) { std::cerr << "GRID IS NULL" << std::endl; exit (1); }
-    zeroGrid(connect);
+    connect = (gridpt*) std::malloc (ctx.numbins);
+    if (connect==NULL) { throw std::bad_alloc(); }
+    zeroGrid(ctx, connect);
   }
-  const int max = NUMBINS;
+  const int max = ctx.numbins;
   int steps=0;
   int connected=0;
   if(gp >= 0 && gp <= max && grid[gp]) {
@@ -1231,43 +1455,7 @@ int get_Connected_Point (gridpt grid[], gridpt connect[], const int gp) {
     if (DEBUG > 0)
       std::cerr << "Get Connected to Point..." << std::flush;
 
-//    #define MAXLIST 1048576 //2^20
-//    #define MAXLIST 32768 //2^15
-//    #define MAXLIST 8192  //2^13
-    int LIST[MAXLIST];
-    int last = 1;
-    LIST[0] = gp;
-    LIST[1] = 0;
-
-
-    while(last != 0) {
-    //cerr << "." << std::flush;
-      int newlast = 0;
-      int NEWLIST[MAXLIST];
-      for(int n=0; n<last; n++) {
-        steps++;
-        int p = LIST[n];
-        for(int i=-1; i<=1; i++) {
-        for(int j=-DX; j<=DX; j+=DX) {
-        for(int k=-DXY; k<=DXY; k+=DXY) {
-          int pt = p + i + j + k;
-          if(grid[pt] && !connect[pt]) {  //isClose2Tunnel???
-            connect[pt] = 1;
-            connected++;
-            if(newlast < MAXLIST-10) {
-              NEWLIST[newlast] = pt;
-              newlast++;
-            }
-          }
-        }}}
-      }
-      #pragma omp parallel for
-      for(int n=0; n<newlast; n++) {
-        LIST[n] = NEWLIST[n];
-      }
-      last=newlast;
-      LIST[last]=0;
-    }
+    steps = flood_Connected(ctx, grid, connect, gp, connected);
     //cerr << std::endl;
     if(steps > 1) {
       if (DEBUG > 0)
@@ -1281,7 +1469,7 @@ int get_Connected_Point (gridpt grid[], gridpt connect[], const int gp) {
 };
 
 /*********************************************/
-int subt_Grids (gridpt biggrid[], gridpt smgrid[]) {
+int subt_Grids(const GridContext& ctx, gridpt biggrid[], gridpt smgrid[]) {
   /*
     Subtracts smgrid from biggrid and save to biggrid
     equivalent to B AND !S
@@ -1299,7 +1487,7 @@ int subt_Grids (gridpt biggrid[], gridpt smgrid[]) {
     std::cerr << "Subtracting Grids (Modifies biggrid)...  " << std::flush;
   //printBar();
 
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
   /*count++;
   if(count > cut) {
     std::cerr << "^" << std::flush;
@@ -1324,7 +1512,7 @@ int subt_Grids (gridpt biggrid[], gridpt smgrid[]) {
 };
 
 /*********************************************/
-int intersect_Grids (gridpt grid1[], gridpt grid2[]) {
+int intersect_Grids(const GridContext& ctx, gridpt grid1[], gridpt grid2[]) {
   /*
     intersect grid1 from grid2 and save to grid1
     equivalent to G1 AND G2
@@ -1343,7 +1531,7 @@ int intersect_Grids (gridpt grid1[], gridpt grid2[]) {
     std::cerr << "Intersecting Grids...  " << std::flush;
   //printBar();
 
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     /*count++;
     if(count > cut) {
       std::cerr << "^" << std::flush;
@@ -1370,7 +1558,7 @@ int intersect_Grids (gridpt grid1[], gridpt grid2[]) {
 
 
 /*********************************************/
-int merge_Grids (gridpt grid1[], gridpt grid2[]) {
+int merge_Grids(const GridContext& ctx, gridpt grid1[], gridpt grid2[]) {
   /*
     intersect grid1 from grid2 and save to grid1
     equivalent to G1 AND G2
@@ -1389,7 +1577,7 @@ int merge_Grids (gridpt grid1[], gridpt grid2[]) {
     std::cerr << "Merging Grids...  " << std::flush;
   //printBar();
 
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     /*count++;
     if(count > cut) {
       std::cerr << "^" << std::flush;
@@ -1422,39 +1610,69 @@ int merge_Grids (gridpt grid1[], gridpt grid2[]) {
 *********************************************/
 
 /*********************************************/
-int fill_AccessGrid (const float x, const float y, const float z,
-	const float R, gridpt grid[]) {
-// could redo to simplify
-  const float cutoff = (R / GRID)*(R / GRID);
-
-  const int imin = int((x - XMIN - R)/GRID - 1.0);
-  const int jmin = int((y - YMIN - R)/GRID - 1.0);
-  const int kmin = int((z - ZMIN - R)/GRID - 1.0);
-  const int imax = int((x - XMIN + R)/GRID + 1.0);
-  const int jmax = int((y - YMIN + R)/GRID + 1.0);
-  const int kmax = int((z - ZMIN + R)/GRID + 1.0);
+// Rasterize the part of one sphere that lies in z-planes [kbegin, kend).
+// Serial on purpose: callers parallelize over atoms/slabs, never per sphere.
+static int fill_AccessGrid_planes(const GridContext& ctx, const float x, const float y,
+	const float z, const float R, const int kbegin, const int kend, gridpt grid[]) {
+  const float cutoff = (R / ctx.spacing)*(R / ctx.spacing);
+
+  const int imin = int((x - ctx.xmin - R)/ctx.spacing - 1.0);
+  const int jmin = int((y - ctx.ymin - R)/ctx.spacing - 1.0);
+  const int kmin = int((z - ctx.zmin - R)/ctx.spacing - 1.0);
+  const int imax = int((x - ctx.xmin + R)/ctx.spacing + 1.0);
+  const int jmax = int((y - ctx.ymin + R)/ctx.spacing + 1.0);
+  const int kmax = int((z - ctx.zmin + R)/ctx.spacing + 1.0);
+
+  const float xk = (x - ctx.xmin)/ctx.spacing;
+  const float yk = (y - ctx.ymin)/ctx.spacing;
+  const float zk = (z - ctx.zmin)/ctx.spacing;
+
+  const int klo = kmin > kbegin ? kmin : kbegin;
+  const int khi = kmax < kend - 1 ? kmax : kend - 1;
 
-  const float xk = (x - XMIN)/GRID;
-  const float yk = (y - YMIN)/GRID;
-  const float zk = (z - ZMIN)/GRID;
-
-  float distsq;
   int filled=0;
-  #pragma omp parallel for
-  for(int di=imin; di<=imax; di++) {
+  // Along a row the test below is monotone in |xk-di|, so the voxels inside
+  // the sphere form one span around the nearest column. Estimate the span
+  // with sqrt, then settle both ends with the exact float test so the set is
+  // the same as testing every voxel of the bounding box.
+  const int icenter = int(std::floor(xk + 0.5f));
+  for(int dk=klo; dk<=khi; dk++) {
   for(int dj=jmin; dj<=jmax; dj++) {
-  for(int dk=kmin; dk<=kmax; dk++) {
-     distsq = (xk-di)*(xk-di) + (yk-dj)*(yk-dj) + (zk-dk)*(zk-dk);
-     if(distsq < cutoff) {
-       int pt = ijk2pt(di,dj,dk);
-       if(!grid[pt]) {
-         grid[pt] = 1;
-         #pragma omp atomic
-         filled++;
-       }
+     auto inside = [&](const int di) {
+       const float distsq = (xk-di)*(xk-di) + (yk-dj)*(yk-dj) + (zk-dk)*(zk-dk);
+       return distsq < cutoff;
+     };
+     if(!inside(icenter)) {
+       continue;
      }
-  }}}
+     const float rest = cutoff - (yk-dj)*(yk-dj) - (zk-dk)*(zk-dk);
+     const float half = rest > 0 ? std::sqrt(rest) : 0.0f;
+     int lo = int(std::ceil(xk - half));
+     int hi = int(std::floor(xk + half));
+     if(lo > icenter) { lo = icenter; }
+     if(hi < icenter) { hi = icenter; }
+     while(lo < icenter && !inside(lo)) { lo++; }
+     while(lo > imin && inside(lo - 1)) { lo--; }
+     while(hi > icenter && !inside(hi)) { hi--; }
+     while(hi < imax && inside(hi + 1)) { hi++; }
+     if(lo < imin) { lo = imin; }
+     if(hi > imax) { hi = imax; }
+     gridpt* row = grid + ijk2pt(ctx, lo, dj, dk);
+     const int len = hi - lo + 1;
+     for(int n=0; n<len; n++) {
+       filled += row[n] ? 0 : 1;
+       row[n] = 1;
+     }
+  }}
   return filled;
+}
+
+/*********************************************/
+int fill_AccessGrid(const GridContext& ctx, const float x, const float y, const float z,
+	const float R, gridpt grid[]) {
+  const int kmin = int((z - ctx.zmin - R)/ctx.spacing - 1.0);
+  const int kmax = int((z - ctx.zmin + R)/ctx.spacing + 1.0);
+  return fill_AccessGrid_planes(ctx, x, y, z, R, kmin, kmax + 1, grid);
 };
 
 /*********************************************/
@@ -1476,60 +1694,30 @@ int fill_AccessGrid (const float x, const float y, const float z,
  * Key Details:
  *   - The function calculates a spherical exclusion zone based on the `probe` size.
  *   - Boundary checks are performed to prevent out-of-bounds access.
- *   - Optimized to avoid unnecessary checks outside the exclusion radius.
+ *   - Uses a cached row-span stencil (utils-stencil.cpp), one memset per row.
  *
  * Notes:
  *   - This function is highly time-critical and should not be parallelized,
  *     as the calling function (`trun_ExcludeGrid`) handles parallelization.
- *   - Uses the squared distance (`distsq`) for computational efficiency, avoiding square root operations.
+ *   - The stencil keeps the original squared-distance test, so the set of
+ *     cleared voxels is unchanged.
  *********************************************/
-void empty_ExcludeGrid(const int i, const int j, const int k, const float probe, gridpt grid[]) {
-  // Compute the scaled probe radius in grid units.
-  const float R = probe / GRID;   // Convert the probe size to grid units.
-  const int r = int(R + 1);       // Integer radius for limiting neighbor checks.
-  const float cutoff = R * R;     // Squared radius for distance comparisons.
-
-  // Variables for neighbor bounds within the grid.
-  int nri, nrj, nrk;  // Negative radius limits for x, y, z.
-  int pri, prj, prk;  // Positive radius limits for x, y, z.
-
-  // Boundary checks to prevent overflow or underflow (stay within grid limits).
-  // For negative bounds:
-  if(i < r) { nri = -i; } else { nri = -r;}
-  if(j < r) { nrj = -j; } else { nrj = -r;}
-  if(k < r) { nrk = -k; } else { nrk = -r;}
-  if(i + r >= DX) { pri = DX-i-1; } else { pri = r;}
-  if(j + r >= DY) { prj = DY-j-1; } else { prj = r;}
-  if(k + r >= DZ) { prk = DZ-k-1; } else { prk = r;}
-
-  // Iterate over the neighboring points within the calculated bounds.
-  // The loop covers a cubic region around (i, j, k), but checks for spherical distance.
-  float distsq; // Squared distance of the current point from the center.
-  int ind;      // Linear index of the grid point being evaluated.
-
-  for (int di = nri; di <= pri; di++) {         // Loop over the x-axis neighbors.
-    for (int dj = nrj; dj <= prj; dj++) {       // Loop over the y-axis neighbors.
-      for (int dk = nrk; dk <= prk; dk++) {     // Loop over the z-axis neighbors.
-        int ind = (i + di) + (j + dj) * DX + (k + dk) * DXY; // Inline ijk2pt
-        if (grid[ind] && (di * di + dj * dj + dk * dk < cutoff)) {
-          grid[ind] = 0;
-        }
-      }
-    }
-  }
-
+void empty_ExcludeGrid(const GridContext& ctx, const int i, const int j, const int k, const float probe, gridpt grid[]) {
+  // The sphere is centered on a voxel, so its shape depends only on the
+  // probe radius in grid units; clear it one cached row span at a time.
+  const SphereStencil& stencil = sphere_stencil(probe / ctx.spacing);
+  stamp_Stencil(ctx, stencil, i, j, k, 0, grid);
   return;
 };
 
-void empty_ExcludeGrid_fast(const int pt, const std::vector<int> &offsets, gridpt grid[]) {
+void empty_ExcludeGrid_fast(const GridContext& ctx, const int pt, const std::vector<int> &offsets, gridpt grid[]) {
   // Iterate over precomputed offsets
   for (const int offset : offsets) {
     const int neighbor = pt + offset;
 
     // Skip out-of-bounds neighbors
-    if (neighbor < 0 || neighbor >= NUMBINS) {
-      std:cerr << "Major Out of Bounds Error" << std::endl;
-      exit(1);
+    if (neighbor < 0 || static_cast<unsigned int>(neighbor) >= ctx.numbins) {
+      throw std::out_of_range("neighbor outside the grid");
     }
 
     // Mark grid point as excluded if filled
@@ -1538,34 +1726,12 @@ void empty_ExcludeGrid_fast(const int pt, const std::vector<int> &offsets, gridp
 }
 
 /*********************************************/
-void fill_ExcludeGrid (const int i, const int j, const int k,
+void fill_ExcludeGrid(const GridContext& ctx, const int i, const int j, const int k,
 	const float probe, gridpt grid[]) {
 //provides indexes (i,j,k) of grid where ijk2pt(i,j,k) = gridpt
-  const float R = probe/GRID; //Aug 19: correction for oversize
-  const int r = int(R+1);
-  const float cutoff = R*R;
-  int nri,nrj,nrk,pri,prj,prk;
-//overflow checks (let's not go off the grid)
-  if(i < r) { nri = -i; } else { nri = -r;}
-  if(j < r) { nrj = -j; } else { nrj = -r;}
-  if(k < r) { nrk = -k; } else { nrk = -r;}
-  if(i + r >= DX) { pri = DX-i-1; } else { pri = r;}
-  if(j + r >= DY) { prj = DY-j-1; } else { prj = r;}
-  if(k + r >= DZ) { prk = DZ-k-1; } else { prk = r;}
-  float distsq;
-  int ind;
+  const SphereStencil& stencil = sphere_stencil(probe/ctx.spacing); //Aug 19: correction for oversize
   // do not parallelize done in previous step
-  for(int di=nri; di<=pri; di++) {
-  for(int dj=nrj; dj<=prj; dj++) {
-  for(int dk=nrk; dk<=prk; dk++) {
-     ind = ijk2pt(i+di,j+dj,k+dk);
-     if(!grid[ind]) {
-       distsq = di*di + dj*dj + dk*dk;
-       if(distsq < cutoff) {
-         grid[ind] = 1;
-       }
-     }
-  }}}
+  stamp_Stencil(ctx, stencil, i, j, k, 1, grid);
   return;
 };
 
@@ -1584,11 +1750,11 @@ void fill_ExcludeGrid (const int i, const int j, const int k,
 // - This function assumes a row-major order for the grid storage.
 // - If the resulting `pt` exceeds the maximum valid index (`DXYZ`),
 //   it reports an error and clamps `pt` to the highest valid index.
-int ijk2pt(const int i, const int j, const int k) {
-  int pt = int(i + j * DX + k * DXY);
-  if (pt >= DXYZ) {  // Check for out-of-bounds access
+int ijk2pt(const GridContext& ctx, const int i, const int j, const int k) {
+  int pt = int(i + j * ctx.dx + k * ctx.dxy);
+  if (pt >= ctx.dxyz) {  // Check for out-of-bounds access
     std::cerr << "Error: ijk2pt index out of bounds :: " << i << ", " << j << ", " << k << std::endl;
-    return DXYZ - 1; // Clamp to the highest valid index
+    return ctx.dxyz - 1; // Clamp to the highest valid index
   }
   return pt;
 };
@@ -1605,10 +1771,10 @@ int ijk2pt(const int i, const int j, const int k) {
 // Notes:
 // - This function uses the grid dimensions (`DX`, `DXY`) to calculate
 //   the original 3D indices from the linear index.
-void pt2ijk(const int pt, int &i, int &j, int &k) {
-  i = pt % DX;           // Compute the x-axis index
-  j = (pt % DXY) / DX;   // Compute the y-axis index
-  k = pt / DXY;          // Compute the z-axis index
+void pt2ijk(const GridContext& ctx, const int pt, int &i, int &j, int &k) {
+  i = pt % ctx.dx;           // Compute the x-axis index
+  j = (pt % ctx.dxy) / ctx.dx;   // Compute the y-axis index
+  k = pt / ctx.dxy;          // Compute the z-axis index
   return;
 };
 
@@ -1624,12 +1790,12 @@ void pt2ijk(const int pt, int &i, int &j, int &k) {
 // Notes:
 // - Physical coordinates are calculated using grid spacing (`GRID`)
 //   and origin offsets (`XMIN`, `YMIN`, `ZMIN`).
-void pt2xyz(const int pt, float &x, float &y, float &z) {
+void pt2xyz(const GridContext& ctx, const int pt, float &x, float &y, float &z) {
   int i, j, k;            // Temporary variables for 3D grid indices
-  pt2ijk(pt, i, j, k);    // Convert `pt` to grid indices
-  x = float(i) * GRID + XMIN; // Compute x-coordinate in physical space
-  y = float(j) * GRID + YMIN; // Compute y-coordinate in physical space
-  z = float(k) * GRID + ZMIN; // Compute z-coordinate in physical space
+  pt2ijk(ctx, pt, i, j, k);    // Convert `pt` to grid indices
+  x = float(i) * ctx.spacing + ctx.xmin; // Compute x-coordinate in physical space
+  y = float(j) * ctx.spacing + ctx.ymin; // Compute y-coordinate in physical space
+  z = float(k) * ctx.spacing + ctx.zmin; // Compute z-coordinate in physical space
   return;
 };
 
@@ -1648,16 +1814,16 @@ void pt2xyz(const int pt, float &x, float &y, float &z) {
 // - This function uses grid spacing (`GRID`) and origin offsets (`XMIN`,
 //   `YMIN`, `ZMIN`) to compute the grid indices from physical coordinates.
 // - Coordinates are rounded to the nearest grid point.
-int xyz2pt(const float x, const float y, const float z) {
-  int ip = int((x - XMIN) / GRID + 0.5); // Compute x-axis index
-  int jp = int((y - YMIN) / GRID + 0.5); // Compute y-axis index
-  int kp = int((z - ZMIN) / GRID + 0.5); // Compute z-axis index
-  return ijk2pt(ip, jp, kp); // Convert to linear index
+int xyz2pt(const GridContext& ctx, const float x, const float y, const float z) {
+  int ip = int((x - ctx.xmin) / ctx.spacing + 0.5); // Compute x-axis index
+  int jp = int((y - ctx.ymin) / ctx.spacing + 0.5); // Compute y-axis index
+  int kp = int((z - ctx.zmin) / ctx.spacing + 0.5); // Compute z-axis index
+  return ijk2pt(ctx, ip, jp, kp); // Convert to linear index
 };
 
 
 /*********************************************/
-bool hasFilledNeighbor(const int pt, const gridpt grid[]) {
+bool hasFilledNeighbor(const GridContext& ctx, const int pt, const gridpt grid[]) {
   short int count = 0; // Counter for the number of neighbors checked.
 
   // Check neighbors along the i-axis.
@@ -1671,7 +1837,7 @@ bool hasFilledNeighbor(const int pt, const gridpt grid[]) {
   // Check neighbors along the j-axis.
   for (int index = -1; index <= 1; index += 2) { // Iterate over -1 and +1.
     count++; // Increment the neighbor count.
-    if (grid[pt + DX * index]) {
+    if (grid[pt + ctx.dx * index]) {
       return true; // Return true if the neighbor is empty.
     }
   }
@@ -1679,7 +1845,7 @@ bool hasFilledNeighbor(const int pt, const gridpt grid[]) {
   // Check neighbors along the k-axis.
   for (int index = -1; index <= 1; index += 2) { // Iterate over -1 and +1.
     count++; // Increment the neighbor count.
-    if (grid[pt + DXY * index]) {
+    if (grid[pt + ctx.dxy * index]) {
       return true; // Return true if the neighbor is empty.
     }
   }
@@ -1694,7 +1860,7 @@ bool hasFilledNeighbor(const int pt, const gridpt grid[]) {
 // Function to determine if a grid point is an edge point using a "star" pattern.
 // This function examines 6 neighbors along the principal axes (i, j, k).
 // Returns true if at least one neighbor is empty (edge point), false otherwise.
-bool hasEmptyNeighbor(const int pt, const gridpt grid[]) {
+bool hasEmptyNeighbor(const GridContext& ctx, const int pt, const gridpt grid[]) {
   short int count = 0; // Counter for the number of neighbors checked.
 
   // Check neighbors along the i-axis.
@@ -1708,7 +1874,7 @@ bool hasEmptyNeighbor(const int pt, const gridpt grid[]) {
   // Check neighbors along the j-axis.
   for (int index = -1; index <= 1; index += 2) { // Iterate over -1 and +1.
     count++; // Increment the neighbor count.
-    if (!grid[pt + DX * index]) {
+    if (!grid[pt + ctx.dx * index]) {
       return true; // Return true if the neighbor is empty.
     }
   }
@@ -1716,7 +1882,7 @@ bool hasEmptyNeighbor(const int pt, const gridpt grid[]) {
   // Check neighbors along the k-axis.
   for (int index = -1; index <= 1; index += 2) { // Iterate over -1 and +1.
     count++; // Increment the neighbor count.
-    if (!grid[pt + DXY * index]) {
+    if (!grid[pt + ctx.dxy * index]) {
       return true; // Return true if the neighbor is empty.
     }
   }
@@ -1734,7 +1900,7 @@ bool hasEmptyNeighbor(const int pt, const gridpt grid[]) {
 // Function to determine if a grid point has any empty neighbors within a 3x3x3 cube.
 // This function examines all 26 neighbors (3x3x3 cube minus the center point).
 // Returns true if at least one neighbor is empty, false otherwise.
-bool hasEmptyNeighbor_Fill(const int pt, const gridpt grid[]) {
+bool hasEmptyNeighbor_Fill(const GridContext& ctx, const int pt, const gridpt grid[]) {
   short int count = 0; // Counter for the number of neighbors checked.
 
   // Iterate through neighbors along the i-axis.
@@ -1746,7 +1912,7 @@ bool hasEmptyNeighbor_Fill(const int pt, const gridpt grid[]) {
         count++; // Increment the neighbor count.
 
         // Compute the neighbor index.
-        int neighborPt = pt + di + dj * DX + dk * DXY;
+        int neighborPt = pt + di + dj * ctx.dx + dk * ctx.dxy;
 
         // Check if the neighbor is empty.
         if (!grid[neighborPt]) {
@@ -1770,12 +1936,12 @@ bool hasEmptyNeighbor_Fill(const int pt, const gridpt grid[]) {
 
 /*********************************************/
 // Zero out all voxels further than `radius` from the main tunnel vector.
-void limitToTunnelArea(const float radius, gridpt grid[]) {
+void limitToTunnelArea(const GridContext& ctx, const float radius, gridpt grid[]) {
   std::cerr << "Limiting to Cylinder Around Exit Tunnel...  " << std::flush;
 
   #pragma omp parallel for
-  for(int pt=0; pt<=DXYZ; pt++) {
-    if(!isCloseToVector(radius,pt)) {
+  for(int pt=0; pt<=ctx.dxyz; pt++) {
+    if(!isCloseToVector(ctx, radius,pt)) {
       grid[pt] = 0;
     }
   }
@@ -1785,12 +1951,12 @@ void limitToTunnelArea(const float radius, gridpt grid[]) {
 };
 
 /*********************************************/
-bool isCloseToVector (const float radius, const int pt) {
+bool isCloseToVector(const GridContext& ctx, const float radius, const int pt) {
 
 //GET QUERY POINT
-  const float x = int(pt % DX) * GRID + XMIN;
-  const float y = int((pt % DXY)/ DX) * GRID + YMIN;
-  const float z = int(pt / DXY) * GRID + ZMIN;
+  const float x = int(pt % ctx.dx) * ctx.spacing + ctx.xmin;
+  const float y = int((pt % ctx.dxy)/ ctx.dx) * ctx.spacing + ctx.ymin;
+  const float z = int(pt / ctx.dxy) * ctx.spacing + ctx.zmin;
 
 //GET DISTANCE
   float dist = distFromPt(x,y,z);
@@ -1832,14 +1998,14 @@ float distFromPt (const float x, const float y, const float z) {
 };
 
 /*********************************************/
-float crossSection (const real p, const vector v, const gridpt grid[])
+float crossSection(const GridContext& ctx, const real p, const vector v, const gridpt grid[])
 {
   // Legacy overload that ignores the user-supplied vector and uses defaults.
-  return crossSection(grid);
+  return crossSection(ctx, grid);
 };
 
 /*********************************************/
-float crossSection (const gridpt grid[])
+float crossSection(const GridContext& ctx, const gridpt grid[])
 {
   //INIT POINT
   struct real p;
@@ -1872,7 +2038,7 @@ float crossSection (const gridpt grid[])
   int pt;
   float count;
   //double mult = GRID*GRID*0.5*0.5*2.0/3.0;
-  double mult = GRID*GRID/6.0;
+  double mult = ctx.spacing*ctx.spacing/6.0;
   std::cerr << "stepping" << std::flush;
   for(float k=-5; k<100; k+=0.5) {
    // Snap the slicing plane to 0.25 increments for reproducibility.
@@ -1880,16 +2046,16 @@ float crossSection (const gridpt grid[])
    std::cerr << "." << std::flush;
    count = 0.0;
    float total = 0.0;
-   for(float i=-200; i<=200; i+=GRID*0.5) {
-    for(float j=-200; j<=200; j+=GRID*0.5) {
+   for(float i=-200; i<=200; i+=ctx.spacing*0.5) {
+    for(float j=-200; j<=200; j+=ctx.spacing*0.5) {
      r.x = p.x + v1.x*i + v2.x*j + v.x*k;
      r.y = p.y + v1.y*i + v2.y*j + v.y*k;
      r.z = p.z + v1.z*i + v2.z*j + v.z*k;
-     if(r.x >= XMIN && r.x <= XMAX &&
-	r.y >= YMIN && r.y <= YMAX &&
-	r.z >= ZMIN && r.z <= ZMAX) {
-       pt = xyz2pt(r.x, r.y, r.z);
-       if(pt >= 0 && pt < DXYZ) {
+     if(r.x >= ctx.xmin && r.x <= ctx.xmax &&
+	r.y >= ctx.ymin && r.y <= ctx.ymax &&
+	r.z >= ctx.zmin && r.z <= ctx.zmax) {
+       pt = xyz2pt(ctx, r.x, r.y, r.z);
+       if(pt >= 0 && pt < ctx.dxyz) {
          total++;
          if(grid[pt]) { count++; }
        }
@@ -1948,17 +2114,17 @@ void printBar () {
 };
 
 /*********************************************/
-void printVol(int vox) {
+void printVol(const GridContext& ctx, int vox) {
   // Print the voxel volume to stderr with fixed precision.
-  long double vol = static_cast<long double>(vox) * static_cast<long double>(GRIDVOL);
+  long double vol = static_cast<long double>(vox) * static_cast<long double>(ctx.gridvol);
   std::cerr << std::fixed << std::setprecision(3) << vol << std::flush;
   return;
 };
 
 /*********************************************/
-void printVolCout(int vox) {
+void printVolCout(const GridContext& ctx, int vox) {
   // Same as printVol but writes to stdout and adds a trailing tab.
-  long double vol = static_cast<long double>(vox) * static_cast<long double>(GRIDVOL);
+  long double vol = static_cast<long double>(vox) * static_cast<long double>(ctx.gridvol);
   std::cout << std::fixed << std::setprecision(3) << vol << "\t" << std::flush;
   return;
 };
@@ -1988,46 +2154,120 @@ void basename (char str[], char base[]) {
 *********************************************/
 
 /*********************************************/
-int countEdgePoints (gridpt grid[]) {
-  //Initialize Variables
-  int type; // for return variables
-  int edges = 0; //count types
-  float count = 0;
-  const float cat = DZ/60.0;
-  float cut = cat;
+// Surface class of a filled voxel from its six face neighbors. Bit n of mask
+// is set when face neighbor n is empty, in the order -x, +x, -y, +y, -z, +z.
+static int edge_class_for_mask(const int mask) {
+  int nb = 0; //num of empty neighbors
+  for(int bit=0; bit<6; bit++) {
+    nb += (mask >> bit) & 1;
+  }
+  const bool cross_gap = (mask & 3) == 3 || (mask & 12) == 12 || (mask & 48) == 48;
+  const bool cross_fill = (mask & 3) == 0 || (mask & 12) == 0 || (mask & 48) == 0;
+  switch(nb) {
+    case 0: return 0;
+    case 1: return 1;
+    case 2: return cross_gap ? 7 : 2;
+    case 3: return cross_gap ? 4 : 3;
+    case 4: return cross_fill ? 8 : 5;
+    case 5: return 6;
+    default: return 9;
+  }
+}
 
-  //cerr << "DXY: " << DXY << "\tDX: " << DX << std::endl;
-  std::cerr << "Count Surface Voxels..." << std::endl;
-  printBar();
+// EDGE_CLASS[mask] = edge_class_for_mask(mask), built once at startup.
+static const std::array<unsigned char, 64> EDGE_CLASS = [] {
+  std::array<unsigned char, 64> table{};
+  for(int mask=0; mask<64; mask++) {
+    table[mask] = (unsigned char) edge_class_for_mask(mask);
+  }
+  return table;
+}();
 
-  int sk=-1, sj=-1;
-  for(int k=0; k<DXYZ; k+=DXY) {
-    sk++;
-    count++;
-    if(count > cut) {
-      std::cerr << "^" << std::flush;
-      cut += cat;
-    }
-    sj=-1;
-    // Walk the j and i indices to examine every voxel in the current slice.
-    for(int j=0; j<DXY; j+=DX) {
-      sj++;
-      for(int i=0; i<DX; i++) {
-        int pt = i+j+k;
-        if(grid[pt]) {
-          type = classifyEdgePoint(pt,grid);
-          if (type != 0)
-	          edges++;
+/*********************************************/
+// Face-neighbor mask of voxel pt. Neighbors before the start of the grid
+// count as empty.
+static inline int edge_mask(const GridContext& ctx, const int pt, const gridpt grid[]) {
+  if(pt >= ctx.dxy + ctx.dx + 1) {
+    return (!grid[pt-1]) | (!grid[pt+1] << 1) | (!grid[pt-ctx.dx] << 2)
+      | (!grid[pt+ctx.dx] << 3) | (!grid[pt-ctx.dxy] << 4) | (!grid[pt+ctx.dxy] << 5);
+  }
+  auto empty = [&](const int q) { return q < 0 || !grid[q]; };
+  return empty(pt-1) | (empty(pt+1) << 1) | (empty(pt-ctx.dx) << 2)
+    | (empty(pt+ctx.dx) << 3) | (empty(pt-ctx.dxy) << 4) | (empty(pt+ctx.dxy) << 5);
+}
+
+/*********************************************/
+// edges[type] = number of filled voxels of each surface class. Planes are
+// shared out between threads, each with its own histogram; the progress bar
+// advances per plane.
+static void edge_class_histogram(const GridContext& ctx, const gridpt grid[], int edges[10]) {
+  for(int i=0; i<=9; i++) { edges[i] = 0; }
+  const float cat = ctx.dz/60.0;
+  float cut = cat;
+  float count = 0;
+  #pragma omp parallel
+  {
+    int local[10] = {0};
+    #pragma omp for schedule(dynamic,4) nowait
+    for(int k=0; k<ctx.dz; k++) {
+      const int plane = k*ctx.dxy;
+      if(k == 0) {
+        for(int pt=0; pt<ctx.dxy; pt++) {
+          if(grid[pt]) {
+            local[EDGE_CLASS[edge_mask(ctx, pt, grid)]]++;
+          }
+        }
+      } else {
+        // Interior planes: every neighbor index is in range, so the mask is
+        // built branch-free from six row pointers.
+        const gridpt* row = grid + plane;
+        const gridpt* xm = row - 1;
+        const gridpt* xp = row + 1;
+        const gridpt* ym = row - ctx.dx;
+        const gridpt* yp = row + ctx.dx;
+        const gridpt* zm = row - ctx.dxy;
+        const gridpt* zp = row + ctx.dxy;
+        for(int n=0; n<ctx.dxy; n++) {
+          if(row[n]) {
+            const int mask = (!xm[n]) | (!xp[n] << 1) | (!ym[n] << 2)
+              | (!yp[n] << 3) | (!zm[n] << 4) | (!zp[n] << 5);
+            local[EDGE_CLASS[mask]]++;
+          }
+        }
+      }
+      #pragma omp critical (edge_progress)
+      {
+        count++;
+        while(count > cut) {
+          std::cerr << "^" << std::flush;
+          cut += cat;
         }
       }
     }
+    #pragma omp critical (edge_histogram)
+    for(int i=0; i<=9; i++) {
+      edges[i] += local[i];
+    }
+  }
+}
+
+/*********************************************/
+int countEdgePoints(const GridContext& ctx, gridpt grid[]) {
+  std::cerr << "Count Surface Voxels..." << std::endl;
+  printBar();
+
+  int counts[10];
+  edge_class_histogram(ctx, grid, counts);
+  int edges = 0;
+  for(int i=1; i<=9; i++) {
+    edges += counts[i];
   }
   return edges;
 }
 
 
 /*********************************************/
-float surface_area (gridpt grid[]) {
+float surface_area(const GridContext& ctx, gridpt grid[]) {
   //Initialize Variables
   float surf=0.0;
   const float wt[] = { 0.0, 0.894, 1.3409, 1.5879, 4.0, 2.6667,
@@ -2037,39 +2277,11 @@ float surface_area (gridpt grid[]) {
   wt[4]=4.0;   wt[5]=2.6667; wt[6]=3.3333;
   wt[7]=1.79;  wt[8]=2.68;   wt[9]=4.08;
 */
-  int type; // for return variables
-  int edges[10]; //count types
-  for(int i=0; i<=9; i++) { edges[i] = 0; }
-  float count = 0;
-  const float cat = DZ/60.0;
-  float cut = cat;
-
-  //cerr << "DXY: " << DXY << "\tDX: " << DX << std::endl;
   std::cerr << "Count Surface Voxels for Surface Area..." << std::endl;
   printBar();
 
-  int sk=-1, sj=-1;
-  for(int k=0; k<DXYZ; k+=DXY) {
-    sk++;
-    count++;
-    if(count > cut) {
-      std::cerr << "^" << std::flush;
-      cut += cat;
-    }
-    sj=-1;
-    for(int j=0; j<DXY; j+=DX) {
-      sj++;
-      for(int i=0; i<DX; i++) {
-        int pt = i+j+k;
-        if(grid[pt]) {
-          //cerr << pt << "::";
-          type = classifyEdgePoint(pt,grid);
-          //surf += wt[type];
-          edges[type]++;
-        }
-      }
-    }
-  }
+  int edges[10]; //count types
+  edge_class_histogram(ctx, grid, edges);
   std::cerr << std::endl << "EDGES: ";
   float totedge=0;
   for(int i=1; i<=9; i++) {
@@ -2080,93 +2292,15 @@ float surface_area (gridpt grid[]) {
     surf += edges[i]*wt[i];
   }
   std::cerr << std::endl << std::endl;
-  return surf*GRID*GRID;
+  return surf*ctx.spacing*ctx.spacing;
 }
 
 /*********************************************/
-int classifyEdgePoint (const int pt, gridpt grid[]) {
-  // Evaluate the six principal neighbors to classify the surface type.
-  short int count=0;
-  short int nb=0; //num of empty neighbors
-  for(int di=-1; di<=1; di+=2) {
-    count++;
-    if(!grid[pt+di]) {
-      nb++;
-    }
-  }
-  for(int dj=-DX; dj<=DX; dj+=2*DX) {
-    count++;
-    if(!grid[pt+dj]) {
-      nb++;
-    }
-  }
-  for(int dk=-DXY; dk<=DXY; dk+=2*DXY) {
-    count++;
-    if(!grid[pt+dk]) {
-      nb++;
-    }
-  }
-  //RETURN BASED ON NUMBER OF EMPTY NEIGHBORS (nb)
-  if(count != 6) {
-    std::cerr << "classifyEdgePoint count " << count << " != 6" << std::endl;
-  }
-  if(pt < DXY) {
-    std::cerr << "pt < DXY " << pt << " < " << DXY << std::endl;
-  }
-  //if(pt + DXY > NUMBINS) {
-  //cerr << "pt > NUMBINS " << pt << " > " << NUMBINS << std::endl;
-  //}
-  if(nb == 0 || nb == 1) {
-    return nb;
-  } else if(nb == 2) {
-//CHECK FOR BOTH CASES
-    //check for cross gaps
-    if(!grid[pt+1] && !grid[pt-1]) {
-      return 7;
-    }
-    if(!grid[pt+DX] && !grid[pt-DX]) {
-      return 7;
-    }
-    if(!grid[pt+DXY] && !grid[pt-DXY]) {
-      return 7;
-    }
-    //the normal case
-    return 2;
-  } else if(nb == 3) {
-//CHECK FOR BOTH CASES
-    //check for cross gaps
-    if(!grid[pt+1] && !grid[pt-1]) {
-      return 4;
-    }
-    if(!grid[pt+DX] && !grid[pt-DX]) {
-      return 4;
-    }
-    if(!grid[pt+DXY] && !grid[pt-DXY]) {
-      return 4;
-    }
-    //the normal case
-    return 3;
-  } else if(nb == 4) {
-//CHECK FOR BOTH CASES
-    //check for cross fills
-    if(grid[pt+1] && grid[pt-1]) {
-      return 8;
-    }
-    if(grid[pt+DX] && grid[pt-DX]) {
-      return 8;
-    }
-    if(grid[pt+DXY] && grid[pt-DXY]) {
-      return 8;
-    }
-    //the normal case
-    return 5;
-  } else if(nb == 5) {
-    return 6;
-  } else if(nb == 6) {
-    return 9;
-  }
-  std::cerr << "classifyEdgePoint neighbor count " << nb << " is weird!" << std::endl;
-  return 0;
+int classifyEdgePoint(const GridContext& ctx, const int pt, gridpt grid[]) {
+  // Classes by number of empty face neighbors (nb): 0 buried, 1 flat, 2 edge
+  // (7 if the two gaps are opposite), 3 corner (4 with an opposite pair),
+  // 4 (8 if the two filled faces are opposite), 5 -> 6, 6 isolated -> 9.
+  return EDGE_CLASS[edge_mask(ctx, pt, grid)];
 };
 
 /*********************************************
@@ -2176,77 +2310,77 @@ int classifyEdgePoint (const int pt, gridpt grid[]) {
 *********************************************/
 
 /*********************************************/
-int fill_cavities(gridpt grid[]) {
+int fill_cavities(const GridContext& ctx, gridpt grid[]) {
   // Identify internal cavities by inverting the filled volume and removing tunnels.
 
   gridpt *cavACC=NULL;
-  cavACC = (gridpt*) std::malloc (NUMBINS);
-  bounding_box(grid,cavACC);
+  cavACC = (gridpt*) std::malloc (ctx.numbins);
+  bounding_box(ctx, grid,cavACC);
 
   //Create inverse access map
-  subt_Grids(cavACC,grid); //modifies cavACC
+  subt_Grids(ctx, cavACC,grid); //modifies cavACC
   //int achanACC_voxels = countGrid(cavACC);
 
 //Get first point
   bool stop = 1; int firstpt = 0;
-  for(unsigned int pt=0; pt<NUMBINS && stop; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins && stop; pt++) {
     if(cavACC[pt]) { stop = 0; firstpt = pt;}
   }
   std::cerr << "FIRST POINT: " << firstpt << std::endl;
 //LAST POINT
   stop = 1; int lastpt = 0;
-  for(unsigned int pt=NUMBINS-10; pt>0 && stop; pt--) {
+  for(unsigned int pt=ctx.numbins-10; pt>0 && stop; pt--) {
     if(cavACC[pt]) { stop = 0; lastpt = pt;}
   }
   std::cerr << "LAST  POINT: " << lastpt << std::endl;
 
   //Pull channels out of inverse access map
   gridpt *chanACC=NULL;
-  chanACC = (gridpt*) std::malloc (NUMBINS);
-  zeroGrid(chanACC);
-  get_Connected_Point(cavACC,chanACC,firstpt); //modifies chanACC
-  get_Connected_Point(cavACC,chanACC,lastpt); //modifies chanACC
+  chanACC = (gridpt*) std::malloc (ctx.numbins);
+  zeroGrid(ctx, chanACC);
+  get_Connected_Point(ctx, cavACC,chanACC,firstpt); //modifies chanACC
+  get_Connected_Point(ctx, cavACC,chanACC,lastpt); //modifies chanACC
   //int chanACC_voxels = countGrid(chanACC);
 
   //Subtract channels from access map leaving only cavities.
-  subt_Grids(cavACC,chanACC); //modifies cavACC
+  subt_Grids(ctx, cavACC,chanACC); //modifies cavACC
   std::free (chanACC);
-  int cavACC_voxels = countGrid(cavACC);
+  int cavACC_voxels = countGrid(ctx, cavACC);
 
 
-  int grid_before = countGrid(grid);
+  int grid_before = countGrid(ctx, grid);
 //Fill Cavities in grid[];
   #pragma omp parallel for
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     if(cavACC[pt]) { grid[pt]=1; }
   }
-  int grid_after = countGrid(grid);
+  int grid_after = countGrid(ctx, grid);
   std::free (cavACC);
 
   std::cerr << std::endl << "CAVITY VOLUME: ";
-  printVol(cavACC_voxels);
+  printVol(ctx, cavACC_voxels);
   std::cerr << std::endl << "BEFORE VOLUME: ";
-  printVol(grid_before);
+  printVol(ctx, grid_before);
   std::cerr << std::endl << "AFTER VOLUME:  ";
-  printVol(grid_after);
+  printVol(ctx, grid_after);
   std::cerr << std::endl << "DIFFERENCE:    ";
-  printVol(grid_after-grid_before);
+  printVol(ctx, grid_after-grid_before);
   std::cerr << std::endl << std::endl;
 
   return cavACC_voxels;
 };
 
 /*********************************************/
-void determine_MinMax(const gridpt grid[], int minmax[]) {
+void determine_MinMax(const GridContext& ctx, const gridpt grid[], int minmax[]) {
   //minmax MUST be an array of length 6
   if (DEBUG > 0)
     std::cerr << "Determining Minima and Maxima..." << std::flush;
-  int xmin=DX, ymin=DXY, zmin=DXYZ;
+  int xmin=ctx.dx, ymin=ctx.dxy, zmin=ctx.dxyz;
   int xmax=0, ymax=0, zmax=0;
   // Scan every voxel to update the min/max per axis.
-  for(int k=0; k<DXYZ; k+=DXY) {
-    for(int j=0; j<DXY; j+=DX) {
-      for(int i=0; i<DX; i++) {
+  for(int k=0; k<ctx.dxyz; k+=ctx.dxy) {
+    for(int j=0; j<ctx.dxy; j+=ctx.dx) {
+      for(int i=0; i<ctx.dx; i++) {
         int pt = i+j+k;
         if(grid[pt]) {
           if(i < xmin) { xmin = i; }
@@ -2269,14 +2403,14 @@ void determine_MinMax(const gridpt grid[], int minmax[]) {
   minmax[5] = zmax;
   if (DEBUG > 0) {
     std::cerr << "X: " << xmin << " <> " << xmax << std::endl;
-    std::cerr << "Y: " << ymin/DX << " <> " << ymax/DX << std::endl;
-    std::cerr << "Z: " << zmin/DXY << " <> " << zmax/DXY << std::endl;
+    std::cerr << "Y: " << ymin/ctx.dx << " <> " << ymax/ctx.dx << std::endl;
+    std::cerr << "Z: " << zmin/ctx.dxy << " <> " << zmax/ctx.dxy << std::endl;
   }
   return;
 };
 
 /*********************************************/
-int makerbot_fill(gridpt ingrid[], gridpt outgrid[]) {
+int makerbot_fill(const GridContext& ctx, gridpt ingrid[], gridpt outgrid[]) {
   /*
   ** Since you cannot see inside a 3D print,
   ** points that are invisible in ingrid are
@@ -2296,7 +2430,7 @@ int makerbot_fill(gridpt ingrid[], gridpt outgrid[]) {
 
 
   int minmax[6];
-  determine_MinMax(outgrid, minmax);
+  determine_MinMax(ctx, outgrid, minmax);
   std::cerr << "makerbot fill" << std::endl;
 //Get first point
   unsigned int iter = 0;
@@ -2306,9 +2440,9 @@ int makerbot_fill(gridpt ingrid[], gridpt outgrid[]) {
     changed = 0;
     iter++;
     #pragma omp parallel for
-    for(unsigned int pt=0; pt<NUMBINS-1; pt++) {
+    for(unsigned int pt=0; pt<ctx.numbins-1; pt++) {
       if(ingrid[pt]) {
-        if (!isNearEdgePoint(pt, ingrid, outgrid)) {
+        if (!isNearEdgePoint(ctx, pt, ingrid, outgrid)) {
           ingrid[pt] = 0;
           outgrid[pt] = 1;
           #pragma omp atomic
@@ -2325,7 +2459,7 @@ int makerbot_fill(gridpt ingrid[], gridpt outgrid[]) {
 };
 
 /*********************************************/
-bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minmax[]) {
+bool isContainedPoint(const GridContext& ctx, const int pt, gridpt ingrid[], gridpt outgrid[], int minmax[]) {
 
   /*
   int ijk2pt(int i, int j, int k);
@@ -2337,20 +2471,20 @@ bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minm
   int xmin, ymin, zmin;
   int xmax, ymax, zmax;
   xmin = minmax[0];
-  ymin = minmax[1]/DX;
-  zmin = minmax[2]/DXY;
+  ymin = minmax[1]/ctx.dx;
+  zmin = minmax[2]/ctx.dxy;
   xmax = minmax[3];
-  ymax = minmax[4]/DX;
-  zmax = minmax[5]/DXY;
+  ymax = minmax[4]/ctx.dx;
+  zmax = minmax[5]/ctx.dxy;
 
-  pt2ijk(pt, ipt, jpt, kpt);
+  pt2ijk(ctx, pt, ipt, jpt, kpt);
   unsigned int checked = 0;
 
   unsigned int fillCount = 0;
   // X axis scan for bounding grid occupancy in both directions.
   filled = 0;
   for(index=1; index<ipt-xmin  && filled==0; index++) {
-    newpt = ijk2pt(ipt - index, jpt, kpt);
+    newpt = ijk2pt(ctx, ipt - index, jpt, kpt);
     checked++;
     if (outgrid[newpt] == 1) {
       fillCount++; filled=1;
@@ -2360,7 +2494,7 @@ bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minm
   }
   filled = 0;
   for(index=1; index<xmax-ipt && filled==0; index++) {
-    newpt = ijk2pt(ipt + index, jpt, kpt);
+    newpt = ijk2pt(ctx, ipt + index, jpt, kpt);
     checked++;
     if (outgrid[newpt] == 1) {
   	  fillCount++; filled=1;
@@ -2372,7 +2506,7 @@ bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minm
   // Y axis checks.
   filled = 0;
   for(index=1; index<jpt-ymin  && filled==0; index++) {
-    newpt = ijk2pt(ipt, jpt - index, kpt);
+    newpt = ijk2pt(ctx, ipt, jpt - index, kpt);
     checked++;
     if (outgrid[newpt] == 1) {
   	  fillCount++; filled=1;
@@ -2382,7 +2516,7 @@ bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minm
   }
   filled = 0;
   for(index=1; index<ymax-jpt && filled==0; index++) {
-    newpt = ijk2pt(ipt, jpt + index, kpt);
+    newpt = ijk2pt(ctx, ipt, jpt + index, kpt);
     checked++;
     if (outgrid[newpt] == 1) {
   	  fillCount++; filled=1;
@@ -2394,7 +2528,7 @@ bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minm
   // Z axis checks.
   filled = 0;
   for(index=1; index<kpt-zmin && filled==0; index++) {
-    newpt = ijk2pt(ipt, jpt, kpt - index);
+    newpt = ijk2pt(ctx, ipt, jpt, kpt - index);
     checked++;
     if (outgrid[newpt] == 1) {
   	  fillCount++; filled=1;
@@ -2404,7 +2538,7 @@ bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minm
   }
   filled = 0;
   for(index=1; index<zmax-kpt && filled==0; index++) {
-    newpt = ijk2pt(ipt, jpt, kpt + index);
+    newpt = ijk2pt(ctx, ipt, jpt, kpt + index);
     checked++;
     if (outgrid[newpt] == 1) {
   	  fillCount++; filled=1;
@@ -2419,12 +2553,12 @@ bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minm
 };
 
 /*********************************************/
-bool isNearEdgePoint (const int pt, gridpt ingrid[], gridpt outgrid[]) {
+bool isNearEdgePoint(const GridContext& ctx, const int pt, gridpt ingrid[], gridpt outgrid[]) {
   int i,j,k;
-  pt2ijk(pt, i, j, k);
+  pt2ijk(ctx, pt, i, j, k);
 
 //provides indexes (i,j,k) of grid where ijk2pt(i,j,k) = gridpt
-  const float R = 3.0/GRID; //Aug 19: correction for oversize
+  const float R = 3.0/ctx.spacing; //Aug 19: correction for oversize
   const int r = int(R+1);
   const float cutoff = R*R;
   int nri,nrj,nrk,pri,prj,prk;
@@ -2432,16 +2566,16 @@ bool isNearEdgePoint (const int pt, gridpt ingrid[], gridpt outgrid[]) {
   if(i < r) { nri = -i; } else { nri = -r;}
   if(j < r) { nrj = -j; } else { nrj = -r;}
   if(k < r) { nrk = -k; } else { nrk = -r;}
-  if(i + r >= DX) { pri = DX-i-1; } else { pri = r;}
-  if(j + r >= DY) { prj = DY-j-1; } else { prj = r;}
-  if(k + r >= DZ) { prk = DZ-k-1; } else { prk = r;}
+  if(i + r >= ctx.dx) { pri = ctx.dx-i-1; } else { pri = r;}
+  if(j + r >= ctx.dy) { prj = ctx.dy-j-1; } else { prj = r;}
+  if(k + r >= ctx.dz) { prk = ctx.dz-k-1; } else { prk = r;}
   float distsq;
   int ind;
   // This inner loop is sequential to avoid race conditions on the shared grid.
   for(int di=nri; di<=pri; di++) {
   for(int dj=nrj; dj<=prj; dj++) {
   for(int dk=nrk; dk<=prk; dk++) {
-     ind = ijk2pt(i+di,j+dj,k+dk);
+     ind = ijk2pt(ctx, i+di,j+dj,k+dk);
      if(!ingrid[ind] && !outgrid[ind]) {
        distsq = di*di + dj*dj + dk*dk;
        if(distsq < cutoff) {
@@ -2454,14 +2588,14 @@ bool isNearEdgePoint (const int pt, gridpt ingrid[], gridpt outgrid[]) {
 
 
 /*********************************************/
-int bounding_box(gridpt grid[], gridpt bbox[]) {
+int bounding_box(const GridContext& ctx, gridpt grid[], gridpt bbox[]) {
   // Reset the output box before filling.
-  zeroGrid(bbox);
+  zeroGrid(ctx, bbox);
 
 
   //PART I: Determine extrema of the occupied region.
   int minmax[6];
-  determine_MinMax(grid, minmax);
+  determine_MinMax(ctx, grid, minmax);
   int xmin, ymin, zmin;
   int xmax, ymax, zmax;
   xmin = minmax[0];
@@ -2484,19 +2618,19 @@ int bounding_box(gridpt grid[], gridpt bbox[]) {
 //PART II: FILL BOX
   int vol=0;
   int count = 0;
-  const float cat = DZ/60.0;
+  const float cat = ctx.dz/60.0;
   float cut = cat;
   std::cerr << "Fill Box..." << std::endl;
   printBar();
   // Iterate over every z-slice between the computed bounds.
-  for(int k=zmin; k<=zmax; k+=DXY) {
+  for(int k=zmin; k<=zmax; k+=ctx.dxy) {
     if(count > cut) {
       std::cerr << "^" << std::flush;
       cut += cat;
     }
     count++;
     // Sweep across the current j-row and fill each column.
-    for(int j=ymin; j<=ymax; j+=DX) {
+    for(int j=ymin; j<=ymax; j+=ctx.dx) {
       // Fill every voxel along the i-axis within the bounding box.
       for(int i=xmin; i<=xmax; i++) {
         bbox[i+j+k] = 1;
@@ -2504,8 +2638,196 @@ int bounding_box(gridpt grid[], gridpt bbox[]) {
   } } }
   // Report the filled-box volume just for diagnostics.
   std::cerr << std::endl << "BOX VOXELS: ";
-  printVol(vol);
+  printVol(ctx, vol);
   std::cerr << std::endl << std::endl;
 
   return vol;
 };
+
+
+/*********************************************
+**********************************************
+      LEGACY GLOBAL-STATE WRAPPERS
+**********************************************
+*********************************************/
+// The overloads below keep the historical signatures working by running the
+// context-based implementation on current_grid_context().  Only the init
+// functions write back into the globals.
+
+void initGridState(float maxprobe) {
+  GridContext ctx = current_grid_context();
+  initGridState(ctx, maxprobe);
+  set_grid_context(ctx);
+  // Reset logging metadata so new inputs appear fresh.
+  XYZRFILE[0]='\0';
+}
+float getIdealGrid() { return getIdealGrid(current_grid_context()); }
+void assignLimits() {
+  GridContext ctx = current_grid_context();
+  assignLimits(ctx);
+  set_grid_context(ctx);
+}
+void testLimits(gridpt grid[]) { testLimits(current_grid_context(), grid); }
+
+int countGrid(const gridpt grid[]) { return countGrid(current_grid_context(), grid); }
+void zeroGrid(gridpt grid[]) { zeroGrid(current_grid_context(), grid); }
+int copyGridFromTo(const gridpt oldgrid[], gridpt newgrid[]) {
+  return copyGrid(current_grid_context(), oldgrid, newgrid);
+}
+int copyGrid(const gridpt oldgrid[], gridpt newgrid[]) {
+  return copyGrid(current_grid_context(), oldgrid, newgrid);
+}
+void inverseGrid(gridpt grid[]) { inverseGrid(current_grid_context(), grid); }
+int first_filled_point(const gridpt grid[]) {
+  return first_filled_point(current_grid_context(), grid);
+}
+int last_filled_point(const gridpt grid[]) {
+  return last_filled_point(current_grid_context(), grid);
+}
+std::unique_ptr<gridpt[]> make_zeroed_grid() { return make_zeroed_grid(current_grid_context()); }
+std::unique_ptr<gridpt[]> make_grid() { return make_grid(current_grid_context()); }
+
+int read_NumAtoms(char file[]) {
+  GridContext ctx = current_grid_context();
+  std::strcpy(XYZRFILE,file);
+  const int count = read_NumAtoms(ctx, file);
+  set_grid_context(ctx);
+  return count;
+}
+int read_NumAtoms_from_array(const XYZRBuffer& buffer) {
+  GridContext ctx = current_grid_context();
+  // Populate filename placeholder when the caller only provides memory data.
+  if(!XYZRFILE[0]) {
+    std::strncpy(XYZRFILE, "<memory>", sizeof(XYZRFILE));
+    XYZRFILE[sizeof(XYZRFILE) - 1] = '\0';
+  }
+  const int count = read_NumAtoms_from_array(ctx, buffer);
+  set_grid_context(ctx);
+  return count;
+}
+int fill_AccessGrid_fromFile(int numatoms, const float probe, char file[], gridpt grid[]) {
+  if(!XYZRFILE[0]) { std::strcpy(XYZRFILE,file); }
+  return fill_AccessGrid_fromFile(current_grid_context(), numatoms, probe, file, grid);
+}
+int fill_AccessGrid_fromArray(int numatoms, const float probe,
+	const XYZRBuffer& buffer, gridpt grid[]) {
+  return fill_AccessGrid_fromArray(current_grid_context(), numatoms, probe, buffer, grid);
+}
+int get_ExcludeGrid_fromFile(int numatoms, const float probe, char file[], gridpt EXCgrid[]) {
+  return get_ExcludeGrid_fromFile(current_grid_context(), numatoms, probe, file, EXCgrid);
+}
+int get_ExcludeGrid_fromArray(int numatoms, const float probe,
+	const XYZRBuffer& buffer, gridpt EXCgrid[]) {
+  return get_ExcludeGrid_fromArray(current_grid_context(), numatoms, probe, buffer, EXCgrid);
+}
+int fill_SurfaceDistance_fromArray(int numatoms, const float maxprobe,
+	const XYZRBuffer& buffer, float field[]) {
+  return fill_SurfaceDistance_fromArray(current_grid_context(), numatoms, maxprobe, buffer, field);
+}
+int threshold_AccessGrid(const float field[], const float probe, gridpt grid[]) {
+  return threshold_AccessGrid(current_grid_context(), field, probe, grid);
+}
+int get_ExcludeGrid_fromArray(ExcludeEngine engine, int numatoms, const float probe,
+	const XYZRBuffer& buffer, gridpt EXCgrid[]) {
+  return get_ExcludeGrid_fromArray(current_grid_context(), engine, numatoms, probe, buffer, EXCgrid);
+}
+
+void trun_ExcludeGrid(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  trun_ExcludeGrid(current_grid_context(), probe, ACCgrid, EXCgrid);
+}
+void trun_ExcludeGrid_fast(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  trun_ExcludeGrid_fast(current_grid_context(), probe, ACCgrid, EXCgrid);
+}
+void grow_ExcludeGrid(const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  grow_ExcludeGrid(current_grid_context(), probe, ACCgrid, EXCgrid);
+}
+void trun_ExcludeGrid(ExcludeEngine engine, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  trun_ExcludeGrid(current_grid_context(), engine, probe, ACCgrid, EXCgrid);
+}
+void grow_ExcludeGrid(ExcludeEngine engine, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]) {
+  grow_ExcludeGrid(current_grid_context(), engine, probe, ACCgrid, EXCgrid);
+}
+float *get_Point(gridpt grid[]) { return get_Point(current_grid_context(), grid); }
+int get_GridPoint(gridpt grid[]) { return get_GridPoint(current_grid_context(), grid); }
+int get_Connected(gridpt grid[], gridpt connect[], const float x, const float y, const float z) {
+  return get_Connected(current_grid_context(), grid, connect, x, y, z);
+}
+int get_ConnectedRange(gridpt grid[], gridpt connect[], const float x, const float y, const float z) {
+  return get_ConnectedRange(current_grid_context(), grid, connect, x, y, z);
+}
+int get_Connected_Point(gridpt grid[], gridpt connect[], const int gp) {
+  return get_Connected_Point(current_grid_context(), grid, connect, gp);
+}
+int subt_Grids(gridpt biggrid[], gridpt smgrid[]) {
+  return subt_Grids(current_grid_context(), biggrid, smgrid);
+}
+int intersect_Grids(gridpt grid1[], gridpt grid2[]) {
+  return intersect_Grids(current_grid_context(), grid1, grid2);
+}
+int merge_Grids(gridpt grid1[], gridpt grid2[]) {
+  return merge_Grids(current_grid_context(), grid1, grid2);
+}
+
+int fill_AccessGrid(const float x, const float y, const float z, const float R, gridpt grid[]) {
+  return fill_AccessGrid(current_grid_context(), x, y, z, R, grid);
+}
+void empty_ExcludeGrid(const int i, const int j, const int k, const float probe, gridpt grid[]) {
+  empty_ExcludeGrid(current_grid_context(), i, j, k, probe, grid);
+}
+void empty_ExcludeGrid_fast(const int pt, const std::vector<int> &offsets, gridpt grid[]) {
+  empty_ExcludeGrid_fast(current_grid_context(), pt, offsets, grid);
+}
+void fill_ExcludeGrid(const int i, const int j, const int k, const float probe, gridpt grid[]) {
+  fill_ExcludeGrid(current_grid_context(), i, j, k, probe, grid);
+}
+int ijk2pt(const int i, const int j, const int k) {
+  return ijk2pt(current_grid_context(), i, j, k);
+}
+void pt2ijk(const int pt, int &i, int &j, int &k) { pt2ijk(current_grid_context(), pt, i, j, k); }
+void pt2xyz(const int pt, float &x, float &y, float &z) { pt2xyz(current_grid_context(), pt, x, y, z); }
+int xyz2pt(const float x, const float y, const float z) {
+  return xyz2pt(current_grid_context(), x, y, z);
+}
+bool hasFilledNeighbor(const int pt, const gridpt grid[]) {
+  return hasFilledNeighbor(current_grid_context(), pt, grid);
+}
+bool hasEmptyNeighbor(const int pt, const gridpt grid[]) {
+  return hasEmptyNeighbor(current_grid_context(), pt, grid);
+}
+bool hasEmptyNeighbor_Fill(const int pt, const gridpt grid[]) {
+  return hasEmptyNeighbor_Fill(current_grid_context(), pt, grid);
+}
+void limitToTunnelArea(const float radius, gridpt grid[]) {
+  limitToTunnelArea(current_grid_context(), radius, grid);
+}
+bool isCloseToVector(const float radius, const int pt) {
+  return isCloseToVector(current_grid_context(), radius, pt);
+}
+float crossSection(const real p, const vector v, const gridpt grid[]) {
+  return crossSection(current_grid_context(), p, v, grid);
+}
+float crossSection(const gridpt grid[]) { return crossSection(current_grid_context(), grid); }
+void printVol(int vox) { printVol(current_grid_context(), vox); }
+void printVolCout(int vox) { printVolCout(current_grid_context(), vox); }
+
+int countEdgePoints(gridpt grid[]) { return countEdgePoints(current_grid_context(), grid); }
+float surface_area(gridpt grid[]) { return surface_area(current_grid_context(), grid); }
+int classifyEdgePoint(const int pt, gridpt grid[]) {
+  return classifyEdgePoint(current_grid_context(), pt, grid);
+}
+int fill_cavities(gridpt grid[]) { return fill_cavities(current_grid_context(), grid); }
+void determine_MinMax(const gridpt grid[], int minmax[]) {
+  determine_MinMax(current_grid_context(), grid, minmax);
+}
+int makerbot_fill(gridpt ingrid[], gridpt outgrid[]) {
+  return makerbot_fill(current_grid_context(), ingrid, outgrid);
+}
+bool isContainedPoint(const int pt, gridpt ingrid[], gridpt outgrid[], int minmax[]) {
+  return isContainedPoint(current_grid_context(), pt, ingrid, outgrid, minmax);
+}
+bool isNearEdgePoint(const int pt, gridpt ingrid[], gridpt outgrid[]) {
+  return isNearEdgePoint(current_grid_context(), pt, ingrid, outgrid);
+}
+int bounding_box(gridpt grid[], gridpt bbox[]) {
+  return bounding_box(current_grid_context(), grid, bbox);
+}
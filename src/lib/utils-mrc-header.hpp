@@ -6,6 +6,7 @@
 
 #include <cstdio>      // for FILE, fwrite
 #include <cstdint>     // for int8_t, int32_t, uint8_t, uint16_t
+#include "utils.hpp"   // for GridContext, gridpt
 
 #define MRC_MODE_BYTE            0
 #define MRC_MODE_SHORT           1
@@ -13,6 +14,7 @@
 #define MRC_MODE_SHORT_COMPLEX   3
 #define MRC_MODE_FLOAT_COMPLEX   4
 #define MRC_MODE_UNSIGNED_SHORT  5
+#define MRC_MODE_PACKED4       101    /* IMOD: 4-bit voxels, two per byte */
 
 #define MRC_COUNT          856    /* Number of freads for a complete header */
 #define MRC_USERS           25
@@ -64,6 +66,49 @@ typedef struct MRCHeaderSt {
 	s08    label[MRC_NUM_LABELS][MRC_LABEL_SIZE];     /* 10 text labels of 80 characters each. */
 } MRCHeaderSt;
 
+/*********************************************/
+// Voxel count (same as countGrid) and bounds of the filled voxels in grid
+// indices (same as determine_MinMax, with j and k divided out), gathered
+// in one parallel pass over the z planes.
+typedef struct MapExtent {
+	int    volume;
+	int    imin, jmin, kmin;
+	int    imax, jmax, kmax;
+} MapExtent;
+
+// Output box in grid indices; may extend past the grid, which reads as 0.
+typedef struct MapBox {
+	int    i0, j0, k0;
+	int    nx, ny, nz;
+} MapBox;
+
+// Open map being written, with its MapEncoding resolved.
+typedef struct MapFile {
+	FILE * fp;
+	bool   gzip;
+	bool   packed4;
+	bool   ok;
+} MapFile;
+
 // write helpers shared between MRC and CCP4 writers
 int byteWrite(FILE* fp, const void* data, int number_of_elements, int element_size);
-int writeMRCHeader(FILE* fp, MRCHeaderSt header);
+int writeMRCHeader(FILE* fp, const MRCHeaderSt& header);
+MapExtent scanMapExtent(const GridContext& ctx, const gridpt data[]);
+// Trimmed box: extrema padded by one voxel, dimensions rounded up to x4.
+MapBox trimmedMapBox(const MapExtent& extent);
+// Fields common to every map we write; start and origin are zeroed.
+void initMapHeader(MRCHeaderSt& header, int nx, int ny, int nz, float spacing, const char label[]);
+// A filename ending in .gz turns on gzip whatever the encoding says, and
+// encoding.gzip adds .gz to a filename without it.
+int openMapFile(MapFile& out, const char filename[], const MapEncoding& encoding);
+// Raw bytes, or gzip members deflated in parallel, 1 MB of input each.
+int mapWrite(MapFile& out, const void* data, size_t bytes);
+// Fails if any write failed.
+int closeMapFile(MapFile& out);
+// Sets header.mode to match the encoding, then writes it.
+int writeMapHeader(MapFile& out, MRCHeaderSt& header);
+// Stream box as MRC_MODE_BYTE or MRC_MODE_PACKED4 voxels, a batch of z
+// slabs per write.
+int writeMapBox(MapFile& out, const GridContext& ctx, const gridpt data[], const MapBox& box);
+// The whole grid, as writeMRCFile and writeCCP4File store it.
+int writeMapGrid(MapFile& out, const GridContext& ctx, const gridpt data[]);
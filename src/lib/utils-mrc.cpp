@@ -1,19 +1,23 @@
 /*
 ** utils-mrc.cpp
 ** MRC2014 volume writer: placement via ORIGIN in Angstroms, NSTART zeroed.
+** Also holds the map engine shared with utils-ccp4.cpp: one parallel scan
+** for the voxel count and extrema, then the body is streamed in z-slab
+** batches with no trimmed copy of the grid, as bytes (mode 0) or 4-bit
+** voxels (mode 101), optionally gzipped. readMRCFile() loads an MRC or CCP4
+** map, plain or gzipped, back onto a grid as a thresholded mask.
 */
+#include <cmath>       // for lround
 #include <cstdio>      // for fclose, fopen, fwrite, snprintf
 #include <cstdlib>     // for std::free, std::malloc
-#include <cstring>     // for memset
+#include <cstring>     // for memcpy, memset, strcmp, strlen
 #include <iostream>    // for cerr, endl
-#include "utils.hpp"     // for cerr, endl, DEBUG, gridpt, countGrid
-#include "utils-mrc-header.hpp"  // for MRCHeaderSt, byteWrite, writeMRCHeader
+#include <string>      // for string
+#include <vector>      // for vector
+#include <zlib.h>      // for deflate, gzopen, gzread
+#include "utils.hpp"     // for GridContext, cerr, endl, DEBUG, gridpt
+#include "utils-mrc-header.hpp"  // for MRCHeaderSt, MapExtent, MapBox, writeMapBox
 
-//FROM utils.h external variables
-extern float XMIN, YMIN, ZMIN;
-extern int DX, DY, DZ;
-extern unsigned int NUMBINS;
-extern float GRID;
 
 
 /*********************************************/
@@ -30,109 +34,81 @@ int byteSwapWriteGrid( FILE * fp, const gridpt * data, int number_of_elements, i
 }
 
 /*********************************************/
-int writeMRCHeader( FILE * fp, MRCHeaderSt header ) {
-	
-	int count = 0;
-	
-	int users = MRC_USERS;
-	int label = MRC_LABEL_SIZE * MRC_NUM_LABELS;
-	
-	count += byteWrite(fp, &header.nx,        1, 4 );
-	count += byteWrite(fp, &header.ny,        1, 4 );
-	count += byteWrite(fp, &header.nz,        1, 4 );
-	count += byteWrite(fp, &header.mode,      1, 4 );
-	count += byteWrite(fp, &header.nxstart,   1, 4 );
-	count += byteWrite(fp, &header.nystart,   1, 4 );
-	count += byteWrite(fp, &header.nzstart,   1, 4 );
-	count += byteWrite(fp, &header.mx,        1, 4 );
-	count += byteWrite(fp, &header.my,        1, 4 );
-	count += byteWrite(fp, &header.mz,        1, 4 );
-	count += byteWrite(fp, &header.x_length,  1, 4 );
-	count += byteWrite(fp, &header.y_length,  1, 4 );
-	count += byteWrite(fp, &header.z_length,  1, 4 );
-	count += byteWrite(fp, &header.alpha,     1, 4 );
-	count += byteWrite(fp, &header.beta,      1, 4 );
-	count += byteWrite(fp, &header.gamma,     1, 4 );
-	count += byteWrite(fp, &header.mapc,      1, 4 );
-	count += byteWrite(fp, &header.mapr,      1, 4 );
-	count += byteWrite(fp, &header.maps,      1, 4 );
-	count += byteWrite(fp, &header.amin,      1, 4 );
-	count += byteWrite(fp, &header.amax,      1, 4 );
-	count += byteWrite(fp, &header.amean,     1, 4 );
-	count += byteWrite(fp, &header.ispg,      1, 4 );
-	count += byteWrite(fp, &header.nsymbt,    1, 4 );
-	count += byteWrite(fp, &header.extra, users, 4 );
-	count += byteWrite(fp, &header.xorigin,   1, 4 );
-	count += byteWrite(fp, &header.yorigin,   1, 4 );
-	count += byteWrite(fp, &header.zorigin,   1, 4 );
-	count += byteWrite(fp, &header.map,       1, 4 );
-	count += byteWrite(fp, &header.mach,      1, 4 );
-	count += byteWrite(fp, &header.rms,       1, 4 );
-	count += byteWrite(fp, &header.nlabl,     1, 4 );
-	count += byteWrite(fp, &header.label, label, 1 );
-	
-	if ( count != MRC_COUNT ) return -1;
+// The header is 56 packed 4-byte words followed by the labels, so the
+// struct is the 1024-byte record on disk and goes out in one fwrite.
+static_assert(sizeof(MRCHeaderSt) == 1024, "MRC header must be 1024 bytes");
+
+int writeMRCHeader( FILE * fp, const MRCHeaderSt& header ) {
+	if ( fwrite(&header, sizeof(MRCHeaderSt), 1, fp) != 1 ) return -1;
 	else return 1;
-	
 }
 
 /*********************************************/
-int writeMRCFile(const gridpt data[], const char filename[] ) {
-	int volume = countGrid(data);
-	if (volume == 0) {
-		cerr << "volume is empty not writing mrc file" << endl;
-		return 0;
+MapExtent scanMapExtent(const GridContext& ctx, const gridpt data[]) {
+	int volume = 0;
+	int imin = ctx.dx, jmin = ctx.dy, kmin = ctx.dz;
+	int imax = 0, jmax = 0, kmax = 0;
+	#pragma omp parallel for reduction(+:volume) reduction(min:imin,jmin,kmin) reduction(max:imax,jmax,kmax)
+	for(int k=0; k<ctx.dz; k++) {
+		for(int j=0; j<ctx.dy; j++) {
+			const gridpt * row = data + k*ctx.dxy + j*ctx.dx;
+			int filled = 0;
+			for(int i=0; i<ctx.dx; i++) {
+				filled += row[i] ? 1 : 0;
+			}
+			if (filled == 0) continue;
+			volume += filled;
+			int first = 0, last = ctx.dx-1;
+			while (!row[first]) first++;
+			while (!row[last]) last--;
+			if (first < imin) imin = first;
+			if (last > imax) imax = last;
+			if (j < jmin) jmin = j;
+			if (j > jmax) jmax = j;
+			if (k < kmin) kmin = k;
+			if (k > kmax) kmax = k;
+		}
 	}
-	cerr << "MRC dims: " << DX << " x " << DY << " x " << DZ << endl;
-	cerr << "writing complete grid to MRC file: " << filename << endl;
-/*
-//PART I: Determine Extrema
-	int minmax[6];
-	int xmin, ymin, zmin;
-	int xmax, ymax, zmax;
-	determine_MinMax(data, minmax);
-	xmin = minmax[0]-1;
-	ymin = minmax[1]/DX-1;
-	zmin = minmax[2]/DXY-1;
-	xmax = minmax[3]+1;
-	ymax = minmax[4]/DX+1;
-	zmax = minmax[5]/DXY+1;
-	cerr << "Minima: " << xmin << " , " << ymin << " , " << zmin << endl;
-	cerr << "Maxima: " << xmax << " , " << ymax << " , " << zmax << endl;
-
-//PART II: Calculate new dimensions
-	int xdim, ydim, zdim;
-	xdim = int((xmax-xmin)/4.0 +1.0)*4;
-	ydim = int((ymax-ymin)/4.0 +1.0)*4;
-	zdim = int((zmax-zmin)/4.0 +1.0)*4;
-	cerr << "Old dimensions: " << DX << " , " << DY << " , " << DZ << endl;
-	cerr << "New dimensions: " << xdim << " , " << ydim << " , " << zdim << endl;
-
-	cerr << "PDB Minima: " << XMIN << " , " << YMIN << " , " << ZMIN << endl;
-	cerr << "PDB Minima: " << XMIN/GRID << " , " << YMIN/GRID << " , " << ZMIN/GRID << endl;
-*/
+	// countGrid also counts the padding bins past the last plane
+	for(unsigned int pt=ctx.dxyz; pt<ctx.numbins; pt++) {
+		if (data[pt]) volume++;
+	}
+	MapExtent extent = {volume, imin, jmin, kmin, imax, jmax, kmax};
+	if (DEBUG > 0) {
+		cerr << "X: " << imin << " <> " << imax << endl;
+		cerr << "Y: " << jmin << " <> " << jmax << endl;
+		cerr << "Z: " << kmin << " <> " << kmax << endl;
+	}
+	return extent;
+}
 
-//PART III: Use old dimensions
-	FILE * fp = fopen(filename, "wb");
-	if ( fp == NULL ) return -1;
-	
+/*********************************************/
+MapBox trimmedMapBox(const MapExtent& extent) {
+	const int xmin = extent.imin-1, xmax = extent.imax+1;
+	const int ymin = extent.jmin-1, ymax = extent.jmax+1;
+	const int zmin = extent.kmin-1, zmax = extent.kmax+1;
+	MapBox box;
+	box.i0 = xmin;
+	box.j0 = ymin;
+	box.k0 = zmin;
+	box.nx = int((xmax-xmin)/4.0 +1.0)*4;
+	box.ny = int((ymax-ymin)/4.0 +1.0)*4;
+	box.nz = int((zmax-zmin)/4.0 +1.0)*4;
+	return box;
+}
+
+/*********************************************/
+void initMapHeader(MRCHeaderSt& header, int nx, int ny, int nz, float spacing, const char label[]) {
 	// Documentation, http://bio3d.colorado.edu/imod/doc/mrc_format.txt
-	MRCHeaderSt header;
-	//cerr << XMIN << "\t" << YMIN << "\t" << ZMIN << endl;
-	//cerr << XMAX << "\t" << YMAX << "\t" << ZMAX << endl;
-	//cerr << DX << "\t" << DY << "\t" << DZ << endl;
-	//cerr << (XMAX-XMIN)/2.0 << "\t" << (YMAX-YMIN)/2.0 << "\t" << (ZMAX-ZMIN)/2.0 << endl;
-	//cerr << (DX-1.0)/2.0*GRID+XMIN << "\t" << (DY-1.0)/2.0*GRID+YMIN << "\t" << (DZ-1.0)/2.0*GRID+ZMIN << endl;
-	header.nx           = DX;
-	header.ny           = DY;
-	header.nz           = DZ;
-	header.mx           = DX;
-	header.my           = DY;
-	header.mz           = DZ;
-	header.x_length     = DX*GRID;
-	header.y_length     = DY*GRID;
-	header.z_length     = DZ*GRID;
-	// MRC2014: placement via ORIGIN only; NSTART zeroed
+	header.nx           = nx;
+	header.ny           = ny;
+	header.nz           = nz;
+	header.mx           = nx;
+	header.my           = ny;
+	header.mz           = nz;
+	header.x_length     = nx*spacing;
+	header.y_length     = ny*spacing;
+	header.z_length     = nz*spacing;
 	header.nxstart      = 0;
 	header.nystart      = 0;
 	header.nzstart      = 0;
@@ -152,194 +128,467 @@ int writeMRCFile(const gridpt data[], const char filename[] ) {
 	//   ord('M')=77, ord('A')=65, ord('P')=80, ord(' ')=32
 	//   32*(256**3) + 80*(256**2) + 65*(256) + 77
 	header.map          = 542130509;
-	// ORIGIN in Angstroms: real-space location of voxel (0,0,0)
-	header.xorigin      = float(XMIN);
-	header.yorigin      = float(YMIN);
-	header.zorigin      = float(ZMIN);
+	header.xorigin      = 0;
+	header.yorigin      = 0;
+	header.zorigin      = 0;
 	header.ispg         = 1;  // single EM-style volume
 	header.nsymbt       = 0;
 	header.mode         = MRC_MODE_BYTE;
 
 	if ( header.nz == 0 ) header.nz = 1;
 
-	if (DEBUG > 0) {
-		cerr << "Standard MRC write" << endl;
-		cerr << "N.START: " << header.nxstart << " , " << header.nystart << " , " << header.nzstart << endl;
-		cerr << "ORIGIN: " << header.xorigin << " , " << header.yorigin << " , " << header.zorigin << endl;
-	}
-
-	int k;
-	for(k=0;k<MRC_USERS;k++) header.extra[k] = 0;
+	for(int k=0;k<MRC_USERS;k++) header.extra[k] = 0;
 	// NVERSION at word 28 = extra[3]: MRC2014 format
 	header.extra[3]     = 20140;
 	// label describing placement convention
 	memset(header.label, 0, MRC_NUM_LABELS * MRC_LABEL_SIZE);
-	snprintf(reinterpret_cast<char*>(header.label[0]), MRC_LABEL_SIZE,
-		"MRC2014: ORIGIN used for placement; NSTART zeroed");
+	snprintf(reinterpret_cast<char*>(header.label[0]), MRC_LABEL_SIZE, "%s", label);
 	header.nlabl        = 1;
-	
-	if ( writeMRCHeader(fp,header) == -1 ) return -1;
+}
 
-	int count = byteWrite( fp, data, NUMBINS, 1 );
-	
-	if ( count != 17 ) return -1;
-	
-	fclose(fp);
+/*********************************************/
+// Input to each gzip member. Members are deflated in parallel and written
+// back to back; gzip, zlib and Python's gzip module read them as one stream.
+static const size_t MAP_GZIP_BLOCK = size_t(1) << 20;
+
+static bool gzipMember(const u08 * in, const size_t bytes, std::vector<u08>& out) {
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	// windowBits 15+16 asks zlib for a gzip wrapper
+	if ( deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK ) {
+		return false;
+	}
+	out.resize(deflateBound(&stream, bytes));
+	stream.next_in = const_cast<u08*>(in);
+	stream.avail_in = bytes;
+	stream.next_out = out.data();
+	stream.avail_out = out.size();
+	const bool done = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+	out.resize(stream.total_out);
+	deflateEnd(&stream);
+	return done;
+}
 
-	return 1;
+/*********************************************/
+int openMapFile(MapFile& out, const char filename[], const MapEncoding& encoding) {
+	const size_t length = strlen(filename);
+	const bool gz_name = length > 3 && strcmp(filename+length-3, ".gz") == 0;
+	// a gzipped map always gets a .gz name, so readers can tell what it is
+	std::string path = filename;
+	if ( encoding.gzip && !gz_name ) {
+		path += ".gz";
+		cerr << "writing gzipped map as " << path << endl;
+	}
+	out.gzip = encoding.gzip || gz_name;
+	out.packed4 = encoding.packed4;
+	out.fp = fopen(path.c_str(), "wb");
+	out.ok = out.fp != NULL;
+	return out.ok ? 1 : -1;
+}
 
+/*********************************************/
+int mapWrite(MapFile& out, const void * data, const size_t bytes) {
+	if ( !out.ok ) return -1;
+	if ( !out.gzip ) {
+		out.ok = fwrite(data, 1, bytes, out.fp) == bytes;
+		return out.ok ? 1 : -1;
+	}
+	const u08 * in = static_cast<const u08*>(data);
+	const int blocks = int((bytes + MAP_GZIP_BLOCK - 1) / MAP_GZIP_BLOCK);
+	std::vector<std::vector<u08> > members(blocks);
+	bool ok = true;
+	#pragma omp parallel for schedule(dynamic,1) reduction(&&:ok)
+	for(int b=0; b<blocks; b++) {
+		const size_t lo = b*MAP_GZIP_BLOCK;
+		const size_t n = lo+MAP_GZIP_BLOCK < bytes ? MAP_GZIP_BLOCK : bytes-lo;
+		ok = gzipMember(in+lo, n, members[b]) && ok;
+	}
+	for(int b=0; ok && b<blocks; b++) {
+		ok = fwrite(members[b].data(), 1, members[b].size(), out.fp) == members[b].size();
+	}
+	out.ok = ok;
+	return out.ok ? 1 : -1;
 }
 
 /*********************************************/
-int ijk2pt2(const int i, const int j, const int k, const int xdim, const int ydim) {
-  return int(i+j*xdim+k*xdim*ydim);
-};
+int closeMapFile(MapFile& out) {
+	if ( out.fp == NULL ) return -1;
+	const bool closed = fclose(out.fp) == 0;
+	out.fp = NULL;
+	return (closed && out.ok) ? 1 : -1;
+}
 
+/*********************************************/
+int writeMapHeader(MapFile& out, MRCHeaderSt& header) {
+	header.mode = out.packed4 ? MRC_MODE_PACKED4 : MRC_MODE_BYTE;
+	return mapWrite(out, &header, sizeof(MRCHeaderSt));
+}
 
 /*********************************************/
-int writeSmallMRCFile(const gridpt data[], const char filename[]) {
-	int volume = countGrid(data);
-	if (volume == 0) {
+// Bytes of output gathered per write; the batch buffer is reused, so a
+// trimmed map never needs a second copy of the grid.
+static const size_t MAP_BATCH_BYTES = size_t(8) << 20;
+
+int writeMapBox(MapFile& out, const GridContext& ctx, const gridpt data[], const MapBox& box) {
+	// mode 101 rows start on a byte boundary, first voxel in the low nibble
+	const size_t rowbytes = out.packed4 ? size_t(box.nx+1)/2 : size_t(box.nx);
+	const size_t plane = rowbytes*box.ny;
+	int batch = int(MAP_BATCH_BYTES / (plane > 0 ? plane : 1));
+	if (batch < 1) batch = 1;
+	if (batch > box.nz) batch = box.nz;
+	u08 * buffer = (u08*) std::malloc(plane*batch);
+	if (buffer == NULL) return -1;
+
+	// Columns of each output row that lie inside the grid.
+	const int ilo = box.i0 < 0 ? 0 : box.i0;
+	const int ihi = box.i0+box.nx > ctx.dx ? ctx.dx : box.i0+box.nx;
+
+	int status = 1;
+	for(int kb=0; kb<box.nz && status == 1; kb+=batch) {
+		const int planes = kb+batch > box.nz ? box.nz-kb : batch;
+		const int rows = planes*box.ny;
+		#pragma omp parallel
+		{
+			std::vector<u08> voxels(out.packed4 ? box.nx : 0);
+			#pragma omp for
+			for(int r=0; r<rows; r++) {
+				u08 * row = buffer + size_t(r)*rowbytes;
+				u08 * bytes = out.packed4 ? voxels.data() : row;
+				const int j = box.j0 + r%box.ny;
+				const int k = box.k0 + kb + r/box.ny;
+				memset(bytes, 0, box.nx);
+				if (j >= 0 && j < ctx.dy && k >= 0 && k < ctx.dz && ilo < ihi) {
+					// gridpt is one byte holding 0 or 1, i.e. already MRC_MODE_BYTE
+					memcpy(bytes + (ilo-box.i0), data + k*ctx.dxy + j*ctx.dx + ilo, ihi-ilo);
+				}
+				if (out.packed4) {
+					for(size_t b=0; b<rowbytes; b++) {
+						const u08 high = 2*b+1 < size_t(box.nx) ? bytes[2*b+1] : 0;
+						row[b] = u08(bytes[2*b] | (high << 4));
+					}
+				}
+			}
+		}
+		status = mapWrite(out, buffer, plane*planes);
+	}
+	std::free(buffer);
+	return status;
+}
+
+/*********************************************/
+int writeMapGrid(MapFile& out, const GridContext& ctx, const gridpt data[]) {
+	// Plain byte maps are the grid itself, padding bins included, as they
+	// have always been written; other encodings stream the dx*dy*dz box.
+	if ( !out.gzip && !out.packed4 ) return mapWrite(out, data, ctx.numbins);
+	const MapBox box = {0, 0, 0, ctx.dx, ctx.dy, ctx.dz};
+	return writeMapBox(out, ctx, data, box);
+}
+
+/*********************************************/
+int writeMRCFile(const GridContext& ctx, const gridpt data[], const char filename[], const MapEncoding& encoding) {
+	const MapExtent extent = scanMapExtent(ctx, data);
+	if (extent.volume == 0) {
 		cerr << "volume is empty not writing mrc file" << endl;
 		return 0;
 	}
-	cerr << "Volume: " << volume*GRIDVOL << " Angstroms" << endl;
-	cerr << "Writing trimmed grid to MRC file: " << filename << endl << endl;
+	cerr << "MRC dims: " << ctx.dx << " x " << ctx.dy << " x " << ctx.dz << endl;
+	cerr << "writing complete grid to MRC file: " << filename << endl;
+
+	MapFile out;
+	if ( openMapFile(out, filename, encoding) != 1 ) return -1;
+	
+	MRCHeaderSt header;
+	initMapHeader(header, ctx.dx, ctx.dy, ctx.dz, ctx.spacing,
+		"MRC2014: ORIGIN used for placement; NSTART zeroed");
+	// MRC2014: placement via ORIGIN only; NSTART zeroed
+	// ORIGIN in Angstroms: real-space location of voxel (0,0,0)
+	header.xorigin      = float(ctx.xmin);
+	header.yorigin      = float(ctx.ymin);
+	header.zorigin      = float(ctx.zmin);
 
-//PART I: Determine Extrema
-	int minmax[6];
-	int xmin, ymin, zmin;
-	int xmax, ymax, zmax;
-	determine_MinMax(data, minmax);
-	xmin = minmax[0]-1;
-	ymin = minmax[1]/DX-1;
-	zmin = minmax[2]/DXY-1;
-	xmax = minmax[3]+1;
-	ymax = minmax[4]/DX+1;
-	zmax = minmax[5]/DXY+1;
-
-
-//PART II: Calculate new dimensions
-	int xdim, ydim, zdim;
-	xdim = int((xmax-xmin)/4.0 +1.0)*4;
-	ydim = int((ymax-ymin)/4.0 +1.0)*4;
-	zdim = int((zmax-zmin)/4.0 +1.0)*4;
 	if (DEBUG > 0) {
-		cerr << "Minima: " << xmin << " , " << ymin << " , " << zmin << endl;
-		cerr << "Maxima: " << xmax << " , " << ymax << " , " << zmax << endl;
-		cerr << "Old dimensions: " << DX << " , " << DY << " , " << DZ << endl;
-		cerr << "New dimensions: " << xdim << " , " << ydim << " , " << zdim << endl;
-		cerr << "PDB Minima: " << (XMIN/GRID)+xmin << " , " << (YMIN/GRID)+ymin 
-			<< " , " << (ZMIN/GRID)+zmin << endl;
-		cerr << "PDB Maxima: " << (XMIN/GRID)+xmax << " , " << (YMIN/GRID)+ymax 
-			<< " , " << (ZMIN/GRID)+zmax << endl;
-		cerr << "Center: " << XMIN/GRID+(xmin+xmax)/2 << " , " << YMIN/GRID+(ymin+ymax)/2 
-			<< " , " << ZMIN/GRID+(zmin+zmax)/2 << endl;
+		cerr << "Standard MRC write" << endl;
+		cerr << "N.START: " << header.nxstart << " , " << header.nystart << " , " << header.nzstart << endl;
+		cerr << "ORIGIN: " << header.xorigin << " , " << header.yorigin << " , " << header.zorigin << endl;
 	}
 
+	int status = writeMapHeader(out, header);
+	if ( status == 1 ) status = writeMapGrid(out, ctx, data);
+	if ( closeMapFile(out) != 1 ) status = -1;
 
-//PART III: Trim the grid
-	int oldpt, newpt;
-	unsigned int numbins = xdim*ydim*zdim;
-	gridpt *smdata;
-	if (DEBUG > 0)
-		cerr << NUMBINS << " --> " << numbins << endl;
-	smdata = (gridpt*) std::malloc (numbins);
-	#pragma omp parallel for
-	for(unsigned int pt=0; pt<numbins; pt++) {
-		smdata[pt] = 0;
+	return status;
+
+}
+
+/*********************************************/
+int writeSmallMRCFile(const GridContext& ctx, const gridpt data[], const char filename[], const MapEncoding& encoding) {
+	const MapExtent extent = scanMapExtent(ctx, data);
+	if (extent.volume == 0) {
+		cerr << "volume is empty not writing mrc file" << endl;
+		return 0;
 	}
-	if (DEBUG > 0)
-	  cerr << "Trimming the grid..." << endl;
-	for(int k=0; k<DZ; k++) {
-		for(int j=0; j<DY; j++) {
-			for(int i=0; i<DX; i++) {
-				oldpt = ijk2pt2(i, j, k, DX, DY);
-				//cerr << oldpt << endl;
-				if(data[oldpt]) {
-					newpt = ijk2pt2(i-xmin, j-ymin, k-zmin, xdim, ydim);
-					//cerr << oldpt << " --> " << newpt << endl;
-					smdata[newpt] = 1;
-				}
-	} } }
-	if (DEBUG > 0)
-	  cerr << endl << "DONE";
+	cerr << "Volume: " << extent.volume*ctx.gridvol << " Angstroms" << endl;
+	cerr << "Writing trimmed grid to MRC file: " << filename << endl << endl;
 
-//PART IV: Use new dimensions
-	FILE * fp = fopen(filename, "wb");
-	if ( fp == NULL ) return -1;
+	const MapBox box = trimmedMapBox(extent);
+	if (DEBUG > 0) {
+		const int xmax = extent.imax+1, ymax = extent.jmax+1, zmax = extent.kmax+1;
+		cerr << "Minima: " << box.i0 << " , " << box.j0 << " , " << box.k0 << endl;
+		cerr << "Maxima: " << xmax << " , " << ymax << " , " << zmax << endl;
+		cerr << "Old dimensions: " << ctx.dx << " , " << ctx.dy << " , " << ctx.dz << endl;
+		cerr << "New dimensions: " << box.nx << " , " << box.ny << " , " << box.nz << endl;
+		cerr << "PDB Minima: " << (ctx.xmin/ctx.spacing)+box.i0 << " , " << (ctx.ymin/ctx.spacing)+box.j0 
+			<< " , " << (ctx.zmin/ctx.spacing)+box.k0 << endl;
+		cerr << "PDB Maxima: " << (ctx.xmin/ctx.spacing)+xmax << " , " << (ctx.ymin/ctx.spacing)+ymax 
+			<< " , " << (ctx.zmin/ctx.spacing)+zmax << endl;
+		cerr << "Center: " << ctx.xmin/ctx.spacing+(box.i0+xmax)/2 << " , " << ctx.ymin/ctx.spacing+(box.j0+ymax)/2 
+			<< " , " << ctx.zmin/ctx.spacing+(box.k0+zmax)/2 << endl;
+	}
+
+	MapFile out;
+	if ( openMapFile(out, filename, encoding) != 1 ) return -1;
 	
 	MRCHeaderSt header;
-	//cerr << XMIN << "\t" << YMIN << "\t" << ZMIN << endl;
-	//cerr << XMAX << "\t" << YMAX << "\t" << ZMAX << endl;
-	//cerr << xdim << "\t" << ydim << "\t" << zdim << endl;
-	//cerr << (XMAX-XMIN)/2.0 << "\t" << (YMAX-YMIN)/2.0 << "\t" << (ZMAX-ZMIN)/2.0 << endl;
-	//cerr << (xdim-1.0)/2.0*GRID+XMIN << "\t" << (ydim-1.0)/2.0*GRID+YMIN << "\t" << (zdim-1.0)/2.0*GRID+ZMIN << endl;
-	header.nx           = xdim;
-	header.ny           = ydim;
-	header.nz           = zdim;
-	header.mx           = xdim;
-	header.my           = ydim;
-	header.mz           = zdim;
-	header.x_length     = xdim*GRID;
-	header.y_length     = ydim*GRID;
-	header.z_length     = zdim*GRID;
+	initMapHeader(header, box.nx, box.ny, box.nz, ctx.spacing,
+		"MRC2014: ORIGIN used for placement; NSTART zeroed");
 	// MRC2014: placement via ORIGIN only; NSTART zeroed
-	header.nxstart      = 0;
-	header.nystart      = 0;
-	header.nzstart      = 0;
-	header.mapc         = 1;
-	header.mapr         = 2;
-	header.maps         = 3;
-	header.alpha        = 90;
-	header.beta         = 90;
-	header.gamma        = 90;
-	header.amean        = 0;
-	header.amax         = 0;
-	header.amin         = 0;
-	header.rms          = 0;
-	// MRC2014 machine stamp: 0x44 0x44 0x00 0x00 for little-endian
-	header.mach         = 0x00004144;
-	// "MAP " from ascii to little-endian integer:
-	//   32*(256**3) + 80*(256**2) + 65*(256) + 77
-	header.map          = 542130509;
 	// ORIGIN in Angstroms: real-space location of trimmed voxel (0,0,0)
-	header.xorigin      = XMIN+GRID*xmin;
-	header.yorigin      = YMIN+GRID*ymin;
-	header.zorigin      = ZMIN+GRID*zmin;
-	header.ispg         = 1;  // single EM-style volume
-	header.nsymbt       = 0;
-	header.mode         = MRC_MODE_BYTE;
+	header.xorigin      = ctx.xmin+ctx.spacing*box.i0;
+	header.yorigin      = ctx.ymin+ctx.spacing*box.j0;
+	header.zorigin      = ctx.zmin+ctx.spacing*box.k0;
 
 	if (DEBUG > 0) {
 		cerr << "Trimmed MRC write" << endl;
 		cerr << "N.START: " << header.nxstart << " , " << header.nystart << " , " << header.nzstart << endl;
-		cerr << "MINS:   " << xmin << " , " << ymin << " , " << zmin;
+		cerr << "MINS:   " << box.i0 << " , " << box.j0 << " , " << box.k0;
 		cerr << "ORIGIN: " << header.xorigin << " , " << header.yorigin << " , " << header.zorigin << endl;
 	}
 
-	if ( header.nz == 0 ) header.nz = 1;
+	int status = writeMapHeader(out, header);
+	if ( status == 1 ) status = writeMapBox(out, ctx, data, box);
+	if ( closeMapFile(out) != 1 ) status = -1;
 
-	int k;
-	for(k=0;k<MRC_USERS;k++) header.extra[k] = 0;
-	// NVERSION at word 28 = extra[3]: MRC2014 format
-	header.extra[3]     = 20140;
-	// label describing placement convention
-	memset(header.label, 0, MRC_NUM_LABELS * MRC_LABEL_SIZE);
-	snprintf(reinterpret_cast<char*>(header.label[0]), MRC_LABEL_SIZE,
-		"MRC2014: ORIGIN used for placement; NSTART zeroed");
-	header.nlabl        = 1;
-	
-	if ( writeMRCHeader(fp,header) == -1 ) return -1;
+	return status;
 
+}
 
-	int count = byteWrite( fp, smdata, numbins, 1 );
-	std::free (smdata);
-	if ( count != 17 ) return -1;
+/*********************************************/
+// gzopen also reads uncompressed files, so one path serves .mrc and .mrc.gz.
+static int readMRCHeader( gzFile gz, MRCHeaderSt& header ) {
+	if ( gzread(gz, &header, sizeof(MRCHeaderSt)) != int(sizeof(MRCHeaderSt)) ) {
+		cerr << "map file is shorter than its 1024-byte header" << endl;
+		return -1;
+	}
+	// big-endian files carry 0x11 in the first stamp byte
+	if ( (header.mach & 0xFF) == 0x11 ) {
+		cerr << "big-endian map files are not supported" << endl;
+		return -1;
+	}
+	if ( header.nx <= 0 || header.ny <= 0 || header.nz <= 0 || header.nsymbt < 0 ) {
+		cerr << "map header has invalid dimensions " << header.nx << " x " << header.ny
+			<< " x " << header.nz << endl;
+		return -1;
+	}
+	if ( header.mapc != 1 || header.mapr != 2 || header.maps != 3 ) {
+		cerr << "map axis order " << header.mapc << "," << header.mapr << "," << header.maps
+			<< " is not supported, only 1,2,3" << endl;
+		return -1;
+	}
+	if ( header.mode != MRC_MODE_BYTE && header.mode != MRC_MODE_SHORT && header.mode != MRC_MODE_FLOAT
+			&& header.mode != MRC_MODE_PACKED4 ) {
+		cerr << "map mode " << header.mode << " is not supported, only 0, 1, 2 and 101" << endl;
+		return -1;
+	}
+	return 1;
+}
 
-	fclose(fp);
+/*********************************************/
+// Voxel size and real-space location of map voxel (0,0,0). Our MRC files
+// place the map with ORIGIN and our CCP4 files with NSTART; a file that
+// sets both is read by ORIGIN, as most viewers do.
+static void mapPlacement(const MRCHeaderSt& header, float size[3], float start[3]) {
+	const int m[3] = {header.mx > 0 ? header.mx : header.nx,
+		header.my > 0 ? header.my : header.ny, header.mz > 0 ? header.mz : header.nz};
+	const float length[3] = {header.x_length, header.y_length, header.z_length};
+	const int nstart[3] = {header.nxstart, header.nystart, header.nzstart};
+	const float origin[3] = {header.xorigin, header.yorigin, header.zorigin};
+	const bool use_origin = origin[0] != 0 || origin[1] != 0 || origin[2] != 0;
+	for(int a=0; a<3; a++) {
+		size[a] = length[a] / m[a];
+		start[a] = use_origin ? origin[a] : nstart[a] * size[a];
+	}
+}
 
+/*********************************************/
+int readMRCGridContext(const char filename[], GridContext& ctx) {
+	gzFile gz = gzopen(filename, "rb");
+	if ( gz == NULL ) {
+		cerr << "unable to open map file: " << filename << endl;
+		return -1;
+	}
+	MRCHeaderSt header;
+	const int status = readMRCHeader(gz, header);
+	gzclose(gz);
+	if ( status != 1 ) return -1;
+
+	float size[3], start[3];
+	mapPlacement(header, size, start);
+	if ( size[0] <= 0 || size[0] != size[1] || size[0] != size[2] ) {
+		cerr << "map voxels are not cubic: " << size[0] << " x " << size[1] << " x " << size[2] << endl;
+		return -1;
+	}
+	ctx = make_grid_context(size[0], ctx.maxprobe);
+	ctx.xmin = start[0];  ctx.ymin = start[1];  ctx.zmin = start[2];
+	ctx.dx = header.nx;  ctx.dy = header.ny;  ctx.dz = header.nz;
+	ctx.xmax = ctx.xmin + (ctx.dx-1)*ctx.spacing;
+	ctx.ymax = ctx.ymin + (ctx.dy-1)*ctx.spacing;
+	ctx.zmax = ctx.zmin + (ctx.dz-1)*ctx.spacing;
+	ctx.dxy = ctx.dy * ctx.dx;
+	ctx.dxyz = ctx.dz * ctx.dxy;
+	ctx.numbins = ctx.dxyz + ctx.dxy + ctx.dx + 1;
 	return 1;
+}
+
+/*********************************************/
+// Threshold one grid row sampled from a section of raw map voxels.
+template <typename T>
+static int fillMapRow(const u08 * row, const int * mi, const int dx, const float threshold, gridpt out[]) {
+	int voxels = 0;
+	for(int i=0; i<dx; i++) {
+		if (mi[i] < 0) continue;
+		T value;
+		memcpy(&value, row + size_t(mi[i])*sizeof(T), sizeof(T));
+		out[i] = float(value) > threshold;
+		voxels += out[i] ? 1 : 0;
+	}
+	return voxels;
+}
+
+// Same for mode 101: two 4-bit voxels per byte, first in the low nibble.
+static int fillPackedRow(const u08 * row, const int * mi, const int dx, const float threshold, gridpt out[]) {
+	int voxels = 0;
+	for(int i=0; i<dx; i++) {
+		if (mi[i] < 0) continue;
+		const int value = (row[mi[i] >> 1] >> ((mi[i] & 1) * 4)) & 0xF;
+		out[i] = float(value) > threshold;
+		voxels += out[i] ? 1 : 0;
+	}
+	return voxels;
+}
 
+/*********************************************/
+// Nearest map voxel along one axis for each grid index, or -1 outside the map.
+static void mapAxisIndex(const float gridmin, const float spacing, const int n,
+		const float start, const float size, const int mapn, int index[]) {
+	for(int i=0; i<n; i++) {
+		const long m = lround((gridmin + i*spacing - start) / size);
+		index[i] = (m >= 0 && m < mapn) ? int(m) : -1;
+	}
 }
 
+/*********************************************/
+int readMRCFile(const GridContext& ctx, const char filename[], const float threshold, gridpt data[]) {
+	gzFile gz = gzopen(filename, "rb");
+	if ( gz == NULL ) {
+		cerr << "unable to open map file: " << filename << endl;
+		return -1;
+	}
+	gzbuffer(gz, 1 << 20);
+	MRCHeaderSt header;
+	if ( readMRCHeader(gz, header) != 1 || gzseek(gz, sizeof(MRCHeaderSt) + header.nsymbt, SEEK_SET) < 0 ) {
+		gzclose(gz);
+		return -1;
+	}
+	cerr << "reading " << header.nx << " x " << header.ny << " x " << header.nz
+		<< " map file: " << filename << endl;
+
+	float size[3], start[3];
+	mapPlacement(header, size, start);
+	std::vector<int> mi(ctx.dx), mj(ctx.dy), mk(ctx.dz);
+	mapAxisIndex(ctx.xmin, ctx.spacing, ctx.dx, start[0], size[0], header.nx, mi.data());
+	mapAxisIndex(ctx.ymin, ctx.spacing, ctx.dy, start[1], size[1], header.ny, mj.data());
+	mapAxisIndex(ctx.zmin, ctx.spacing, ctx.dz, start[2], size[2], header.nz, mk.data());
+	if (DEBUG > 0) {
+		cerr << "Map voxel: " << size[0] << " , " << size[1] << " , " << size[2] << endl;
+		cerr << "Map start: " << start[0] << " , " << start[1] << " , " << start[2] << endl;
+	}
+
+	// Sections are read in order, a batch per read, and each grid plane is
+	// filled while the section it samples is in the buffer.
+	const int bytes = header.mode == MRC_MODE_FLOAT ? 4 : (header.mode == MRC_MODE_SHORT ? 2 : 1);
+	const size_t rowbytes = header.mode == MRC_MODE_PACKED4 ? size_t(header.nx+1)/2 : size_t(header.nx)*bytes;
+	const size_t section = rowbytes*header.ny;
+	int batch = int(MAP_BATCH_BYTES / section);
+	if (batch < 1) batch = 1;
+	if (batch > header.nz) batch = header.nz;
+	std::vector<u08> buffer(section*batch);
+
+	zeroGrid(ctx, data);
+	int voxels = 0;
+	int status = 1;
+	for(int s0=0; s0<header.nz && status == 1; s0+=batch) {
+		const int sections = s0+batch > header.nz ? header.nz-s0 : batch;
+		if ( gzread(gz, buffer.data(), section*sections) != int(section*sections) ) {
+			cerr << "map file is truncated: " << filename << endl;
+			status = -1;
+			break;
+		}
+		#pragma omp parallel for reduction(+:voxels)
+		for(int k=0; k<ctx.dz; k++) {
+			if (mk[k] < s0 || mk[k] >= s0+sections) continue;
+			for(int j=0; j<ctx.dy; j++) {
+				if (mj[j] < 0) continue;
+				const u08 * row = buffer.data() + (size_t(mk[k]-s0)*header.ny + mj[j])*rowbytes;
+				gridpt * out = data + k*ctx.dxy + j*ctx.dx;
+				if (header.mode == MRC_MODE_PACKED4) {
+					voxels += fillPackedRow(row, mi.data(), ctx.dx, threshold, out);
+				} else if (header.mode == MRC_MODE_FLOAT) {
+					voxels += fillMapRow<f32>(row, mi.data(), ctx.dx, threshold, out);
+				} else if (header.mode == MRC_MODE_SHORT) {
+					voxels += fillMapRow<s16>(row, mi.data(), ctx.dx, threshold, out);
+				} else {
+					voxels += fillMapRow<s08>(row, mi.data(), ctx.dx, threshold, out);
+				}
+			}
+		}
+	}
+	gzclose(gz);
+	if ( status != 1 ) return -1;
+	cerr << "map voxels above " << threshold << ": " << voxels << endl;
+	return voxels;
+}
+
+/*********************************************/
+// Like readMRCFile, but only for a map on ctx's own lattice (same voxel size,
+// origin a whole number of voxels away), so nearest-voxel sampling copies it
+// exactly. Returns -1 when the map is elsewhere.
+int readMRCFileOnGrid(const GridContext& ctx, const char filename[], const float threshold, gridpt data[]) {
+	GridContext map = ctx;
+	if ( readMRCGridContext(filename, map) != 1 ) return -1;
+	const float tolerance = 1e-3 * ctx.spacing;
+	bool aligned = fabs(map.spacing - ctx.spacing) <= tolerance;
+	const float offset[3] = {map.xmin - ctx.xmin, map.ymin - ctx.ymin, map.zmin - ctx.zmin};
+	for(int a=0; a<3; a++) {
+		const float voxels = offset[a] / ctx.spacing;
+		aligned = aligned && fabs(voxels - lround(voxels)) * ctx.spacing <= tolerance;
+	}
+	if ( !aligned ) {
+		cerr << "map " << filename << " (voxel size " << map.spacing << ", origin "
+			<< map.xmin << " " << map.ymin << " " << map.zmin << ") is not on the grid (voxel size "
+			<< ctx.spacing << ", origin " << ctx.xmin << " " << ctx.ymin << " " << ctx.zmin << ")" << endl;
+		return -1;
+	}
+	return readMRCFile(ctx, filename, threshold, data);
+}
+
+/*********************************************/
+// Legacy entry points: write using the process-wide grid context.
+int writeMRCFile(const gridpt data[], const char filename[]) {
+	return writeMRCFile(current_grid_context(), data, filename);
+}
+int writeSmallMRCFile(const gridpt data[], const char filename[]) {
+	return writeSmallMRCFile(current_grid_context(), data, filename);
+}
+int readMRCFile(const char filename[], const float threshold, gridpt data[]) {
+	return readMRCFile(current_grid_context(), filename, threshold, data);
+}
@@ -8,11 +8,12 @@
 #include <iostream>   // for cerr
 #include <sstream>    // for basic_ostringstream, ostringstream
 #include <algorithm>
-#include <cmath>      // for pow, round
+#include <cmath>      // for pow, round, nearbyint, fabs, isfinite, signbit
+#include <cstdio>     // for snprintf
 #include <string>     // for char_traits, allocator, basic_string
 #include <vector>
 #include "argument_helper.hpp"
-#include "utils.hpp"    // for GRID, endl, DX, DXY, gridpt
+#include "utils.hpp"    // for GridContext, endl, gridpt
 #include "vossvolvox_cli_common.hpp"
 
 /*********************************************
@@ -51,10 +52,138 @@ std::string trim_trailing_zeros(std::string text) {
   }
   return text;
 }
+
+// z-planes formatted together before they are written out in order.
+const int PDB_BATCH = 16;
+
+// Appends value right-aligned in width, like printf("%*d").
+void append_int(std::string& out, int value, int width) {
+  char digits[16];
+  int n = 0;
+  unsigned int u = value < 0 ? 0u - unsigned(value) : unsigned(value);
+  do {
+    digits[n++] = char('0' + u % 10);
+    u /= 10;
+  } while (u > 0);
+  if (value < 0) {
+    digits[n++] = '-';
+  }
+  for (int pad = width - n; pad > 0; pad--) {
+    out.push_back(' ');
+  }
+  while (n > 0) {
+    out.push_back(digits[--n]);
+  }
+}
+
+// Appends value like printf("%*.*f") with 2 or 3 decimals. A float times
+// 10^decimals is exact in double, so nearbyint gives printf's
+// round-half-even result.
+void append_fixed(std::string& out, float value, int width, int decimals) {
+  const double scale = decimals == 3 ? 1000.0 : 100.0;
+  const double scaled = std::nearbyint(double(std::fabs(value)) * scale);
+  if (!std::isfinite(value) || scaled >= 1e15) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%*.*f", width, decimals, double(value));
+    out.append(buffer);
+    return;
+  }
+  char digits[24];
+  int n = 0;
+  unsigned long long u = (unsigned long long)scaled;
+  for (int d = 0; d < decimals; d++) {
+    digits[n++] = char('0' + u % 10);
+    u /= 10;
+  }
+  digits[n++] = '.';
+  do {
+    digits[n++] = char('0' + u % 10);
+    u /= 10;
+  } while (u > 0);
+  if (std::signbit(value)) {
+    digits[n++] = '-';
+  }
+  for (int pad = width - n; pad > 0; pad--) {
+    out.push_back(' ');
+  }
+  while (n > 0) {
+    out.push_back(digits[--n]);
+  }
+}
+
+// Appends the water HETATM line for grid point (i,j,k), atom number n,
+// without a line terminator.
+void append_pdb_point(std::string& out, const GridContext& ctx, int i, int j, int k, int n) {
+  const float x = float(i) * ctx.spacing + ctx.xmin;
+  const float y = float(j) * ctx.spacing + ctx.ymin;
+  const float z = float(k) * ctx.spacing + ctx.zmin;
+  const float dist = distFromPt(x, y, z);
+  out.append("HETATM");
+  append_int(out, n % 99999 + 1, 5);
+  out.append("  O   HOH  ");
+  append_int(out, (n / 10) % 9999 + 1, 4);
+  out.append("    ");
+  append_fixed(out, x, 8, 3);
+  append_fixed(out, y, 8, 3);
+  append_fixed(out, z, 8, 3);
+  out.append("  1.00");
+  append_fixed(out, dist, 6, 2);
+}
+
+// Writes a HETATM line for every point with keep(pt) set, numbered in grid
+// order. Planes are gathered and formatted in parallel PDB_BATCH at a time,
+// then each plane goes out with a single write. Prints one '^' per 1/60th
+// of the planes. Returns the number of points written.
+template <typename Keep>
+int write_pdb_points(const GridContext& ctx, std::ofstream& out, Keep keep) {
+  const float cat = ctx.dz / 60.0;
+  float cut = cat;
+  int planes = 0;
+  int anum = 0;
+  std::vector<std::vector<int>> points(PDB_BATCH);
+  std::vector<std::string> text(PDB_BATCH);
+  for (int k0 = 0; k0 < ctx.dz; k0 += PDB_BATCH) {
+    const int nk = k0 + PDB_BATCH <= ctx.dz ? PDB_BATCH : ctx.dz - k0;
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int b = 0; b < nk; b++) {
+      points[b].clear();
+      const int base = (k0 + b) * ctx.dxy;
+      for (int pt = base; pt < base + ctx.dxy; pt++) {
+        if (keep(pt)) {
+          points[b].push_back(pt - base);
+        }
+      }
+    }
+    std::vector<int> first(nk);
+    for (int b = 0; b < nk; b++) {
+      first[b] = anum;
+      anum += int(points[b].size());
+    }
+    #pragma omp parallel for schedule(dynamic,1)
+    for (int b = 0; b < nk; b++) {
+      std::string& lines = text[b];
+      lines.clear();
+      lines.reserve(points[b].size() * 67);
+      int n = first[b];
+      for (const int rest : points[b]) {
+        append_pdb_point(lines, ctx, rest % ctx.dx, rest / ctx.dx, k0 + b, ++n);
+        lines.push_back('\n');
+      }
+    }
+    for (int b = 0; b < nk; b++) {
+      if (++planes > cut) {
+        cerr << "^" << flush;
+        cut += cat;
+      }
+      out.write(text[b].data(), std::streamsize(text[b].size()));
+    }
+  }
+  return anum;
+}
 }  // namespace
 
-std::string format_resolution(long double numerator, int decimals) {
-  const long double gridvol = static_cast<long double>(GRIDVOL);
+std::string format_resolution(const GridContext& ctx, long double numerator, int decimals) {
+  const long double gridvol = static_cast<long double>(ctx.gridvol);
   if (gridvol == 0.0L) {
     return "inf";
   }
@@ -67,35 +196,15 @@ std::string format_resolution(long double numerator, int decimals) {
 //========================================================
 //========================================================
 // Function to convert grid indices (i, j, k) and atom number to a water HETATM line for PDB
-std::string ijk2pdb(int i, int j, int k, int n) {
-  // Calculate XYZ coordinates
-  float x = float(i) * GRID + XMIN;
-  float y = float(j) * GRID + YMIN;
-  float z = float(k) * GRID + ZMIN;
-
-  // Calculate temperature (distance for illustrative purposes)
-  float dist = distFromPt(x, y, z);
-
-  // Format the PDB HETATM line
-  std::ostringstream oss;
-  oss << "HETATM"                                  // Record name
-    << std::setw(5) << std::right << (n % 99999 + 1) // Atom serial number
-    << "  O   HOH  "                            // Atom and residue type
-    << std::setw(4) << std::right << ((n / 10) % 9999 + 1) // Residue serial number
-    << "    "                                   // Spacer
-    << std::fixed << std::setprecision(3)
-    << std::setw(8) << x                        // X coordinate
-    << std::setw(8) << y                        // Y coordinate
-    << std::setw(8) << z                        // Z coordinate
-    << "  1.00"                                 // Occupancy
-    << std::setw(6) << std::setprecision(2) << dist; // Temperature factor
-
-  return oss.str();
+std::string ijk2pdb(const GridContext& ctx, int i, int j, int k, int n) {
+  std::string line;
+  append_pdb_point(line, ctx, i, j, k, n);
+  return line;
 }
 
 //========================================================
 //========================================================
-void write_PDB(const gridpt grid[], const char outfile[]) {
+void write_PDB(const GridContext& ctx, const gridpt grid[], const char outfile[]) {
   cerr << "Writing FULL PDB to file: " << outfile << endl;
 
   // Open the output file
@@ -115,42 +224,15 @@ void write_PDB(const gridpt grid[], const char outfile[]) {
       out << "REMARK Arg: " << arg << endl;
     }
   }
-  out << "REMARK Grid: " << GRID << "\tGRIDVOL: " << GRIDVOL
-      << "\tWater_Res: " << WATER_RES << "\tMaxProbe: " << MAXPROBE
-      << "\tCutoff: " << CUTOFF << endl;
-
-  // Progress tracking
-  float count = 0;
-  int anum = 0;
-  const float cat = DZ / 60.0;
-  float cut = cat;
+  out << "REMARK Grid: " << ctx.spacing << "\tGRIDVOL: " << ctx.gridvol
+      << "\tWater_Res: " << ctx.water_res << "\tMaxProbe: " << ctx.maxprobe
+      << "\tCutoff: " << ctx.cutoff << endl;
 
   cerr << "Writing the grid to [ " << outfile << " ]..." << endl;
   printBar();
 
-  // Loop through the grid
-  int sk = -1;
-  for (int k = 0; k < DXYZ; k += DXY) {
-    sk++;
-    count++;
-    if (count > cut) {
-      cerr << "^" << flush;
-      cut += cat;
-    }
-
-    int sj = -1;
-    for (int j = 0; j < DXY; j += DX) {
-      sj++;
-      for (int i = 0; i < DX; i++) {
-        if (grid[i + j + k]) {  // Check if grid point is occupied
-          anum++;
-          // Use ijk2pdb to generate the PDB line
-          std::string line = ijk2pdb(i, sj, sk, anum);
-          out << line << endl;
-        }
-      }
-    }
-  }
+  // One line per occupied grid point
+  const int anum = write_pdb_points(ctx, out, [&](int pt) { return grid[pt] != 0; });
 
   // Finalize output
   out << endl;
@@ -160,7 +242,7 @@ void write_PDB(const gridpt grid[], const char outfile[]) {
 
 //========================================================
 //========================================================
-void write_SurfPDB(const gridpt grid[], const char outfile[]) {
+void write_SurfPDB(const GridContext& ctx, const gridpt grid[], const char outfile[]) {
   std::cerr << "Writing SURFACE PDB to file: " << outfile << std::endl;
   std::ofstream out(outfile);
 
@@ -174,38 +256,18 @@ void write_SurfPDB(const gridpt grid[], const char outfile[]) {
       out << "REMARK Arg: " << arg << std::endl;
     }
   }
-  out << "REMARK Grid: " << GRID << "\tGRIDVOL: " << GRIDVOL
-      << "\tWater_Res: " << WATER_RES
-      << "\tMaxProbe: " << MAXPROBE << "\tCutoff: " << CUTOFF << std::endl;
-
-  // Progress tracking
-  int anum = 0, pnum = 0;
-  const float cat = DZ / 60.0;
-  float cut = cat;
+  out << "REMARK Grid: " << ctx.spacing << "\tGRIDVOL: " << ctx.gridvol
+      << "\tWater_Res: " << ctx.water_res
+      << "\tMaxProbe: " << ctx.maxprobe << "\tCutoff: " << ctx.cutoff << std::endl;
 
   std::cerr << "Writing the grid to [" << outfile << "]..." << std::endl;
   printBar();
 
-  // Loop through the grid and write PDB entries for edge points
-  int sk = -1, sj = -1;
-  for (int k = 0; k < DXYZ; k += DXY) {
-    sk++;
-    if (++pnum > cut) {
-        std::cerr << "^" << std::flush;
-        cut += cat;
-    }
-    sj = -1;
-    for (int j = 0; j < DXY; j += DX) {
-      sj++;
-      for (int i = 0; i < DX; i++) {
-        int pt = i + j + k;
-        if (grid[pt] && hasEmptyNeighbor(pt, grid)) {
-          anum++;
-          out << ijk2pdb(i, sj, sk, anum) << std::endl; // Use refactored function
-        }
-      }
-    }
-  }
+  // One line per edge point
+  const int anum = write_pdb_points(ctx, out, [&](int pt) {
+    return grid[pt] && hasEmptyNeighbor(ctx, pt, grid);
+  });
+  const int pnum = ctx.dz;
 
   out << std::endl;
   out.close();
@@ -229,7 +291,7 @@ void write_SurfPDB(const gridpt grid[], const char outfile[]) {
 // Returns:
 //    - The blurred value (normalized or thresholded) for the given voxel.
 //========================================================
-float computeBlurredValue(const gridpt grid[], int voxelIndex) {
+float computeBlurredValue(const GridContext& ctx, const gridpt grid[], int voxelIndex) {
   // Initialize the blurred value
   float value = 0.0;
 
@@ -243,7 +305,7 @@ float computeBlurredValue(const gridpt grid[], int voxelIndex) {
     for (int dj = -1; dj <= 1; dj++) {       // Neighbor offset along the y-axis
       for (int dk = -1; dk <= 1; dk++) {     // Neighbor offset along the z-axis
         // Compute the neighbor index
-        int neighborIndex = voxelIndex + di + dj * DX + dk * DXY;
+        int neighborIndex = voxelIndex + di + dj * ctx.dx + dk * ctx.dxy;
 
         // Check if the neighbor is occupied
         if (grid[neighborIndex]) {
@@ -281,37 +343,40 @@ float computeBlurredValue(const gridpt grid[], int voxelIndex) {
   return value;
 }
 
-void report_grid_metrics(std::ostream& out, int voxels, long double surface_area) {
-  out << "Grid Spacing:       " << GRID << " A\n"
-      << "Voxel Volume:       " << GRIDVOL << " A\n"
-      << "Resolution:         " << format_resolution(1000.0L) << " voxels per A^3\n"
-      << "Resolution:         " << format_resolution(11494.0L) << " voxels per water molecule\n"
+void report_grid_metrics(const GridContext& ctx, std::ostream& out, int voxels, long double surface_area) {
+  out << "Grid Spacing:       " << ctx.spacing << " A\n"
+      << "Voxel Volume:       " << ctx.gridvol << " A\n"
+      << "Resolution:         " << format_resolution(ctx, 1000.0L) << " voxels per A^3\n"
+      << "Resolution:         " << format_resolution(ctx, 11494.0L) << " voxels per water molecule\n"
       << "Total Voxels:       " << voxels << "\n"
-      << "Volume:             " << voxels * GRIDVOL << "\n"
+      << "Volume:             " << voxels * ctx.gridvol << "\n"
       << "Surface Area:       " << surface_area << " A^2\n";
 }
 
-void write_output_files(const gridpt grid[],
+void write_output_files(const GridContext& ctx, const gridpt grid[],
                         const vossvolvox::OutputSettings& outputs) {
+  MapEncoding encoding;
+  encoding.packed4 = outputs.map_4bit;
+  encoding.gzip = outputs.map_gzip;
   if (!outputs.mrcFile.empty()) {
     if (outputs.use_small_mrc) {
-      writeSmallMRCFile(grid, const_cast<char*>(outputs.mrcFile.c_str()));
+      writeSmallMRCFile(ctx, grid, const_cast<char*>(outputs.mrcFile.c_str()), encoding);
     } else {
-      writeMRCFile(grid, const_cast<char*>(outputs.mrcFile.c_str()));
+      writeMRCFile(ctx, grid, const_cast<char*>(outputs.mrcFile.c_str()), encoding);
     }
   }
   if (!outputs.ccp4File.empty()) {
     if (outputs.use_small_mrc) {
-      writeSmallCCP4File(grid, const_cast<char*>(outputs.ccp4File.c_str()));
+      writeSmallCCP4File(ctx, grid, const_cast<char*>(outputs.ccp4File.c_str()), encoding);
     } else {
-      writeCCP4File(grid, const_cast<char*>(outputs.ccp4File.c_str()));
+      writeCCP4File(ctx, grid, const_cast<char*>(outputs.ccp4File.c_str()), encoding);
     }
   }
   if (!outputs.ezdFile.empty()) {
-    write_HalfEZD(grid, const_cast<char*>(outputs.ezdFile.c_str()));
+    write_HalfEZD(ctx, grid, const_cast<char*>(outputs.ezdFile.c_str()));
   }
   if (!outputs.pdbFile.empty()) {
-    write_SurfPDB(grid, const_cast<char*>(outputs.pdbFile.c_str()));
+    write_SurfPDB(ctx, grid, const_cast<char*>(outputs.pdbFile.c_str()));
   }
 }
 
@@ -321,7 +386,7 @@ void write_output_files(const gridpt grid[],
 **********************************************
 *********************************************/
 
-void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, bool blur = false) {
+void write_BinnedEZD(const GridContext& ctx, const gridpt grid[], const char outfile[], int binFactor, bool blur = false) {
   if (binFactor <= 0) {
     std::cerr << "Error: Invalid binFactor. Must be greater than 0." << std::endl;
     return;
@@ -332,18 +397,18 @@ void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, b
             << " for file: " << outfile << std::endl;
 
   // Arrays for grid start, end, min/max physical dimensions, origin, and extent
-  unsigned int start[3] = {NUMBINS, NUMBINS, NUMBINS};
+  unsigned int start[3] = {ctx.numbins, ctx.numbins, ctx.numbins};
   unsigned int end[3] = {0, 0, 0};
   float min[3], max[3];
   unsigned int origin[3], extent[3];
 
   // Identify the boundaries of the occupied grid
-  for (unsigned int ind = 0; ind < NUMBINS; ind++) {
+  for (unsigned int ind = 0; ind < ctx.numbins; ind++) {
     if (grid[ind]) {
-      const int coords[3] = {
-        int(ind % DX),
-        int((ind % DXY) / DX),
-        int(ind / DXY)
+      const unsigned int coords[3] = {
+        ind % ctx.dx,
+        (ind % ctx.dxy) / ctx.dx,
+        ind / ctx.dxy
       };
 
       for (int axis = 0; axis < 3; axis++) {
@@ -360,17 +425,17 @@ void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, b
   }
 
   // Compute physical min/max values
-  min[0] = start[0] * GRID + XMIN;
-  min[1] = start[1] * GRID + YMIN;
-  min[2] = start[2] * GRID + ZMIN;
+  min[0] = start[0] * ctx.spacing + ctx.xmin;
+  min[1] = start[1] * ctx.spacing + ctx.ymin;
+  min[2] = start[2] * ctx.spacing + ctx.zmin;
 
-  max[0] = end[0] * GRID + XMIN;
-  max[1] = end[1] * GRID + YMIN;
-  max[2] = end[2] * GRID + ZMIN;
+  max[0] = end[0] * ctx.spacing + ctx.xmin;
+  max[1] = end[1] * ctx.spacing + ctx.ymin;
+  max[2] = end[2] * ctx.spacing + ctx.zmin;
 
   // Compute ORIGIN and EXTENT
   for (int axis = 0; axis < 3; axis++) {
-    origin[axis] = int((min[axis] / GRID - 1.0) / binFactor + 0.5);
+    origin[axis] = int((min[axis] / ctx.spacing - 1.0) / binFactor + 0.5);
     extent[axis] = int((end[axis] - start[axis] + 1) / binFactor + 0.5);
   }
 
@@ -386,9 +451,9 @@ void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, b
   time(&t);
   out << "EZD_MAP" << std::endl
       << "! EZD file (c) Neil Voss, 2005" << std::endl
-      << "! Grid spacing: " << GRID << " A, scaled by binning factor: " << binFactor << std::endl
+      << "! Grid spacing: " << ctx.spacing << " A, scaled by binning factor: " << binFactor << std::endl
       << "! Dimensions (X, Y, Z): " << max[0] - min[0] << " x " << max[1] - min[1] << " x " << max[2] - min[2] << " A" << std::endl
-      << "! Water resolution: " << WATER_RES << " A" << std::endl
+      << "! Water resolution: " << ctx.water_res << " A" << std::endl
       << "! Date: " << ctime(&t) << std::endl;
 
   if (binFactor > 1) {
@@ -408,13 +473,13 @@ void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, b
 
   // Write voxel data
   int outcnt = 0;
-  for (int k = start[2]; k <= end[2]; k += binFactor) {
-    for (int j = start[1]; j <= end[1]; j += binFactor) {
-      for (int i = start[0]; i <= end[0]; i += binFactor) {
-        int voxelIndex = i + j * DX + k * DXY;
+  for (unsigned int k = start[2]; k <= end[2]; k += binFactor) {
+    for (unsigned int j = start[1]; j <= end[1]; j += binFactor) {
+      for (unsigned int i = start[0]; i <= end[0]; i += binFactor) {
+        int voxelIndex = i + j * ctx.dx + k * ctx.dxy;
         float value = 0.0f;
         if (blur) {
-          value = computeBlurredValue(grid, voxelIndex);
+          value = computeBlurredValue(ctx, grid, voxelIndex);
         } else if (grid[voxelIndex]) {
           value = 1.0f;
         } else {
@@ -439,24 +504,71 @@ void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, b
   std::cerr << "Done. Wrote file: " << outfile << std::endl;
 }
 
-void write_EZD(const gridpt grid[], const char outfile[]) {
-  write_BinnedEZD(grid, outfile, 1, false);
+void write_EZD(const GridContext& ctx, const gridpt grid[], const char outfile[]) {
+  write_BinnedEZD(ctx, grid, outfile, 1, false);
 }
 
-void write_HalfEZD(const gridpt grid[], const char outfile[]) {
-  write_BinnedEZD(grid, outfile, 2, false);
+void write_HalfEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]) {
+  write_BinnedEZD(ctx, grid, outfile, 2, false);
 }
 
-void write_ThirdEZD(const gridpt grid[], const char outfile[]) {
-  write_BinnedEZD(grid, outfile, 3, false);
+void write_ThirdEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]) {
+  write_BinnedEZD(ctx, grid, outfile, 3, false);
 }
 
-void write_FifthEZD(const gridpt grid[], const char outfile[]) {
-  write_BinnedEZD(grid, outfile, 5, false);
+void write_FifthEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]) {
+  write_BinnedEZD(ctx, grid, outfile, 5, false);
 }
 
 //========================================================
 //========================================================
-void write_BlurEZD (const gridpt grid[], const char outfile[]) {
-  write_BinnedEZD(grid, outfile, 1, true);
+void write_BlurEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]) {
+  write_BinnedEZD(ctx, grid, outfile, 1, true);
 };
+
+/*********************************************
+**********************************************
+      LEGACY GLOBAL-STATE WRAPPERS
+**********************************************
+*********************************************/
+
+std::string format_resolution(long double numerator, int decimals) {
+  return format_resolution(current_grid_context(), numerator, decimals);
+}
+std::string ijk2pdb(int i, int j, int k, int n) {
+  return ijk2pdb(current_grid_context(), i, j, k, n);
+}
+void write_PDB(const gridpt grid[], const char outfile[]) {
+  write_PDB(current_grid_context(), grid, outfile);
+}
+void write_SurfPDB(const gridpt grid[], const char outfile[]) {
+  write_SurfPDB(current_grid_context(), grid, outfile);
+}
+float computeBlurredValue(const gridpt grid[], int voxelIndex) {
+  return computeBlurredValue(current_grid_context(), grid, voxelIndex);
+}
+void report_grid_metrics(std::ostream& out, int voxels, long double surface_area) {
+  report_grid_metrics(current_grid_context(), out, voxels, surface_area);
+}
+void write_output_files(const gridpt grid[],
+                        const vossvolvox::OutputSettings& outputs) {
+  write_output_files(current_grid_context(), grid, outputs);
+}
+void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, bool blur) {
+  write_BinnedEZD(current_grid_context(), grid, outfile, binFactor, blur);
+}
+void write_EZD(const gridpt grid[], const char outfile[]) {
+  write_EZD(current_grid_context(), grid, outfile);
+}
+void write_HalfEZD(const gridpt grid[], const char outfile[]) {
+  write_HalfEZD(current_grid_context(), grid, outfile);
+}
+void write_ThirdEZD(const gridpt grid[], const char outfile[]) {
+  write_ThirdEZD(current_grid_context(), grid, outfile);
+}
+void write_FifthEZD(const gridpt grid[], const char outfile[]) {
+  write_FifthEZD(current_grid_context(), grid, outfile);
+}
+void write_BlurEZD(const gridpt grid[], const char outfile[]) {
+  write_BlurEZD(current_grid_context(), grid, outfile);
+}
@@ -0,0 +1,84 @@
+/*
+** utils-stencil.cpp
+** Sphere stencil cache used by fill_ExcludeGrid, empty_ExcludeGrid and the
+** excluded-volume truncation loops. Tools use one or two probe radii per run,
+** so after the first call every lookup is a hit in the per-thread memo.
+*/
+
+#include <cstring>                    // for memcpy, memset
+#include <memory>                     // for unique_ptr
+#include <mutex>                      // for mutex, lock_guard
+#include <unordered_map>              // for unordered_map
+
+#include "utils-stencil.hpp"
+
+namespace {
+
+std::mutex stencil_mutex;
+std::unordered_map<unsigned int, std::unique_ptr<SphereStencil>> stencil_cache;
+
+inline unsigned int radius_key(const float radius) {
+  unsigned int key;
+  std::memcpy(&key, &radius, sizeof(key));
+  return key;
+}
+
+std::unique_ptr<SphereStencil> build_stencil(const float radius) {
+  std::unique_ptr<SphereStencil> stencil(new SphereStencil);
+  stencil->radius = radius;
+  stencil->reach = int(radius + 1);
+  const float cutoff = radius * radius;
+  const int r = stencil->reach;
+  for (int dk = -r; dk <= r; dk++) {
+    for (int dj = -r; dj <= r; dj++) {
+      // Same integer-to-float comparison as the per-voxel loops it replaces.
+      const int jk = dj * dj + dk * dk;
+      if (!(jk < cutoff)) {
+        continue;
+      }
+      int w = 0;
+      while (w < r && (w + 1) * (w + 1) + jk < cutoff) {
+        w++;
+      }
+      stencil->rows.push_back(StencilRow{dj, dk, -w, w});
+    }
+  }
+  return stencil;
+}
+
+}  // namespace
+
+/*********************************************/
+const SphereStencil& sphere_stencil(const float radius) {
+  thread_local const SphereStencil* last = nullptr;
+  if (last != nullptr && radius_key(last->radius) == radius_key(radius)) {
+    return *last;
+  }
+  std::lock_guard<std::mutex> lock(stencil_mutex);
+  std::unique_ptr<SphereStencil>& slot = stencil_cache[radius_key(radius)];
+  if (!slot) {
+    slot = build_stencil(radius);
+  }
+  last = slot.get();
+  return *last;
+}
+
+/*********************************************/
+void stamp_Stencil(const GridContext& ctx, const SphereStencil& stencil,
+                   const int i, const int j, const int k, const gridpt value,
+                   gridpt grid[]) {
+  for (const StencilRow& row : stencil.rows) {
+    const int jj = j + row.dj;
+    const int kk = k + row.dk;
+    if (jj < 0 || jj >= ctx.dy || kk < 0 || kk >= ctx.dz) {
+      continue;
+    }
+    const int ilo = i + row.di_lo < 0 ? 0 : i + row.di_lo;
+    const int ihi = i + row.di_hi >= ctx.dx ? ctx.dx - 1 : i + row.di_hi;
+    if (ilo > ihi) {
+      continue;
+    }
+    std::memset(grid + ilo + jj * ctx.dx + kk * ctx.dxy, value ? 1 : 0,
+                sizeof(gridpt) * (ihi - ilo + 1));
+  }
+}
@@ -0,0 +1,37 @@
+/*
+** utils-stencil.hpp
+** Cached row-span stencils for spheres centered on a grid point.
+** A stencil lists, for every (dj,dk) row that the sphere touches, the
+** inclusive di range inside it, so filling or clearing a sphere is one
+** contiguous write per row instead of a distance test per voxel.
+*/
+#ifndef UTILS_STENCIL_H
+#define UTILS_STENCIL_H
+
+#include <vector>                     // for vector
+
+#include "utils.hpp"                  // for GridContext, gridpt
+
+struct StencilRow {
+  int dj, dk;          // row offset from the center voxel
+  int di_lo, di_hi;    // inclusive span of di inside the sphere
+};
+
+struct SphereStencil {
+  float radius;        // radius in voxels (probe / spacing)
+  int reach;           // int(radius + 1), the bounding half-width
+  std::vector<StencilRow> rows;
+};
+
+// Stencil of points with di*di+dj*dj+dk*dk < radius*radius. Stencils are
+// built once per distinct radius and shared by all threads; the returned
+// reference stays valid for the life of the process.
+const SphereStencil& sphere_stencil(const float radius);
+
+// Set (value=1) or clear (value=0) the stencil around voxel (i,j,k),
+// clipped to the grid edges.
+void stamp_Stencil(const GridContext& ctx, const SphereStencil& stencil,
+                   const int i, const int j, const int k, const gridpt value,
+                   gridpt grid[]);
+
+#endif // UTILS_STENCIL_H
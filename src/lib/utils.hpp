@@ -93,14 +93,56 @@ struct XYZRBuffer {
   inline int size() const { return static_cast<int>(atoms.size()); }
 };
 
+/*************************************************
+//grid context (in utils-main.cpp)
+**************************************************/
+// Everything that describes one voxel grid: bounds, dimensions, strides,
+// spacing and the probe/derived constants.  Every grid function below has
+// an overload taking the context explicitly; the context-free overloads and
+// the XMIN/DX/NUMBINS/GRID/... globals are a compatibility shim that reads
+// (and for the init functions, writes) one process-wide context.
+struct GridContext {
+  float xmin = 1000, ymin = 1000, zmin = 1000;
+  float xmax = -1000, ymax = -1000, zmax = -1000;
+  int dx = 0, dy = 0, dz = 0;
+  int dxy = 0, dxyz = 0;
+  unsigned int numbins = 0;
+  float spacing = 0.5;
+  float gridvol = 0.125;
+  float maxprobe = 15;
+  float water_res = 14137.2 / 0.125;
+  float cutoff = 10000;
+};
+
+// How trun_ExcludeGrid/grow_ExcludeGrid turn an accessible grid into an
+// excluded one: stamp a probe sphere per boundary voxel, or threshold an
+// exact distance transform (utils-edt.cpp). Both give the same grid; the
+// distance transform costs 4 bytes per voxel but is probe-independent.
+enum class ExcludeEngine { Stamp, DistanceTransform };
+
+GridContext current_grid_context();
+void set_grid_context(const GridContext& ctx);
+GridContext make_grid_context(float spacing, float maxprobe);
+
 //init functions
+void initGridState(GridContext& ctx, float maxprobe);
 void initGridState(float maxprobe);
 void finalGridDims(float maxprobe);
+float getIdealGrid(const GridContext& ctx);
 float getIdealGrid ();
+void assignLimits(GridContext& ctx);
 void assignLimits ();
+void testLimits(const GridContext& ctx, gridpt grid[]);
 void testLimits (gridpt grid[]);
 
 //grid util functions
+int countGrid(const GridContext& ctx, const gridpt grid[]);
+void zeroGrid(const GridContext& ctx, gridpt grid[]);
+int copyGridFromTo(const GridContext& ctx, const gridpt oldgrid[], gridpt newgrid[]);
+int copyGrid(const GridContext& ctx, const gridpt oldgrid[], gridpt newgrid[]);
+void inverseGrid(const GridContext& ctx, gridpt grid[]);
+int first_filled_point(const GridContext& ctx, const gridpt grid[]);
+int last_filled_point(const GridContext& ctx, const gridpt grid[]);
 int countGrid (const gridpt grid[]);
 void zeroGrid (gridpt grid[]);
 int copyGridFromTo (const gridpt oldgrid[], gridpt newgrid[]);
@@ -110,21 +152,58 @@ int first_filled_point(const gridpt grid[]);
 int last_filled_point(const gridpt grid[]);
 
 //file based functions
+int read_NumAtoms(GridContext& ctx, char file[]);
+int read_NumAtoms_from_array(GridContext& ctx, const XYZRBuffer& buffer);
+int fill_AccessGrid_fromFile(const GridContext& ctx, int numatoms, const float probe,
+	char file[], gridpt grid[]);
+int fill_AccessGrid_fromArray(const GridContext& ctx, int numatoms, const float probe,
+	const XYZRBuffer& buffer, gridpt grid[]);
+int fill_SurfaceDistance_fromArray(const GridContext& ctx, int numatoms, const float maxprobe,
+	const XYZRBuffer& buffer, float field[]);
+int threshold_AccessGrid(const GridContext& ctx, const float field[], const float probe, gridpt grid[]);
+int get_ExcludeGrid_fromFile(const GridContext& ctx, int numatoms, const float probe,
+	char file[], gridpt EXCgrid[]);
+int get_ExcludeGrid_fromArray(const GridContext& ctx, int numatoms, const float probe,
+	const XYZRBuffer& buffer, gridpt EXCgrid[]);
+int get_ExcludeGrid_fromArray(const GridContext& ctx, ExcludeEngine engine, int numatoms,
+	const float probe, const XYZRBuffer& buffer, gridpt EXCgrid[]);
 int read_NumAtoms (char file[]);
 int read_NumAtoms_from_array (const XYZRBuffer& buffer);
 int fill_AccessGrid_fromFile (int numatoms, const float probe, char file[], gridpt grid[]);
 int fill_AccessGrid_fromArray (int numatoms, const float probe,
 	const XYZRBuffer& buffer, gridpt grid[]);
+int fill_SurfaceDistance_fromArray (int numatoms, const float maxprobe,
+	const XYZRBuffer& buffer, float field[]);
+int threshold_AccessGrid (const float field[], const float probe, gridpt grid[]);
 int get_ExcludeGrid_fromFile (int numatoms, const float probe, char file[], gridpt EXCgrid[]);
 int get_ExcludeGrid_fromArray (int numatoms, const float probe,
 	const XYZRBuffer& buffer, gridpt EXCgrid[]);
+int get_ExcludeGrid_fromArray (ExcludeEngine engine, int numatoms, const float probe,
+	const XYZRBuffer& buffer, gridpt EXCgrid[]);
 
 //generate grids / grid changers
 //void expand (gridpt oldgrid[], gridpt newgrid[]);
 //void contract (gridpt oldgrid[], gridpt newgrid[]);
+void trun_ExcludeGrid(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+void trun_ExcludeGrid_fast(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+void grow_ExcludeGrid(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+void trun_ExcludeGrid_edt(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+void grow_ExcludeGrid_edt(const GridContext& ctx, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+void trun_ExcludeGrid(const GridContext& ctx, ExcludeEngine engine, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+void grow_ExcludeGrid(const GridContext& ctx, ExcludeEngine engine, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+float *get_Point(const GridContext& ctx, gridpt grid[]);
+int get_GridPoint(const GridContext& ctx, gridpt grid[]);
+int get_Connected(const GridContext& ctx, gridpt grid[], gridpt connect[], const float x, const float y, const float z);
+int get_ConnectedRange(const GridContext& ctx, gridpt grid[], gridpt connect[], const float x, const float y, const float z);
+int get_Connected_Point(const GridContext& ctx, gridpt grid[], gridpt connect[], const int gp);
+int subt_Grids(const GridContext& ctx, gridpt biggrid[], gridpt smgrid[]);
+int intersect_Grids(const GridContext& ctx, gridpt grid1[], gridpt grid2[]);
+int merge_Grids(const GridContext& ctx, gridpt grid1[], gridpt grid2[]);
 void trun_ExcludeGrid (const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]); //contract
 void trun_ExcludeGrid_fast (const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]); //contract
 void grow_ExcludeGrid (const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]); //expands
+void trun_ExcludeGrid (ExcludeEngine engine, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
+void grow_ExcludeGrid (ExcludeEngine engine, const float probe, const gridpt ACCgrid[], gridpt EXCgrid[]);
 float *get_Point (gridpt grid[]);
 int get_GridPoint (gridpt grid[]);
 int get_Connected (gridpt grid[], gridpt connect[], const float x, const float y, const float z);
@@ -135,27 +214,44 @@ int intersect_Grids (gridpt grid1[], gridpt grid2[]); //Modifies grid1; returns
 int merge_Grids (gridpt grid1[], gridpt grid2[]); //Modifies grid1; returns final vox num
 
 //point based function
+int fill_AccessGrid(const GridContext& ctx, const float x, const float y, const float z, const float r, gridpt grid[]);
+void empty_ExcludeGrid(const GridContext& ctx, const int i, const int j, const int k, const float probe, gridpt grid[]);
+void empty_ExcludeGrid_fast(const GridContext& ctx, const int pt, const std::vector<int> &offsets, gridpt grid[]);
+void fill_ExcludeGrid(const GridContext& ctx, const int i, const int j, const int k, const float probe, gridpt grid[]);
 int fill_AccessGrid (const float x, const float y, const float z, const float r, gridpt grid[]);
 void empty_ExcludeGrid (const int i, const int j, const int k, const float probe, gridpt grid[]);
 void empty_ExcludeGrid_fast(const int pt, const std::vector<int> &offsets, gridpt grid[]);
 void fill_ExcludeGrid (const int i, const int j, const int k, const float probe, gridpt grid[]);
 //void generateOffsets(int radius);
 
+int ijk2pt(const GridContext& ctx, const int i, const int j, const int k);
+void pt2ijk(const GridContext& ctx, const int pt, int &i, int &j, int &k);
+void pt2xyz(const GridContext& ctx, const int pt, float &x, float &y, float &z);
+int xyz2pt(const GridContext& ctx, const float x, const float y, const float z);
 int ijk2pt(const int i, const int j, const int k);
 void pt2ijk(const int pt, int &i, int &j, int &k);
 void pt2xyz(const int pt, float &x, float &y, float &z);
 int xyz2pt(const float x, const float y, const float z);
 
+bool hasFilledNeighbor(const GridContext& ctx, const int pt, const gridpt grid[]);
+bool hasEmptyNeighbor(const GridContext& ctx, const int pt, const gridpt grid[]);
+bool hasEmptyNeighbor_Fill(const GridContext& ctx, const int pt, const gridpt grid[]);
 bool hasFilledNeighbor (const int pt, const gridpt grid[]);
 bool hasEmptyNeighbor (const int pt, const gridpt grid[]);
 bool hasEmptyNeighbor_Fill (const int pt, const gridpt grid[]);
 //void expand_Point (const int pt, gridpt grid[]);
 //void contract_Point (const int pt, gridpt grid[]);
 
+bool isContainedPoint(const GridContext& ctx, const int pt, gridpt ingrid[], gridpt outgrid[], int minmax[]);
+bool isNearEdgePoint(const GridContext& ctx, const int pt, gridpt ingrid[], gridpt outgrid[]);
 bool isContainedPoint (const int pt, gridpt ingrid[], gridpt outgrid[], int minmax[]);
 bool isNearEdgePoint (const int pt, gridpt ingrid[], gridpt outgrid[]);
 
 //special
+bool isCloseToVector(const GridContext& ctx, const float radius, const int pt);
+void limitToTunnelArea(const GridContext& ctx, const float radius, gridpt grid[]);
+float crossSection(const GridContext& ctx, const real p, const vector v, const gridpt grid[]);
+float crossSection(const GridContext& ctx, const gridpt grid[]);
 bool isCloseToVector (const float radius, const int pt);
 void limitToTunnelArea(const float radius, gridpt grid[]);
 float distFromPt (const float x, const float y, const float z);
@@ -167,11 +263,16 @@ void real2index (const real p, ind i);
 void padLeft(char a[], int n);
 void padRight(char a[], int n);
 void printBar ();
+void printVol(const GridContext& ctx, int vox);
+void printVolCout(const GridContext& ctx, int vox);
 void printVol (int vox);
 void printVolCout (int vox);
 void basename(char str[], char base[]);
 
 //surface area
+int countEdgePoints(const GridContext& ctx, gridpt grid[]);
+float surface_area(const GridContext& ctx, gridpt grid[]);
+int classifyEdgePoint(const GridContext& ctx, const int pt, gridpt grid[]);
 int countEdgePoints (gridpt grid[]);
 float surface_area (gridpt grid[]);
 int classifyEdgePoint (const int pt, gridpt grid[]);
@@ -179,6 +280,10 @@ int classifyEdgePoint (const int pt, gridpt grid[]);
 //other ideas
 //int convex_hull(gridpt grid[], gridpt hull[]);
 //int convex_hull(int numatoms, char file[], gridpt hull[]);
+void determine_MinMax(const GridContext& ctx, const gridpt grid[], int minmax[]);
+int bounding_box(const GridContext& ctx, gridpt grid[], gridpt bbox[]);
+int fill_cavities(const GridContext& ctx, gridpt grid[]);
+int makerbot_fill(const GridContext& ctx, gridpt ingrid[], gridpt outgrid[]);
 void determine_MinMax(const gridpt grid[], int minmax[]);
 int bounding_box(gridpt grid[], gridpt bbox[]);
 //int bounding_box(int numatoms, char file[], gridpt bbox[]);
@@ -189,16 +294,28 @@ int makerbot_fill(gridpt ingrid[], gridpt outgrid[]);
 //output functions (in utils-output.cpp)
 **************************************************/
 //void ijk2pdb (char line[], int i, int j, int k, int n);
+std::string ijk2pdb(const GridContext& ctx, int i, int j, int k, int n);
 std::string ijk2pdb(int i, int j, int k, int n);
 //output PDB functions (in utils-output.cpp)
 namespace vossvolvox {
 struct OutputSettings;
 }
+void write_PDB(const GridContext& ctx, const gridpt grid[], const char outfile[]);
+void write_SurfPDB(const GridContext& ctx, const gridpt grid[], const char outfile[]);
 void write_PDB (const gridpt grid[], const char outfile[]);
 void write_SurfPDB (const gridpt grid[], const char outfile[]);
+std::string format_resolution(const GridContext& ctx, long double numerator, int decimals = 3);
 std::string format_resolution(long double numerator, int decimals = 3);
+void report_grid_metrics(const GridContext& ctx, std::ostream& out, int voxels, long double surface_area);
 void report_grid_metrics(std::ostream& out, int voxels, long double surface_area);
 //output EZD functions (in utils-output.cpp)
+float computeBlurredValue(const GridContext& ctx, const gridpt grid[], int voxelIndex);
+void write_BinnedEZD(const GridContext& ctx, const gridpt grid[], const char outfile[], int binFactor, bool blur);
+void write_EZD(const GridContext& ctx, const gridpt grid[], const char outfile[]);
+void write_HalfEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]);
+void write_ThirdEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]);
+void write_FifthEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]);
+void write_BlurEZD(const GridContext& ctx, const gridpt grid[], const char outfile[]);
 float computeBlurredValue(const gridpt grid[], int voxelIndex);
 void write_BinnedEZD(const gridpt grid[], const char outfile[], int binFactor, bool blur);
 void write_EZD (const gridpt grid[], const char outfile[]);
@@ -210,13 +327,55 @@ void write_BlurEZD (const gridpt grid[], const char outfile[]);
 /*************************************************
 //output functions (in utils-mrc.cpp)
 **************************************************/
+// Voxel encoding for map output. The default is one byte per voxel (mode 0);
+// packed4 stores two voxels per byte (IMOD mode 101) and gzip compresses the
+// whole file, header included.
+struct MapEncoding {
+  bool packed4 = false;
+  bool gzip = false;
+};
+int writeMRCFile(const GridContext& ctx, const gridpt data[], const char filename[],
+                 const MapEncoding& encoding = MapEncoding());
+int writeSmallMRCFile(const GridContext& ctx, const gridpt data[], const char filename[],
+                      const MapEncoding& encoding = MapEncoding());
+int writeCCP4File(const GridContext& ctx, const gridpt data[], const char filename[],
+                  const MapEncoding& encoding = MapEncoding());
+int writeSmallCCP4File(const GridContext& ctx, const gridpt data[], const char filename[],
+                       const MapEncoding& encoding = MapEncoding());
+void write_output_files(const GridContext& ctx, const gridpt grid[],
+                        const vossvolvox::OutputSettings& outputs);
 int writeMRCFile(const gridpt data[], const char filename[] );
 int writeSmallMRCFile(const gridpt data[], const char filename[] );
 int writeCCP4File(const gridpt data[], const char filename[] );
 int writeSmallCCP4File(const gridpt data[], const char filename[] );
+// Map input (also utils-mrc.cpp). readMRCFile samples an MRC or CCP4 map
+// (modes 0, 1, 2 or 101, plain or gzipped) at every voxel of the grid
+// (nearest map voxel, by real-space position) and sets voxels whose value
+// is above threshold; voxels outside the map stay empty. Returns the voxel count, or -1 on error. readMRCGridContext builds
+// a context whose grid is the map's own voxel lattice. readMRCFileOnGrid also
+// returns -1 when the map is not on ctx's lattice.
+int readMRCFile(const GridContext& ctx, const char filename[], const float threshold, gridpt data[]);
+int readMRCFileOnGrid(const GridContext& ctx, const char filename[], const float threshold, gridpt data[]);
+int readMRCFile(const char filename[], const float threshold, gridpt data[]);
+int readMRCGridContext(const char filename[], GridContext& ctx);
 void write_output_files(const gridpt grid[],
                         const vossvolvox::OutputSettings& outputs);
+std::unique_ptr<gridpt[]> make_zeroed_grid(const GridContext& ctx);
+std::unique_ptr<gridpt[]> make_grid(const GridContext& ctx);
 std::unique_ptr<gridpt[]> make_zeroed_grid();
 std::unique_ptr<gridpt[]> make_grid();
 
+// Grid storage kept across the structures of a batch run. zeroed() returns
+// ctx.numbins zeroed voxels and only reallocates when the previous
+// allocation is smaller, so the pages stay mapped from one input to the next.
+class GridBuffer {
+ public:
+  gridpt* zeroed(const GridContext& ctx);
+  gridpt* get() const { return data_.get(); }
+
+ private:
+  std::unique_ptr<gridpt[]> data_;
+  unsigned int capacity_ = 0;
+};
+
 #endif // UTILS_H
@@ -0,0 +1,108 @@
+#pragma once
+
+/*
+** vossvolvox.h
+** C interface of libvossvolvox, for embedding the grid analyses in other
+** programs (Python through ctypes or cffi, R, Julia, ...) without writing
+** structure or map files.
+**
+** A context holds the atoms, the grid spacing and the grid of the last
+** operation. An operation grids the atoms for its probes, fills the result
+** grid, and keeps its volume; the surface area is computed on first request.
+** vv_grid_data() lends out the result grid itself, one byte (0 or 1) per
+** voxel with x varying fastest, so a caller can wrap it without a copy:
+**
+**   numpy.ctypeslib.as_array(ptr, shape=(nz, ny, nx))
+**
+** Calls on one context are serialized by that context's lock; separate
+** contexts may be used from separate threads at once. Functions returning
+** int give VV_OK or a negative VV_E* code; vv_last_error() describes the
+** failure. A grid spacing too fine for the atoms' extent (more than
+** 2^31 - 1 voxels) gives VV_EINVAL; a failed grid allocation gives
+** VV_EINTERNAL. Progress messages of the grid code go to the process's
+** stderr, as with the tools.
+**
+** Only what is declared here is exported, and it changes only together
+** with VV_API_VERSION.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define VV_API __attribute__((visibility("default")))
+#else
+#define VV_API
+#endif
+
+#define VV_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct vv_context vv_context;
+
+enum {
+  VV_OK = 0,
+  VV_EINVAL = -1,     /* bad argument */
+  VV_ENOATOMS = -2,   /* fewer than 3 atoms with a radius in (0, 100) */
+  VV_EIO = -3,        /* structure file missing or unreadable */
+  VV_ENOGRID = -4,    /* no operation has run on this context yet */
+  VV_EINTERNAL = -5   /* unexpected failure inside the library */
+};
+
+/* VV_API_VERSION of the loaded library. */
+VV_API int vv_api_version(void);
+
+/* New context with the given grid spacing in Angstroms; NULL when the
+   spacing is not positive. */
+VV_API vv_context* vv_context_create(float grid_spacing);
+VV_API void vv_context_destroy(vv_context* ctx);
+
+/* Message for the last failed call on ctx, "" after a success. */
+VV_API const char* vv_last_error(const vv_context* ctx);
+
+/* Atoms from count rows of x, y, z, radius (a C-contiguous float32 array of
+   shape (count, 4)). The values are copied; the array stays the caller's. */
+VV_API int vv_set_atoms(vv_context* ctx, const float* xyzr, size_t count);
+
+/* Atoms converted from an XYZR, PDB, mmCIF or PDBML file with the default
+   radii and filters of the command-line tools. */
+VV_API int vv_load_structure(vv_context* ctx, const char* path);
+
+VV_API size_t vv_atom_count(const vv_context* ctx);
+
+/* Solvent-excluded volume for a probe radius (Volume.exe). */
+VV_API int vv_excluded(vv_context* ctx, float probe);
+
+/* Solvent-accessible volume: atoms grown by the probe radius. */
+VV_API int vv_accessible(vv_context* ctx, float probe);
+
+/* Cavities enclosed by the probe's excluded surface inside the shell of the
+   larger shell probe, as the second method of Cavities.exe. */
+VV_API int vv_cavities(vv_context* ctx, float probe, float shell_probe);
+
+/* The channel through point (x, y, z) between the small and the trimmed big
+   probe surfaces, as Channel.exe. */
+VV_API int vv_channel(vv_context* ctx, float big_probe, float small_probe, float trim_probe,
+                      float x, float y, float z);
+
+/* Results of the last operation; negative when none has run. */
+VV_API int64_t vv_voxel_count(const vv_context* ctx);
+VV_API double vv_volume(const vv_context* ctx);
+VV_API double vv_surface_area(vv_context* ctx);
+
+/* Shape of the result grid as dims = {nx, ny, nz}, the coordinates of
+   voxel (0, 0, 0) and the spacing. Voxel (i, j, k) is at
+   origin + spacing * (i, j, k) and at offset i + nx * (j + ny * k). */
+VV_API int vv_grid_shape(const vv_context* ctx, size_t dims[3], float origin[3], float* spacing);
+
+/* The result grid, nx * ny * nz bytes (stored in *count when count is not
+   NULL). Borrowed: valid until the next operation on ctx or its
+   destruction. NULL when no operation has run. */
+VV_API const uint8_t* vv_grid_data(const vv_context* ctx, size_t* count);
+
+#ifdef __cplusplus
+}
+#endif
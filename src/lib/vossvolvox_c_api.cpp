@@ -0,0 +1,307 @@
+/*
+** vossvolvox_c_api.cpp
+** The C interface of libvossvolvox (vossvolvox.h). Each operation builds the
+** grid context its probes need and composes the same grid steps as the
+** matching tool, passing that context to every step.
+*/
+
+#include <cstdint>                    // for int64_t, uint8_t
+#include <exception>                  // for exception
+#include <stdexcept>                  // for length_error
+#include <initializer_list>           // for initializer_list
+#include <mutex>                      // for mutex, lock_guard
+#include <string>                     // for string
+#include <vector>                     // for vector
+
+#include "pdb_io.hpp"
+#include "utils.hpp"
+#include "vossvolvox.h"
+#include "xyzr_cli_helpers.hpp"
+
+static_assert(sizeof(gridpt) == 1, "vv_grid_data hands out gridpt as one byte per voxel");
+static_assert(sizeof(XYZRAtom) == 4 * sizeof(float), "vv_set_atoms reads rows of four floats");
+
+struct vv_context {
+  mutable std::mutex lock;            // held for the length of each call on this context
+  float spacing = 0.5;
+  XYZRBuffer atoms;
+  GridBuffer grid;
+  GridContext grid_ctx;
+  bool has_grid = false;
+  int64_t voxels = -1;
+  double surface = -1;
+  std::string error;
+};
+
+namespace {
+
+int fail(vv_context* ctx, int code, const std::string& message) {
+  ctx->error = message;
+  return code;
+}
+
+// read_NumAtoms_from_array throws on fewer than 3 usable atoms; this check
+// gives the caller VV_ENOATOMS instead
+bool enough_atoms(const XYZRBuffer& atoms) {
+  int valid = 0;
+  for (const auto& atom : atoms.atoms) {
+    valid += (atom.r > 0 && atom.r < 100) ? 1 : 0;
+  }
+  return valid >= 3;
+}
+
+// Sizes the grid for max_probe and zeroes the result grid. Returns the
+// number of atoms gridded.
+int start_operation(vv_context* ctx, float max_probe) {
+  const std::vector<const XYZRBuffer*> buffers = {&ctx->atoms};
+  const auto prepared = vossvolvox::build_grid_context_from_xyzr(buffers, ctx->spacing, max_probe);
+  ctx->grid_ctx = prepared.context;
+  ctx->grid.zeroed(ctx->grid_ctx);
+  ctx->has_grid = true;
+  ctx->voxels = -1;
+  ctx->surface = -1;
+  return prepared.total_atoms;
+}
+
+// Checks the context and probes, runs one operation on a fresh grid sized for
+// max_probe, and records its voxel count. A spacing too fine for the atoms
+// (assignLimits throws length_error before anything is allocated) is
+// VV_EINVAL; other exceptions, std::bad_alloc included, are VV_EINTERNAL.
+template <typename Operation>
+int run_operation(vv_context* ctx, std::initializer_list<float> probes, Operation operation) {
+  if (ctx == nullptr) {
+    return VV_EINVAL;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  float max_probe = 0;
+  for (const float probe : probes) {
+    if (!(probe >= 0)) {
+      return fail(ctx, VV_EINVAL, "probe radii must not be negative");
+    }
+    max_probe = probe > max_probe ? probe : max_probe;
+  }
+  if (!enough_atoms(ctx->atoms)) {
+    return fail(ctx, VV_ENOATOMS, "fewer than 3 atoms with a usable radius");
+  }
+  try {
+    const int numatoms = start_operation(ctx, max_probe);
+    ctx->voxels = operation(ctx->grid_ctx, numatoms, ctx->grid.get());
+  } catch (const std::length_error& error) {
+    ctx->has_grid = false;
+    return fail(ctx, VV_EINVAL, error.what());
+  } catch (const std::exception& error) {
+    ctx->has_grid = false;
+    return fail(ctx, VV_EINTERNAL, error.what());
+  }
+  ctx->error.clear();
+  return VV_OK;
+}
+
+}  // namespace
+
+extern "C" {
+
+int vv_api_version(void) {
+  return VV_API_VERSION;
+}
+
+vv_context* vv_context_create(float grid_spacing) {
+  if (!(grid_spacing > 0)) {
+    return nullptr;
+  }
+  vv_context* ctx = new vv_context;
+  ctx->spacing = grid_spacing;
+  return ctx;
+}
+
+void vv_context_destroy(vv_context* ctx) {
+  delete ctx;
+}
+
+const char* vv_last_error(const vv_context* ctx) {
+  return ctx != nullptr ? ctx->error.c_str() : "no context";
+}
+
+int vv_set_atoms(vv_context* ctx, const float* xyzr, size_t count) {
+  if (ctx == nullptr || (xyzr == nullptr && count > 0)) {
+    return VV_EINVAL;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  const XYZRAtom* rows = reinterpret_cast<const XYZRAtom*>(xyzr);
+  ctx->atoms.atoms.assign(rows, rows + count);
+  ctx->error.clear();
+  return VV_OK;
+}
+
+int vv_load_structure(vv_context* ctx, const char* path) {
+  if (ctx == nullptr || path == nullptr) {
+    return VV_EINVAL;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  try {
+    if (!vossvolvox::load_xyzr_or_exit(path, vossvolvox::pdbio::ConversionOptions(), ctx->atoms)) {
+      return fail(ctx, VV_EIO, std::string("unable to load '") + path + "'");
+    }
+  } catch (const std::exception& error) {
+    ctx->atoms.atoms.clear();
+    return fail(ctx, VV_EIO, error.what());
+  }
+  ctx->error.clear();
+  return VV_OK;
+}
+
+size_t vv_atom_count(const vv_context* ctx) {
+  if (ctx == nullptr) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  return ctx->atoms.atoms.size();
+}
+
+int vv_excluded(vv_context* ctx, float probe) {
+  return run_operation(ctx, {probe}, [&](const GridContext& grid_ctx, int numatoms, gridpt grid[]) {
+    return get_ExcludeGrid_fromArray(grid_ctx, numatoms, probe, ctx->atoms, grid);
+  });
+}
+
+int vv_accessible(vv_context* ctx, float probe) {
+  return run_operation(ctx, {probe}, [&](const GridContext& grid_ctx, int numatoms, gridpt grid[]) {
+    return fill_AccessGrid_fromArray(grid_ctx, numatoms, probe, ctx->atoms, grid);
+  });
+}
+
+int vv_cavities(vv_context* ctx, float probe, float shell_probe) {
+  // Cavities.exe sizes its grid for twice the shell probe
+  return run_operation(ctx, {probe, 2 * shell_probe},
+                       [&](const GridContext& grid_ctx, int numatoms, gridpt grid[]) {
+    // shell: the shell probe's accessible volume, cavities filled, then excluded
+    auto shellACC = make_zeroed_grid(grid_ctx);
+    fill_AccessGrid_fromArray(grid_ctx, numatoms, shell_probe, ctx->atoms, shellACC.get());
+    fill_cavities(grid_ctx, shellACC.get());
+    trun_ExcludeGrid(grid_ctx, shell_probe, shellACC.get(), grid);
+    shellACC.reset();
+
+    // empty space inside the shell
+    auto exclude = make_zeroed_grid(grid_ctx);
+    get_ExcludeGrid_fromArray(grid_ctx, numatoms, probe, ctx->atoms, exclude.get());
+    subt_Grids(grid_ctx, grid, exclude.get());
+    exclude.reset();
+
+    // less the channels reaching the first and last empty voxels
+    auto channels = make_zeroed_grid(grid_ctx);
+    get_Connected_Point(grid_ctx, grid, channels.get(), first_filled_point(grid_ctx, grid));
+    get_Connected_Point(grid_ctx, grid, channels.get(), last_filled_point(grid_ctx, grid));
+    subt_Grids(grid_ctx, grid, channels.get());
+    return countGrid(grid_ctx, grid);
+  });
+}
+
+int vv_channel(vv_context* ctx, float big_probe, float small_probe, float trim_probe,
+               float x, float y, float z) {
+  if (ctx != nullptr && !(big_probe > 0)) {
+    std::lock_guard<std::mutex> call(ctx->lock);
+    return fail(ctx, VV_EINVAL, "the big probe radius must be positive");
+  }
+  return run_operation(ctx, {big_probe, small_probe, trim_probe},
+                       [&](const GridContext& grid_ctx, int numatoms, gridpt grid[]) {
+    // big probe surface, trimmed
+    auto trimgrid = make_zeroed_grid(grid_ctx);
+    {
+      auto biggrid = make_zeroed_grid(grid_ctx);
+      get_ExcludeGrid_fromArray(grid_ctx, numatoms, big_probe, ctx->atoms, biggrid.get());
+      trun_ExcludeGrid(grid_ctx, trim_probe, biggrid.get(), trimgrid.get());
+    }
+
+    // solvent between it and the small probe's accessible surface
+    auto solventACC = make_zeroed_grid(grid_ctx);
+    {
+      auto smgrid = make_zeroed_grid(grid_ctx);
+      fill_AccessGrid_fromArray(grid_ctx, numatoms, small_probe, ctx->atoms, smgrid.get());
+      copyGrid(grid_ctx, trimgrid.get(), solventACC.get());
+      subt_Grids(grid_ctx, solventACC.get(), smgrid.get());
+    }
+
+    // the channel through the point, grown back to the contact surface
+    auto channelACC = make_zeroed_grid(grid_ctx);
+    get_Connected(grid_ctx, solventACC.get(), channelACC.get(), x, y, z);
+    solventACC.reset();
+    grow_ExcludeGrid(grid_ctx, small_probe, channelACC.get(), grid);
+    return intersect_Grids(grid_ctx, grid, trimgrid.get());
+  });
+}
+
+int64_t vv_voxel_count(const vv_context* ctx) {
+  if (ctx == nullptr) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  return ctx->has_grid ? ctx->voxels : -1;
+}
+
+double vv_volume(const vv_context* ctx) {
+  if (ctx == nullptr) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  return ctx->has_grid ? double(ctx->voxels) * ctx->grid_ctx.gridvol : -1;
+}
+
+double vv_surface_area(vv_context* ctx) {
+  if (ctx == nullptr) {
+    return -1;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  if (!ctx->has_grid) {
+    return -1;
+  }
+  if (ctx->surface < 0) {
+    try {
+      ctx->surface = surface_area(ctx->grid_ctx, ctx->grid.get());
+    } catch (const std::exception& error) {
+      fail(ctx, VV_EINTERNAL, error.what());
+      return -1;
+    }
+  }
+  return ctx->surface;
+}
+
+int vv_grid_shape(const vv_context* ctx, size_t dims[3], float origin[3], float* spacing) {
+  if (ctx == nullptr) {
+    return VV_EINVAL;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  if (!ctx->has_grid) {
+    return VV_ENOGRID;
+  }
+  if (dims != nullptr) {
+    dims[0] = ctx->grid_ctx.dx;
+    dims[1] = ctx->grid_ctx.dy;
+    dims[2] = ctx->grid_ctx.dz;
+  }
+  if (origin != nullptr) {
+    origin[0] = ctx->grid_ctx.xmin;
+    origin[1] = ctx->grid_ctx.ymin;
+    origin[2] = ctx->grid_ctx.zmin;
+  }
+  if (spacing != nullptr) {
+    *spacing = ctx->grid_ctx.spacing;
+  }
+  return VV_OK;
+}
+
+const uint8_t* vv_grid_data(const vv_context* ctx, size_t* count) {
+  if (ctx == nullptr) {
+    if (count != nullptr) {
+      *count = 0;
+    }
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> call(ctx->lock);
+  const bool ready = ctx->has_grid;
+  if (count != nullptr) {
+    *count = ready ? size_t(ctx->grid_ctx.dxyz) : 0;
+  }
+  return ready ? reinterpret_cast<const uint8_t*>(ctx->grid.get()) : nullptr;
+}
+
+}  // extern "C"
@@ -1,9 +1,13 @@
 #include "vossvolvox_cli_common.hpp"
 
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <exception>
 #include <iostream>
 
+#include <sys/stat.h>
+
 namespace {
 
 bool g_debug_enabled = false;
@@ -39,8 +43,28 @@ void add_filter_options(ArgumentParser& parser, FilterSettings& filters) {
                         filters.exclude_amino);
 }
 
+void add_cache_option(ArgumentParser& parser, FilterSettings& filters) {
+  parser.add_option("",
+                    "--xyzr-cache",
+                    filters.xyzr_cache,
+                    std::string(),
+                    "Keep converted structures in this directory as binary XYZR, keyed by "
+                    "file content and filter settings, and reuse them on later runs.",
+                    "<directory>");
+}
+
 void add_output_options(ArgumentParser& parser, OutputSettings& outputs) {
   add_output_file_options(parser, outputs.pdbFile, outputs.ezdFile, outputs.mrcFile, outputs.ccp4File);
+  parser.add_flag("",
+                  "--map-4bit",
+                  outputs.map_4bit,
+                  false,
+                  "Write MRC/CCP4 voxels packed two per byte (mode 101, read by IMOD and ChimeraX).");
+  parser.add_flag("",
+                  "--map-gzip",
+                  outputs.map_gzip,
+                  false,
+                  "Gzip MRC/CCP4 output, adding .gz to the name if missing (also enabled by a .gz file name).");
 }
 
 pdbio::ConversionOptions make_conversion_options(const FilterSettings& filters) {
@@ -63,6 +87,7 @@ pdbio::ConversionOptions make_conversion_options(const FilterSettings& filters)
   options.filters.exclude_water = filters.exclude_water;
   options.filters.exclude_nucleic_acids = filters.exclude_nucleic;
   options.filters.exclude_amino_acids = filters.exclude_amino;
+  options.cache_dir = filters.xyzr_cache;
   if (debug_enabled()) {
     std::cerr << "Debug: conversion_options"
               << " use_united=" << (options.use_united ? "true" : "false")
@@ -72,11 +97,137 @@ pdbio::ConversionOptions make_conversion_options(const FilterSettings& filters)
               << " exclude_water=" << (options.filters.exclude_water ? "true" : "false")
               << " exclude_nucleic=" << (options.filters.exclude_nucleic_acids ? "true" : "false")
               << " exclude_amino=" << (options.filters.exclude_amino_acids ? "true" : "false")
+              << " cache_dir=" << (options.cache_dir.empty() ? "<none>" : options.cache_dir)
               << std::endl;
   }
   return options;
 }
 
+void add_engine_option(ArgumentParser& parser, EngineSettings& engine) {
+  parser.add_option("",
+                    "--exclude-engine",
+                    engine.exclude_engine,
+                    std::string("stamp"),
+                    "Excluded-volume engine: 'stamp' (probe spheres) or 'edt' "
+                    "(distance transform; same result, time independent of probe size).",
+                    "<stamp|edt>");
+}
+
+void add_trim_map_options(ArgumentParser& parser, TrimMapSettings& trim) {
+  parser.add_option("",
+                    "--trim-map",
+                    trim.load_path,
+                    std::string(),
+                    "Read the trimmed big-probe shell from this MRC/CCP4 map instead of "
+                    "computing it.",
+                    "<map file>");
+  parser.add_option("",
+                    "--trim-map-threshold",
+                    trim.threshold,
+                    0.5,
+                    "Map values above this are inside the shell (default 0.5).",
+                    "<value>");
+  parser.add_option("",
+                    "--save-trim-map",
+                    trim.save_path,
+                    std::string(),
+                    "Write the trimmed big-probe shell to this MRC file for --trim-map.",
+                    "<MRC file>");
+}
+
+void add_checkpoint_option(ArgumentParser& parser, CheckpointSettings& checkpoint) {
+  parser.add_option("",
+                    "--checkpoint-dir",
+                    checkpoint.dir,
+                    std::string(),
+                    "Save intermediate grids in this directory and reload them on later "
+                    "runs with the same input, grid, and stage parameters.",
+                    "<directory>");
+}
+
+void add_frame_options(ArgumentParser& parser, FrameSettings& frames) {
+  parser.add_flag("",
+                  "--models",
+                  frames.models,
+                  false,
+                  "Treat each MODEL/ENDMDL block of the input PDB as a frame and print one "
+                  "result row per frame.");
+  parser.add_option("",
+                    "--trajectory",
+                    frames.trajectory,
+                    std::string(),
+                    "Print one result row per frame of this DCD trajectory; radii come from "
+                    "the input structure.",
+                    "<DCD file>");
+}
+
+void add_batch_options(ArgumentParser& parser, BatchSettings& batch) {
+  parser.add_option("",
+                    "--jobs",
+                    batch.jobs,
+                    1,
+                    "Structures of an -i @list run analyzed at once (0 = one per core).",
+                    "<count>");
+  parser.add_option("",
+                    "--memory-budget",
+                    batch.memory_mb,
+                    0.0,
+                    "Memory in MB for the grids of concurrent --jobs (default half of RAM).",
+                    "<MB>");
+}
+
+void add_server_option(ArgumentParser& parser, ServerSettings& server) {
+  parser.add_option("",
+                    "--serve",
+                    server.socket_path,
+                    std::string(),
+                    "Serve JSON-lines requests on this Unix socket instead of analyzing -i; "
+                    "the other options become request defaults.",
+                    "<socket>");
+}
+
+bool frames_requested(const FrameSettings& frames) {
+  return frames.models || !frames.trajectory.empty();
+}
+
+OutputSettings drop_grid_outputs(const OutputSettings& outputs, const std::string& items) {
+  if (!outputs.pdbFile.empty() || !outputs.ezdFile.empty() || !outputs.mrcFile.empty() ||
+      !outputs.ccp4File.empty()) {
+    std::cerr << "Note: grid output files are not written for " << items << std::endl;
+  }
+  OutputSettings dropped = outputs;
+  dropped.pdbFile.clear();
+  dropped.ezdFile.clear();
+  dropped.mrcFile.clear();
+  dropped.ccp4File.clear();
+  return dropped;
+}
+
+std::string checkpoint_path(const CheckpointSettings& checkpoint, const std::string& stage,
+                            uint64_t key) {
+  if (checkpoint.dir.empty()) {
+    return std::string();
+  }
+  ::mkdir(checkpoint.dir.c_str(), 0777);
+  char name[32];
+  std::snprintf(name, sizeof(name), "-%016llx.vvgrid", static_cast<unsigned long long>(key));
+  return checkpoint.dir + "/" + stage + name;
+}
+
+bool resolve_exclude_engine(const EngineSettings& engine, ExcludeEngine& out) {
+  if (engine.exclude_engine == "stamp") {
+    out = ExcludeEngine::Stamp;
+    return true;
+  }
+  if (engine.exclude_engine == "edt") {
+    out = ExcludeEngine::DistanceTransform;
+    return true;
+  }
+  std::cerr << "Error: unknown --exclude-engine '" << engine.exclude_engine
+            << "' (expected 'stamp' or 'edt').\n";
+  return false;
+}
+
 void add_debug_option(ArgumentParser& parser, DebugSettings& debug) {
   parser.add_option("",
                     "--debug",
@@ -86,6 +237,21 @@ void add_debug_option(ArgumentParser& parser, DebugSettings& debug) {
                     "");
 }
 
+void exit_on_uncaught_exception() {
+  std::set_terminate([] {
+    try {
+      if (std::current_exception()) {
+        std::rethrow_exception(std::current_exception());
+      }
+    } catch (const std::exception& error) {
+      std::cerr << "\nError: " << error.what() << std::endl;
+    } catch (...) {
+      std::cerr << "\nError: unknown exception" << std::endl;
+    }
+    std::exit(1);
+  });
+}
+
 void enable_debug(const DebugSettings& debug) {
   g_debug_enabled = debug.debug;
   if (g_debug_enabled && !g_debug_registered) {
@@ -107,6 +273,8 @@ void debug_report_cli(const std::string& input_label, const OutputSettings* outp
               << " ezd=" << (outputs->ezdFile.empty() ? "<none>" : outputs->ezdFile)
               << " mrc=" << (outputs->mrcFile.empty() ? "<none>" : outputs->mrcFile)
               << " mrc_small=" << (outputs->use_small_mrc ? "true" : "false")
+              << " map_4bit=" << (outputs->map_4bit ? "true" : "false")
+              << " map_gzip=" << (outputs->map_gzip ? "true" : "false")
               << std::endl;
   } else {
     std::cerr << "Debug: outputs=<none>" << std::endl;
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #include "argument_helper.hpp"
 #include "pdb_io.hpp"
+#include "utils.hpp"
 
 namespace vossvolvox {
 
@@ -15,6 +17,7 @@ struct FilterSettings {
   bool exclude_water = false;
   bool exclude_nucleic = false;
   bool exclude_amino = false;
+  std::string xyzr_cache;
 };
 
 struct OutputSettings {
@@ -23,16 +26,70 @@ struct OutputSettings {
   std::string mrcFile;
   std::string ccp4File;
   bool use_small_mrc = false;
+  bool map_4bit = false;              // MRC/CCP4 voxels as mode 101
+  bool map_gzip = false;              // gzip MRC/CCP4 files
 };
 
 struct DebugSettings {
   bool debug = false;
 };
 
+struct EngineSettings {
+  std::string exclude_engine = "stamp";
+};
+
+// Reuse of the trimmed big-probe shell across runs (Channel.exe, Solvent.exe).
+struct TrimMapSettings {
+  std::string load_path;
+  std::string save_path;
+  double threshold = 0.5;
+};
+
+// Stage checkpoints for the multi-stage tools (Cavities.exe, Tunnel.exe).
+struct CheckpointSettings {
+  std::string dir;
+};
+
+// Frame-by-frame runs over an ensemble or trajectory (Volume.exe, Cavities.exe).
+struct FrameSettings {
+  bool models = false;                // each MODEL block of -i is a frame
+  std::string trajectory;             // DCD frames, radii from -i
+};
+
+// Concurrent structures for -i @list runs (Volume.exe, Cavities.exe).
+struct BatchSettings {
+  int jobs = 1;                       // structures at once; 0 = one per core
+  double memory_mb = 0;               // budget for concurrent grids; 0 = half of RAM
+};
+
+// Long-running server mode (Volume.exe, Channel.exe).
+struct ServerSettings {
+  std::string socket_path;            // Unix socket for JSON-lines requests
+};
+
 void add_filter_options(ArgumentParser& parser, FilterSettings& filters);
+void add_cache_option(ArgumentParser& parser, FilterSettings& filters);
 void add_output_options(ArgumentParser& parser, OutputSettings& outputs);
 pdbio::ConversionOptions make_conversion_options(const FilterSettings& filters);
 void add_debug_option(ArgumentParser& parser, DebugSettings& debug);
+void add_engine_option(ArgumentParser& parser, EngineSettings& engine);
+void add_trim_map_options(ArgumentParser& parser, TrimMapSettings& trim);
+void add_checkpoint_option(ArgumentParser& parser, CheckpointSettings& checkpoint);
+void add_frame_options(ArgumentParser& parser, FrameSettings& frames);
+bool frames_requested(const FrameSettings& frames);
+void add_batch_options(ArgumentParser& parser, BatchSettings& batch);
+void add_server_option(ArgumentParser& parser, ServerSettings& server);
+// Output settings for a run over many inputs or frames: every result would
+// overwrite the same grid files, so the file names are cleared, with a note
+// naming what is being iterated when any were given.
+OutputSettings drop_grid_outputs(const OutputSettings& outputs, const std::string& items);
+// <dir>/<stage>-<key>.vvgrid, or "" when --checkpoint-dir is not set.
+std::string checkpoint_path(const CheckpointSettings& checkpoint, const std::string& stage,
+                            uint64_t key);
+bool resolve_exclude_engine(const EngineSettings& engine, ExcludeEngine& out);
+// The grid code throws on a failed allocation or too few atoms; a tool that
+// lets such an exception escape prints its message and exits with status 1.
+void exit_on_uncaught_exception();
 void enable_debug(const DebugSettings& debug);
 bool debug_enabled();
 void debug_report_cli(const std::string& input_label, const OutputSettings* outputs);
@@ -4,7 +4,9 @@
 
 #include "utils.hpp"
 
+#include <cstddef>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
 namespace vossvolvox {
@@ -32,54 +34,195 @@ void debug_report_grid_state() {
             << std::endl;
 }
 
+namespace {
+
+// Converts straight into the float buffer the grid code reads, so a load
+// keeps only one copy of the atoms.
+class BufferSink : public vossvolvox::pdbio::XyzrSink {
+ public:
+  explicit BufferSink(XYZRBuffer& buffer) : buffer_(buffer) {}
+  void reserve(std::size_t count) override { buffer_.atoms.reserve(count); }
+  void add(double x, double y, double z, double radius) override {
+    buffer_.atoms.push_back(XYZRAtom{static_cast<float>(x),
+                                     static_cast<float>(y),
+                                     static_cast<float>(z),
+                                     static_cast<float>(radius)});
+  }
+
+ private:
+  XYZRBuffer& buffer_;
+};
+
+// Makes ctx the process-wide grid for the legacy overloads.
+void publish_grid_context(const GridContext& ctx, const std::string& input_label) {
+  set_grid_context(ctx);
+
+  // XYZRFILE is only a logging label; "<memory>" matches read_NumAtoms_from_array.
+  const std::string label = input_label.empty() ? "<memory>" : input_label;
+  std::strncpy(XYZRFILE, label.c_str(), sizeof(XYZRFILE));
+  XYZRFILE[sizeof(XYZRFILE) - 1] = '\0';
+
+  debug_note_grid_prep_start();
+  debug_report_grid_state();
+}
+
+}  // namespace
+
 bool load_xyzr_or_exit(const std::string& path,
                        const vossvolvox::pdbio::ConversionOptions& opts,
                        XYZRBuffer& out) {
-  vossvolvox::pdbio::XyzrData data;
-  if (!vossvolvox::pdbio::ReadFileToXyzr(path, opts, data)) {
+  out.atoms.clear();
+  BufferSink sink(out);
+  if (!vossvolvox::pdbio::LoadStructureAsXyzr(path, opts, sink)) {
     std::cerr << "Error: unable to load XYZR data from '" << path << "'\n";
     return false;
   }
-
-  out.atoms.clear();
-  out.atoms.reserve(data.atoms.size());
-  for (const auto& atom : data.atoms) {
-    out.atoms.push_back(XYZRAtom{static_cast<float>(atom.x),
-                                 static_cast<float>(atom.y),
-                                 static_cast<float>(atom.z),
-                                 static_cast<float>(atom.radius)});
-  }
   return true;
 }
 
-GridPrepResult prepare_grid_from_xyzr(const std::vector<const XYZRBuffer*>& buffers,
-                                      float grid_spacing,
-                                      float max_probe,
-                                      const std::string& input_label,
-                                      bool debug_limits) {
-  GRID = grid_spacing;
-  initGridState(max_probe);
-
-  if (!input_label.empty()) {
-    std::strncpy(XYZRFILE, input_label.c_str(), sizeof(XYZRFILE));
-    XYZRFILE[sizeof(XYZRFILE) - 1] = '\0';
-  }
-
+GridPrepResult build_grid_context_from_xyzr(const std::vector<const XYZRBuffer*>& buffers,
+                                            float grid_spacing,
+                                            float max_probe) {
   GridPrepResult result;
+  result.context = make_grid_context(grid_spacing, max_probe);
   result.per_input.reserve(buffers.size());
   for (const auto* buffer : buffers) {
     if (!buffer) {
       result.per_input.push_back(0);
       continue;
     }
-    const int atoms = read_NumAtoms_from_array(*buffer);
+    const int atoms = read_NumAtoms_from_array(result.context, *buffer);
     result.per_input.push_back(atoms);
     result.total_atoms += atoms;
   }
+  assignLimits(result.context);
+  return result;
+}
 
-  assignLimits();
-  debug_note_grid_prep_start();
-  debug_report_grid_state();
+bool InputBatch::open(const std::string& input) {
+  paths_.clear();
+  index_ = 0;
+  failures_ = 0;
+  is_list_ = !input.empty() && input[0] == '@';
+  if (!is_list_) {
+    paths_.push_back(input);
+    return true;
+  }
+  std::ifstream list(input.substr(1));
+  if (!list) {
+    std::cerr << "Error: unable to read input list '" << input.substr(1) << "'\n";
+    return false;
+  }
+  std::string line;
+  while (std::getline(list, line)) {
+    const auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') {
+      continue;
+    }
+    const auto last = line.find_last_not_of(" \t\r");
+    paths_.push_back(line.substr(first, last - first + 1));
+  }
+  if (paths_.empty()) {
+    std::cerr << "Error: input list '" << input.substr(1) << "' names no structures\n";
+    return false;
+  }
+  std::cerr << "Batch: " << paths_.size() << " inputs from " << input.substr(1) << std::endl;
+  return true;
+}
+
+bool InputBatch::next(const vossvolvox::pdbio::ConversionOptions& opts,
+                      float grid_spacing,
+                      float max_probe,
+                      XYZRBuffer& atoms,
+                      GridPrepResult& result) {
+  while (index_ < paths_.size()) {
+    const std::string& input = paths_[index_++];
+    if (!load_xyzr_or_exit(input, opts, atoms)) {
+      failures_++;
+      continue;
+    }
+    // read_NumAtoms_from_array throws on fewer than 3 atoms; skip such
+    // entries here so the rest of a list still runs.
+    int valid = 0;
+    for (const auto& atom : atoms.atoms) {
+      valid += (atom.r > 0 && atom.r < 100) ? 1 : 0;
+    }
+    if (is_list_ && valid < 3) {
+      std::cerr << "Error: not enough atoms in '" << input << "'\n";
+      failures_++;
+      continue;
+    }
+    const std::vector<const XYZRBuffer*> buffers = {&atoms};
+    result = prepare_grid_from_xyzr(buffers, grid_spacing, max_probe, input, false);
+    return true;
+  }
+  return false;
+}
+
+bool FrameStream::open(const FrameSettings& frames,
+                       const std::string& input,
+                       const vossvolvox::pdbio::ConversionOptions& opts) {
+  const bool opened = frames.trajectory.empty() ? reader_.Open(input, std::string(), opts)
+                                                : reader_.Open(frames.trajectory, input, opts);
+  if (!opened) {
+    std::cerr << "Error: unable to read frames from '"
+              << (frames.trajectory.empty() ? input : frames.trajectory) << "'\n";
+  }
+  return opened;
+}
+
+bool FrameStream::prepare_grid(float grid_spacing,
+                               float max_probe,
+                               const std::string& input_label,
+                               GridPrepResult& result) {
+  result = GridPrepResult();
+  result.context = make_grid_context(grid_spacing, max_probe);
+  XYZRBuffer frame;
+  BufferSink sink(frame);
+  frame_count_ = 0;
+  while (reader_.Next(sink)) {
+    frame_count_++;
+    const int atoms = read_NumAtoms_from_array(result.context, frame);
+    if (atoms > result.total_atoms) {
+      result.total_atoms = atoms;
+    }
+    frame.atoms.clear();
+  }
+  if (reader_.failed() || frame_count_ == 0 || !reader_.Rewind()) {
+    std::cerr << "Error: " << (reader_.failed() ? "unable to read every frame" : "no frames found")
+              << "\n";
+    return false;
+  }
+  result.per_input.push_back(result.total_atoms);
+  assignLimits(result.context);
+  publish_grid_context(result.context, input_label);
+  std::cerr << "Frames: " << frame_count_ << " on one " << result.context.dx << " x "
+            << result.context.dy << " x " << result.context.dz << " grid" << std::endl;
+  frame_ = 0;
+  return true;
+}
+
+bool FrameStream::next(XYZRBuffer& out) {
+  out.atoms.clear();
+  BufferSink sink(out);
+  if (!reader_.Next(sink)) {
+    return false;
+  }
+  frame_++;
+  atoms_ = 0;
+  for (const auto& atom : out.atoms) {
+    atoms_ += (atom.r > 0 && atom.r < 100) ? 1 : 0;
+  }
+  return true;
+}
+
+GridPrepResult prepare_grid_from_xyzr(const std::vector<const XYZRBuffer*>& buffers,
+                                      float grid_spacing,
+                                      float max_probe,
+                                      const std::string& input_label,
+                                      bool debug_limits) {
+  GridPrepResult result = build_grid_context_from_xyzr(buffers, grid_spacing, max_probe);
+  publish_grid_context(result.context, input_label);
   (void)debug_limits;
   return result;
 }
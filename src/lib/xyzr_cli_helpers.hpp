@@ -5,22 +5,96 @@
 
 #include "pdb_io.hpp"
 #include "utils.hpp"
+#include "vossvolvox_cli_common.hpp"
 
 namespace vossvolvox {
 
 struct GridPrepResult {
   int total_atoms = 0;
   std::vector<int> per_input;
+  GridContext context;
 };
 
 bool load_xyzr_or_exit(const std::string& path,
                        const vossvolvox::pdbio::ConversionOptions& opts,
                        XYZRBuffer& out);
 
+// Computes the grid bounds for the given inputs without touching the
+// process-wide globals; the result's context is ready for the ctx overloads.
+GridPrepResult build_grid_context_from_xyzr(const std::vector<const XYZRBuffer*>& buffers,
+                                            float grid_spacing,
+                                            float max_probe);
+
+// As above, then publishes the context through the legacy globals.
 GridPrepResult prepare_grid_from_xyzr(const std::vector<const XYZRBuffer*>& buffers,
                                       float grid_spacing,
                                       float max_probe,
                                       const std::string& input_label,
                                       bool debug_limits);
 
+// Inputs of a batch run. "-i @list.txt" names a file listing one structure
+// per line (blank lines and lines starting with '#' are skipped); any other
+// input is a batch of one. Inputs that fail to load are reported, counted,
+// and skipped, so one bad entry does not end the run.
+class InputBatch {
+ public:
+  bool open(const std::string& input);
+
+  // Loads the next input that converts and sizes its grid like
+  // prepare_grid_from_xyzr. Returns false after the last input.
+  bool next(const vossvolvox::pdbio::ConversionOptions& opts,
+            float grid_spacing,
+            float max_probe,
+            XYZRBuffer& atoms,
+            GridPrepResult& result);
+
+  // Path of the input last returned by next().
+  const std::string& path() const { return paths_[index_ - 1]; }
+  bool is_list() const { return is_list_; }
+  std::size_t size() const { return paths_.size(); }
+  int failures() const { return failures_; }
+
+ private:
+  std::vector<std::string> paths_;
+  std::size_t index_ = 0;
+  bool is_list_ = false;
+  int failures_ = 0;
+};
+
+// Frames of an ensemble or trajectory for --models and --trajectory. Every
+// frame is gridded on one context sized to the union of all frame bounds,
+// so grids can be allocated once and results compare across frames.
+class FrameStream {
+ public:
+  // Opens the MODEL blocks of input, or the frames of frames.trajectory with
+  // radii from input.
+  bool open(const FrameSettings& frames,
+            const std::string& input,
+            const vossvolvox::pdbio::ConversionOptions& opts);
+
+  // First pass: reads every frame to build the union context, publishes it
+  // like prepare_grid_from_xyzr, and rewinds. total_atoms is the atom count
+  // of the largest frame.
+  bool prepare_grid(float grid_spacing,
+                    float max_probe,
+                    const std::string& input_label,
+                    GridPrepResult& result);
+
+  // Second pass: the next frame; false after the last one or on an error.
+  bool next(XYZRBuffer& out);
+
+  // 1-based number of the frame last returned by next(), and its atoms
+  // counted as read_NumAtoms_from_array counts them.
+  int frame() const { return frame_; }
+  int atoms() const { return atoms_; }
+  int frame_count() const { return frame_count_; }
+  bool failed() const { return reader_.failed(); }
+
+ private:
+  vossvolvox::pdbio::FrameReader reader_;
+  int frame_ = 0;
+  int atoms_ = 0;
+  int frame_count_ = 0;
+};
+
 }  // namespace vossvolvox
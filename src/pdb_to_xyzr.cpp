@@ -38,6 +38,7 @@ void print_citation() {
 int main(int argc, char** argv) {
     std::ios::sync_with_stdio(false);
     std::string input_file;
+    std::string binary_output;
     vossvolvox::FilterSettings filters;
     vossvolvox::DebugSettings debug;
 
@@ -46,10 +47,17 @@ int main(int argc, char** argv) {
         "Convert structural inputs (PDB/mmCIF/PDBML/XYZR) to XYZR format.");
     vossvolvox::add_input_option(parser, input_file);
     vossvolvox::add_filter_options(parser, filters);
+    parser.add_option("",
+                      "--xyzrb-output",
+                      binary_output,
+                      std::string(),
+                      "Write binary XYZR (float32) to this file instead of text to stdout.",
+                      "<xyzrb file>");
     vossvolvox::add_debug_option(parser, debug);
     parser.add_example(std::string(argv[0]) +
                        " -i 1A01.pdb --exclude-ions --exclude-water > 1a01-filtered.xyzr");
     parser.add_example(std::string(argv[0]) + " -i - --exclude-water < 1a01.pdb > 1a01.xyzr");
+    parser.add_example(std::string(argv[0]) + " -i 1A01.pdb --xyzrb-output 1a01.xyzrb");
 
     std::string positional_input;
     std::vector<std::string> filtered_args;
@@ -72,7 +80,7 @@ int main(int argc, char** argv) {
             }
             break;
         }
-        if (arg == "-i" || arg == "--input") {
+        if (arg == "-i" || arg == "--input" || arg == "--xyzrb-output") {
             filtered_args.push_back(arg);
             if (i + 1 < argc) {
                 filtered_args.push_back(argv[i + 1]);
@@ -124,6 +132,21 @@ int main(int argc, char** argv) {
     const auto convert_options = vossvolvox::make_conversion_options(filters);
 
     const bool use_stdin = input_file.empty() || input_file == "-";
+    if (!binary_output.empty()) {
+        vossvolvox::pdbio::XyzrData data;
+        vossvolvox::pdbio::PdbToXyzrConverter converter;
+        const bool loaded =
+            use_stdin ? converter.ConvertStreamToAtoms(std::cin, "<stdin>", convert_options, data.atoms)
+                      : vossvolvox::pdbio::ReadFileToXyzr(input_file, convert_options, data);
+        if (!loaded) {
+            return 2;
+        }
+        if (!vossvolvox::pdbio::WriteBinaryXyzrToFile(binary_output, data, convert_options)) {
+            std::cerr << "pdb_to_xyzr: unable to write '" << binary_output << "'\n";
+            return 2;
+        }
+        return 0;
+    }
     if (!use_stdin) {
         vossvolvox::pdbio::XyzrData data;
         if (!vossvolvox::pdbio::ReadFileToXyzr(input_file, convert_options, data)) {
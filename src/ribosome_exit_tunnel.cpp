@@ -5,21 +5,23 @@
 #include "argument_helper.hpp"
 #include "pdb_io.hpp"
 #include "utils.hpp"                    // for get_Connected, endl, gridpt, cerr
+#include "utils-checkpoint.hpp"
 #include "vossvolvox_cli_common.hpp"
 #include "xyzr_cli_helpers.hpp"
 
 // Globals
-extern float GRID, GRIDVOL;
+extern float GRID;
 
-void printTun(const float probe, 
+void printTun(const GridContext& ctx, const float probe,
 	const float surfEXC, const int tunnEXC_voxels, const int chanEXC_voxels,
 	const float surfACC, const int tunnACC_voxels, const int chanACC_voxels,
 	char file[]);
-void defineTunnel(gridpt tunnel[], gridpt channels[]);
+void defineTunnel(const GridContext& ctx, gridpt tunnel[], gridpt channels[]);
 
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   vossvolvox::OutputSettings outputs;
@@ -29,6 +31,7 @@ int main(int argc, char *argv[]) {
   double trim_prb = 3.0;
   float grid = GRID;
   vossvolvox::FilterSettings filters;
+  vossvolvox::CheckpointSettings checkpoint;
 
   vossvolvox::ArgumentParser parser(
       argv[0],
@@ -61,6 +64,8 @@ int main(int argc, char *argv[]) {
   outputs.use_small_mrc = true;
   vossvolvox::add_output_options(parser, outputs);
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
+  vossvolvox::add_checkpoint_option(parser, checkpoint);
   vossvolvox::add_debug_option(parser, debug);
   parser.add_example("./Tunnel.exe -i 1jj2.xyzr -b 12 -s 3 -t 4 -g 0.6 -o tunnel.pdb");
 
@@ -99,60 +104,74 @@ int main(int argc, char *argv[]) {
       false);
   const int numatoms = grid_result.total_atoms;
 
+  const GridContext& ctx = grid_result.context;
+
 //HEADER CHECK
-  cerr << "Grid Spacing: " << GRID << endl;
+  cerr << "Grid Spacing: " << ctx.spacing << endl;
   cerr << "Input file:   " << input_path << endl;
 
 // ****************************************************
 // BUSINESS PART
 // ****************************************************
 
+  // stage checkpoints: the trimmed shell, then the channels for "probe"
+  const uint64_t shell_key = checkpoint_Key(ctx, xyzr_buffer, {shell_rad, trim_prb});
+  const uint64_t chan_key = checkpoint_Key(ctx, xyzr_buffer, {shell_rad, trim_prb, tunnel_prb});
+  const std::string shell_path = vossvolvox::checkpoint_path(checkpoint, "shell", shell_key);
+  const std::string chan_path = vossvolvox::checkpoint_path(checkpoint, "chanACC", chan_key);
+
 //Compute Shell
-  auto shellACC = make_zeroed_grid();
-  fill_AccessGrid_fromArray(numatoms, shell_rad, xyzr_buffer, shellACC.get());
-  fill_cavities(shellACC.get());
+  auto shellEXC = make_zeroed_grid(ctx);
+  if (load_GridCheckpoint(ctx, shell_path, shell_key, shellEXC.get()) != 1) {
+    auto shellACC = make_zeroed_grid(ctx);
+    fill_AccessGrid_fromArray(ctx, numatoms, shell_rad, xyzr_buffer, shellACC.get());
+    fill_cavities(ctx, shellACC.get());
 
-  auto shellEXC = make_zeroed_grid();
-  trun_ExcludeGrid(shell_rad, shellACC.get(), shellEXC.get());
-  shellACC.reset();
+    trun_ExcludeGrid(ctx, shell_rad, shellACC.get(), shellEXC.get());
+    shellACC.reset();
 
 //Trim Shell
-  if(trim_prb > 0.0) {
-    auto trimEXC = make_zeroed_grid();
-    copyGrid(shellEXC.get(), trimEXC.get());
-    trun_ExcludeGrid(trim_prb, shellEXC.get(), trimEXC.get());  // TRIMMING PART
-    zeroGrid(shellEXC.get());
-    copyGrid(trimEXC.get(), shellEXC.get());
+    if(trim_prb > 0.0) {
+      auto trimEXC = make_zeroed_grid(ctx);
+      copyGrid(ctx, shellEXC.get(), trimEXC.get());
+      trun_ExcludeGrid(ctx, trim_prb, shellEXC.get(), trimEXC.get());  // TRIMMING PART
+      zeroGrid(ctx, shellEXC.get());
+      copyGrid(ctx, trimEXC.get(), shellEXC.get());
+    }
+    save_GridCheckpoint(ctx, shellEXC.get(), shell_key, shell_path);
   }
 
 //Get Shell Volume
-  int shell_vol = countGrid(shellEXC.get());
-  printVol(shell_vol); cerr << endl;
+  int shell_vol = countGrid(ctx, shellEXC.get());
+  printVol(ctx, shell_vol); cerr << endl;
 
+  auto chanACC = make_zeroed_grid(ctx);
+  if (load_GridCheckpoint(ctx, chan_path, chan_key, chanACC.get()) != 1) {
 //Get Access Volume for "probe"
-  auto access = make_zeroed_grid();
-  fill_AccessGrid_fromArray(numatoms, tunnel_prb, xyzr_buffer, access.get());
+    auto access = make_zeroed_grid(ctx);
+    fill_AccessGrid_fromArray(ctx, numatoms, tunnel_prb, xyzr_buffer, access.get());
 
 //Get Channels for "probe"
-  auto chanACC = make_zeroed_grid();
-  copyGrid(shellEXC.get(), chanACC.get());
-  subt_Grids(chanACC.get(), access.get());
-  access.reset();
-  intersect_Grids(chanACC.get(), shellEXC.get()); //modifies chanACC
-  int chanACC_voxels = countGrid(chanACC.get());
-  printVol(chanACC_voxels); cerr << endl;
+    copyGrid(ctx, shellEXC.get(), chanACC.get());
+    subt_Grids(ctx, chanACC.get(), access.get());
+    access.reset();
+    intersect_Grids(ctx, chanACC.get(), shellEXC.get()); //modifies chanACC
+    save_GridCheckpoint(ctx, chanACC.get(), chan_key, chan_path);
+  }
+  int chanACC_voxels = countGrid(ctx, chanACC.get());
+  printVol(ctx, chanACC_voxels); cerr << endl;
 
 //Extract Tunnel
-  auto tunnACC = make_zeroed_grid();
-  defineTunnel(tunnACC.get(), chanACC.get());
+  auto tunnACC = make_zeroed_grid(ctx);
+  defineTunnel(ctx, tunnACC.get(), chanACC.get());
   //writeMRCFile(chanACC, mrcfile);
   chanACC.reset();
-  int tunnACC_voxels = countGrid(tunnACC.get());
+  int tunnACC_voxels = countGrid(ctx, tunnACC.get());
   cerr << "ACCESSIBLE TUNNEL VOLUME: ";
-  printVol(tunnACC_voxels); cerr << endl << endl;
+  printVol(ctx, tunnACC_voxels); cerr << endl << endl;
   //float surfACC = surface_area(tunnACC);
   float surfACC = 0;
-  if (tunnACC_voxels*GRIDVOL > 2000000) {
+  if (tunnACC_voxels*ctx.gridvol > 2000000) {
     cerr << "ERROR: Accessible volume of tunnel is too large to be valid" << endl;
     shellEXC.reset();
     //writeMRCFile(chanACC, mrcfile);
@@ -160,31 +179,32 @@ int main(int argc, char *argv[]) {
   }
 
 //Grow Tunnel
-  auto tunnEXC = make_zeroed_grid();
-  grow_ExcludeGrid(tunnel_prb, tunnACC.get(), tunnEXC.get());
+  auto tunnEXC = make_zeroed_grid(ctx);
+  grow_ExcludeGrid(ctx, tunnel_prb, tunnACC.get(), tunnEXC.get());
   tunnACC.reset();
 
 //Intersect Grown Tunnel with Shell
-  intersect_Grids(tunnEXC.get(), shellEXC.get()); //modifies tunnEXC
+  intersect_Grids(ctx, tunnEXC.get(), shellEXC.get()); //modifies tunnEXC
   shellEXC.reset();
 
 //Get EXC Props
-  int tunnEXC_voxels = countGrid(tunnEXC.get());
+  int tunnEXC_voxels = countGrid(ctx, tunnEXC.get());
   cerr << "TUNNEL VOLUME: ";
-  printVol(tunnEXC_voxels); cerr << endl << endl;
+  printVol(ctx, tunnEXC_voxels); cerr << endl << endl;
   //shell volume at 6A probe 9732148*0.6^3 = 2,102,144 A^3
   //solvent volume at 1.4A probe 2465252*0.6^3 = 532,494 A^3
-  if (tunnEXC_voxels*GRIDVOL > 1800000) {
+  if (tunnEXC_voxels*ctx.gridvol > 1800000) {
     cerr << "ERROR: Excluded volume of tunnel is too large to be valid" << endl;
     return 0;
   }
-  float surfEXC = surface_area(tunnEXC.get());
+  float surfEXC = surface_area(ctx, tunnEXC.get());
 
 //Output
-  report_grid_metrics(std::cerr, tunnEXC_voxels, static_cast<long double>(surfEXC));
-  write_output_files(tunnEXC.get(), outputs);
+  report_grid_metrics(ctx, std::cerr, tunnEXC_voxels, static_cast<long double>(surfEXC));
+  write_output_files(ctx, tunnEXC.get(), outputs);
 
-  printTun(trim_prb,
+  printTun(ctx,
+           trim_prb,
            surfEXC,
            tunnEXC_voxels,
            0,
@@ -201,24 +221,24 @@ int main(int argc, char *argv[]) {
 //***********************************************************//
 //***********************************************************//
 
-void defineTunnel(gridpt tunnel[], gridpt channels[])
+void defineTunnel(const GridContext& ctx, gridpt tunnel[], gridpt channels[])
 {
 //NEW IDEAL TUNNEL POINTS
-  zeroGrid(tunnel);
+  zeroGrid(ctx, tunnel);
 //  get_Connected(chanACC,tunnACC,77.2,116.0,109.2); //tRNA cleft
-  get_Connected(channels, tunnel, 74.8,130.0,83.6); //highest tunnel pt
-  get_Connected(channels, tunnel, 68.3,132.2,85.6); //largest area
-  get_Connected(channels, tunnel, 53.6,144.8,69.6); //below main
-  get_Connected(channels, tunnel, 49.9,151.8,67.3); //2nd largest & low 
-  get_Connected(channels, tunnel, 38.4,160.4,63.6); //low blob point
-  get_Connected(channels, tunnel, 35.6,163.6,61.6); //lowest pt
+  get_Connected(ctx, channels, tunnel, 74.8,130.0,83.6); //highest tunnel pt
+  get_Connected(ctx, channels, tunnel, 68.3,132.2,85.6); //largest area
+  get_Connected(ctx, channels, tunnel, 53.6,144.8,69.6); //below main
+  get_Connected(ctx, channels, tunnel, 49.9,151.8,67.3); //2nd largest & low 
+  get_Connected(ctx, channels, tunnel, 38.4,160.4,63.6); //low blob point
+  get_Connected(ctx, channels, tunnel, 35.6,163.6,61.6); //lowest pt
 //OLD POINTS ; CAN'T HURT
-  get_Connected(channels, tunnel, 53.6,141.3,66.4);
-  get_Connected(channels, tunnel, 71.5,120.4,97.3);
-  get_Connected(channels, tunnel, 71.5,125.0,98.1);
-  get_Connected(channels, tunnel, 70.3,131.2,81.9);
-  get_Connected(channels, tunnel, 55.7,140.2,73.8);
-  get_Connected(channels, tunnel, 44.6,153.2,68.7);
+  get_Connected(ctx, channels, tunnel, 53.6,141.3,66.4);
+  get_Connected(ctx, channels, tunnel, 71.5,120.4,97.3);
+  get_Connected(ctx, channels, tunnel, 71.5,125.0,98.1);
+  get_Connected(ctx, channels, tunnel, 70.3,131.2,81.9);
+  get_Connected(ctx, channels, tunnel, 55.7,140.2,73.8);
+  get_Connected(ctx, channels, tunnel, 44.6,153.2,68.7);
 
   //get_Connected(channels,tunnel,0.0,0.0,0.0);
   return;
@@ -228,7 +248,7 @@ void defineTunnel(gridpt tunnel[], gridpt channels[])
 //***********************************************************//
 //***********************************************************//
 
-void printTun(const float probe, 
+void printTun(const GridContext& ctx, const float probe,
 	const float surfEXC, const int tunnEXC_voxels, const int chanEXC_voxels,
 	const float surfACC, const int tunnACC_voxels, const int chanACC_voxels,
         char file[])
@@ -238,16 +258,16 @@ void printTun(const float probe,
 
     cout << probe << "\t";
 //EXCLUDE
-    printVolCout(tunnEXC_voxels);
-    printVolCout(chanEXC_voxels);
+    printVolCout(ctx, tunnEXC_voxels);
+    printVolCout(ctx, chanEXC_voxels);
     cout << perEXC << "\t";
     cout << surfEXC << "\t";
 //ACCESS
-    printVolCout(tunnACC_voxels);
-    printVolCout(chanACC_voxels);
+    printVolCout(ctx, tunnACC_voxels);
+    printVolCout(ctx, chanACC_voxels);
     cout << perACC << "\t";
     cout << surfACC << "\t";
-    cout << GRID << endl;
+    cout << ctx.spacing << endl;
 
     return;
 };
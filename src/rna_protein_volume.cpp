@@ -10,7 +10,6 @@
 
 // Globals
 extern float GRID;
-extern unsigned int NUMBINS;
 
 
 /*********************************************/
@@ -20,10 +19,12 @@ int trimYAxis (gridpt grid[]) {
   if (DEBUG > 0)
     cerr << "Trimming Y Axis from Grids...  " << flush;
 
+  // Snapshot the grid once instead of per voxel in the legacy pt2xyz.
+  const GridContext ctx = current_grid_context();
   float x,y,z;
-  for(unsigned int pt=0; pt<NUMBINS; pt++) {
+  for(unsigned int pt=0; pt<ctx.numbins; pt++) {
     if (grid[pt]) {
-      pt2xyz(pt, x, y, z);
+      pt2xyz(ctx, pt, x, y, z);
       if(y > 170) {
         grid[pt] = 0;
       }
@@ -40,6 +41,7 @@ int trimYAxis (gridpt grid[]) {
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string rna_file;
   std::string amino_file;
@@ -76,6 +78,7 @@ int main(int argc, char *argv[]) {
                     "Grid spacing in Angstroms.",
                     "<grid>");
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
   vossvolvox::add_debug_option(parser, debug);
   parser.add_example("./Custom.exe -r rna.xyzr -a protein.xyzr -p 10 -g 0.8");
 
@@ -5,6 +5,7 @@
 #include "argument_helper.hpp"
 #include "pdb_io.hpp"
 #include "utils.hpp"
+#include "utils-bitgrid.hpp"
 #include "vossvolvox_cli_common.hpp"
 #include "xyzr_cli_helpers.hpp"
 
@@ -14,6 +15,7 @@ extern float GRID;
 int main(int argc, char *argv[]) {
   std::cerr << std::endl;
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   std::string input_path;
   vossvolvox::OutputSettings outputs;
@@ -23,6 +25,7 @@ int main(int argc, char *argv[]) {
   double TRIMPROBE = 1.5;
   float grid = GRID;
   vossvolvox::FilterSettings filters;
+  vossvolvox::TrimMapSettings trim;
 
   vossvolvox::ArgumentParser parser(
       argv[0],
@@ -54,6 +57,8 @@ int main(int argc, char *argv[]) {
                     "<grid spacing>");
   vossvolvox::add_output_options(parser, outputs);
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
+  vossvolvox::add_trim_map_options(parser, trim);
   vossvolvox::add_debug_option(parser, debug);
   parser.add_example("./Solvent.exe -i sample.xyzr -s 1.5 -b 9.0 -t 4 -g 0.5 -o solvent.pdb");
 
@@ -91,82 +96,96 @@ int main(int argc, char *argv[]) {
       input_path,
       false);
   const int numatoms = grid_result.total_atoms;
+  const GridContext& ctx = grid_result.context;
 
 //HEADER CHECK
   if(SMPROBE > BIGPROBE) { cerr << "ERROR: SMPROBE > BIGPROBE" << endl; return 1; }
   cerr << "Small Probe Radius: " << SMPROBE << endl;
   cerr << " Big  Probe Radius: " << BIGPROBE << endl;
   cerr << "Trim  Probe Radius: " << TRIMPROBE << endl;
-  cerr << "Grid Spacing: " << GRID << endl;
+  cerr << "Grid Spacing: " << ctx.spacing << endl;
   cerr << "Input file:   " << input_path << endl;
 
 
 // ****************************************************
 // STARTING LARGE PROBE
 // ****************************************************
-  auto biggrid = make_zeroed_grid();
-  int bigvox;
-  if (BIGPROBE > 0.0) {
-    bigvox = get_ExcludeGrid_fromArray(numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
-  } else {
+  if (BIGPROBE <= 0.0) {
     cerr << "BIGPROBE <= 0" << endl;
     return 1;
   }
-
+  auto trimbytes = make_zeroed_grid(ctx);
+  if (!trim.load_path.empty()) {
+    // shell saved by an earlier run with --save-trim-map
+    if (readMRCFileOnGrid(ctx, trim.load_path.c_str(), trim.threshold, trimbytes.get()) < 0) {
+      return 1;
+    }
+  } else {
+    auto biggrid = make_zeroed_grid(ctx);
+    get_ExcludeGrid_fromArray(ctx, numatoms, BIGPROBE, xyzr_buffer, biggrid.get());
 
 // ****************************************************
 // TRIM LARGE PROBE SURFACE
 // ****************************************************
-  auto trimgrid = make_zeroed_grid();
-  copyGrid(biggrid.get(), trimgrid.get());
-  if(TRIMPROBE > 0) {
-    trun_ExcludeGrid(TRIMPROBE, biggrid.get(), trimgrid.get());
+    copyGrid(ctx, biggrid.get(), trimbytes.get());
+    if(TRIMPROBE > 0) {
+      trun_ExcludeGrid(ctx, TRIMPROBE, biggrid.get(), trimbytes.get());
+    }
+  }
+  if (!trim.save_path.empty()
+      && writeMRCFile(ctx, trimbytes.get(), trim.save_path.c_str()) != 1) {
+    std::cerr << "Error: --save-trim-map " << trim.save_path
+              << " was not written (empty shell or write error)" << std::endl;
+    return 1;
   }
-  biggrid.reset();
+  // keep the trimmed shell bit-packed, it is held for the rest of the run
+  BitGrid trimgrid = make_zeroed_bitgrid(ctx);
+  copyGrid(ctx, trimbytes.get(), trimgrid);
+  trimbytes.reset();
 
   //cout << "bg_prb\tsm_prb\tgrid\texcvol\tsurf\taccvol\tfile" << endl;
 
 // ****************************************************
 // STARTING SMALL PROBE
 // ****************************************************
-    auto smgrid = make_zeroed_grid();
+    auto smgrid = make_zeroed_grid(ctx);
     int smvox;
-    smvox = fill_AccessGrid_fromArray(numatoms, SMPROBE, xyzr_buffer, smgrid.get());
+    smvox = fill_AccessGrid_fromArray(ctx, numatoms, SMPROBE, xyzr_buffer, smgrid.get());
 
 // ****************************************************
 // GETTING ACCESSIBLE CHANNELS
 // ****************************************************
-    auto solventACC = make_zeroed_grid();
-    copyGrid(trimgrid.get(), solventACC.get()); //copy trimgrid into solventACC
-    subt_Grids(solventACC.get(), smgrid.get()); //modify solventACC
+    auto solventACC = make_zeroed_grid(ctx);
+    copyGrid(trimgrid, solventACC.get()); //copy trimgrid into solventACC
+    subt_Grids(ctx, solventACC.get(), smgrid.get()); //modify solventACC
     smgrid.reset();
 
 // ***************************************************
 // GETTING CONTACT CHANNEL
 // ***************************************************
-    auto solventEXC = make_zeroed_grid();
-    int solventACCvol = copyGrid(solventACC.get(), solventEXC.get());
+    auto solventEXC = make_zeroed_grid(ctx);
+    int solventACCvol = copyGrid(ctx, solventACC.get(), solventEXC.get());
     cerr << "Accessible Channel Volume  ";
-    printVol(solventACCvol);
-    grow_ExcludeGrid(SMPROBE, solventACC.get(), solventEXC.get());
+    printVol(ctx, solventACCvol);
+    grow_ExcludeGrid(ctx, SMPROBE, solventACC.get(), solventEXC.get());
     solventACC.reset();
 
 //limit growth to inside trimgrid
-    intersect_Grids(solventEXC.get(), trimgrid.get()); //modifies solventEXC
-    trimgrid.reset();
+    intersect_Grids(solventEXC.get(), trimgrid); //modifies solventEXC
+    trimgrid = BitGrid();
 
 // ***************************************************
 // OUTPUT RESULTS
 // ***************************************************
-    cout << BIGPROBE << "\t" << SMPROBE << "\t" << GRID << "\t" << flush;
-    int solventEXCvol = countGrid(solventEXC.get());
-    printVolCout(solventEXCvol);
-    long double surf = surface_area(solventEXC.get());
+    cout << BIGPROBE << "\t" << SMPROBE << "\t" << ctx.spacing << "\t" << flush;
+    int solventEXCvol = countGrid(ctx, solventEXC.get());
+    printVolCout(ctx, solventEXCvol);
+    long double surf = surface_area(ctx, solventEXC.get());
     cout << "\t" << surf << "\t" << flush;
     //printVolCout(solventACCvol);
     cout << input_path << endl;
-    report_grid_metrics(std::cerr, solventEXCvol, surf);
-    write_output_files(solventEXC.get(), outputs);
+    report_grid_metrics(ctx, std::cerr, solventEXCvol, surf);
+    write_output_files(ctx, solventEXC.get(), outputs);
 
   cerr << endl << "Program Completed Sucessfully" << endl << endl;
   return 0;
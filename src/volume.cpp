@@ -3,7 +3,9 @@
 #include <string>
 #include <vector>
 
+#include "analysis_server.hpp"
 #include "argument_helper.hpp"
+#include "batch_scheduler.hpp"
 #include "pdb_io.hpp"
 #include "utils.hpp"
 #include "vossvolvox_cli_common.hpp"
@@ -12,16 +14,40 @@
 // Globals
 extern float GRID;
 
+// Peak bytes per voxel of processGrid: the excluded and accessible grids,
+// plus the seed grid and 4-byte distances of the distance-transform engine
+const double VOLUME_BYTES_PER_VOXEL = 8;
+
+// Excluded volume in voxels and its surface area
+struct VolumeResult {
+  int voxels = 0;
+  long double surf = 0;
+};
+
 // Function prototypes
-void processGrid(double probe,
-                 const vossvolvox::OutputSettings& outputs,
-                 const std::string& inputFile,
-                 const XYZRBuffer& xyzr_buffer,
-                 int numatoms);
+VolumeResult processGrid(const GridContext& ctx,
+                         double probe,
+                         const vossvolvox::OutputSettings& outputs,
+                         const std::string& inputFile,
+                         const XYZRBuffer& xyzr_buffer,
+                         int numatoms,
+                         gridpt EXCgrid[],
+                         int frame);
+int processFrames(vossvolvox::FrameStream& frames,
+                  double probe,
+                  float grid,
+                  const vossvolvox::OutputSettings& outputs,
+                  const std::string& inputFile);
+int serveRequests(const std::string& socket_path,
+                  const vossvolvox::pdbio::ConversionOptions& convert_options,
+                  double probe,
+                  float grid,
+                  const vossvolvox::OutputSettings& outputs);
 
 int main(int argc, char* argv[]) {
   std::cerr << "\n";
   vossvolvox::set_command_line(argc, argv);
+  vossvolvox::exit_on_uncaught_exception();
 
   // Initialize variables
   std::string inputFile;
@@ -30,6 +56,9 @@ int main(int argc, char* argv[]) {
   double probe = 10.0;
   float grid = GRID;  // Use global GRID value initially
   vossvolvox::FilterSettings filters;
+  vossvolvox::FrameSettings frames;
+  vossvolvox::BatchSettings batch_settings;
+  vossvolvox::ServerSettings server;
 
   vossvolvox::ArgumentParser parser(
       argv[0],
@@ -39,8 +68,13 @@ int main(int argc, char* argv[]) {
   parser.add_option("-g", "--grid", grid, GRID, "Grid spacing in Angstroms.", "<grid spacing>");
   vossvolvox::add_output_options(parser, outputs);
   vossvolvox::add_filter_options(parser, filters);
+  vossvolvox::add_cache_option(parser, filters);
   vossvolvox::add_debug_option(parser, debug);
+  vossvolvox::add_frame_options(parser, frames);
+  vossvolvox::add_batch_options(parser, batch_settings);
+  vossvolvox::add_server_option(parser, server);
   parser.add_example(std::string(argv[0]) + " -i sample.xyzr -p 1.5 -g 0.5 -o surface.pdb");
+  parser.add_example(std::string(argv[0]) + " -i @structures.txt -p 1.5 -g 0.5 --jobs 0");
 
   const auto parse_result = parser.parse(argc, argv);
   if (parse_result == vossvolvox::ArgumentParser::ParseResult::HelpRequested) {
@@ -49,7 +83,7 @@ int main(int argc, char* argv[]) {
   if (parse_result == vossvolvox::ArgumentParser::ParseResult::Error) {
     return 1;
   }
-  if (!vossvolvox::ensure_input_present(inputFile, parser)) {
+  if (server.socket_path.empty() && !vossvolvox::ensure_input_present(inputFile, parser)) {
     return 1;
   }
 
@@ -71,53 +105,157 @@ int main(int argc, char* argv[]) {
 
   // Load atoms into memory and compute bounds
   const auto convert_options = vossvolvox::make_conversion_options(filters);
+  if (!server.socket_path.empty()) {
+    return serveRequests(server.socket_path, convert_options, probe, grid, outputs);
+  }
+  vossvolvox::InputBatch batch;
+  if (!batch.open(inputFile)) {
+    return 1;
+  }
+  if (vossvolvox::frames_requested(frames)) {
+    vossvolvox::FrameStream stream;
+    if (batch.is_list()) {
+      std::cerr << "Error: --models and --trajectory take a single input, not a list\n";
+      return 1;
+    }
+    if (!stream.open(frames, inputFile, convert_options)) {
+      return 1;
+    }
+    return processFrames(stream, probe, grid, outputs, inputFile);
+  }
+  const auto batch_outputs =
+      batch.is_list() ? vossvolvox::drop_grid_outputs(outputs, "input lists") : outputs;
+
+  // Each process running inputs keeps one excluded grid, reallocated only
+  // when the next structure's grid does not fit in it
+  GridBuffer EXCgrid;
+  vossvolvox::BatchScheduler scheduler(
+      batch.is_list() ? batch_settings : vossvolvox::BatchSettings(),
+      VOLUME_BYTES_PER_VOXEL,
+      [&](const std::string& path, const XYZRBuffer& atoms,
+          const vossvolvox::GridPrepResult& prepared) {
+        // Process the grid for volume and surface calculations
+        processGrid(prepared.context, probe, batch_outputs, path, atoms, prepared.total_atoms,
+                    EXCgrid.zeroed(prepared.context), 0);
+      });
   XYZRBuffer xyzr_buffer;
-  if (!vossvolvox::load_xyzr_or_exit(inputFile, convert_options, xyzr_buffer)) {
+  vossvolvox::GridPrepResult grid_result;
+  while (batch.next(convert_options, grid, static_cast<float>(probe), xyzr_buffer, grid_result)) {
+    scheduler.submit(batch.path(), xyzr_buffer, grid_result);
+  }
+  if (scheduler.finish() + batch.failures() > 0) {
     return 1;
   }
-  const std::vector<const XYZRBuffer*> buffers = {&xyzr_buffer};
-  const auto grid_result = vossvolvox::prepare_grid_from_xyzr(
-      buffers,
-      grid,
-      static_cast<float>(probe),
-      inputFile,
-      false);
-  const int numatoms = grid_result.total_atoms;
-
-  // Process the grid for volume and surface calculations
-  processGrid(probe, outputs, inputFile, xyzr_buffer, numatoms);
 
   // Program completed successfully
   std::cerr << "\nProgram Completed Successfully\n\n";
   return 0;
 }
 
-// Process the grid for volume and surface calculations
-void processGrid(double probe,
-                 const vossvolvox::OutputSettings& outputs,
-                 const std::string& inputFile,
-                 const XYZRBuffer& xyzr_buffer,
-                 int numatoms) {
-  // Allocate memory for the excluded grid
-  auto EXCgrid = make_zeroed_grid();
+// Run every frame on one union-bounds grid, reusing the excluded grid
+int processFrames(vossvolvox::FrameStream& frames,
+                  double probe,
+                  float grid,
+                  const vossvolvox::OutputSettings& outputs,
+                  const std::string& inputFile) {
+  vossvolvox::GridPrepResult grid_result;
+  if (!frames.prepare_grid(grid, static_cast<float>(probe), inputFile, grid_result)) {
+    return 1;
+  }
+  const auto frame_outputs = vossvolvox::drop_grid_outputs(outputs, "frames");
+  auto EXCgrid = make_zeroed_grid(grid_result.context);
+  XYZRBuffer frame;
+  while (frames.next(frame)) {
+    processGrid(grid_result.context, probe, frame_outputs, inputFile, frame, frames.atoms(),
+                EXCgrid.get(), frames.frame());
+  }
+  if (frames.failed()) {
+    return 1;
+  }
+  std::cerr << "\nProgram Completed Successfully\n\n";
+  return 0;
+}
+
+// Answer "volume" requests on socket_path until the server stops; the
+// command-line probe, grid, and map settings are the request defaults
+int serveRequests(const std::string& socket_path,
+                  const vossvolvox::pdbio::ConversionOptions& convert_options,
+                  double probe,
+                  float grid,
+                  const vossvolvox::OutputSettings& outputs) {
+  GridBuffer EXCgrid;
+  vossvolvox::AnalysisServer server(convert_options);
+  server.add_tool("volume", [&](const vossvolvox::ServerRequest& request,
+                                const XYZRBuffer& atoms,
+                                const std::string& label,
+                                vossvolvox::ServerReply& reply) {
+    const double request_probe = request.number("probe", probe);
+    const float spacing = static_cast<float>(request.number("grid", grid));
+    if (spacing <= 0 || request_probe < 0) {
+      reply.fail("\"grid\" must be positive and \"probe\" not negative");
+      return false;
+    }
+    const std::vector<const XYZRBuffer*> buffers = {&atoms};
+    const auto prepared = vossvolvox::prepare_grid_from_xyzr(
+        buffers, spacing, static_cast<float>(request_probe), label, false);
+    reply.progress("grid");
+    const VolumeResult result =
+        processGrid(prepared.context, request_probe, request.outputs(outputs), label, atoms,
+                    prepared.total_atoms, EXCgrid.zeroed(prepared.context), 0);
+    const long double gridvol = prepared.context.gridvol;
+    reply.field("probe", request_probe);
+    reply.field("grid", prepared.context.spacing);
+    reply.field("volume", static_cast<double>(result.voxels * gridvol));
+    reply.field("surf_area", static_cast<double>(result.surf));
+    reply.field("num_atoms", prepared.total_atoms);
+    return true;
+  });
+  return server.run(socket_path);
+}
 
+// Process the grid for volume and surface calculations; frame > 0 adds a
+// frame column to the result row
+VolumeResult processGrid(const GridContext& ctx,
+                         double probe,
+                         const vossvolvox::OutputSettings& outputs,
+                         const std::string& inputFile,
+                         const XYZRBuffer& xyzr_buffer,
+                         int numatoms,
+                         gridpt EXCgrid[],
+                         int frame) {
   // Populate the grid based on the probe radius
-  int voxels = get_ExcludeGrid_fromArray(numatoms, probe, xyzr_buffer, EXCgrid.get());
+  int voxels = get_ExcludeGrid_fromArray(ctx, numatoms, probe, xyzr_buffer, EXCgrid);
 
-  long double surf = surface_area(EXCgrid.get());
+  long double surf = surface_area(ctx, EXCgrid);
 
   std::cerr << "\nSummary of Results:\n"
             << "Probe Radius:       " << probe << " A\n";
-  report_grid_metrics(std::cerr, voxels, surf);
+  report_grid_metrics(ctx, std::cerr, voxels, surf);
   std::cerr << "Number of Atoms:    " << numatoms << "\n"
             << "Input File:         " << inputFile << "\n"
             << "\n";
 
-  write_output_files(EXCgrid.get(), outputs);
+  write_output_files(ctx, EXCgrid, outputs);
+
+  // Output results to `std::cout` (batch processing); printVolCout leaves
+  // cout in fixed notation, so restore it for the next frame's row
+  const auto cout_flags = std::cout.flags();
+  const auto cout_precision = std::cout.precision();
+  std::cout << probe << "\t" << ctx.spacing << "\t";
+  printVolCout(ctx, voxels);
+  std::cout << "\t" << surf << "\t" << numatoms;
+  if (frame > 0) {
+    std::cout << "\t" << frame << "\t" << inputFile;
+    std::cout << "\tprobe,grid,volume,surf_area,num_atoms,frame,file\n";
+  } else {
+    std::cout << "\t" << inputFile;
+    std::cout << "\tprobe,grid,volume,surf_area,num_atoms,file\n";
+  }
+  std::cout.flags(cout_flags);
+  std::cout.precision(cout_precision);
 
-  // Output results to `std::cout` (batch processing)
-  std::cout << probe << "\t" << GRID << "\t";
-  printVolCout(voxels);
-  std::cout << "\t" << surf << "\t" << numatoms << "\t" << inputFile;
-  std::cout << "\tprobe,grid,volume,surf_area,num_atoms,file\n";
+  VolumeResult result;
+  result.voxels = voxels;
+  result.surf = surf;
+  return result;
 }
@@ -6,9 +6,15 @@ from __future__ import annotations
 import argparse
 import gzip
 import hashlib
+import json
+import os
+import re
 import shutil
+import socket
+import struct
 import subprocess
 import sys
+import tempfile
 import textwrap
 import time
 import urllib.error
@@ -72,8 +78,12 @@ class TestFailureWithChecks(TestFailure):
         self.total = len(checks)
 
 
-def run(cmd: List[str], cwd: Path) -> subprocess.CompletedProcess:
+def run(cmd: List[str], cwd: Path, env: Dict[str, Any] | None = None) -> subprocess.CompletedProcess:
     """Run a command and capture stdout/stderr."""
+    run_env = None
+    if env:
+        run_env = dict(os.environ)
+        run_env.update({key: str(value) for key, value in env.items()})
     try:
         result = subprocess.run(
             cmd,
@@ -81,6 +91,7 @@ def run(cmd: List[str], cwd: Path) -> subprocess.CompletedProcess:
             capture_output=True,
             text=True,
             check=False,
+            env=run_env,
         )
     except FileNotFoundError as exc:  # pragma: no cover - defensive
         raise TestFailure(f"Command not found: {cmd[0]}") from exc
@@ -101,6 +112,79 @@ def run(cmd: List[str], cwd: Path) -> subprocess.CompletedProcess:
     return result
 
 
+def serve(
+    cmd: List[str], cwd: Path, spec: Dict[str, Any], env: Dict[str, Any] | None = None
+) -> subprocess.CompletedProcess:
+    """Run cmd with --serve, send each request, then shut it down.
+
+    The "row" of every result event becomes a stdout line and the message of
+    every error event an "error:" line after the server's own stderr, so the
+    usual summary and reference checks apply to served results.
+    """
+    run_env = None
+    if env:
+        run_env = dict(os.environ)
+        run_env.update({key: str(value) for key, value in env.items()})
+    # Unix socket paths are short, so keep the socket out of the work directory
+    socket_dir = Path(tempfile.mkdtemp(prefix="vv-e2e-"))
+    socket_path = socket_dir / "server.sock"
+    command = [*cmd, "--serve", str(socket_path)]
+    process = subprocess.Popen(
+        command,
+        cwd=str(cwd),
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+        env=run_env,
+    )
+    rows: List[str] = []
+    errors: List[str] = []
+    try:
+        deadline = time.monotonic() + 30
+        while not socket_path.exists():
+            if process.poll() is not None or time.monotonic() > deadline:
+                raise TestFailure(f"Server did not start: {' '.join(command)}")
+            time.sleep(0.05)
+        requests = [*spec.get("requests", []), {"tool": "shutdown"}]
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as client:
+            client.connect(str(socket_path))
+            stream = client.makefile("rw")
+            for request in requests:
+                line = request if isinstance(request, str) else json.dumps(request)
+                stream.write(line + "\n")
+                stream.flush()
+                while True:
+                    reply = stream.readline()
+                    if not reply:
+                        raise TestFailure(f"Server closed the connection on: {line}")
+                    event = json.loads(reply)
+                    if event.get("event") == "result":
+                        if "row" in event:
+                            rows.append(event["row"])
+                        elif event.get("tool") == "ping":
+                            rows.append(f"ping: {event.get('tools')}")
+                        break
+                    if event.get("event") == "error":
+                        errors.append(f"error: {event.get('message')}")
+                        break
+        stdout, stderr = process.communicate(timeout=60)
+    finally:
+        if process.poll() is None:
+            process.kill()
+            process.communicate()
+        shutil.rmtree(socket_dir, ignore_errors=True)
+    if process.returncode != 0:
+        raise TestFailure(
+            f"Server failed: {' '.join(command)}\nreturn code: {process.returncode}\nstderr:\n{stderr}"
+        )
+    return subprocess.CompletedProcess(
+        command,
+        process.returncode,
+        stdout + "".join(f"{row}\n" for row in rows),
+        stderr + "".join(f"{error}\n" for error in errors),
+    )
+
+
 def compare_float(label: str, expected: float, actual: float, tolerance: float = 1e-3) -> None:
     if abs(expected - actual) > tolerance:
         raise TestFailure(f"{label} mismatch: expected {expected}, got {actual}")
@@ -114,6 +198,15 @@ def count_lines(path: Path) -> int:
 def md5sum(path: Path) -> str:
     return hashlib.md5(path.read_bytes()).hexdigest()
 
+def map_mode(path: Path) -> int:
+    """MODE word of an MRC/CCP4 header; a .gz map is read through gzip."""
+    opener = gzip.open if path.suffix == ".gz" else open
+    with opener(path, "rb") as handle:
+        header = handle.read(16)
+    if len(header) < 16:
+        raise TestFailure(f"{path} is shorter than a map header")
+    return struct.unpack("<i", header[12:16])[0]
+
 def md5_hetatm(path: Path) -> str:
     digest = hashlib.md5()
     with path.open("r") as handle:
@@ -137,23 +230,59 @@ def sanitized_md5(path: Path) -> str:
     return digest.hexdigest()
 
 
-def extract_summary(output: str) -> Dict[str, float]:
-    summary = None
+def extract_summaries(output: str) -> List[Dict[str, float]]:
+    """Parse every summary line; batch and multi-frame runs print one per structure."""
+    summaries = []
     for line in output.splitlines():
-        if "probe,grid,volume" in line:
-            summary = line.strip()
-    if not summary:
+        if "probe,grid,volume" not in line:
+            continue
+        tokens = line.split()
+        if len(tokens) < 5:
+            raise TestFailure(f"Unexpected summary format: {line.strip()}")
+        summaries.append({
+            "probe": float(tokens[0]),
+            "grid": float(tokens[1]),
+            "volume": float(tokens[2]),
+            "surface": float(tokens[3]),
+            "atoms": float(tokens[4]),
+        })
+    if not summaries:
         raise TestFailure("Unable to locate summary line in program output.")
-    tokens = summary.split()
-    if len(tokens) < 5:
-        raise TestFailure(f"Unexpected summary format: {summary}")
-    return {
-        "probe": float(tokens[0]),
-        "grid": float(tokens[1]),
-        "volume": float(tokens[2]),
-        "surface": float(tokens[3]),
-        "atoms": float(tokens[4]),
-    }
+    return summaries
+
+
+def comparable_lines(result: subprocess.CompletedProcess, match: str | None) -> List[str]:
+    """Stdout lines, or the stdout and stderr lines matching a regex, without trailing blanks."""
+    if match is None:
+        lines = result.stdout.splitlines()
+    else:
+        pattern = re.compile(match)
+        lines = [line for line in (result.stdout + result.stderr).splitlines() if pattern.search(line)]
+    return [line.rstrip() for line in lines]
+
+
+def build_command(entry: Dict[str, Any], name: str) -> List[str]:
+    import shlex
+
+    program = entry.get("program")
+    if program:
+        program_path = BIN_DIR / program
+        if not program_path.exists():
+            raise TestFailure(f"{name}: program {program_path} not found. Build the binaries first.")
+        command = [str(program_path)]
+        for arg in entry.get("args", []):
+            command.extend(shlex.split(str(arg)))
+        return command
+    command_entries = entry.get("command")
+    if not isinstance(command_entries, list):
+        raise TestFailure(f"Test {name}: command must be a list.")
+    command = []
+    for arg in command_entries:
+        if isinstance(arg, list):
+            command.extend(arg)
+        else:
+            command.extend(shlex.split(str(arg)))
+    return command
 
 
 def resolve_path(base: Path, value: str) -> Path:
@@ -222,6 +351,41 @@ def convert_xyzr(pdb: Path, output: Path, filters: List[str], overwrite: bool =
     output.write_text(result.stdout)
 
 
+def write_models(pdb: Path, dest: Path, count: int) -> None:
+    """Repeat the atom records of pdb as count MODEL/ENDMDL blocks."""
+    records = [
+        line for line in pdb.read_text().splitlines(keepends=True)
+        if line.startswith(("ATOM", "HETATM", "TER"))
+    ]
+    with dest.open("w") as out:
+        for model in range(1, count + 1):
+            out.write(f"MODEL     {model:4d}\n")
+            out.writelines(records)
+            out.write("ENDMDL\n")
+        out.write("END\n")
+
+
+def write_dcd(xyzrb: Path, dest: Path, frames: int) -> None:
+    """Write a DCD trajectory of frames copies of the atoms of a binary XYZR file."""
+    data = xyzrb.read_bytes()
+    (atoms,) = struct.unpack_from("=Q", data, 16)
+    coords = [data[64 + axis * 4 * atoms:64 + (axis + 1) * 4 * atoms] for axis in range(3)]
+
+    def record(payload: bytes) -> bytes:
+        return struct.pack("=i", len(payload)) + payload + struct.pack("=i", len(payload))
+
+    # plain (non-CHARMM) header: no unit cell, no fixed atoms, no titles
+    icntrl = [0] * 20
+    icntrl[0] = frames
+    with dest.open("wb") as out:
+        out.write(record(b"CORD" + struct.pack("=20i", *icntrl)))
+        out.write(record(struct.pack("=i", 0)))
+        out.write(record(struct.pack("=i", atoms)))
+        for _ in range(frames):
+            for axis in coords:
+                out.write(record(axis))
+
+
 def handle_prerequisite(action: Dict[str, Any], workdir: Path) -> None:
     kind = action.get("action")
     if kind == "download_pdb":
@@ -236,10 +400,36 @@ def handle_prerequisite(action: Dict[str, Any], workdir: Path) -> None:
         convert_xyzr(pdb_path, output, filters, overwrite=overwrite)
     elif kind == "ensure_dir":
         ensure_dir(resolve_path(workdir, action.get("path", ".")))
+    elif kind == "write_file":
+        target = resolve_path(workdir, action["path"])
+        ensure_dir(target.parent)
+        target.write_text("".join(f"{line}\n" for line in action.get("lines", [])))
     elif kind == "remove":
         target = resolve_path(workdir, action["path"])
-        if target.exists():
+        if target.is_dir():
+            shutil.rmtree(target)
+        elif target.exists():
             target.unlink()
+    elif kind == "gzip":
+        source = resolve_path(workdir, action["path"])
+        target = resolve_path(workdir, action.get("dest", f"{action['path']}.gz"))
+        with source.open("rb") as stream, gzip.open(target, "wb") as out:
+            shutil.copyfileobj(stream, out)
+    elif kind == "models":
+        write_models(
+            resolve_path(workdir, action["path"]),
+            resolve_path(workdir, action["dest"]),
+            action.get("count", 2),
+        )
+    elif kind == "dcd":
+        write_dcd(
+            resolve_path(workdir, action["path"]),
+            resolve_path(workdir, action["dest"]),
+            action.get("frames", 2),
+        )
+    elif kind == "run":
+        # e.g. write an input in another format, or warm a cache
+        run(build_command(action, "run prerequisite"), cwd=workdir, env=action.get("env"))
     else:
         raise TestFailure(f"Unknown prerequisite action: {kind}")
 
@@ -253,30 +443,13 @@ def run_test(test: Dict[str, Any]) -> Tuple[float, int, int]:
     for prereq in test.get("prerequisites", []):
         handle_prerequisite(prereq, workdir)
 
-    program = test.get("program")
-    import shlex
-
-    if program:
-        program_path = BIN_DIR / program
-        if not program_path.exists():
-            raise TestFailure(f"{name}: program {program_path} not found. Build the binaries first.")
-        command = [str(program_path)]
-        args_entries = test.get("args", [])
-        for entry in args_entries:
-            command.extend(shlex.split(str(entry)))
-    else:
-        command_entries = test.get("command")
-        if not isinstance(command_entries, list):
-            raise TestFailure(f"Test {name}: command must be a list.")
-        command = []
-        for entry in command_entries:
-            if isinstance(entry, list):
-                command.extend(entry)
-            else:
-                command.extend(shlex.split(str(entry)))
+    command = build_command(test, name)
 
     start = time.perf_counter()
-    result = run(command, cwd=workdir)
+    if "serve" in test:
+        result = serve(command, workdir, test["serve"], env=test.get("env"))
+    else:
+        result = run(command, cwd=workdir, env=test.get("env"))
     duration = time.perf_counter() - start
     expect = test.get("expect", {})
     checks: List[Tuple[str, bool, str]] = []
@@ -288,16 +461,22 @@ def run_test(test: Dict[str, Any]) -> Tuple[float, int, int]:
         summary_expect = expect["summary"]
         tol = summary_expect.get("tolerance", 1e-3)
         try:
-            summary = extract_summary(result.stdout)
+            summaries = extract_summaries(result.stdout)
         except TestFailure as exc:
             record_check("summary", False, str(exc))
         else:
+            if "count" in summary_expect:
+                record_check(
+                    "summary_count",
+                    len(summaries) == summary_expect["count"],
+                    f"expected {summary_expect['count']} summary lines, found {len(summaries)}",
+                )
             for key in ("volume", "surface", "atoms"):
                 if key in summary_expect:
                     expected_value = summary_expect[key]
-                    actual_value = summary[key]
                     try:
-                        compare_float(key, expected_value, actual_value, tol)
+                        for summary in summaries:
+                            compare_float(key, expected_value, summary[key], tol)
                     except TestFailure as exc:
                         record_check(key, False, str(exc))
                     else:
@@ -349,14 +528,53 @@ def run_test(test: Dict[str, Any]) -> Tuple[float, int, int]:
                 else:
                     record_check("md5_sanitized", True)
 
+    map_expect = expect.get("map")
+    if map_expect:
+        map_path = resolve_path(workdir, map_expect["path"])
+        if not map_path.exists():
+            record_check("map_exists", False, f"expected output {map_path} is missing.")
+        else:
+            record_check("map_exists", True)
+            if "mode" in map_expect:
+                try:
+                    mode = map_mode(map_path)
+                except (OSError, TestFailure) as exc:
+                    record_check("map_mode", False, str(exc))
+                else:
+                    record_check(
+                        "map_mode",
+                        mode == map_expect["mode"],
+                        f"expected map mode {map_expect['mode']}, found {mode}",
+                    )
+
     if expect.get("stdout_contains"):
-        needle = expect["stdout_contains"]
+        needles = expect["stdout_contains"]
+        if isinstance(needles, str):
+            needles = [needles]
         combined = result.stdout + result.stderr
-        if needle not in combined:
-            record_check("stdout_contains", False, f"stdout missing expected text: {needle}")
+        missing = [needle for needle in needles if needle not in combined]
+        if missing:
+            record_check("stdout_contains", False, f"stdout missing expected text: {missing[0]}")
         else:
             record_check("stdout_contains", True)
 
+    reference = expect.get("reference")
+    if reference:
+        # the same results as another run, e.g. the default engine or one thread
+        reference_result = run(build_command(reference, name), cwd=workdir, env=reference.get("env"))
+        expected_lines = comparable_lines(reference_result, reference.get("match"))
+        actual_lines = comparable_lines(result, reference.get("match"))
+        if not expected_lines:
+            record_check("reference", False, "reference run printed no lines to compare")
+        elif actual_lines != expected_lines:
+            differing = next(
+                (pair for pair in zip(expected_lines, actual_lines) if pair[0] != pair[1]),
+                (f"{len(expected_lines)} lines", f"{len(actual_lines)} lines"),
+            )
+            record_check("reference", False, f"expected {differing[0]!r}, got {differing[1]!r}")
+        else:
+            record_check("reference", True)
+
     total = len(checks)
     passed = sum(1 for _, ok, _ in checks if ok)
     if passed != total:
@@ -394,12 +612,15 @@ def find_default_config() -> Path:
 def collect_required_binaries(tests: List[Dict[str, Any]]) -> List[Path]:
     required = set()
     for test in tests:
-        program = test.get("program")
-        if program:
-            required.add(BIN_DIR / program)
+        for entry in (test, test.get("expect", {}).get("reference") or {}):
+            program = entry.get("program")
+            if program:
+                required.add(BIN_DIR / program)
         for prereq in test.get("prerequisites", []):
             if prereq.get("action") == "convert_xyzr":
                 required.add(BIN_DIR / "pdb_to_xyzr.exe")
+            if prereq.get("action") == "run" and prereq.get("program"):
+                required.add(BIN_DIR / prereq["program"])
     return sorted(required)
 
 
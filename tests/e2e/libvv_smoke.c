@@ -0,0 +1,58 @@
+/*
+** libvv_smoke.c
+** Links libvossvolvox and prints the excluded volume of a structure in the
+** row format of Volume.exe, so the e2e suite can compare the two. It also
+** checks that a grid too fine for the structure is refused with VV_EINVAL
+** rather than crashing.
+**
+**   libvv_smoke <structure> <probe> <grid>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vossvolvox.h"
+
+int main(int argc, char** argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <structure> <probe> <grid>\n", argv[0]);
+    return 2;
+  }
+  const float probe = (float)atof(argv[2]);
+  const float grid = (float)atof(argv[3]);
+  if (vv_api_version() != VV_API_VERSION) {
+    fprintf(stderr, "library API version %d, header %d\n", vv_api_version(), VV_API_VERSION);
+    return 1;
+  }
+  vv_context* ctx = vv_context_create(grid);
+  if (ctx == NULL) {
+    fprintf(stderr, "unable to create a context with grid %s\n", argv[3]);
+    return 1;
+  }
+  int status = vv_load_structure(ctx, argv[1]);
+  if (status == VV_OK) {
+    status = vv_excluded(ctx, probe);
+  }
+  if (status != VV_OK) {
+    fprintf(stderr, "error %d: %s\n", status, vv_last_error(ctx));
+    vv_context_destroy(ctx);
+    return 1;
+  }
+  printf("%g\t%g\t%.3f\t\t%.3f\t%zu\t%s\tprobe,grid,volume,surf_area,num_atoms,file\n",
+         probe, grid, vv_volume(ctx), vv_surface_area(ctx), vv_atom_count(ctx), argv[1]);
+  vv_context_destroy(ctx);
+
+  /* more voxels than the grid code can index */
+  ctx = vv_context_create(0.001f);
+  status = vv_load_structure(ctx, argv[1]);
+  if (status == VV_OK) {
+    status = vv_excluded(ctx, probe);
+  }
+  if (status != VV_EINVAL || vv_volume(ctx) >= 0) {
+    fprintf(stderr, "grid 0.001: expected VV_EINVAL, got %d (%s)\n", status, vv_last_error(ctx));
+    vv_context_destroy(ctx);
+    return 1;
+  }
+  vv_context_destroy(ctx);
+  return 0;
+}